@@ -24,6 +24,12 @@
 extern "C" {
 #endif
 
+/**
+ * Default size in bytes of a connection's buffer for upload stream contents.
+ * See @ref html_set_write_buffer_size
+ */
+#define HTML_WRITE_BUFFER_SIZE (64 * 1024)
+
 /** @cond PRIVATE */
 struct html_mime_map_;
 struct html_connection_;
@@ -78,6 +84,10 @@ size_t HTML_API html_escape(char *dst, size_t dst_size, const char *src);
  * Connect to catui server with `com.gulachek.html-forms` protocol
  * @param[out] pcon Pointer to connection object pointer
  * @return 0 on failure, 1 on success
+ * @remark Version 0.2.0 of the protocol is requested so messages can be
+ * binary encoded. Servers that refuse it are connected to with 0.1.0, which
+ * encodes messages as JSON and sends each file as its own upload. Lazy
+ * uploads and upload acknowledgements fail on 0.1.0 connections.
  */
 int HTML_API html_connect(html_connection **pcon);
 
@@ -93,6 +103,8 @@ void HTML_API html_disconnect(html_connection *con);
  * @param[out] pcon Pointer to connection object pointer
  * @param[in] fd The fd associated with the previously bootstrapped connection
  * @remark This should only be used to create new connection objects
+ * @remark The protocol version isn't known, so the connection is used like
+ * a 0.1.0 connection (see @ref html_connect)
  */
 int HTML_API html_connection_transfer_fd(html_connection **pcon, int fd);
 
@@ -102,9 +114,24 @@ int HTML_API html_connection_transfer_fd(html_connection **pcon, int fd);
  * @return The fd the connection is associated with, otherwise -1
  * @remark This is useful for select loops. Manipulating the underlying file
  * stream results in undefined behavior.
+ * @remark Messages that arrive while waiting for the server, like for upload
+ * acknowledgements, are read off the fd and kept, so the fd won't become
+ * readable for them. Check @ref html_has_pending before blocking on the fd.
  */
 int HTML_API html_connection_fd(html_connection *con);
 
+/**
+ * Check whether messages were already received and are waiting to be read
+ * @param[in] con The connection
+ * @return 1 if a message can be read without waiting on the fd, 0 otherwise
+ * @remark Functions that wait for the server, like for upload
+ * acknowledgements, keep the messages that arrive meanwhile. Read them before
+ * waiting for the fd to be readable.
+ * @remark Kept messages are read by the function for their type, like @ref
+ * html_form_read for forms. Reading another type leaves them in place.
+ */
+int HTML_API html_has_pending(const html_connection *con);
+
 /**
  * Check to see if a close was requested on the connection
  * @param[in] con The connection
@@ -151,6 +178,9 @@ int HTML_API html_upload_stream_open(html_connection *con, const char *url);
  * @remark The caller cannot assume that the data will be sent to the server
  * with this call. The implementation may buffer the contents for efficiency and
  * sync when @ref html_upload_stream_close is called.
+ * @remark Writes are buffered up to the size set by @ref
+ * html_set_write_buffer_size. A write that doesn't fit is sent along with
+ * the buffered contents in a single system call.
  */
 int HTML_API html_upload_stream_write(html_connection *con, const void *data,
                                       size_t size);
@@ -162,6 +192,50 @@ int HTML_API html_upload_stream_write(html_connection *con, const void *data,
  */
 int HTML_API html_upload_stream_close(html_connection *con);
 
+/**
+ * Send upload stream contents that are buffered on the connection
+ * @param con The connection
+ * @return 1 on success, 0 otherwise
+ * @remark @ref html_upload_stream_close flushes, so this is only needed for
+ * the server to receive part of a stream before it's closed
+ */
+int HTML_API html_flush(html_connection *con);
+
+/**
+ * Set how many bytes of upload stream contents are buffered before they're
+ * sent. Buffered contents are flushed first.
+ * @param con The connection
+ * @param size The size of the buffer in bytes. 0 sends every write
+ * immediately. The default is @ref HTML_WRITE_BUFFER_SIZE.
+ * @return 1 on success, 0 otherwise
+ */
+int HTML_API html_set_write_buffer_size(html_connection *con, size_t size);
+
+/**
+ * Have the server acknowledge each upload once it's servable, and limit how
+ * many uploads can be sent before the server catches up. This lets many
+ * uploads be pipelined without the server falling arbitrarily far behind.
+ * @param con The connection
+ * @param window The most uploads that can be unacknowledged. Starting
+ * another waits for the oldest to be acknowledged. 0 means no limit.
+ * @return 1 on success, 0 otherwise
+ * @remark Each call to an upload function is one upload, including @ref
+ * html_upload_dir
+ * @remark Messages that arrive while waiting, like forms, are kept for
+ * later reads
+ * @remark This fails if the server's protocol version is older than 0.2.0
+ */
+int HTML_API html_set_upload_window(html_connection *con, size_t window);
+
+/**
+ * Wait until every upload is servable, like before navigating to a page
+ * that uses them
+ * @param con The connection
+ * @return 1 on success, 0 otherwise
+ * @remark Acknowledgements must be enabled with @ref html_set_upload_window
+ */
+int HTML_API html_upload_wait(html_connection *con);
+
 /**
  * Upload file to be accessible from URL
  * @param con The connection
@@ -173,6 +247,20 @@ int HTML_API html_upload_stream_close(html_connection *con);
 int HTML_API html_upload_file(html_connection *con, const char *url,
                               const char *file_path);
 
+/**
+ * Upload an open file to be accessible from URL. The server copies the
+ * file itself when it can receive the descriptor, which is nearly instant
+ * for large files on file systems that support clones. Otherwise its
+ * contents are sent over the connection.
+ * @param con The connection
+ * @param url The url that the file will be accessible from the browser
+ * @param fd An open, readable descriptor of a regular file. The whole file is
+ * uploaded regardless of its offset, which isn't changed. The caller still
+ * owns the descriptor.
+ * @return 1 on success, 0 otherwise
+ */
+int HTML_API html_upload_fd(html_connection *con, const char *url, int fd);
+
 /**
  * Recursively upload files to be accessible from URL
  * @param con The connection
@@ -197,6 +285,48 @@ int HTML_API html_upload_dir(html_connection *con, const char *url,
 int HTML_API html_upload_archive(html_connection *con, const char *url,
                                  const char *archive_path);
 
+/**
+ * Called when the server needs a URL under a lazy prefix to respond to a
+ * request. See @ref html_upload_lazy
+ * @param[in] con The connection
+ * @param[in] url The null terminated URL to upload
+ * @param[in] ctx The context given to @ref html_set_fetch_callback
+ * @return 1 if @a url was uploaded, 0 if it can't be. The server responds
+ * with 404 Not Found when it can't.
+ * @remark The callback must upload @a url with one of the upload functions,
+ * like @ref html_upload_file, before returning 1. It can't read messages.
+ */
+typedef int html_fetch_callback(html_connection *con, const char *url,
+                                void *ctx);
+
+/**
+ * Set the function that uploads lazy URLs when the server requests them
+ * @param[in] con The connection
+ * @param[in] cb The callback. A null pointer makes every fetch fail.
+ * @param[in] ctx A pointer passed to @a cb
+ * @return 1 on success, 0 otherwise
+ * @remark Fetch requests are handled while waiting for other messages, like
+ * in @ref html_form_read and @ref html_recv
+ */
+int HTML_API html_set_fetch_callback(html_connection *con,
+                                     html_fetch_callback *cb, void *ctx);
+
+/**
+ * Upload URLs that begin with a prefix only when the browser requests them.
+ * This lets applications with many rarely viewed resources start without
+ * uploading them all. Requested URLs that weren't already uploaded are passed
+ * to the callback set with @ref html_set_fetch_callback.
+ * @param[in] con The connection
+ * @param[in] url The URL prefix of the lazy resources, like "/docs/"
+ * @param[in] cache Nonzero to keep fetched uploads for later requests. When 0,
+ * every request for a URL that wasn't uploaded explicitly is fetched again.
+ * @return 1 on success, 0 otherwise
+ * @remark Registering the same prefix again replaces its @a cache setting
+ * @remark This fails if the server's protocol version is older than 0.2.0
+ */
+int HTML_API html_upload_lazy(html_connection *con, const char *url,
+                              int cache);
+
 /**
  * Create a mime map object
  * @return A pointer to a newly created mime map, or a NULL pointer on
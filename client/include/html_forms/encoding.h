@@ -52,12 +52,46 @@ extern "C" {
  */
 #define HTML_FORM_SIZE 4096
 
+/**
+ * Size of a null-terminated hex SHA-256 digest for communication
+ */
+#define HTML_DIGEST_SIZE 65
+
+/**
+ * Size in bytes of the little-endian size header of each chunk in an upload
+ * stream. Older clients used 2 byte headers, which limited chunks to 65535
+ * bytes.
+ */
+#define HTML_STREAM_CHUNK_HEADER_SIZE 4
+
+/**
+ * First byte of a binary encoded message. JSON encoded messages begin with
+ * '{', so decoders accept either encoding.
+ */
+#define HTML_BINARY_MAGIC 0xb1
+
+/**
+ * Ways to encode a message. The binary encoding follows @ref
+ * HTML_BINARY_MAGIC with the message type as a byte, then the payload's
+ * fields in the order they're declared. Integers are little-endian, where
+ * sizes take 8 bytes and other numbers and flags take 1 byte. Strings are
+ * a 2 byte length followed by that many bytes without a null terminator. A
+ * mime map is a 2 byte count of entries, each an extension and a MIME type.
+ */
+enum html_msg_encoding {
+  HTML_ENC_JSON = 0,   /**< JSON object, understood by every peer */
+  HTML_ENC_BINARY = 1, /**< Compact binary, since protocol version 0.2.0 */
+};
+
 /** Input message types */
 enum html_in_msg_type {
-  HTML_IMSG_FORM = 0,      /**< Form submission */
-  HTML_IMSG_APP_MSG = 1,   /**< Application-defined message */
-  HTML_IMSG_CLOSE_REQ = 2, /**< Request to close application */
-  HTML_IMSG_ERROR = 3,     /**< Server reported error */
+  HTML_IMSG_FORM = 0,          /**< Form submission */
+  HTML_IMSG_APP_MSG = 1,       /**< Application-defined message */
+  HTML_IMSG_CLOSE_REQ = 2,     /**< Request to close application */
+  HTML_IMSG_ERROR = 3,         /**< Server reported error */
+  HTML_IMSG_UPLOAD_NEEDED = 4, /**< Uploads missing from the server */
+  HTML_IMSG_FETCH = 5,         /**< Request to upload a lazy URL */
+  HTML_IMSG_UPLOAD_ACK = 6,    /**< An upload is servable */
 };
 
 /** Output message types */
@@ -68,6 +102,12 @@ enum html_out_msg_type {
   HTML_OMSG_MIME_MAP = 3,           /**< Map file extensions to MIME types */
   HTML_OMSG_CLOSE = 4,              /**< Close the connection */
   HTML_OMSG_ACCEPT_IO_TRANSFER = 5, /**< Accept an I/O transfer request */
+  HTML_OMSG_UPLOAD_MANIFEST = 6,    /**< List files the client can upload */
+  HTML_OMSG_UPLOAD_BATCH = 7,       /**< Upload many files at once */
+  HTML_OMSG_UPLOAD_FD = 8,          /**< Upload an open file descriptor */
+  HTML_OMSG_LAZY = 9,               /**< Upload URLs when they're requested */
+  HTML_OMSG_FETCH_FAILED = 10,      /**< A lazy URL can't be uploaded */
+  HTML_OMSG_ACK_UPLOADS = 11,       /**< Acknowledge each upload */
 };
 
 /** Resource types to be uploaded */
@@ -78,11 +118,13 @@ enum html_resource_type {
 
 /** Upload resources */
 struct html_omsg_upload {
-  size_t content_length;         /**< The file or archive size in bytes. A
-                                    content_length of indicates that the upload will be
-                                    transmitted in sized chunks. */
-  enum html_resource_type rtype; /**< The resource type */
-  char url[HTML_URL_SIZE];       /**< URL to point at the resource */
+  size_t content_length;          /**< The file or archive size in bytes. A
+                                     content_length of indicates that the upload will be
+                                     transmitted in sized chunks. */
+  enum html_resource_type rtype;  /**< The resource type */
+  char url[HTML_URL_SIZE];        /**< URL to point at the resource */
+  unsigned int chunk_header_size; /**< Size in bytes of each streamed
+                                     chunk's size header, 2 or 4 */
 };
 
 /** Navigate to a relative URL */
@@ -100,6 +142,60 @@ struct html_omsg_accept_io_transfer {
   char token[HTML_UUID_SIZE]; /**< Token associated with I/O transfer request */
 };
 
+/**
+ * Offer files to upload, so the server can say which it needs. Followed by
+ * a manifest of @a content_length bytes. See @ref html_encode_manifest
+ */
+struct html_omsg_upload_manifest {
+  size_t content_length; /**< @brief Size of the manifest in bytes */
+};
+
+/** A file offered in an upload manifest */
+struct html_manifest_entry {
+  char url[HTML_URL_SIZE];       /**< URL the file would be uploaded to */
+  size_t size;                   /**< Size of the file in bytes */
+  char sha256[HTML_DIGEST_SIZE]; /**< Lowercase hex SHA-256 of contents */
+};
+
+/**
+ * Upload many files in one message. Followed by an index of @a
+ * content_length bytes listing the files, then each file's contents in the
+ * order listed. See @ref html_encode_upload_batch
+ */
+struct html_omsg_upload_batch {
+  size_t content_length; /**< @brief Size of the index in bytes */
+};
+
+/**
+ * Upload a file by passing its open descriptor. Followed by a single byte
+ * carrying the descriptor as SCM_RIGHTS ancillary data, so the server can
+ * copy the file without its contents passing through the connection.
+ */
+struct html_omsg_upload_fd {
+  char url[HTML_URL_SIZE]; /**< URL to point at the file */
+};
+
+/**
+ * Upload URLs that begin with a prefix only when they're requested. When
+ * the browser requests one that hasn't been uploaded, the server sends an
+ * @ref html_imsg_fetch and waits for it to be uploaded.
+ */
+struct html_omsg_lazy {
+  char url[HTML_URL_SIZE]; /**< URL prefix of the lazy resources */
+  int cache; /**< Whether to keep fetched uploads for later requests */
+};
+
+/** Reply to a fetch request for a URL that can't be uploaded */
+struct html_omsg_fetch_failed {
+  char url[HTML_URL_SIZE]; /**< URL from the fetch request */
+};
+
+/** A file in an upload batch */
+struct html_batch_entry {
+  char url[HTML_URL_SIZE]; /**< URL to point at the file */
+  size_t size;             /**< Size of the file in bytes */
+};
+
 /**
  * Output message for use by server implementations
  */
@@ -114,6 +210,15 @@ struct html_out_msg {
         app_msg; /**< @brief The application-defined message payload */
     struct html_omsg_accept_io_transfer accept_io_transfer; /**< @brief The
                                             accept I/O transfer payload */
+    struct html_omsg_upload_manifest
+        upload_manifest; /**< @brief The upload manifest payload */
+    struct html_omsg_upload_batch
+        upload_batch; /**< @brief The upload batch payload */
+    struct html_omsg_upload_fd
+        upload_fd; /**< @brief The upload descriptor payload */
+    struct html_omsg_lazy lazy; /**< @brief The lazy prefix payload */
+    struct html_omsg_fetch_failed
+        fetch_failed; /**< @brief The failed fetch payload */
 
     /**
      * The message as a mime map
@@ -143,6 +248,25 @@ struct html_imsg_app_msg {
   size_t content_length;
 };
 
+/**
+ * Server replied to an upload manifest. Followed by a list of @a
+ * content_length bytes of the manifest entries to upload. See @ref
+ * html_decode_upload_needed
+ */
+struct html_imsg_upload_needed {
+  /** The size of the list in bytes */
+  size_t content_length;
+};
+
+/**
+ * Server needs a URL under a lazy prefix to be uploaded to respond to a
+ * request. See @ref html_omsg_lazy
+ */
+struct html_imsg_fetch {
+  /** The URL to upload */
+  char url[HTML_URL_SIZE];
+};
+
 /** Server reported fatal error */
 struct html_imsg_error {
   /** null-terminated message sent from server */
@@ -164,6 +288,10 @@ struct html_in_msg {
     struct html_imsg_app_msg app_msg;
     /** Fatal error reported by server */
     struct html_imsg_error error;
+    /** Reply to an upload manifest */
+    struct html_imsg_upload_needed upload_needed;
+    /** Request to upload a lazy URL */
+    struct html_imsg_fetch fetch;
   } msg;
 };
 
@@ -196,6 +324,44 @@ int HTML_API html_decode_out_msg(const void *data, size_t size,
 int HTML_API html_decode_in_msg(const void *data, size_t size,
                                 struct html_in_msg *msg);
 
+/**
+ * Find how a message was encoded
+ * @param[in] data Pointer to a buffer with an encoded message
+ * @param[in] size The size of the encoded message in bytes
+ * @return The encoding that @ref html_decode_out_msg or @ref
+ * html_decode_in_msg would decode the message with
+ */
+enum html_msg_encoding HTML_API html_msg_encoding_of(const void *data,
+                                                     size_t size);
+
+/**
+ * Encode an output message. This is useful for client library
+ * implementations.
+ * @param[in] data Pointer to buffer to hold encoded message
+ * @param[in] size The size of @a data's buffer in bytes
+ * @param[in] msg The message to encode
+ * @param[in] encoding How to encode the message. Only servers that accept
+ * protocol version 0.2.0 can decode @ref HTML_ENC_BINARY
+ * @return The size of the encoded message or -1 on failure
+ * @remark The binary encoding doesn't allocate memory
+ */
+int HTML_API html_encode_out_msg(void *data, size_t size,
+                                 const struct html_out_msg *msg,
+                                 enum html_msg_encoding encoding);
+
+/**
+ * Encode an input message. This is useful for server implementations.
+ * @param[in] data Pointer to buffer to hold encoded message
+ * @param[in] size The size of @a data's buffer in bytes
+ * @param[in] msg The message to encode
+ * @param[in] encoding How to encode the message. Only send @ref
+ * HTML_ENC_BINARY to clients that have sent binary encoded messages
+ * @return The size of the encoded message or -1 on failure
+ */
+int HTML_API html_encode_in_msg(void *data, size_t size,
+                                const struct html_in_msg *msg,
+                                enum html_msg_encoding encoding);
+
 /**
  * Encode an upload message
  * @param[in] data Pointer to buffer to hold encoded message
@@ -206,6 +372,8 @@ int HTML_API html_decode_in_msg(const void *data, size_t size,
  * 0 indicates that the upload will be streamed in sized chunks.
  * @param[in] type The type of resource being uploaded
  * @return The size of the encoded message or -1 on failure
+ * @remark Streamed chunks must have @ref HTML_STREAM_CHUNK_HEADER_SIZE byte
+ * size headers
  */
 int HTML_API html_encode_omsg_upload(void *data, size_t size, const char *url,
                                      size_t content_length,
@@ -261,6 +429,175 @@ int HTML_API html_encode_omsg_close(void *data, size_t size);
 int HTML_API html_encode_omsg_accept_io_transfer(void *data, size_t size,
                                                  const char *token);
 
+/**
+ * Encode a header to send an upload manifest
+ * @param[in] data Points to a buffer of size @a size bytes
+ * @param[in] size The size of the buffer pointed to by @a data
+ * @param[in] content_length The size in bytes of the encoded manifest that
+ * follows
+ * @return The size in bytes of the encoded message, -1 on failure
+ */
+int HTML_API html_encode_omsg_upload_manifest(void *data, size_t size,
+                                              size_t content_length);
+
+/**
+ * Encode the body of an upload manifest
+ * @param[in] entries The files offered for upload
+ * @param[in] n The number of entries
+ * @param[out] size The size in bytes of the encoded manifest
+ * @return The encoded manifest, or a null pointer on failure
+ * @remark The caller must free() the returned pointer
+ */
+char *HTML_API html_encode_manifest(const struct html_manifest_entry *entries,
+                                    size_t n, size_t *size);
+
+/**
+ * Decode the body of an upload manifest. This is useful for server
+ * implementations.
+ * @param[in] data Pointer to the encoded manifest
+ * @param[in] size The size in bytes of the encoded manifest
+ * @param[out] entries The decoded entries
+ * @param[out] n The number of decoded entries
+ * @return 1 on success, 0 on failure
+ * @remark The caller must free() @a entries on success
+ */
+int HTML_API html_decode_manifest(const void *data, size_t size,
+                                  struct html_manifest_entry **entries,
+                                  size_t *n);
+
+/**
+ * Encode a header to reply to an upload manifest. This is useful for server
+ * implementations.
+ * @param[in] data Points to a buffer of size @a size bytes
+ * @param[in] size The size of the buffer pointed to by @a data
+ * @param[in] content_length The size in bytes of the encoded list that
+ * follows
+ * @return The size in bytes of the encoded message, -1 on failure
+ */
+int HTML_API html_encode_imsg_upload_needed(void *data, size_t size,
+                                            size_t content_length);
+
+/**
+ * Encode the list of manifest entries the server needs uploaded. This is
+ * useful for server implementations.
+ * @param[in] indices Indices into the manifest's entries, in order
+ * @param[in] n The number of indices
+ * @param[out] size The size in bytes of the encoded list
+ * @return The encoded list, or a null pointer on failure
+ * @remark The caller must free() the returned pointer
+ */
+char *HTML_API html_encode_upload_needed(const size_t *indices, size_t n,
+                                         size_t *size);
+
+/**
+ * Decode the list of manifest entries the server needs uploaded
+ * @param[in] data Pointer to the encoded list
+ * @param[in] size The size in bytes of the encoded list
+ * @param[out] indices Indices into the manifest's entries
+ * @param[out] n The number of indices
+ * @return 1 on success, 0 on failure
+ * @remark The caller must free() @a indices on success
+ */
+int HTML_API html_decode_upload_needed(const void *data, size_t size,
+                                       size_t **indices, size_t *n);
+
+/**
+ * Encode a header to upload a batch of files
+ * @param[in] data Points to a buffer of size @a size bytes
+ * @param[in] size The size of the buffer pointed to by @a data
+ * @param[in] content_length The size in bytes of the encoded index that
+ * follows
+ * @return The size in bytes of the encoded message, -1 on failure
+ */
+int HTML_API html_encode_omsg_upload_batch(void *data, size_t size,
+                                           size_t content_length);
+
+/**
+ * Encode the index of an upload batch
+ * @param[in] entries The files in the batch, in the order they're sent
+ * @param[in] n The number of entries
+ * @param[out] size The size in bytes of the encoded index
+ * @return The encoded index, or a null pointer on failure
+ * @remark The caller must free() the returned pointer
+ */
+char *HTML_API html_encode_upload_batch(const struct html_batch_entry *entries,
+                                        size_t n, size_t *size);
+
+/**
+ * Decode the index of an upload batch. This is useful for server
+ * implementations.
+ * @param[in] data Pointer to the encoded index
+ * @param[in] size The size in bytes of the encoded index
+ * @param[out] entries The decoded entries
+ * @param[out] n The number of decoded entries
+ * @return 1 on success, 0 on failure
+ * @remark The caller must free() @a entries on success
+ */
+int HTML_API html_decode_upload_batch(const void *data, size_t size,
+                                      struct html_batch_entry **entries,
+                                      size_t *n);
+
+/**
+ * Encode a message to upload a file by passing its descriptor
+ * @param[in] data Points to a buffer of size @a size bytes
+ * @param[in] size The size of the buffer pointed to by @a data
+ * @param[in] url The URL that the browser can request that will point to the
+ * file
+ * @return The size in bytes of the encoded message, -1 on failure
+ */
+int HTML_API html_encode_omsg_upload_fd(void *data, size_t size,
+                                        const char *url);
+
+/**
+ * Encode a message to upload URLs under a prefix when they're requested
+ * @param[in] data Points to a buffer of size @a size bytes
+ * @param[in] size The size of the buffer pointed to by @a data
+ * @param[in] url The URL prefix of the lazy resources
+ * @param[in] cache Nonzero to keep fetched uploads for later requests
+ * @return The size in bytes of the encoded message, -1 on failure
+ */
+int HTML_API html_encode_omsg_lazy(void *data, size_t size, const char *url,
+                                   int cache);
+
+/**
+ * Encode a reply to a fetch request for a URL that can't be uploaded
+ * @param[in] data Points to a buffer of size @a size bytes
+ * @param[in] size The size of the buffer pointed to by @a data
+ * @param[in] url The URL from the fetch request
+ * @return The size in bytes of the encoded message, -1 on failure
+ */
+int HTML_API html_encode_omsg_fetch_failed(void *data, size_t size,
+                                           const char *url);
+
+/**
+ * Encode a request for the client to upload a lazy URL. This is useful for
+ * server implementations.
+ * @param[in] data Points to a buffer of size @a size bytes
+ * @param[in] size The size of the buffer pointed to by @a data
+ * @param[in] url The URL to upload
+ * @return The size in bytes of the encoded message, -1 on failure
+ */
+int HTML_API html_encode_imsg_fetch(void *data, size_t size, const char *url);
+
+/**
+ * Encode a request for the server to acknowledge each upload message once
+ * its contents are servable. Acknowledgements are sent in the order the
+ * uploads were sent. An upload batch is acknowledged once for all its files.
+ * @param[in] data Points to a buffer of size @a size bytes
+ * @param[in] size The size of the buffer pointed to by @a data
+ * @return The size in bytes of the encoded message, -1 on failure
+ */
+int HTML_API html_encode_omsg_ack_uploads(void *data, size_t size);
+
+/**
+ * Encode an acknowledgement that the oldest unacknowledged upload is
+ * servable. This is useful for server implementations.
+ * @param[in] data Points to a buffer of size @a size bytes
+ * @param[in] size The size of the buffer pointed to by @a data
+ * @return The size in bytes of the encoded message, -1 on failure
+ */
+int HTML_API html_encode_imsg_upload_ack(void *data, size_t size);
+
 /**
  * Encode a form submission. This is useful for server implementations.
  * @param[in] data Pointer to buffer to hold encoded message
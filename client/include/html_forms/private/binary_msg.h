@@ -0,0 +1,37 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#ifndef HTML_BINARY_MSG_H
+#define HTML_BINARY_MSG_H
+
+#include "html_forms/encoding.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int html_encode_binary_out_msg(void *data, size_t size,
+                               const struct html_out_msg *msg);
+
+int html_encode_binary_in_msg(void *data, size_t size,
+                              const struct html_in_msg *msg);
+
+/**
+ * Decode a message that begins with @ref HTML_BINARY_MAGIC
+ * @remark Only a mime map allocates memory
+ */
+int html_decode_binary_out_msg(const void *data, size_t size,
+                               struct html_out_msg *msg);
+
+int html_decode_binary_in_msg(const void *data, size_t size,
+                              struct html_in_msg *msg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -9,11 +9,50 @@
 #define HTML_CONNECTION_H
 
 #include "html_forms.h"
+#include "html_forms/encoding.h"
+
+#include <stdint.h>
+
+struct html_stashed_msg;
+
+// Protocol versions a connection can be negotiated to
+enum html_protocol_version {
+  HTML_PROTOCOL_0_1_0, // JSON messages and one file per upload
+  HTML_PROTOCOL_0_2_0, // binary messages, 4 byte chunk headers, manifests,
+                       // batches, descriptors, lazy URLs and acknowledgements
+};
 
 struct html_connection_ {
   int fd;
   int close_requested;
   char errbuf[512];
+
+  // the protocol version the server accepted, which decides which messages
+  // it understands and how they're encoded
+  enum html_protocol_version version;
+  enum html_msg_encoding encoding;
+
+  // upload stream contents not yet written to fd
+  uint8_t *wbuf;
+  size_t wbuf_len;
+  size_t wbuf_size;
+
+  // uploads lazy URLs the server requests
+  html_fetch_callback *fetch_cb;
+  void *fetch_ctx;
+
+  // uploads the server hasn't acknowledged, if it was asked to
+  int acks_enabled;
+  size_t upload_window;
+  size_t uploads_in_flight;
+
+  // messages received while waiting for acknowledgements, oldest first
+  struct html_stashed_msg *stash;
+
+  // unread body of the last message taken from the stash
+  uint8_t *body;
+  size_t body_off;
+  size_t body_len;
 };
 
 int printf_err(html_connection *con, const char *fmt, ...);
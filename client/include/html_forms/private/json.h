@@ -0,0 +1,123 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#ifndef HTML_JSON_H
+#define HTML_JSON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Prints JSON straight into a caller's buffer. Once anything doesn't fit,
+ * the rest is ignored and html_json_finish fails.
+ */
+struct html_json_writer {
+  char *data;
+  size_t size;
+  size_t n;
+  int ok;
+  int need_comma;
+};
+
+void html_json_init(struct html_json_writer *w, void *data, size_t size);
+
+void html_json_begin_object(struct html_json_writer *w);
+void html_json_end_object(struct html_json_writer *w);
+void html_json_begin_array(struct html_json_writer *w);
+void html_json_end_array(struct html_json_writer *w);
+
+/** Start an object member, whose value is written next */
+void html_json_key(struct html_json_writer *w, const char *key);
+
+void html_json_uint(struct html_json_writer *w, uint64_t val);
+void html_json_bool(struct html_json_writer *w, int val);
+
+/** Write a string, escaped like cJSON does. A null pointer fails. */
+void html_json_string(struct html_json_writer *w, const char *str);
+
+void html_json_add_uint(struct html_json_writer *w, const char *key,
+                        uint64_t val);
+void html_json_add_bool(struct html_json_writer *w, const char *key, int val);
+void html_json_add_string(struct html_json_writer *w, const char *key,
+                          const char *str);
+
+/**
+ * Null terminate the output
+ * @return The length of the output, or -1 if it didn't fit
+ */
+int html_json_finish(struct html_json_writer *w);
+
+enum html_json_kind {
+  HTML_JSON_MISSING = 0,
+  HTML_JSON_NULL,
+  HTML_JSON_FALSE,
+  HTML_JSON_TRUE,
+  HTML_JSON_NUMBER,
+  HTML_JSON_STRING,
+  HTML_JSON_ARRAY,
+  HTML_JSON_OBJECT,
+};
+
+/** A parsed value. Strings, arrays and objects span [begin, end). */
+struct html_json_value {
+  enum html_json_kind kind;
+  double number;
+  const char *begin;
+  const char *end;
+};
+
+/** An object member to look for while scanning */
+struct html_json_key {
+  const char *name;
+  int case_sensitive;
+};
+
+/**
+ * Parse an object in a single pass, recording the first member that
+ * matches each key. Member lookup follows cJSON_GetObjectItem, so keys are
+ * matched case-insensitively unless marked otherwise, and bytes after the
+ * object are ignored.
+ * @param[in] data The encoded object
+ * @param[in] size The size of the encoded object in bytes
+ * @param[in] keys The members to look for
+ * @param[in] nkeys The number of keys
+ * @param[out] values The value of each key's member, or HTML_JSON_MISSING
+ * @return 1 if data is a valid object, 0 otherwise
+ */
+int html_json_scan_object(const void *data, size_t size,
+                          const struct html_json_key *keys, size_t nkeys,
+                          struct html_json_value *values);
+
+/**
+ * Copy a string value up to its first null character, like a C string
+ * @return 1 if the value is a string that fits in out, 0 otherwise
+ */
+int html_json_copy_string(const struct html_json_value *val, char *out,
+                          size_t out_size);
+
+/** Iterates the elements of a scanned array */
+struct html_json_iter {
+  const char *p;
+  const char *end;
+};
+
+void html_json_iter_init(struct html_json_iter *it,
+                         const struct html_json_value *array);
+
+/** @return 1 if item holds the next element, 0 at the end of the array */
+int html_json_iter_next(struct html_json_iter *it,
+                        struct html_json_value *item);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
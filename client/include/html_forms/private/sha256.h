@@ -0,0 +1,51 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#ifndef HTML_SHA256_H
+#define HTML_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Size in bytes of a SHA-256 digest */
+#define HTML_SHA256_SIZE 32
+
+/** Size of a null-terminated lowercase hex SHA-256 digest */
+#define HTML_SHA256_HEX_SIZE 65
+
+struct html_sha256_ctx {
+  uint32_t state[8];
+  uint64_t nbits;
+  uint8_t block[64];
+  size_t block_len;
+};
+
+void html_sha256_init(struct html_sha256_ctx *ctx);
+
+void html_sha256_update(struct html_sha256_ctx *ctx, const void *data,
+                        size_t size);
+
+void html_sha256_final(struct html_sha256_ctx *ctx,
+                       uint8_t digest[HTML_SHA256_SIZE]);
+
+/**
+ * Format a digest as lowercase hex
+ * @param[in] digest The digest to format
+ * @param[out] hex Buffer to hold null-terminated hex string
+ */
+void html_sha256_hex(const uint8_t digest[HTML_SHA256_SIZE],
+                     char hex[HTML_SHA256_HEX_SIZE]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,370 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#include "html_forms/private/binary_msg.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/* See html_msg_encoding for the format */
+
+#define SIZE_FIELD 8
+#define BYTE_FIELD 1
+#define LEN_FIELD 2
+
+// Appends fields to a message, failing once they don't fit
+struct writer {
+  uint8_t *data;
+  size_t size;
+  size_t n;
+  int ok;
+};
+
+static void put_bytes(struct writer *w, const void *data, size_t n) {
+  if (!w->ok || w->size - w->n < n) {
+    w->ok = 0;
+    return;
+  }
+
+  memcpy(w->data + w->n, data, n);
+  w->n += n;
+}
+
+static void put_uint(struct writer *w, uint64_t val, size_t width) {
+  uint8_t buf[SIZE_FIELD];
+  for (size_t i = 0; i < width; ++i)
+    buf[i] = (uint8_t)(val >> (8 * i));
+
+  put_bytes(w, buf, width);
+}
+
+static void put_str(struct writer *w, const char *str) {
+  size_t len = strlen(str);
+  if (len > UINT16_MAX) {
+    w->ok = 0;
+    return;
+  }
+
+  put_uint(w, len, LEN_FIELD);
+  put_bytes(w, str, len);
+}
+
+static void put_header(struct writer *w, int type) {
+  put_uint(w, HTML_BINARY_MAGIC, BYTE_FIELD);
+  put_uint(w, type, BYTE_FIELD);
+}
+
+static int finish(const struct writer *w) {
+  if (!w->ok || w->n > INT32_MAX)
+    return -1;
+
+  return (int)w->n;
+}
+
+// Reads fields from a message, failing once they run past its end
+struct reader {
+  const uint8_t *data;
+  size_t size;
+  size_t n;
+  int ok;
+};
+
+static const uint8_t *get_bytes(struct reader *r, size_t n) {
+  if (!r->ok || r->size - r->n < n) {
+    r->ok = 0;
+    return NULL;
+  }
+
+  const uint8_t *p = r->data + r->n;
+  r->n += n;
+  return p;
+}
+
+static uint64_t get_uint(struct reader *r, size_t width) {
+  const uint8_t *p = get_bytes(r, width);
+  if (!p)
+    return 0;
+
+  uint64_t val = 0;
+  for (size_t i = 0; i < width; ++i)
+    val |= (uint64_t)p[i] << (8 * i);
+
+  return val;
+}
+
+static size_t get_size(struct reader *r) {
+  uint64_t val = get_uint(r, SIZE_FIELD);
+  if (val > SIZE_MAX)
+    r->ok = 0;
+
+  return (size_t)val;
+}
+
+// Only a 0 or 1 byte is a flag
+static int get_flag(struct reader *r) {
+  uint64_t val = get_uint(r, BYTE_FIELD);
+  if (val > 1)
+    r->ok = 0;
+
+  return (int)val;
+}
+
+// Copy a string with room for its null terminator, rejecting strings that
+// hold one since they'd be silently cut short
+static void get_str(struct reader *r, char *out, size_t out_size) {
+  size_t len = get_uint(r, LEN_FIELD);
+  const uint8_t *p = get_bytes(r, len);
+  if (!p)
+    return;
+
+  if (len >= out_size || memchr(p, '\0', len)) {
+    r->ok = 0;
+    return;
+  }
+
+  memcpy(out, p, len);
+  out[len] = '\0';
+}
+
+// The type of a message, or -1 if it isn't binary encoded
+static int get_header(struct reader *r) {
+  if (get_uint(r, BYTE_FIELD) != HTML_BINARY_MAGIC)
+    r->ok = 0;
+
+  int type = (int)get_uint(r, BYTE_FIELD);
+  return r->ok ? type : -1;
+}
+
+// Trailing bytes mean the message isn't what the type said it was
+static int done(const struct reader *r) { return r->ok && r->n == r->size; }
+
+static void put_mime_map(struct writer *w, const html_mime_map *mimes) {
+  size_t n = html_mime_map_size(mimes);
+  if (n > UINT16_MAX) {
+    w->ok = 0;
+    return;
+  }
+
+  put_uint(w, n, LEN_FIELD);
+  for (size_t i = 0; i < n; ++i) {
+    const char *ext, *mime;
+    if (!html_mime_map_entry_at(mimes, i, &ext, &mime)) {
+      w->ok = 0;
+      return;
+    }
+
+    put_str(w, ext);
+    put_str(w, mime);
+  }
+}
+
+static html_mime_map *get_mime_map(struct reader *r) {
+  size_t n = get_uint(r, LEN_FIELD);
+  if (!r->ok)
+    return NULL;
+
+  html_mime_map *mimes = html_mime_map_create();
+  if (!mimes)
+    return NULL;
+
+  for (size_t i = 0; i < n; ++i) {
+    char ext[HTML_MIME_SIZE], mime[HTML_MIME_SIZE + 1];
+    get_str(r, ext, sizeof(ext));
+    get_str(r, mime, sizeof(mime));
+
+    if (!(r->ok && html_mime_map_add(mimes, ext, mime))) {
+      html_mime_map_free(mimes);
+      return NULL;
+    }
+  }
+
+  return mimes;
+}
+
+int html_encode_binary_out_msg(void *data, size_t size,
+                               const struct html_out_msg *msg) {
+  struct writer w = {.data = data, .size = size, .n = 0, .ok = 1};
+  put_header(&w, msg->type);
+
+  switch (msg->type) {
+  case HTML_OMSG_UPLOAD:
+    put_uint(&w, msg->msg.upload.content_length, SIZE_FIELD);
+    put_uint(&w, msg->msg.upload.rtype, BYTE_FIELD);
+    put_str(&w, msg->msg.upload.url);
+    put_uint(&w, msg->msg.upload.chunk_header_size, BYTE_FIELD);
+    break;
+  case HTML_OMSG_NAVIGATE:
+    put_str(&w, msg->msg.navigate.url);
+    break;
+  case HTML_OMSG_APP_MSG:
+    put_uint(&w, msg->msg.app_msg.content_length, SIZE_FIELD);
+    break;
+  case HTML_OMSG_MIME_MAP:
+    put_mime_map(&w, msg->msg.mime);
+    break;
+  case HTML_OMSG_CLOSE:
+  case HTML_OMSG_ACK_UPLOADS:
+    break;
+  case HTML_OMSG_ACCEPT_IO_TRANSFER:
+    put_str(&w, msg->msg.accept_io_transfer.token);
+    break;
+  case HTML_OMSG_UPLOAD_MANIFEST:
+    put_uint(&w, msg->msg.upload_manifest.content_length, SIZE_FIELD);
+    break;
+  case HTML_OMSG_UPLOAD_BATCH:
+    put_uint(&w, msg->msg.upload_batch.content_length, SIZE_FIELD);
+    break;
+  case HTML_OMSG_UPLOAD_FD:
+    put_str(&w, msg->msg.upload_fd.url);
+    break;
+  case HTML_OMSG_LAZY:
+    put_str(&w, msg->msg.lazy.url);
+    put_uint(&w, msg->msg.lazy.cache ? 1 : 0, BYTE_FIELD);
+    break;
+  case HTML_OMSG_FETCH_FAILED:
+    put_str(&w, msg->msg.fetch_failed.url);
+    break;
+  default:
+    return -1;
+  }
+
+  return finish(&w);
+}
+
+int html_decode_binary_out_msg(const void *data, size_t size,
+                               struct html_out_msg *msg) {
+  struct reader r = {.data = data, .size = size, .n = 0, .ok = 1};
+  int type = get_header(&r);
+
+  switch (type) {
+  case HTML_OMSG_UPLOAD: {
+    struct html_omsg_upload *upload = &msg->msg.upload;
+    upload->content_length = get_size(&r);
+
+    uint64_t rtype = get_uint(&r, BYTE_FIELD);
+    if (rtype > HTML_RT_ARCHIVE)
+      return 0;
+
+    upload->rtype = (enum html_resource_type)rtype;
+    get_str(&r, upload->url, sizeof(upload->url));
+
+    upload->chunk_header_size = get_uint(&r, BYTE_FIELD);
+    if (!(upload->chunk_header_size == 2 || upload->chunk_header_size == 4))
+      return 0;
+    break;
+  }
+  case HTML_OMSG_NAVIGATE:
+    get_str(&r, msg->msg.navigate.url, sizeof(msg->msg.navigate.url));
+    break;
+  case HTML_OMSG_APP_MSG:
+    msg->msg.app_msg.content_length = get_size(&r);
+    break;
+  case HTML_OMSG_MIME_MAP:
+    if (!(msg->msg.mime = get_mime_map(&r)))
+      return 0;
+
+    if (!done(&r)) {
+      html_mime_map_free(msg->msg.mime);
+      msg->msg.mime = NULL;
+      return 0;
+    }
+    break;
+  case HTML_OMSG_CLOSE:
+  case HTML_OMSG_ACK_UPLOADS:
+    break;
+  case HTML_OMSG_ACCEPT_IO_TRANSFER:
+    get_str(&r, msg->msg.accept_io_transfer.token,
+            sizeof(msg->msg.accept_io_transfer.token));
+    break;
+  case HTML_OMSG_UPLOAD_MANIFEST:
+    msg->msg.upload_manifest.content_length = get_size(&r);
+    break;
+  case HTML_OMSG_UPLOAD_BATCH:
+    msg->msg.upload_batch.content_length = get_size(&r);
+    break;
+  case HTML_OMSG_UPLOAD_FD:
+    get_str(&r, msg->msg.upload_fd.url, sizeof(msg->msg.upload_fd.url));
+    break;
+  case HTML_OMSG_LAZY:
+    get_str(&r, msg->msg.lazy.url, sizeof(msg->msg.lazy.url));
+    msg->msg.lazy.cache = get_flag(&r);
+    break;
+  case HTML_OMSG_FETCH_FAILED:
+    get_str(&r, msg->msg.fetch_failed.url, sizeof(msg->msg.fetch_failed.url));
+    break;
+  default:
+    return 0;
+  }
+
+  msg->type = (enum html_out_msg_type)type;
+  return done(&r);
+}
+
+int html_encode_binary_in_msg(void *data, size_t size,
+                              const struct html_in_msg *msg) {
+  struct writer w = {.data = data, .size = size, .n = 0, .ok = 1};
+  put_header(&w, msg->type);
+
+  switch (msg->type) {
+  case HTML_IMSG_FORM:
+    put_uint(&w, msg->msg.form.content_length, SIZE_FIELD);
+    put_str(&w, msg->msg.form.mime_type);
+    break;
+  case HTML_IMSG_APP_MSG:
+    put_uint(&w, msg->msg.app_msg.content_length, SIZE_FIELD);
+    break;
+  case HTML_IMSG_CLOSE_REQ:
+  case HTML_IMSG_UPLOAD_ACK:
+    break;
+  case HTML_IMSG_ERROR:
+    put_str(&w, msg->msg.error.msg);
+    break;
+  case HTML_IMSG_UPLOAD_NEEDED:
+    put_uint(&w, msg->msg.upload_needed.content_length, SIZE_FIELD);
+    break;
+  case HTML_IMSG_FETCH:
+    put_str(&w, msg->msg.fetch.url);
+    break;
+  default:
+    return -1;
+  }
+
+  return finish(&w);
+}
+
+int html_decode_binary_in_msg(const void *data, size_t size,
+                              struct html_in_msg *msg) {
+  struct reader r = {.data = data, .size = size, .n = 0, .ok = 1};
+  int type = get_header(&r);
+
+  switch (type) {
+  case HTML_IMSG_FORM:
+    msg->msg.form.content_length = get_size(&r);
+    get_str(&r, msg->msg.form.mime_type, sizeof(msg->msg.form.mime_type));
+    break;
+  case HTML_IMSG_APP_MSG:
+    msg->msg.app_msg.content_length = get_size(&r);
+    break;
+  case HTML_IMSG_CLOSE_REQ:
+  case HTML_IMSG_UPLOAD_ACK:
+    break;
+  case HTML_IMSG_ERROR:
+    get_str(&r, msg->msg.error.msg, sizeof(msg->msg.error.msg));
+    break;
+  case HTML_IMSG_UPLOAD_NEEDED:
+    msg->msg.upload_needed.content_length = get_size(&r);
+    break;
+  case HTML_IMSG_FETCH:
+    get_str(&r, msg->msg.fetch.url, sizeof(msg->msg.fetch.url));
+    break;
+  default:
+    return 0;
+  }
+
+  msg->type = (enum html_in_msg_type)type;
+  return done(&r);
+}
@@ -7,7 +7,10 @@
  */
 #include "html_forms.h"
 #include "html_forms/encoding.h"
+#include "html_forms/private/binary_msg.h"
 #include "html_forms/private/html_connection.h"
+#include "html_forms/private/json.h"
+#include "html_forms/private/sha256.h"
 #include <msgstream.h>
 
 #include <catui.h>
@@ -18,11 +21,18 @@
 #include <string.h>
 
 #include <dirent.h>
+#include <fcntl.h>
 #include <sys/dirent.h>
 #include <sys/errno.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
 /*
  * https://www.php.net/manual/en/function.htmlspecialchars.php
  *
@@ -114,41 +124,59 @@ static html_connection *html_connection_alloc() {
 
   con->close_requested = 0;
   con->fd = -1;
+  con->wbuf = NULL;
+  con->wbuf_len = 0;
+  con->wbuf_size = HTML_WRITE_BUFFER_SIZE;
+  con->fetch_cb = NULL;
+  con->fetch_ctx = NULL;
+  con->acks_enabled = 0;
+  con->upload_window = 0;
+  con->uploads_in_flight = 0;
+  con->stash = NULL;
+  con->body = NULL;
+  con->body_off = con->body_len = 0;
+  con->version = HTML_PROTOCOL_0_1_0;
+  con->encoding = HTML_ENC_JSON;
   return con;
 }
 
-int html_connect(html_connection **pcon) {
-  if (!pcon)
-    goto fail;
-
-  html_connection *con = *pcon = html_connection_alloc();
-  if (!con)
-    goto fail;
-
+// Connect with a protocol version, recording why the server refused it
+static int connect_version(html_connection *con, const char *version) {
   FILE *f = tmpfile();
   if (!f) {
     printf_err(con, "Failed to create tmpfile for catui");
-    goto fail;
+    return 0;
   }
 
-  con->fd = catui_connect("com.gulachek.html-forms", "0.1.0", f);
+  con->fd = catui_connect("com.gulachek.html-forms", version, f);
   if (con->fd == -1) {
-
     fflush(f);
     rewind(f);
     char buf[sizeof(con->errbuf)];
     size_t nread = fread(buf, 1, sizeof(buf), f);
     printf_err(con, "Failed to create catui connection: %*s", nread, buf);
-    goto fail;
   }
 
   fclose(f);
-  return 1;
+  return con->fd != -1;
+}
 
-fail:
-  if (f)
-    fclose(f);
-  return 0;
+int html_connect(html_connection **pcon) {
+  if (!pcon)
+    return 0;
+
+  html_connection *con = *pcon = html_connection_alloc();
+  if (!con)
+    return 0;
+
+  // servers that only accept 0.1.0 decode JSON messages
+  if (connect_version(con, "0.2.0")) {
+    con->version = HTML_PROTOCOL_0_2_0;
+    con->encoding = HTML_ENC_BINARY;
+    return 1;
+  }
+
+  return connect_version(con, "0.1.0");
 }
 
 int html_connection_transfer_fd(html_connection **pcon, int fd) {
@@ -159,21 +187,45 @@ int html_connection_transfer_fd(html_connection **pcon, int fd) {
   if (!con)
     return 0;
 
+  // the version isn't known, so only what 0.1.0 supports is used
   con->fd = fd;
   return 1;
 }
 
+// A message received while waiting for an upload acknowledgement
+struct html_stashed_msg {
+  struct html_in_msg msg;
+  uint8_t *body;
+  size_t body_len;
+  struct html_stashed_msg *next;
+};
+
+static void free_stash(html_connection *con) {
+  while (con->stash) {
+    struct html_stashed_msg *next = con->stash->next;
+    free(con->stash->body);
+    free(con->stash);
+    con->stash = next;
+  }
+}
+
 void html_disconnect(html_connection *con) {
   if (!con)
     return;
 
+  html_flush(con);
+
+  struct html_out_msg msg = {.type = HTML_OMSG_CLOSE};
   uint8_t buf[HTML_MSG_SIZE];
-  int n = html_encode_omsg_close(buf, sizeof(buf));
+  int n = html_encode_out_msg(buf, sizeof(buf), &msg, con->encoding);
   if (n >= 0) {
     msgstream_fd_send(con->fd, buf, sizeof(buf), n);
   }
 
   close(con->fd);
+  free(con->wbuf);
+  free(con->body);
+  free_stash(con);
   free(con);
 }
 
@@ -185,6 +237,12 @@ int html_connection_fd(html_connection *con) {
   return con->fd;
 }
 
+int html_has_pending(const html_connection *con) {
+  if (!con)
+    return 0;
+  return con->stash != NULL;
+}
+
 int html_close_requested(const html_connection *con) {
   if (!con)
     return 0;
@@ -204,180 +262,308 @@ const char *html_errmsg(html_connection *con) {
   return con->errbuf;
 }
 
-int html_encode_omsg_upload(void *data, size_t size, const char *url,
-                            size_t content_length,
-                            enum html_resource_type type) {
+static int encode_omsg_upload(void *data, size_t size, const char *url,
+                              size_t content_length,
+                              enum html_resource_type type,
+                              unsigned int chunk_header_size) {
   // url: string
   // size?: number (missing means stream sized-chunks)
   // resType: number
+  // chunkHeader?: number (size of stream chunk headers, missing means 2)
 
-  cJSON *obj = cJSON_CreateObject();
-  if (!obj)
-    return -1;
+  struct html_json_writer w;
+  html_json_init(&w, data, size);
+  html_json_begin_object(&w);
+  html_json_add_uint(&w, "type", HTML_OMSG_UPLOAD);
 
-  if (!cJSON_AddNumberToObject(obj, "type", HTML_OMSG_UPLOAD))
-    return -1;
+  if (content_length > 0)
+    html_json_add_uint(&w, "size", content_length);
+  else if (chunk_header_size != 2) // 0.1.0 servers don't know the key
+    html_json_add_uint(&w, "chunkHeader", chunk_header_size);
 
-  if (content_length > 0) {
-    if (!cJSON_AddNumberToObject(obj, "size", content_length))
-      return -1;
-  }
+  html_json_add_string(&w, "url", url);
+  html_json_add_uint(&w, "resType", type);
+  html_json_end_object(&w);
+  return html_json_finish(&w);
+}
 
-  if (!cJSON_AddStringToObject(obj, "url", url))
-    return -1;
+int html_encode_omsg_upload(void *data, size_t size, const char *url,
+                            size_t content_length,
+                            enum html_resource_type type) {
+  return encode_omsg_upload(data, size, url, content_length, type,
+                            HTML_STREAM_CHUNK_HEADER_SIZE);
+}
 
-  if (!cJSON_AddNumberToObject(obj, "resType", type)) {
-    return -1;
+static int read_msg_type(html_connection *con, struct html_in_msg *msg,
+                         int msg_type);
+static int recv_reply(html_connection *con, struct html_in_msg *msg,
+                      int msg_type);
+static int read_body(html_connection *con, size_t n, void *data);
+static int readn(html_connection *con, size_t n, void *data);
+static int writen(html_connection *con, size_t n, const void *data);
+static int begin_upload(html_connection *con);
+
+// Copy a string into a message, failing if it wouldn't fit when decoded
+static int copy_field(html_connection *con, char *dst, size_t dst_size,
+                      const char *src) {
+  if (!src) {
+    printf_err(con, "null string arg");
+    return 0;
   }
 
-  if (!cJSON_PrintPreallocated(obj, data, size, 0))
-    return -1;
+  if (strlcpy(dst, src, dst_size) >= dst_size) {
+    printf_err(con, "'%s' is longer than a message allows (%lu bytes)", src,
+               dst_size - 1);
+    return 0;
+  }
 
-  cJSON_Delete(obj);
-  return strlen(data);
+  return 1;
 }
 
-static int html_send_upload(html_connection *con, const char *url,
-                            const char *file_path,
-                            enum html_resource_type type) {
+static int encode_out_msg(html_connection *con, void *data, size_t size,
+                          const struct html_out_msg *msg) {
+  return html_encode_out_msg(data, size, msg, con->encoding);
+}
 
-  if (!con)
-    return 0;
+// Fail unless the server's protocol version supports a feature
+static int require_version(html_connection *con,
+                           enum html_protocol_version version,
+                           const char *feature) {
+  if (con->version >= version)
+    return 1;
 
-  int fd = con->fd;
+  printf_err(con, "The server's protocol version doesn't support %s",
+             feature);
+  return 0;
+}
 
-  struct stat stats;
-  if (stat(file_path, &stats) == -1) {
-    printf_err(con, "stat('%s'): %s", file_path, strerror(errno));
-    return 0;
-  }
+// 0.1.0 servers read 2 byte chunk headers
+static unsigned int chunk_header_size(const html_connection *con) {
+  return con->version >= HTML_PROTOCOL_0_2_0 ? HTML_STREAM_CHUNK_HEADER_SIZE
+                                             : 2;
+}
 
-  char buf[HTML_MSG_SIZE];
-  int n = html_encode_omsg_upload(buf, sizeof(buf), url, stats.st_size, type);
-  if (n < 0) {
-    printf_err(con, "Failed to serialize message (likely memory issue)");
-    return 0;
-  }
+// Files are copied through a buffer of this size when the kernel can't
+// send them directly
+#define FILE_COPY_BUFFER_SIZE (64 * 1024)
 
-  int ec = msgstream_fd_send(fd, buf, sizeof(buf), n);
-  if (ec) {
-    printf_err(con, "Failed to send message: %s", msgstream_errstr(ec));
-    return 0;
-  }
+// Have the kernel write part of a file to the connection without a copy
+// to userspace. Returns the number of bytes written, or -1 with errno set.
+static ssize_t sendfile_some(html_connection *con, int fd, off_t offset,
+                             size_t count) {
+#if defined(__linux__)
+  return sendfile(con->fd, fd, &offset, count);
+#elif defined(__APPLE__)
+  off_t len = count;
+  // partial writes are reported through len even on failure
+  if (sendfile(fd, con->fd, offset, &len, NULL, 0) == -1 && len == 0)
+    return -1;
 
-  FILE *f = fopen(file_path, "r");
-  if (!f) {
-    printf_err(con, "fopen('%s'): %s", file_path, strerror(errno));
+  return len;
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+// Whether sendfile failed because it doesn't support these descriptors
+static int sendfile_unsupported(int err) {
+  return err == EINVAL || err == ENOSYS || err == ENOTSOCK ||
+         err == ENOTSUP || err == EOPNOTSUPP;
+}
+
+static int copy_file_contents(html_connection *con, int fd, off_t offset,
+                              size_t size, const char *file_path) {
+  void *buf = malloc(FILE_COPY_BUFFER_SIZE);
+  if (!buf) {
+    printf_err(con, "Failed to allocate file copy buffer");
     return 0;
   }
 
-  size_t nleft = stats.st_size;
+  int ret = 0;
+  size_t nleft = size;
   while (nleft) {
-    size_t n_to_read = HTML_MSG_SIZE < nleft ? HTML_MSG_SIZE : nleft;
-    size_t nread = fread(buf, 1, n_to_read, f);
-    if (nread == 0) {
+    size_t n_to_read =
+        FILE_COPY_BUFFER_SIZE < nleft ? FILE_COPY_BUFFER_SIZE : nleft;
+    ssize_t nread = pread(fd, buf, n_to_read, offset);
+    if (nread < 1) {
       printf_err(con, "Read fewer bytes than expected on '%s': %s", file_path,
-                 strerror(errno));
-      return 0;
+                 nread ? strerror(errno) : "end of file");
+      goto done;
     }
 
+    if (!writen(con, nread, buf))
+      goto done;
+
+    offset += nread;
     nleft -= nread;
+  }
+
+  ret = 1;
+
+done:
+  free(buf);
+  return ret;
+}
+
+// Write exactly size bytes of an open file to the connection
+static int send_fd_contents(html_connection *con, int fd, size_t size,
+                            const char *file_path) {
+  off_t offset = 0;
+  size_t nleft = size;
+  while (nleft) {
+    size_t count = nleft < (1 << 30) ? nleft : (1 << 30);
+    ssize_t n = sendfile_some(con, fd, offset, count);
+    if (n == -1 && errno == EINTR)
+      continue;
+
+    // the rest is copied through a buffer
+    if (n == -1 && sendfile_unsupported(errno))
+      break;
 
-    if (write(fd, buf, nread) == -1) {
-      printf_err(con, "Failed to write file contents to connection: %s",
-                 strerror(errno));
+    if (n < 1) {
+      printf_err(con, "Failed to send '%s': %s", file_path,
+                 n ? strerror(errno) : "file is shorter than expected");
       return 0;
     }
+
+    offset += n;
+    nleft -= n;
   }
 
-  return 1;
+  return !nleft || copy_file_contents(con, fd, offset, nleft, file_path);
 }
 
-int html_upload_stream_open(html_connection *con, const char *url) {
-  if (!con)
+// Write exactly size bytes of a file to the connection
+static int send_file_contents(html_connection *con, const char *file_path,
+                              size_t size) {
+  int fd = open(file_path, O_RDONLY);
+  if (fd == -1) {
+    printf_err(con, "open('%s'): %s", file_path, strerror(errno));
     return 0;
+  }
 
-  char buf[HTML_MSG_SIZE];
-  int n = html_encode_omsg_upload(buf, sizeof(buf), url, 0, HTML_RT_FILE);
+  int ret = send_fd_contents(con, fd, size, file_path);
+  close(fd);
+  return ret;
+}
+
+// Upload an open file by sending its contents over the connection
+static int html_send_upload_fd(html_connection *con, const char *url, int fd,
+                               const char *file_path,
+                               enum html_resource_type type) {
+  struct stat stats;
+  if (fstat(fd, &stats) == -1) {
+    printf_err(con, "fstat('%s'): %s", file_path, strerror(errno));
+    return 0;
+  }
 
+  struct html_out_msg msg = {.type = HTML_OMSG_UPLOAD};
+  msg.msg.upload.content_length = stats.st_size;
+  msg.msg.upload.rtype = type;
+  msg.msg.upload.chunk_header_size = chunk_header_size(con);
+  if (!copy_field(con, msg.msg.upload.url, sizeof(msg.msg.upload.url), url))
+    return 0;
+
+  char buf[HTML_MSG_SIZE];
+  int n = encode_out_msg(con, buf, sizeof(buf), &msg);
   if (n < 0) {
     printf_err(con, "Failed to serialize message (likely memory issue)");
     return 0;
   }
 
+  if (!begin_upload(con))
+    return 0;
+
   int ec = msgstream_fd_send(con->fd, buf, sizeof(buf), n);
   if (ec) {
     printf_err(con, "Failed to send message: %s", msgstream_errstr(ec));
     return 0;
   }
 
-  return 1;
-}
-
-typedef uint8_t le16_buf[2];
+  // a size of 0 opens a stream, which is ended right away
+  if (stats.st_size == 0)
+    return html_upload_stream_close(con);
 
-static int le_encode(size_t n, le16_buf buf) {
-  if (n > 0xffff)
-    return 0;
-
-  buf[0] = n % 0x100;
-  n /= 0x100;
-  buf[1] = n % 0x100;
-  return 1;
+  return send_fd_contents(con, fd, stats.st_size, file_path);
 }
 
-static int le_decode(const le16_buf buf, size_t *n) {
-  *n = buf[0] + (0x100 * buf[1]);
-  return 1;
-}
+static int html_send_upload(html_connection *con, const char *url,
+                            const char *file_path,
+                            enum html_resource_type type) {
 
-int html_upload_stream_write(html_connection *con, const void *data,
-                             size_t size) {
-  le16_buf chunk_size;
-  if (!le_encode(size, chunk_size)) {
-    printf_err(con, "Failed to encode chunk size header");
+  if (!con)
     return 0;
-  }
 
-  int ret = write(con->fd, chunk_size, sizeof(chunk_size));
-  if (ret == -1) {
-    printf_err(con, "Failed to write chunk size: %s", strerror(errno));
+  int fd = open(file_path, O_RDONLY);
+  if (fd == -1) {
+    printf_err(con, "open('%s'): %s", file_path, strerror(errno));
     return 0;
   }
 
-  ret = write(con->fd, data, size);
-  if (ret == -1) {
-    printf_err(con, "Failed to write chunk: %s", strerror(errno));
+  int ret = html_send_upload_fd(con, url, fd, file_path, type);
+  close(fd);
+  return ret;
+}
+
+// Descriptors can only be passed over Unix sockets
+static int can_pass_fds(html_connection *con) {
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+  if (getsockname(con->fd, (struct sockaddr *)&addr, &len) == -1)
     return 0;
-  }
 
-  return 1;
+  return addr.ss_family == AF_UNIX;
 }
 
-int html_upload_stream_close(html_connection *con) {
-  // no current need to flush since unbuffered right now
-  uint16_t zero = 0;
-  int ret = write(con->fd, &zero, 2);
-  if (ret == -1) {
-    printf_err(con, "Failed to close stream: %s", strerror(errno));
+// Attach a descriptor to a single byte
+static int send_fd(html_connection *con, int fd) {
+  char byte = 0;
+  struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+
+  union {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } control;
+  memset(&control, 0, sizeof(control));
+
+  struct msghdr msg = {0};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+  ssize_t n;
+  while ((n = sendmsg(con->fd, &msg, 0)) == -1 && errno == EINTR)
+    ;
+
+  if (n != 1) {
+    printf_err(con, "Failed to pass file descriptor: %s", strerror(errno));
     return 0;
   }
 
   return 1;
 }
 
-int html_upload_file(html_connection *con, const char *url,
-                     const char *file_path) {
-  return html_send_upload(con, url, file_path, HTML_RT_FILE);
-}
+int html_encode_omsg_upload_fd(void *data, size_t size, const char *url) {
+  // url: string
 
-int html_upload_archive(html_connection *con, const char *url,
-                        const char *archive_path) {
-  return html_send_upload(con, url, archive_path, HTML_RT_ARCHIVE);
+  struct html_json_writer w;
+  html_json_init(&w, data, size);
+  html_json_begin_object(&w);
+  html_json_add_uint(&w, "type", HTML_OMSG_UPLOAD_FD);
+  html_json_add_string(&w, "url", url);
+  html_json_end_object(&w);
+  return html_json_finish(&w);
 }
 
-int html_upload_dir(html_connection *con, const char *url,
-                    const char *dir_path) {
+int html_upload_fd(html_connection *con, const char *url, int fd) {
   if (!con)
     return 0;
 
@@ -386,92 +572,389 @@ int html_upload_dir(html_connection *con, const char *url,
     return 0;
   }
 
-  if (!dir_path) {
-    printf_err(con, "null dir_path arg");
+  struct stat stats;
+  if (fstat(fd, &stats) == -1) {
+    printf_err(con, "fstat(%d): %s", fd, strerror(errno));
     return 0;
   }
 
-  DIR *dir = opendir(dir_path);
-  if (!dir) {
-    printf_err(con, "opendir('%s'): %s", dir_path, strerror(errno));
+  if (!S_ISREG(stats.st_mode)) {
+    printf_err(con, "Only regular files can be uploaded by descriptor");
     return 0;
   }
 
-  char sub_path[PATH_MAX];
-  char sub_url[HTML_URL_SIZE];
-#define PN sizeof(sub_path)
-#define UN sizeof(sub_url)
+  // 0.1.0 servers can't receive descriptors
+  if (con->version < HTML_PROTOCOL_0_2_0 || !can_pass_fds(con))
+    return html_send_upload_fd(con, url, fd, url, HTML_RT_FILE);
 
-  size_t base_path_len = strlcpy(sub_path, dir_path, PN);
-  if (base_path_len >= PN) {
-    printf_err(con, "Failed to copy dir path %s", dir_path);
+  struct html_out_msg msg = {.type = HTML_OMSG_UPLOAD_FD};
+  if (!copy_field(con, msg.msg.upload_fd.url, sizeof(msg.msg.upload_fd.url),
+                  url))
+    return 0;
+
+  char buf[HTML_MSG_SIZE];
+  int n = encode_out_msg(con, buf, sizeof(buf), &msg);
+  if (n < 0) {
+    printf_err(con, "Failed to serialize message (likely memory issue)");
     return 0;
   }
 
-  if (sub_path[base_path_len - 1] != '/') {
-    base_path_len = strlcat(sub_path, "/", PN);
-    if (base_path_len >= PN) {
-      printf_err(con, "Failed to append '/' to %s", sub_path);
-      return 0;
-    }
+  if (!begin_upload(con))
+    return 0;
+
+  int ec = msgstream_fd_send(con->fd, buf, sizeof(buf), n);
+  if (ec) {
+    printf_err(con, "Failed to send message: %s", msgstream_errstr(ec));
+    return 0;
   }
 
-  size_t base_url_len = strlcpy(sub_url, url, UN);
-  if (base_url_len >= UN) {
-    printf_err(con, "Failed to copy url %s", url);
+  return send_fd(con, fd);
+}
+
+int html_upload_stream_open(html_connection *con, const char *url) {
+  if (!con)
+    return 0;
+
+  struct html_out_msg msg = {.type = HTML_OMSG_UPLOAD};
+  msg.msg.upload.content_length = 0;
+  msg.msg.upload.rtype = HTML_RT_FILE;
+  msg.msg.upload.chunk_header_size = chunk_header_size(con);
+  if (!copy_field(con, msg.msg.upload.url, sizeof(msg.msg.upload.url), url))
+    return 0;
+
+  char buf[HTML_MSG_SIZE];
+  int n = encode_out_msg(con, buf, sizeof(buf), &msg);
+
+  if (n < 0) {
+    printf_err(con, "Failed to serialize message (likely memory issue)");
     return 0;
   }
 
-  if (sub_url[base_url_len - 1] != '/') {
-    base_url_len = strlcat(sub_url, "/", UN);
-    if (base_url_len >= UN) {
-      printf_err(con, "Failed to append '/' to %s", sub_url);
-      return 0;
-    }
+  if (!begin_upload(con))
+    return 0;
+
+  int ec = msgstream_fd_send(con->fd, buf, sizeof(buf), n);
+  if (ec) {
+    printf_err(con, "Failed to send message: %s", msgstream_errstr(ec));
+    return 0;
   }
 
-  struct dirent *entry;
-  while ((entry = readdir(dir))) {
-    // only interested in regular files and dirs
-    switch (entry->d_type) {
-    case DT_REG:
-    case DT_DIR:
-      break;
-    default:
-      continue;
-    }
+  return 1;
+}
 
-    if (entry->d_namlen < 1)
-      continue;
+typedef uint8_t le32_buf[HTML_STREAM_CHUNK_HEADER_SIZE];
 
-    // ignore hidden files
-    if (entry->d_name[0] == '.')
-      continue;
+static void le_encode(uint32_t n, le32_buf buf) {
+  for (int i = 0; i < HTML_STREAM_CHUNK_HEADER_SIZE; ++i) {
+    buf[i] = n % 0x100;
+    n /= 0x100;
+  }
+}
 
-    if (base_path_len + entry->d_namlen + 1 > PN) {
-      printf_err(con, "No space to concatenate '%*s' to path '%s'",
-                 entry->d_namlen, entry->d_name, sub_path);
-      goto fail;
+// Write every iovec, continuing after partial writes
+static int writev_all(html_connection *con, struct iovec *iov, int iovcnt) {
+  while (iovcnt > 0) {
+    ssize_t ret = writev(con->fd, iov, iovcnt);
+    if (ret < 1) {
+      printf_err(con, "writev() failed: %s", strerror(errno));
+      return 0;
     }
 
-    memcpy(sub_path + base_path_len, entry->d_name, entry->d_namlen);
-    sub_path[base_path_len + entry->d_namlen] = '\0';
+    size_t n = ret;
+    while (iovcnt > 0 && n >= iov->iov_len) {
+      n -= iov->iov_len;
+      ++iov;
+      --iovcnt;
+    }
 
-    if (base_url_len + entry->d_namlen + 1 > UN) {
-      printf_err(con, "No space to concatenate '%*s' to url '%s'",
-                 entry->d_namlen, entry->d_name, sub_url);
-      goto fail;
+    if (iovcnt > 0) {
+      iov->iov_base = (uint8_t *)iov->iov_base + n;
+      iov->iov_len -= n;
     }
+  }
 
-    memcpy(sub_url + base_url_len, entry->d_name, entry->d_namlen);
-    sub_url[base_url_len + entry->d_namlen] = '\0';
+  return 1;
+}
 
-    if (entry->d_type == DT_REG) {
-      if (!html_upload_file(con, sub_url, sub_path)) {
+// Append a chunk to the write buffer. If it doesn't fit, the buffer and
+// the chunk are sent together.
+static int buffered_write_chunk(html_connection *con, const le32_buf header,
+                                const void *data, size_t size) {
+  size_t header_size = chunk_header_size(con);
+  size_t chunk_size = header_size + size;
+
+  if (con->wbuf_size - con->wbuf_len >= chunk_size) {
+    if (!con->wbuf && !(con->wbuf = malloc(con->wbuf_size))) {
+      printf_err(con, "Failed to allocate %lu byte write buffer",
+                 con->wbuf_size);
+      return 0;
+    }
+
+    uint8_t *end = con->wbuf + con->wbuf_len;
+    memcpy(end, header, header_size);
+    if (size)
+      memcpy(end + header_size, data, size);
+    con->wbuf_len += chunk_size;
+    return 1;
+  }
+
+  struct iovec iov[3] = {
+      {.iov_base = con->wbuf, .iov_len = con->wbuf_len},
+      {.iov_base = (void *)header, .iov_len = header_size},
+      {.iov_base = (void *)data, .iov_len = size},
+  };
+
+  con->wbuf_len = 0;
+  return writev_all(con, iov, 3);
+}
+
+int html_flush(html_connection *con) {
+  if (!con)
+    return 0;
+
+  if (con->wbuf_len == 0)
+    return 1;
+
+  struct iovec iov = {.iov_base = con->wbuf, .iov_len = con->wbuf_len};
+  con->wbuf_len = 0;
+  return writev_all(con, &iov, 1);
+}
+
+int html_set_write_buffer_size(html_connection *con, size_t size) {
+  if (!html_flush(con))
+    return 0;
+
+  free(con->wbuf);
+  con->wbuf = NULL;
+  con->wbuf_size = size;
+  return 1;
+}
+
+int html_upload_stream_write(html_connection *con, const void *data,
+                             size_t size) {
+  const uint8_t *bytes = data;
+  uint32_t max_chunk = chunk_header_size(con) == 2 ? UINT16_MAX : UINT32_MAX;
+
+  // an empty chunk would end the stream
+  while (size > 0) {
+    uint32_t n = size > max_chunk ? max_chunk : (uint32_t)size;
+
+    le32_buf chunk_size;
+    le_encode(n, chunk_size);
+
+    if (!buffered_write_chunk(con, chunk_size, bytes, n))
+      return 0;
+
+    bytes += n;
+    size -= n;
+  }
+
+  return 1;
+}
+
+int html_upload_stream_close(html_connection *con) {
+  le32_buf zero = {0};
+  return buffered_write_chunk(con, zero, NULL, 0) && html_flush(con);
+}
+
+int html_upload_file(html_connection *con, const char *url,
+                     const char *file_path) {
+  if (!con)
+    return 0;
+
+  int fd = open(file_path, O_RDONLY);
+  if (fd == -1) {
+    printf_err(con, "open('%s'): %s", file_path, strerror(errno));
+    return 0;
+  }
+
+  int ret = html_upload_fd(con, url, fd);
+  close(fd);
+  return ret;
+}
+
+int html_upload_archive(html_connection *con, const char *url,
+                        const char *archive_path) {
+  return html_send_upload(con, url, archive_path, HTML_RT_ARCHIVE);
+}
+
+// Files found in a directory to be uploaded
+struct upload_list {
+  struct html_manifest_entry *entries;
+  char **paths;
+  size_t n;
+  size_t cap;
+};
+
+static void upload_list_free(struct upload_list *list) {
+  for (size_t i = 0; i < list->n; ++i)
+    free(list->paths[i]);
+
+  free(list->paths);
+  free(list->entries);
+}
+
+static int hash_file(html_connection *con, const char *file_path,
+                     char hex[HTML_DIGEST_SIZE]) {
+  FILE *f = fopen(file_path, "r");
+  if (!f) {
+    printf_err(con, "fopen('%s'): %s", file_path, strerror(errno));
+    return 0;
+  }
+
+  struct html_sha256_ctx ctx;
+  html_sha256_init(&ctx);
+
+  char buf[8192];
+  size_t nread;
+  while ((nread = fread(buf, 1, sizeof(buf), f)) > 0)
+    html_sha256_update(&ctx, buf, nread);
+
+  int err = ferror(f);
+  fclose(f);
+  if (err) {
+    printf_err(con, "Failed to read '%s'", file_path);
+    return 0;
+  }
+
+  uint8_t digest[HTML_SHA256_SIZE];
+  html_sha256_final(&ctx, digest);
+  html_sha256_hex(digest, hex);
+  return 1;
+}
+
+static int upload_list_push(html_connection *con, struct upload_list *list,
+                            const char *url, const char *file_path,
+                            int hash) {
+  if (list->n == list->cap) {
+    size_t cap = list->cap ? 2 * list->cap : 16;
+    struct html_manifest_entry *entries =
+        realloc(list->entries, cap * sizeof(*entries));
+    if (!entries) {
+      printf_err(con, "Failed to allocate upload manifest");
+      return 0;
+    }
+    list->entries = entries;
+
+    char **paths = realloc(list->paths, cap * sizeof(*paths));
+    if (!paths) {
+      printf_err(con, "Failed to allocate upload manifest");
+      return 0;
+    }
+    list->paths = paths;
+    list->cap = cap;
+  }
+
+  struct html_manifest_entry *entry = &list->entries[list->n];
+  if (strlcpy(entry->url, url, sizeof(entry->url)) >= sizeof(entry->url)) {
+    printf_err(con, "URL too long: %s", url);
+    return 0;
+  }
+
+  struct stat stats;
+  if (stat(file_path, &stats) == -1) {
+    printf_err(con, "stat('%s'): %s", file_path, strerror(errno));
+    return 0;
+  }
+  entry->size = stats.st_size;
+
+  if (hash && !hash_file(con, file_path, entry->sha256))
+    return 0;
+
+  if (!(list->paths[list->n] = strdup(file_path))) {
+    printf_err(con, "Failed to allocate upload path");
+    return 0;
+  }
+
+  ++list->n;
+  return 1;
+}
+
+// Recursively list the files in a directory with their hashes
+static int collect_dir(html_connection *con, const char *url,
+                       const char *dir_path, int hash,
+                       struct upload_list *list) {
+  DIR *dir = opendir(dir_path);
+  if (!dir) {
+    printf_err(con, "opendir('%s'): %s", dir_path, strerror(errno));
+    return 0;
+  }
+
+  char sub_path[PATH_MAX];
+  char sub_url[HTML_URL_SIZE];
+#define PN sizeof(sub_path)
+#define UN sizeof(sub_url)
+
+  size_t base_path_len = strlcpy(sub_path, dir_path, PN);
+  if (base_path_len >= PN) {
+    printf_err(con, "Failed to copy dir path %s", dir_path);
+    return 0;
+  }
+
+  if (sub_path[base_path_len - 1] != '/') {
+    base_path_len = strlcat(sub_path, "/", PN);
+    if (base_path_len >= PN) {
+      printf_err(con, "Failed to append '/' to %s", sub_path);
+      return 0;
+    }
+  }
+
+  size_t base_url_len = strlcpy(sub_url, url, UN);
+  if (base_url_len >= UN) {
+    printf_err(con, "Failed to copy url %s", url);
+    return 0;
+  }
+
+  if (sub_url[base_url_len - 1] != '/') {
+    base_url_len = strlcat(sub_url, "/", UN);
+    if (base_url_len >= UN) {
+      printf_err(con, "Failed to append '/' to %s", sub_url);
+      return 0;
+    }
+  }
+
+  struct dirent *entry;
+  while ((entry = readdir(dir))) {
+    // only interested in regular files and dirs
+    switch (entry->d_type) {
+    case DT_REG:
+    case DT_DIR:
+      break;
+    default:
+      continue;
+    }
+
+    if (entry->d_namlen < 1)
+      continue;
+
+    // ignore hidden files
+    if (entry->d_name[0] == '.')
+      continue;
+
+    if (base_path_len + entry->d_namlen + 1 > PN) {
+      printf_err(con, "No space to concatenate '%*s' to path '%s'",
+                 entry->d_namlen, entry->d_name, sub_path);
+      goto fail;
+    }
+
+    memcpy(sub_path + base_path_len, entry->d_name, entry->d_namlen);
+    sub_path[base_path_len + entry->d_namlen] = '\0';
+
+    if (base_url_len + entry->d_namlen + 1 > UN) {
+      printf_err(con, "No space to concatenate '%*s' to url '%s'",
+                 entry->d_namlen, entry->d_name, sub_url);
+      goto fail;
+    }
+
+    memcpy(sub_url + base_url_len, entry->d_name, entry->d_namlen);
+    sub_url[base_url_len + entry->d_namlen] = '\0';
+
+    if (entry->d_type == DT_REG) {
+      if (!upload_list_push(con, list, sub_url, sub_path, hash)) {
         goto fail;
       }
     } else if (entry->d_type == DT_DIR) {
-      if (!html_upload_dir(con, sub_url, sub_path)) {
+      if (!collect_dir(con, sub_url, sub_path, hash, list)) {
         goto fail;
       }
     }
@@ -488,67 +971,510 @@ fail:
   return 0;
 }
 
-int html_encode_omsg_navigate(void *data, size_t size, const char *url) {
+// Offer the files to the server and find out which it doesn't have yet
+static int negotiate_uploads(html_connection *con,
+                             const struct upload_list *list, size_t **needed,
+                             size_t *nneeded) {
+  size_t manifest_size;
+  char *manifest = html_encode_manifest(list->entries, list->n, &manifest_size);
+  if (!manifest) {
+    printf_err(con, "Failed to encode upload manifest");
+    return 0;
+  }
+
+  struct html_out_msg omsg = {.type = HTML_OMSG_UPLOAD_MANIFEST};
+  omsg.msg.upload_manifest.content_length = manifest_size;
+
+  char buf[HTML_MSG_SIZE];
+  int n = encode_out_msg(con, buf, sizeof(buf), &omsg);
+  if (n < 0) {
+    printf_err(con, "Failed to serialize message (likely memory issue)");
+    free(manifest);
+    return 0;
+  }
+
+  int ec = msgstream_fd_send(con->fd, buf, sizeof(buf), n);
+  if (ec) {
+    printf_err(con, "Failed to send message: %s", msgstream_errstr(ec));
+    free(manifest);
+    return 0;
+  }
+
+  int ok = writen(con, manifest_size, manifest);
+  free(manifest);
+  if (!ok)
+    return 0;
+
+  // forms and other messages that arrive first are kept for later reads
+  struct html_in_msg msg;
+  if (!recv_reply(con, &msg, HTML_IMSG_UPLOAD_NEEDED))
+    return 0;
+
+  size_t list_size = msg.msg.upload_needed.content_length;
+  char *body = malloc(list_size ? list_size : 1);
+  if (!body) {
+    printf_err(con, "Failed to allocate %lu bytes for needed uploads",
+               list_size);
+    return 0;
+  }
+
+  ok = read_body(con, list_size, body) &&
+       html_decode_upload_needed(body, list_size, needed, nneeded);
+  free(body);
+
+  if (!ok)
+    printf_err(con, "Failed to read needed uploads");
+
+  return ok;
+}
+
+// Send the needed files in one message instead of one upload apiece
+static int send_upload_batch(html_connection *con,
+                             const struct upload_list *list,
+                             const size_t *needed, size_t nneeded) {
+  int ret = 0;
+  char *index = NULL;
+
+  struct html_batch_entry *entries =
+      calloc(nneeded ? nneeded : 1, sizeof(*entries));
+  if (!entries) {
+    printf_err(con, "Failed to allocate upload batch");
+    return 0;
+  }
+
+  for (size_t i = 0; i < nneeded; ++i) {
+    size_t j = needed[i];
+    if (j >= list->n) {
+      printf_err(con, "Server needs unknown upload %lu", j);
+      goto done;
+    }
+
+    memcpy(entries[i].url, list->entries[j].url, sizeof(entries[i].url));
+    entries[i].size = list->entries[j].size;
+  }
+
+  size_t index_size;
+  if (!(index = html_encode_upload_batch(entries, nneeded, &index_size))) {
+    printf_err(con, "Failed to encode upload batch");
+    goto done;
+  }
+
+  struct html_out_msg msg = {.type = HTML_OMSG_UPLOAD_BATCH};
+  msg.msg.upload_batch.content_length = index_size;
+
+  char buf[HTML_MSG_SIZE];
+  int n = encode_out_msg(con, buf, sizeof(buf), &msg);
+  if (n < 0) {
+    printf_err(con, "Failed to serialize message (likely memory issue)");
+    goto done;
+  }
+
+  if (!begin_upload(con))
+    goto done;
+
+  int ec = msgstream_fd_send(con->fd, buf, sizeof(buf), n);
+  if (ec) {
+    printf_err(con, "Failed to send message: %s", msgstream_errstr(ec));
+    goto done;
+  }
+
+  if (!writen(con, index_size, index))
+    goto done;
+
+  // the sizes were sent, so a file that changed since can't be recovered
+  for (size_t i = 0; i < nneeded; ++i) {
+    if (!send_file_contents(con, list->paths[needed[i]], entries[i].size))
+      goto done;
+  }
+
+  ret = 1;
+
+done:
+  free(index);
+  free(entries);
+  return ret;
+}
+
+int html_upload_dir(html_connection *con, const char *url,
+                    const char *dir_path) {
+  if (!con)
+    return 0;
+
+  if (!url) {
+    printf_err(con, "null url arg");
+    return 0;
+  }
+
+  if (!dir_path) {
+    printf_err(con, "null dir_path arg");
+    return 0;
+  }
+
+  struct upload_list list = {0};
+  size_t *needed = NULL, nneeded = 0;
+  int ret = 0;
+
+  // the hashes are only needed for the manifest
+  int hash = con->version >= HTML_PROTOCOL_0_2_0;
+  if (!collect_dir(con, url, dir_path, hash, &list))
+    goto done;
+
+  if (list.n == 0) {
+    ret = 1;
+    goto done;
+  }
+
+  // 0.1.0 servers take the files one upload at a time
+  if (con->version < HTML_PROTOCOL_0_2_0) {
+    for (size_t i = 0; i < list.n; ++i) {
+      if (!html_send_upload(con, list.entries[i].url, list.paths[i],
+                            HTML_RT_FILE))
+        goto done;
+    }
+
+    ret = 1;
+    goto done;
+  }
+
+  // only files the server doesn't already have are sent
+  if (!negotiate_uploads(con, &list, &needed, &nneeded))
+    goto done;
+
+  if (nneeded > 0 && !send_upload_batch(con, &list, needed, nneeded))
+    goto done;
+
+  ret = 1;
+
+done:
+  free(needed);
+  upload_list_free(&list);
+  return ret;
+}
+
+int html_encode_omsg_lazy(void *data, size_t size, const char *url,
+                          int cache) {
   // url: string
+  // cache: bool
 
-  cJSON *obj = cJSON_CreateObject();
-  if (!obj)
-    return -1;
+  struct html_json_writer w;
+  html_json_init(&w, data, size);
+  html_json_begin_object(&w);
+  html_json_add_uint(&w, "type", HTML_OMSG_LAZY);
+  html_json_add_string(&w, "url", url);
+  html_json_add_bool(&w, "cache", cache);
+  html_json_end_object(&w);
+  return html_json_finish(&w);
+}
 
-  if (!cJSON_AddNumberToObject(obj, "type", HTML_OMSG_NAVIGATE))
-    return -1;
+int html_encode_omsg_fetch_failed(void *data, size_t size, const char *url) {
+  // url: string
 
-  if (!cJSON_AddStringToObject(obj, "url", url))
-    return -1;
+  struct html_json_writer w;
+  html_json_init(&w, data, size);
+  html_json_begin_object(&w);
+  html_json_add_uint(&w, "type", HTML_OMSG_FETCH_FAILED);
+  html_json_add_string(&w, "url", url);
+  html_json_end_object(&w);
+  return html_json_finish(&w);
+}
 
-  if (!cJSON_PrintPreallocated(obj, data, size, 0))
-    return -1;
+int html_encode_omsg_ack_uploads(void *data, size_t size) {
+  struct html_json_writer w;
+  html_json_init(&w, data, size);
+  html_json_begin_object(&w);
+  html_json_add_uint(&w, "type", HTML_OMSG_ACK_UPLOADS);
+  html_json_end_object(&w);
+  return html_json_finish(&w);
+}
+
+int html_set_upload_window(html_connection *con, size_t window) {
+  if (!con)
+    return 0;
+
+  if (!require_version(con, HTML_PROTOCOL_0_2_0, "upload acknowledgements"))
+    return 0;
 
-  cJSON_Delete(obj);
-  return strlen(data);
+  if (!con->acks_enabled) {
+    struct html_out_msg msg = {.type = HTML_OMSG_ACK_UPLOADS};
+    char buf[HTML_MSG_SIZE];
+    int n = encode_out_msg(con, buf, sizeof(buf), &msg);
+    if (n < 0) {
+      printf_err(con, "Failed to serialize message (likely memory issue)");
+      return 0;
+    }
+
+    int ec = msgstream_fd_send(con->fd, buf, sizeof(buf), n);
+    if (ec) {
+      printf_err(con, "Failed to send message: %s", msgstream_errstr(ec));
+      return 0;
+    }
+
+    con->acks_enabled = 1;
+  }
+
+  con->upload_window = window;
+  return 1;
 }
 
-int html_encode_omsg_close(void *data, size_t size) {
-  cJSON *obj = cJSON_CreateObject();
-  if (!obj)
-    return -1;
+int html_set_fetch_callback(html_connection *con, html_fetch_callback *cb,
+                            void *ctx) {
+  if (!con)
+    return 0;
 
-  if (!cJSON_AddNumberToObject(obj, "type", HTML_OMSG_CLOSE))
-    return -1;
+  con->fetch_cb = cb;
+  con->fetch_ctx = ctx;
+  return 1;
+}
 
-  if (!cJSON_PrintPreallocated(obj, data, size, 0))
-    return -1;
+int html_upload_lazy(html_connection *con, const char *url, int cache) {
+  if (!con)
+    return 0;
+
+  if (!url) {
+    printf_err(con, "null url arg");
+    return 0;
+  }
+
+  if (!require_version(con, HTML_PROTOCOL_0_2_0, "lazy uploads"))
+    return 0;
+
+  struct html_out_msg msg = {.type = HTML_OMSG_LAZY};
+  msg.msg.lazy.cache = cache;
+  if (!copy_field(con, msg.msg.lazy.url, sizeof(msg.msg.lazy.url), url))
+    return 0;
 
-  cJSON_Delete(obj);
-  return strlen(data);
+  char buf[HTML_MSG_SIZE];
+  int n = encode_out_msg(con, buf, sizeof(buf), &msg);
+  if (n < 0) {
+    printf_err(con, "Failed to serialize message (likely memory issue)");
+    return 0;
+  }
+
+  int ec = msgstream_fd_send(con->fd, buf, sizeof(buf), n);
+  if (ec) {
+    printf_err(con, "Failed to send message: %s", msgstream_errstr(ec));
+    return 0;
+  }
+
+  return 1;
+}
+
+// Upload a URL the server requested, or tell it that it can't be
+static int handle_fetch(html_connection *con, const char *url) {
+  if (con->fetch_cb && con->fetch_cb(con, url, con->fetch_ctx))
+    return 1;
+
+  // the url came from a decoded message, so it fits
+  struct html_out_msg msg = {.type = HTML_OMSG_FETCH_FAILED};
+  strlcpy(msg.msg.fetch_failed.url, url, sizeof(msg.msg.fetch_failed.url));
+
+  char buf[HTML_MSG_SIZE];
+  int n = encode_out_msg(con, buf, sizeof(buf), &msg);
+  if (n < 0) {
+    printf_err(con, "Failed to serialize message (likely memory issue)");
+    return 0;
+  }
+
+  int ec = msgstream_fd_send(con->fd, buf, sizeof(buf), n);
+  if (ec) {
+    printf_err(con, "Failed to send message: %s", msgstream_errstr(ec));
+    return 0;
+  }
+
+  return 1;
+}
+
+int html_encode_omsg_navigate(void *data, size_t size, const char *url) {
+  // url: string
+
+  struct html_json_writer w;
+  html_json_init(&w, data, size);
+  html_json_begin_object(&w);
+  html_json_add_uint(&w, "type", HTML_OMSG_NAVIGATE);
+  html_json_add_string(&w, "url", url);
+  html_json_end_object(&w);
+  return html_json_finish(&w);
+}
+
+int html_encode_omsg_close(void *data, size_t size) {
+  struct html_json_writer w;
+  html_json_init(&w, data, size);
+  html_json_begin_object(&w);
+  html_json_add_uint(&w, "type", HTML_OMSG_CLOSE);
+  html_json_end_object(&w);
+  return html_json_finish(&w);
 }
 
 int html_encode_omsg_accept_io_transfer(void *data, size_t size,
                                         const char *token) {
-  cJSON *obj = cJSON_CreateObject();
-  if (!obj)
-    return -1;
+  // token: string
+
+  struct html_json_writer w;
+  html_json_init(&w, data, size);
+  html_json_begin_object(&w);
+  html_json_add_uint(&w, "type", HTML_OMSG_ACCEPT_IO_TRANSFER);
+  html_json_add_string(&w, "token", token);
+  html_json_end_object(&w);
+  return html_json_finish(&w);
+}
+
+int html_encode_omsg_upload_manifest(void *data, size_t size,
+                                     size_t content_length) {
+  // size: number
+
+  struct html_json_writer w;
+  html_json_init(&w, data, size);
+  html_json_begin_object(&w);
+  html_json_add_uint(&w, "type", HTML_OMSG_UPLOAD_MANIFEST);
+  html_json_add_uint(&w, "size", content_length);
+  html_json_end_object(&w);
+  return html_json_finish(&w);
+}
+
+static int add_to_array(cJSON *array, cJSON *item) {
+  if (!item)
+    return 0;
+
+  if (!cJSON_AddItemToArray(array, item)) {
+    cJSON_Delete(item);
+    return 0;
+  }
+
+  return 1;
+}
+
+char *html_encode_manifest(const struct html_manifest_entry *entries,
+                           size_t n, size_t *size) {
+  // [[url, size, sha256], ...]
+
+  cJSON *array = cJSON_CreateArray();
+  if (!array)
+    return NULL;
+
+  for (size_t i = 0; i < n; ++i) {
+    const struct html_manifest_entry *entry = &entries[i];
+    cJSON *item = cJSON_CreateArray();
+    if (!add_to_array(array, item))
+      goto fail;
+
+    if (!add_to_array(item, cJSON_CreateString(entry->url)))
+      goto fail;
+
+    if (!add_to_array(item, cJSON_CreateNumber(entry->size)))
+      goto fail;
+
+    if (!add_to_array(item, cJSON_CreateString(entry->sha256)))
+      goto fail;
+  }
+
+  char *out = cJSON_PrintUnformatted(array);
+  cJSON_Delete(array);
+
+  if (out)
+    *size = strlen(out);
+
+  return out;
+
+fail:
+  cJSON_Delete(array);
+  return NULL;
+}
+
+int html_encode_imsg_upload_needed(void *data, size_t size,
+                                   size_t content_length) {
+  // size: number
+
+  struct html_json_writer w;
+  html_json_init(&w, data, size);
+  html_json_begin_object(&w);
+  html_json_add_uint(&w, "type", HTML_IMSG_UPLOAD_NEEDED);
+  html_json_add_uint(&w, "size", content_length);
+  html_json_end_object(&w);
+  return html_json_finish(&w);
+}
+
+char *html_encode_upload_needed(const size_t *indices, size_t n,
+                                size_t *size) {
+  // [index, ...]
+
+  cJSON *array = cJSON_CreateArray();
+  if (!array)
+    return NULL;
+
+  for (size_t i = 0; i < n; ++i) {
+    if (!add_to_array(array, cJSON_CreateNumber(indices[i]))) {
+      cJSON_Delete(array);
+      return NULL;
+    }
+  }
+
+  char *out = cJSON_PrintUnformatted(array);
+  cJSON_Delete(array);
+
+  if (out)
+    *size = strlen(out);
+
+  return out;
+}
+
+int html_encode_omsg_upload_batch(void *data, size_t size,
+                                  size_t content_length) {
+  // size: number
+
+  struct html_json_writer w;
+  html_json_init(&w, data, size);
+  html_json_begin_object(&w);
+  html_json_add_uint(&w, "type", HTML_OMSG_UPLOAD_BATCH);
+  html_json_add_uint(&w, "size", content_length);
+  html_json_end_object(&w);
+  return html_json_finish(&w);
+}
+
+char *html_encode_upload_batch(const struct html_batch_entry *entries,
+                               size_t n, size_t *size) {
+  // [[url, size], ...]
 
-  int ok = 1;
-  if (!cJSON_AddNumberToObject(obj, "type", HTML_OMSG_ACCEPT_IO_TRANSFER))
-    ok = 0;
+  cJSON *array = cJSON_CreateArray();
+  if (!array)
+    return NULL;
+
+  for (size_t i = 0; i < n; ++i) {
+    const struct html_batch_entry *entry = &entries[i];
+    cJSON *item = cJSON_CreateArray();
+    if (!add_to_array(array, item))
+      goto fail;
+
+    if (!add_to_array(item, cJSON_CreateString(entry->url)))
+      goto fail;
+
+    if (!add_to_array(item, cJSON_CreateNumber(entry->size)))
+      goto fail;
+  }
 
-  if (!cJSON_AddStringToObject(obj, "token", token))
-    ok = 0;
+  char *out = cJSON_PrintUnformatted(array);
+  cJSON_Delete(array);
 
-  if (!cJSON_PrintPreallocated(obj, data, size, 0))
-    ok = 0;
+  if (out)
+    *size = strlen(out);
 
-  cJSON_Delete(obj);
-  return ok ? strlen(data) : -1;
+  return out;
+
+fail:
+  cJSON_Delete(array);
+  return NULL;
 }
 
 int html_navigate(html_connection *con, const char *url) {
   if (!con)
     return 0;
 
+  struct html_out_msg msg = {.type = HTML_OMSG_NAVIGATE};
+  if (!copy_field(con, msg.msg.navigate.url, sizeof(msg.msg.navigate.url),
+                  url))
+    return 0;
+
   char buf[HTML_MSG_SIZE];
-  int n = html_encode_omsg_navigate(buf, sizeof(buf), url);
+  int n = encode_out_msg(con, buf, sizeof(buf), &msg);
   if (n < 0) {
     printf_err(con,
                "Failed to serialize navigate message (likely memory issue)");
@@ -568,8 +1494,13 @@ int html_accept_io_transfer(html_connection *con, const char *io_token) {
   if (!con)
     return 0;
 
+  struct html_out_msg msg = {.type = HTML_OMSG_ACCEPT_IO_TRANSFER};
+  if (!copy_field(con, msg.msg.accept_io_transfer.token,
+                  sizeof(msg.msg.accept_io_transfer.token), io_token))
+    return 0;
+
   char buf[HTML_MSG_SIZE];
-  int n = html_encode_omsg_accept_io_transfer(buf, sizeof(buf), io_token);
+  int n = encode_out_msg(con, buf, sizeof(buf), &msg);
   if (n < 0) {
     printf_err(con, "Failed to serialize accept I/O transfer message (likely "
                     "memory issue)");
@@ -588,21 +1519,13 @@ int html_accept_io_transfer(html_connection *con, const char *io_token) {
 int html_encode_omsg_app_msg(void *data, size_t size, size_t content_length) {
   // size: number
 
-  cJSON *obj = cJSON_CreateObject();
-  if (!obj)
-    return -1;
-
-  if (!cJSON_AddNumberToObject(obj, "type", HTML_OMSG_APP_MSG))
-    return -1;
-
-  if (!cJSON_AddNumberToObject(obj, "size", content_length))
-    return -1;
-
-  if (!cJSON_PrintPreallocated(obj, data, size, 0))
-    return -1;
-
-  cJSON_Delete(obj);
-  return strlen(data);
+  struct html_json_writer w;
+  html_json_init(&w, data, size);
+  html_json_begin_object(&w);
+  html_json_add_uint(&w, "type", HTML_OMSG_APP_MSG);
+  html_json_add_uint(&w, "size", content_length);
+  html_json_end_object(&w);
+  return html_json_finish(&w);
 }
 
 int html_send(html_connection *con, const void *data, size_t size) {
@@ -611,8 +1534,11 @@ int html_send(html_connection *con, const void *data, size_t size) {
 
   int fd = con->fd;
 
+  struct html_out_msg msg = {.type = HTML_OMSG_APP_MSG};
+  msg.msg.app_msg.content_length = size;
+
   char buf[HTML_MSG_SIZE];
-  int n = html_encode_omsg_app_msg(buf, sizeof(buf), size);
+  int n = encode_out_msg(con, buf, sizeof(buf), &msg);
   if (n < 0) {
     printf_err(con, "Failed to serialize message (likely memory issue)");
     return 0;
@@ -632,64 +1558,100 @@ int html_send(html_connection *con, const void *data, size_t size) {
   return 1;
 }
 
-static int copy_string(cJSON *obj, const char *prop, char *out,
-                       size_t out_size) {
-  cJSON *str = cJSON_GetObjectItem(obj, prop);
-  if (!str)
+// Members of a JSON encoded message
+enum msg_key {
+  KEY_TYPE,
+  KEY_URL,
+  KEY_SIZE,
+  KEY_CHUNK_HEADER,
+  KEY_RES_TYPE,
+  KEY_CACHE,
+  KEY_TOKEN,
+  KEY_MIME,
+  KEY_MSG,
+  KEY_MAP,
+  KEY_COUNT
+};
+
+// Looked up like cJSON_GetObjectItem, except the mime map which was detached
+// case sensitively
+static const struct html_json_key msg_keys[KEY_COUNT] = {
+    [KEY_TYPE] = {"type", 0},
+    [KEY_URL] = {"url", 0},
+    [KEY_SIZE] = {"size", 0},
+    [KEY_CHUNK_HEADER] = {"chunkHeader", 0},
+    [KEY_RES_TYPE] = {"resType", 0},
+    [KEY_CACHE] = {"cache", 0},
+    [KEY_TOKEN] = {"token", 0},
+    [KEY_MIME] = {"mime", 0},
+    [KEY_MSG] = {"msg", 0},
+    [KEY_MAP] = {"map", 1},
+};
+
+// A whole number that fits in an int, since that's what sizes used to be
+static int json_uint(const struct html_json_value *val, unsigned int *out) {
+  if (val->kind != HTML_JSON_NUMBER)
     return 0;
 
-  const char *val = cJSON_GetStringValue(str);
-  if (!val)
+  double dval = val->number;
+  if (!(dval >= 0 && dval <= INT_MAX))
     return 0;
 
-  size_t n = strlcpy(out, val, out_size);
-  return n <= out_size;
+  *out = (unsigned int)dval;
+  return *out == dval;
 }
 
-static int intval(cJSON *obj, const char *key, int *val) {
-  cJSON *item = cJSON_GetObjectItem(obj, key);
-  if (!(item && cJSON_IsNumber(item)))
+static int json_size(const struct html_json_value *val, size_t *out) {
+  if (val->kind != HTML_JSON_NUMBER)
     return 0;
 
-  double dval = cJSON_GetNumberValue(item);
-  int ival = (int)dval;
-  if (ival != dval)
+  double dval = val->number;
+  if (!(dval >= 0 && dval < (double)SIZE_MAX))
     return 0;
 
-  *val = ival;
-  return 1;
+  *out = (size_t)dval;
+  return *out == dval;
 }
 
-static int uintval(cJSON *obj, const char *key, unsigned int *val) {
-  int ival;
-  if (!intval(obj, key, &ival))
+static int sizeval(cJSON *item, size_t *val) {
+  if (!(item && cJSON_IsNumber(item)))
     return 0;
 
-  if (ival < 0)
+  double dval = cJSON_GetNumberValue(item);
+  if (dval < 0)
     return 0;
 
-  *val = (unsigned int)ival;
-  return 1;
+  *val = (size_t)dval;
+  return *val == dval;
 }
 
-static int html_decode_upload_msg(cJSON *obj, struct html_omsg_upload *msg) {
+static int html_decode_upload_msg(const struct html_json_value *vals,
+                                  struct html_omsg_upload *msg) {
   // url: string
   // size?: number
   // archive: bool
-  if (!copy_string(obj, "url", msg->url, sizeof(msg->url)))
+  if (!html_json_copy_string(&vals[KEY_URL], msg->url, sizeof(msg->url)))
     return 0;
 
-  unsigned int size;
-  if (cJSON_HasObjectItem(obj, "size")) {
-    if (!uintval(obj, "size", &size))
+  unsigned int size = 0;
+  if (vals[KEY_SIZE].kind != HTML_JSON_MISSING) {
+    if (!json_uint(&vals[KEY_SIZE], &size))
       return 0;
-  } else {
-    size = 0;
   }
   msg->content_length = size;
 
+  unsigned int chunk_header = 2;
+  if (vals[KEY_CHUNK_HEADER].kind != HTML_JSON_MISSING) {
+    if (!json_uint(&vals[KEY_CHUNK_HEADER], &chunk_header))
+      return 0;
+
+    if (!(chunk_header == 2 || chunk_header == 4))
+      return 0;
+  }
+  msg->chunk_header_size = chunk_header;
+
   unsigned int rtype;
-  if (!uintval(obj, "resType", &rtype))
+  if (!json_uint(&vals[KEY_RES_TYPE], &rtype))
     return 0;
 
   if (rtype > HTML_RT_ARCHIVE)
@@ -699,116 +1661,309 @@ static int html_decode_upload_msg(cJSON *obj, struct html_omsg_upload *msg) {
   return 1;
 }
 
-static int html_decode_navigate_msg(cJSON *obj,
-                                    struct html_omsg_navigate *msg) {
-  if (!copy_string(obj, "url", msg->url, sizeof(msg->url)))
+static int html_decode_lazy_msg(const struct html_json_value *vals,
+                                struct html_omsg_lazy *msg) {
+  // url: string
+  // cache: bool
+  if (!html_json_copy_string(&vals[KEY_URL], msg->url, sizeof(msg->url)))
+    return 0;
+
+  enum html_json_kind cache = vals[KEY_CACHE].kind;
+  if (!(cache == HTML_JSON_TRUE || cache == HTML_JSON_FALSE))
     return 0;
 
+  msg->cache = cache == HTML_JSON_TRUE;
   return 1;
 }
 
-static int html_decode_app_msg(cJSON *obj, struct html_omsg_app_msg *msg) {
-  cJSON *size = cJSON_GetObjectItem(obj, "size");
-  if (!(size && cJSON_IsNumber(size)))
-    return 0;
-  double size_val = cJSON_GetNumberValue(size);
-  if (size_val < 0)
-    return 0;
-  msg->content_length = (size_t)size_val;
-  if (msg->content_length != size_val)
+static int is_sha256_hex(const char *str) {
+  if (!str || strlen(str) != HTML_DIGEST_SIZE - 1)
     return 0;
 
+  for (const char *c = str; *c; ++c) {
+    if (!(isdigit(*c) || (*c >= 'a' && *c <= 'f')))
+      return 0;
+  }
+
   return 1;
 }
 
-static int
-html_decode_accept_io_transfer(cJSON *obj,
-                               struct html_omsg_accept_io_transfer *msg) {
-  if (!copy_string(obj, "token", msg->token, sizeof(msg->token)))
-    return 0;
+int html_decode_manifest(const void *data, size_t size,
+                         struct html_manifest_entry **pentries, size_t *pn) {
+  // [[url, size, sha256], ...]
+
+  struct html_manifest_entry *entries = NULL;
+  cJSON *array = cJSON_ParseWithLength((const char *)data, size);
+  if (!cJSON_IsArray(array))
+    goto fail;
+
+  size_t n = cJSON_GetArraySize(array);
+  if (!(entries = calloc(n ? n : 1, sizeof(*entries))))
+    goto fail;
+
+  size_t i = 0;
+  cJSON *item;
+  cJSON_ArrayForEach(item, array) {
+    if (!(cJSON_IsArray(item) && cJSON_GetArraySize(item) == 3))
+      goto fail;
 
+    struct html_manifest_entry *entry = &entries[i++];
+
+    const char *url = cJSON_GetStringValue(cJSON_GetArrayItem(item, 0));
+    if (!url || strlcpy(entry->url, url, sizeof(entry->url)) >=
+                    sizeof(entry->url))
+      goto fail;
+
+    if (!sizeval(cJSON_GetArrayItem(item, 1), &entry->size))
+      goto fail;
+
+    const char *hash = cJSON_GetStringValue(cJSON_GetArrayItem(item, 2));
+    if (!is_sha256_hex(hash))
+      goto fail;
+
+    memcpy(entry->sha256, hash, sizeof(entry->sha256));
+  }
+
+  cJSON_Delete(array);
+  *pentries = entries;
+  *pn = n;
   return 1;
+
+fail:
+  cJSON_Delete(array);
+  free(entries);
+  return 0;
 }
 
-static int html_decode_mime_msg(cJSON *obj, html_mime_map *mimes) {
-  if (!mimes)
-    return 0;
+int html_decode_upload_needed(const void *data, size_t size,
+                              size_t **pindices, size_t *pn) {
+  // [index, ...]
+
+  size_t *indices = NULL;
+  cJSON *array = cJSON_ParseWithLength((const char *)data, size);
+  if (!cJSON_IsArray(array))
+    goto fail;
 
-  cJSON *map = cJSON_DetachItemFromObjectCaseSensitive(obj, "map");
-  if (!cJSON_IsArray(map)) {
+  size_t n = cJSON_GetArraySize(array);
+  if (!(indices = calloc(n ? n : 1, sizeof(*indices))))
     goto fail;
+
+  size_t i = 0;
+  cJSON *item;
+  cJSON_ArrayForEach(item, array) {
+    if (!sizeval(item, &indices[i++]))
+      goto fail;
   }
 
+  cJSON_Delete(array);
+  *pindices = indices;
+  *pn = n;
+  return 1;
+
+fail:
+  cJSON_Delete(array);
+  free(indices);
+  return 0;
+}
+
+int html_decode_upload_batch(const void *data, size_t size,
+                             struct html_batch_entry **pentries, size_t *pn) {
+  // [[url, size], ...]
+
+  struct html_batch_entry *entries = NULL;
+  cJSON *array = cJSON_ParseWithLength((const char *)data, size);
+  if (!cJSON_IsArray(array))
+    goto fail;
+
+  size_t n = cJSON_GetArraySize(array);
+  if (!(entries = calloc(n ? n : 1, sizeof(*entries))))
+    goto fail;
+
+  size_t i = 0;
   cJSON *item;
-  cJSON_ArrayForEach(item, map) {
-    // [extname, mime]
-    if (cJSON_GetArraySize(item) != 2)
+  cJSON_ArrayForEach(item, array) {
+    if (!(cJSON_IsArray(item) && cJSON_GetArraySize(item) == 2))
       goto fail;
 
-    cJSON *ext = cJSON_GetArrayItem(item, 0);
-    if (!cJSON_IsString(ext))
+    struct html_batch_entry *entry = &entries[i++];
+
+    const char *url = cJSON_GetStringValue(cJSON_GetArrayItem(item, 0));
+    if (!url || strlcpy(entry->url, url, sizeof(entry->url)) >=
+                    sizeof(entry->url))
       goto fail;
 
-    cJSON *mime = cJSON_GetArrayItem(item, 1);
-    if (!cJSON_IsString(ext))
+    if (!sizeval(cJSON_GetArrayItem(item, 1), &entry->size))
       goto fail;
   }
 
-  cJSON_Delete(mimes->array);
-  mimes->array = map;
+  cJSON_Delete(array);
+  *pentries = entries;
+  *pn = n;
   return 1;
 
 fail:
-  cJSON_Delete(map);
+  cJSON_Delete(array);
+  free(entries);
   return 0;
 }
 
+// [extname, mime]
+static int html_decode_mime_entry(const struct html_json_value *item,
+                                  html_mime_map *mimes) {
+  if (item->kind != HTML_JSON_ARRAY)
+    return 0;
+
+  struct html_json_iter it;
+  struct html_json_value ext, mime, extra;
+  html_json_iter_init(&it, item);
+  if (!(html_json_iter_next(&it, &ext) && html_json_iter_next(&it, &mime)))
+    return 0;
+
+  if (html_json_iter_next(&it, &extra))
+    return 0;
+
+  char ext_buf[HTML_MIME_SIZE], mime_buf[HTML_MIME_SIZE + 1];
+  if (!(html_json_copy_string(&ext, ext_buf, sizeof(ext_buf)) &&
+        html_json_copy_string(&mime, mime_buf, sizeof(mime_buf))))
+    return 0;
+
+  return html_mime_map_add(mimes, ext_buf, mime_buf);
+}
+
+static html_mime_map *html_decode_mime_msg(const struct html_json_value *map) {
+  if (map->kind != HTML_JSON_ARRAY)
+    return NULL;
+
+  html_mime_map *mimes = html_mime_map_create();
+  if (!mimes)
+    return NULL;
+
+  struct html_json_iter it;
+  struct html_json_value item;
+  html_json_iter_init(&it, map);
+  while (html_json_iter_next(&it, &item)) {
+    if (!html_decode_mime_entry(&item, mimes)) {
+      html_mime_map_free(mimes);
+      return NULL;
+    }
+  }
+
+  return mimes;
+}
+
+enum html_msg_encoding html_msg_encoding_of(const void *data, size_t size) {
+  if (size > 0 && *(const uint8_t *)data == HTML_BINARY_MAGIC)
+    return HTML_ENC_BINARY;
+
+  return HTML_ENC_JSON;
+}
+
 int html_decode_out_msg(const void *data, size_t size,
                         struct html_out_msg *msg) {
   // TODO error message for failure conditions
 
-  cJSON *obj = cJSON_ParseWithLength((const char *)data, size);
-  if (!obj) {
-    goto fail;
-  }
+  if (html_msg_encoding_of(data, size) == HTML_ENC_BINARY)
+    return html_decode_binary_out_msg(data, size, msg);
 
-  cJSON *type = cJSON_GetObjectItem(obj, "type");
-  if (!(type && cJSON_IsNumber(type))) {
-    goto fail;
-  }
+  struct html_json_value vals[KEY_COUNT];
+  if (!html_json_scan_object(data, size, msg_keys, KEY_COUNT, vals))
+    return 0;
+
+  if (vals[KEY_TYPE].kind != HTML_JSON_NUMBER)
+    return 0;
 
   int ret = 0;
-  double type_val = cJSON_GetNumberValue(type);
+  double type_val = vals[KEY_TYPE].number;
 
   if (type_val == HTML_OMSG_UPLOAD) {
     msg->type = HTML_OMSG_UPLOAD;
-    ret = html_decode_upload_msg(obj, &msg->msg.upload);
+    ret = html_decode_upload_msg(vals, &msg->msg.upload);
   } else if (type_val == HTML_OMSG_NAVIGATE) {
     msg->type = HTML_OMSG_NAVIGATE;
-    ret = html_decode_navigate_msg(obj, &msg->msg.navigate);
+    ret = html_json_copy_string(&vals[KEY_URL], msg->msg.navigate.url,
+                                sizeof(msg->msg.navigate.url));
   } else if (type_val == HTML_OMSG_APP_MSG) {
     msg->type = HTML_OMSG_APP_MSG;
-    ret = html_decode_app_msg(obj, &msg->msg.app_msg);
+    ret = json_size(&vals[KEY_SIZE], &msg->msg.app_msg.content_length);
   } else if (type_val == HTML_OMSG_MIME_MAP) {
     msg->type = HTML_OMSG_MIME_MAP;
-    msg->msg.mime = html_mime_map_create();
-    ret = html_decode_mime_msg(obj, msg->msg.mime);
+    msg->msg.mime = html_decode_mime_msg(&vals[KEY_MAP]);
+    ret = msg->msg.mime != NULL;
   } else if (type_val == HTML_OMSG_CLOSE) {
     msg->type = HTML_OMSG_CLOSE;
     ret = 1;
   } else if (type_val == HTML_OMSG_ACCEPT_IO_TRANSFER) {
     msg->type = HTML_OMSG_ACCEPT_IO_TRANSFER;
-    ret = html_decode_accept_io_transfer(obj, &msg->msg.accept_io_transfer);
-  } else {
-    goto fail;
+    char *token = msg->msg.accept_io_transfer.token;
+    ret = html_json_copy_string(&vals[KEY_TOKEN], token,
+                                sizeof(msg->msg.accept_io_transfer.token));
+  } else if (type_val == HTML_OMSG_UPLOAD_MANIFEST) {
+    msg->type = HTML_OMSG_UPLOAD_MANIFEST;
+    ret = json_size(&vals[KEY_SIZE], &msg->msg.upload_manifest.content_length);
+  } else if (type_val == HTML_OMSG_UPLOAD_BATCH) {
+    msg->type = HTML_OMSG_UPLOAD_BATCH;
+    ret = json_size(&vals[KEY_SIZE], &msg->msg.upload_batch.content_length);
+  } else if (type_val == HTML_OMSG_UPLOAD_FD) {
+    msg->type = HTML_OMSG_UPLOAD_FD;
+    ret = html_json_copy_string(&vals[KEY_URL], msg->msg.upload_fd.url,
+                                sizeof(msg->msg.upload_fd.url));
+  } else if (type_val == HTML_OMSG_LAZY) {
+    msg->type = HTML_OMSG_LAZY;
+    ret = html_decode_lazy_msg(vals, &msg->msg.lazy);
+  } else if (type_val == HTML_OMSG_FETCH_FAILED) {
+    msg->type = HTML_OMSG_FETCH_FAILED;
+    ret = html_json_copy_string(&vals[KEY_URL], msg->msg.fetch_failed.url,
+                                sizeof(msg->msg.fetch_failed.url));
+  } else if (type_val == HTML_OMSG_ACK_UPLOADS) {
+    msg->type = HTML_OMSG_ACK_UPLOADS;
+    ret = 1;
   }
 
-  cJSON_Delete(obj);
   return ret;
+}
 
-fail:
-  cJSON_Delete(obj);
-  return 0;
+int html_encode_out_msg(void *data, size_t size, const struct html_out_msg *msg,
+                        enum html_msg_encoding encoding) {
+  if (encoding == HTML_ENC_BINARY)
+    return html_encode_binary_out_msg(data, size, msg);
+
+  switch (msg->type) {
+  case HTML_OMSG_UPLOAD:
+    return encode_omsg_upload(data, size, msg->msg.upload.url,
+                              msg->msg.upload.content_length,
+                              msg->msg.upload.rtype,
+                              msg->msg.upload.chunk_header_size);
+  case HTML_OMSG_NAVIGATE:
+    return html_encode_omsg_navigate(data, size, msg->msg.navigate.url);
+  case HTML_OMSG_APP_MSG:
+    return html_encode_omsg_app_msg(data, size,
+                                    msg->msg.app_msg.content_length);
+  case HTML_OMSG_MIME_MAP:
+    return html_encode_omsg_mime_map(data, size, msg->msg.mime);
+  case HTML_OMSG_CLOSE:
+    return html_encode_omsg_close(data, size);
+  case HTML_OMSG_ACCEPT_IO_TRANSFER:
+    return html_encode_omsg_accept_io_transfer(
+        data, size, msg->msg.accept_io_transfer.token);
+  case HTML_OMSG_UPLOAD_MANIFEST:
+    return html_encode_omsg_upload_manifest(
+        data, size, msg->msg.upload_manifest.content_length);
+  case HTML_OMSG_UPLOAD_BATCH:
+    return html_encode_omsg_upload_batch(data, size,
+                                         msg->msg.upload_batch.content_length);
+  case HTML_OMSG_UPLOAD_FD:
+    return html_encode_omsg_upload_fd(data, size, msg->msg.upload_fd.url);
+  case HTML_OMSG_LAZY:
+    return html_encode_omsg_lazy(data, size, msg->msg.lazy.url,
+                                 msg->msg.lazy.cache);
+  case HTML_OMSG_FETCH_FAILED:
+    return html_encode_omsg_fetch_failed(data, size,
+                                         msg->msg.fetch_failed.url);
+  case HTML_OMSG_ACK_UPLOADS:
+    return html_encode_omsg_ack_uploads(data, size);
+  default:
+    return -1;
+  }
 }
 
 int html_encode_imsg_form(void *data, size_t size, size_t content_length,
@@ -816,190 +1971,364 @@ int html_encode_imsg_form(void *data, size_t size, size_t content_length,
   // mime: string
   // size: number
 
-  cJSON *obj = cJSON_CreateObject();
-  if (!obj)
-    return -1;
-
-  if (!cJSON_AddNumberToObject(obj, "type", HTML_IMSG_FORM))
-    return -1;
+  struct html_json_writer w;
+  html_json_init(&w, data, size);
+  html_json_begin_object(&w);
+  html_json_add_uint(&w, "type", HTML_IMSG_FORM);
+  html_json_add_uint(&w, "size", content_length);
+  html_json_add_string(&w, "mime", mime_type);
+  html_json_end_object(&w);
+  return html_json_finish(&w);
+}
 
-  if (!cJSON_AddNumberToObject(obj, "size", content_length))
-    return -1;
+int html_encode_imsg_error(void *data, size_t size, const char *msg) {
+  // msg: string
 
-  if (!cJSON_AddStringToObject(obj, "mime", mime_type))
-    return -1;
+  struct html_json_writer w;
+  html_json_init(&w, data, size);
+  html_json_begin_object(&w);
+  html_json_add_uint(&w, "type", HTML_IMSG_ERROR);
+  html_json_add_string(&w, "msg", msg);
+  html_json_end_object(&w);
+  return html_json_finish(&w);
+}
 
-  if (!cJSON_PrintPreallocated(obj, data, size, 0))
-    return -1;
+int html_encode_imsg_app_msg(void *data, size_t size, size_t content_length) {
+  // size: number
 
-  cJSON_Delete(obj);
-  return strlen(data);
+  struct html_json_writer w;
+  html_json_init(&w, data, size);
+  html_json_begin_object(&w);
+  html_json_add_uint(&w, "type", HTML_IMSG_APP_MSG);
+  html_json_add_uint(&w, "size", content_length);
+  html_json_end_object(&w);
+  return html_json_finish(&w);
 }
 
-int html_encode_imsg_error(void *data, size_t size, const char *msg) {
-  // msg: string
+int html_encode_imsg_close_req(void *data, size_t size) {
+  struct html_json_writer w;
+  html_json_init(&w, data, size);
+  html_json_begin_object(&w);
+  html_json_add_uint(&w, "type", HTML_IMSG_CLOSE_REQ);
+  html_json_end_object(&w);
+  return html_json_finish(&w);
+}
 
-  cJSON *obj = cJSON_CreateObject();
-  if (!obj)
-    return -1;
+int html_encode_imsg_fetch(void *data, size_t size, const char *url) {
+  // url: string
 
-  if (!cJSON_AddNumberToObject(obj, "type", HTML_IMSG_ERROR))
-    return -1;
+  struct html_json_writer w;
+  html_json_init(&w, data, size);
+  html_json_begin_object(&w);
+  html_json_add_uint(&w, "type", HTML_IMSG_FETCH);
+  html_json_add_string(&w, "url", url);
+  html_json_end_object(&w);
+  return html_json_finish(&w);
+}
 
-  if (!cJSON_AddStringToObject(obj, "msg", msg))
-    return -1;
+int html_encode_imsg_upload_ack(void *data, size_t size) {
+  struct html_json_writer w;
+  html_json_init(&w, data, size);
+  html_json_begin_object(&w);
+  html_json_add_uint(&w, "type", HTML_IMSG_UPLOAD_ACK);
+  html_json_end_object(&w);
+  return html_json_finish(&w);
+}
 
-  if (!cJSON_PrintPreallocated(obj, data, size, 0))
-    return -1;
+int html_decode_in_msg(const void *data, size_t size, struct html_in_msg *msg) {
+  // TODO error message for failure conditions
 
-  cJSON_Delete(obj);
-  return strlen(data);
-}
+  if (html_msg_encoding_of(data, size) == HTML_ENC_BINARY)
+    return html_decode_binary_in_msg(data, size, msg);
 
-static int html_decode_submit_form_msg(cJSON *obj, struct html_imsg_form *msg) {
-  // mime: string
-  // size: number
-  if (!copy_string(obj, "mime", msg->mime_type, sizeof(msg->mime_type)))
+  struct html_json_value vals[KEY_COUNT];
+  if (!html_json_scan_object(data, size, msg_keys, KEY_COUNT, vals))
     return 0;
 
-  cJSON *size = cJSON_GetObjectItem(obj, "size");
-  if (!(size && cJSON_IsNumber(size)))
+  if (vals[KEY_TYPE].kind != HTML_JSON_NUMBER)
     return 0;
-  double size_val = cJSON_GetNumberValue(size);
-  if (size_val < 0)
+
+  int ret = 0;
+  double type_val = vals[KEY_TYPE].number;
+
+  if (type_val == HTML_IMSG_FORM) {
+    // mime: string
+    // size: number
+    msg->type = HTML_IMSG_FORM;
+    ret = html_json_copy_string(&vals[KEY_MIME], msg->msg.form.mime_type,
+                                sizeof(msg->msg.form.mime_type)) &&
+          json_size(&vals[KEY_SIZE], &msg->msg.form.content_length);
+  } else if (type_val == HTML_IMSG_APP_MSG) {
+    msg->type = HTML_IMSG_APP_MSG;
+    ret = json_size(&vals[KEY_SIZE], &msg->msg.app_msg.content_length);
+  } else if (type_val == HTML_IMSG_CLOSE_REQ) {
+    msg->type = HTML_IMSG_CLOSE_REQ;
+    ret = 1;
+  } else if (type_val == HTML_IMSG_ERROR) {
+    msg->type = HTML_IMSG_ERROR;
+    ret = html_json_copy_string(&vals[KEY_MSG], msg->msg.error.msg,
+                                sizeof(msg->msg.error.msg));
+  } else if (type_val == HTML_IMSG_UPLOAD_NEEDED) {
+    msg->type = HTML_IMSG_UPLOAD_NEEDED;
+    ret = json_size(&vals[KEY_SIZE], &msg->msg.upload_needed.content_length);
+  } else if (type_val == HTML_IMSG_FETCH) {
+    msg->type = HTML_IMSG_FETCH;
+    ret = html_json_copy_string(&vals[KEY_URL], msg->msg.fetch.url,
+                                sizeof(msg->msg.fetch.url));
+  } else if (type_val == HTML_IMSG_UPLOAD_ACK) {
+    msg->type = HTML_IMSG_UPLOAD_ACK;
+    ret = 1;
+  }
+
+  return ret;
+}
+
+int html_encode_in_msg(void *data, size_t size, const struct html_in_msg *msg,
+                       enum html_msg_encoding encoding) {
+  if (encoding == HTML_ENC_BINARY)
+    return html_encode_binary_in_msg(data, size, msg);
+
+  switch (msg->type) {
+  case HTML_IMSG_FORM:
+    return html_encode_imsg_form(data, size, msg->msg.form.content_length,
+                                 msg->msg.form.mime_type);
+  case HTML_IMSG_APP_MSG:
+    return html_encode_imsg_app_msg(data, size,
+                                    msg->msg.app_msg.content_length);
+  case HTML_IMSG_CLOSE_REQ:
+    return html_encode_imsg_close_req(data, size);
+  case HTML_IMSG_ERROR:
+    return html_encode_imsg_error(data, size, msg->msg.error.msg);
+  case HTML_IMSG_UPLOAD_NEEDED:
+    return html_encode_imsg_upload_needed(
+        data, size, msg->msg.upload_needed.content_length);
+  case HTML_IMSG_FETCH:
+    return html_encode_imsg_fetch(data, size, msg->msg.fetch.url);
+  case HTML_IMSG_UPLOAD_ACK:
+    return html_encode_imsg_upload_ack(data, size);
+  default:
+    return -1;
+  }
+}
+
+// Receive and decode the next message from the server
+static int recv_in_msg(html_connection *con, struct html_in_msg *msg) {
+  uint8_t buf[HTML_MSG_SIZE];
+  size_t n;
+  int ec = msgstream_fd_recv(con->fd, buf, sizeof(buf), &n);
+  if (ec) {
+    printf_err(con, "Failed to receive input message: %s",
+               msgstream_errstr(ec));
     return 0;
-  msg->content_length = (size_t)size_val;
-  if (msg->content_length != size_val)
+  }
+
+  if (!html_decode_in_msg(buf, n, msg)) {
+    printf_err(con, "Failed to parse input message");
     return 0;
+  }
 
   return 1;
 }
 
-static int html_decode_error(cJSON *obj, struct html_imsg_error *msg) {
-  // msg: string
-  if (!copy_string(obj, "msg", msg->msg, sizeof(msg->msg)))
+// Keep a message and its body to be read after waiting for a reply
+static int stash_msg(html_connection *con, const struct html_in_msg *msg) {
+  size_t body_len = 0;
+  if (msg->type == HTML_IMSG_FORM)
+    body_len = msg->msg.form.content_length;
+  else if (msg->type == HTML_IMSG_APP_MSG)
+    body_len = msg->msg.app_msg.content_length;
+  else if (msg->type == HTML_IMSG_UPLOAD_NEEDED)
+    body_len = msg->msg.upload_needed.content_length;
+
+  struct html_stashed_msg *stashed = calloc(1, sizeof(*stashed));
+  if (!stashed) {
+    printf_err(con, "Failed to allocate stashed message");
+    return 0;
+  }
+
+  stashed->msg = *msg;
+  stashed->body_len = body_len;
+  if (body_len && !(stashed->body = malloc(body_len))) {
+    printf_err(con, "Failed to allocate %lu byte message body", body_len);
+    free(stashed);
     return 0;
+  }
+
+  if (!readn(con, body_len, stashed->body)) {
+    free(stashed->body);
+    free(stashed);
+    return 0;
+  }
 
+  struct html_stashed_msg **tail = &con->stash;
+  while (*tail)
+    tail = &(*tail)->next;
+
+  *tail = stashed;
   return 1;
 }
 
-int html_encode_imsg_app_msg(void *data, size_t size, size_t content_length) {
-  // size: number
+// Make body the one read_body reads, or the connection if it's null. The
+// last message's body is done with.
+static void set_body(html_connection *con, uint8_t *body, size_t len) {
+  free(con->body);
+  con->body = body;
+  con->body_off = 0;
+  con->body_len = len;
+}
 
-  cJSON *obj = cJSON_CreateObject();
-  if (!obj)
-    return -1;
+// Find the oldest stashed message of a type
+static struct html_stashed_msg **find_stashed(html_connection *con,
+                                              int msg_type) {
+  struct html_stashed_msg **link = &con->stash;
+  while (*link && (*link)->msg.type != msg_type)
+    link = &(*link)->next;
 
-  if (!cJSON_AddNumberToObject(obj, "type", HTML_IMSG_APP_MSG))
-    return -1;
+  return *link ? link : NULL;
+}
 
-  if (!cJSON_AddNumberToObject(obj, "size", content_length))
-    return -1;
+// Take a stashed message. Its body is read before the connection.
+static void unstash_msg(html_connection *con, struct html_stashed_msg **link,
+                        struct html_in_msg *msg) {
+  struct html_stashed_msg *stashed = *link;
+  *link = stashed->next;
 
-  if (!cJSON_PrintPreallocated(obj, data, size, 0))
-    return -1;
+  *msg = stashed->msg;
+  set_body(con, stashed->body, stashed->body_len);
+  free(stashed);
+}
+
+// Read the body of the last message, which may have been stashed
+static int read_body(html_connection *con, size_t n, void *data) {
+  if (!con->body)
+    return readn(con, n, data);
+
+  if (n > con->body_len - con->body_off) {
+    printf_err(con, "Message body is shorter than expected");
+    return 0;
+  }
 
-  cJSON_Delete(obj);
-  return strlen(data);
+  memcpy(data, con->body + con->body_off, n);
+  con->body_off += n;
+  return 1;
 }
 
-int html_encode_imsg_close_req(void *data, size_t size) {
-  cJSON *obj = cJSON_CreateObject();
-  if (!obj)
-    return -1;
+// Handle a message that arrived while waiting for another. Lazy URLs are
+// uploaded, acknowledgements counted and the rest kept for later reads.
+static int handle_other_msg(html_connection *con,
+                            const struct html_in_msg *msg) {
+  switch (msg->type) {
+  case HTML_IMSG_FETCH:
+    return handle_fetch(con, msg->msg.fetch.url);
+  case HTML_IMSG_UPLOAD_ACK:
+    if (con->uploads_in_flight)
+      --con->uploads_in_flight;
+    return 1;
+  case HTML_IMSG_ERROR:
+    printf_err(con, "(server): %s", msg->msg.error.msg);
+    return 0;
+  default:
+    return stash_msg(con, msg);
+  }
+}
 
-  if (!cJSON_AddNumberToObject(obj, "type", HTML_IMSG_CLOSE_REQ))
-    return -1;
+// Receive messages until the server replies with msg_type, keeping the
+// others for later reads. A reply that was kept while uploading a fetched
+// URL is taken first.
+static int recv_reply(html_connection *con, struct html_in_msg *msg,
+                      int msg_type) {
+  struct html_stashed_msg **stashed = find_stashed(con, msg_type);
+  if (stashed) {
+    unstash_msg(con, stashed, msg);
+    return 1;
+  }
 
-  if (!cJSON_PrintPreallocated(obj, data, size, 0))
-    return -1;
+  while (1) {
+    if (!recv_in_msg(con, msg))
+      return 0;
+
+    if (msg->type == msg_type)
+      break;
 
-  cJSON_Delete(obj);
-  return strlen(data);
+    if (!handle_other_msg(con, msg))
+      return 0;
+  }
+
+  set_body(con, NULL, 0);
+  return 1;
 }
 
-static int html_decode_recv_app_msg(cJSON *obj, struct html_imsg_app_msg *msg) {
-  // size: number
-  // TODO - factor this size calc out
-  cJSON *size = cJSON_GetObjectItem(obj, "size");
-  if (!(size && cJSON_IsNumber(size)))
-    return 0;
-  double size_val = cJSON_GetNumberValue(size);
-  if (size_val < 0)
-    return 0;
-  msg->content_length = (size_t)size_val;
-  if (msg->content_length != size_val)
+// Wait until the oldest unacknowledged upload is acknowledged
+static int wait_for_ack(html_connection *con) {
+  struct html_in_msg msg;
+  if (!recv_reply(con, &msg, HTML_IMSG_UPLOAD_ACK))
     return 0;
 
+  --con->uploads_in_flight;
   return 1;
 }
 
-int html_decode_in_msg(const void *data, size_t size, struct html_in_msg *msg) {
-  // TODO error message for failure conditions
+// Wait for room in the upload window and count another upload in flight
+static int begin_upload(html_connection *con) {
+  if (!con->acks_enabled)
+    return 1;
 
-  cJSON *obj = cJSON_ParseWithLength((const char *)data, size);
-  if (!obj) {
-    goto fail;
+  while (con->upload_window && con->uploads_in_flight >= con->upload_window) {
+    if (!wait_for_ack(con))
+      return 0;
   }
 
-  cJSON *type = cJSON_GetObjectItem(obj, "type");
-  if (!(type && cJSON_IsNumber(type))) {
-    goto fail;
-  }
+  ++con->uploads_in_flight;
+  return 1;
+}
 
-  int ret = 0;
-  double type_val = cJSON_GetNumberValue(type);
+int html_upload_wait(html_connection *con) {
+  if (!con)
+    return 0;
 
-  if (type_val == HTML_IMSG_FORM) {
-    msg->type = HTML_IMSG_FORM;
-    ret = html_decode_submit_form_msg(obj, &msg->msg.form);
-  } else if (type_val == HTML_IMSG_APP_MSG) {
-    msg->type = HTML_IMSG_APP_MSG;
-    ret = html_decode_recv_app_msg(obj, &msg->msg.app_msg);
-  } else if (type_val == HTML_IMSG_CLOSE_REQ) {
-    msg->type = HTML_IMSG_CLOSE_REQ;
-    ret = 1;
-  } else if (type_val == HTML_IMSG_ERROR) {
-    msg->type = HTML_IMSG_ERROR;
-    ret = html_decode_error(obj, &msg->msg.error);
-  } else {
-    goto fail;
+  if (!con->acks_enabled) {
+    printf_err(con, "Upload acknowledgements are not enabled");
+    return 0;
   }
 
-  cJSON_Delete(obj);
-  return ret;
+  while (con->uploads_in_flight) {
+    if (!wait_for_ack(con))
+      return 0;
+  }
 
-fail:
-  cJSON_Delete(obj);
-  return 0;
+  return 1;
 }
 
+// Wait for a message of msg_type or a close request. Messages of other
+// types, like forms while waiting for an app message, are kept for the
+// functions that read them.
 static int read_msg_type(html_connection *con, struct html_in_msg *msg,
                          int msg_type) {
-  uint8_t buf[HTML_MSG_SIZE];
-  size_t n;
-  int ec = msgstream_fd_recv(con->fd, buf, sizeof(buf), &n);
-  if (ec) {
-    printf_err(con, "Failed to receive input message: %s",
-               msgstream_errstr(ec));
-    return 0;
-  }
+  struct html_stashed_msg **link = &con->stash;
+  while (*link && (*link)->msg.type != msg_type &&
+         (*link)->msg.type != HTML_IMSG_CLOSE_REQ)
+    link = &(*link)->next;
 
-  if (!html_decode_in_msg(buf, n, msg)) {
-    printf_err(con, "Failed to parse input message");
-    return 0;
-  }
+  if (*link) {
+    unstash_msg(con, link, msg);
+  } else {
+    while (1) {
+      if (!recv_in_msg(con, msg))
+        return 0;
 
-  if (msg->type != msg_type) {
-    if (msg->type == HTML_IMSG_CLOSE_REQ) {
-      printf_err(con, "Close requested by user");
-      con->close_requested = 1;
-    } else if (msg->type == HTML_IMSG_ERROR) {
-      printf_err(con, "(server): %s", msg->msg.error.msg);
-    } else {
-      printf_err(con, "Unexpected message type: %d", msg->type);
+      if (msg->type == msg_type || msg->type == HTML_IMSG_CLOSE_REQ)
+        break;
+
+      if (!handle_other_msg(con, msg))
+        return 0;
     }
 
+    set_body(con, NULL, 0);
+  }
+
+  if (msg->type == HTML_IMSG_CLOSE_REQ) {
+    printf_err(con, "Close requested by user");
+    con->close_requested = 1;
     return 0;
   }
 
@@ -1021,6 +2350,21 @@ static int readn(html_connection *con, size_t n, void *data) {
   return 1;
 }
 
+static int writen(html_connection *con, size_t n, const void *data) {
+  size_t nwritten = 0;
+  while (nwritten < n) {
+    ssize_t ret = write(con->fd, data + nwritten, n - nwritten);
+    if (ret < 1) {
+      printf_err(con, "write() failed: %s", strerror(errno));
+      return 0;
+    }
+
+    nwritten += ret;
+  }
+
+  return 1;
+}
+
 static int html_read_form_data(html_connection *con, void *data, size_t size,
                                size_t *pnread) {
   struct html_in_msg msg;
@@ -1044,7 +2388,7 @@ static int html_read_form_data(html_connection *con, void *data, size_t size,
     return 0;
   }
 
-  if (!readn(con, form->content_length, data))
+  if (!read_body(con, form->content_length, data))
     return 0;
 
   ((char *)data)[form->content_length] = '\0';
@@ -1074,7 +2418,7 @@ int html_recv(html_connection *con, void *data, size_t size, size_t *msg_size) {
     return 0;
   }
 
-  if (!readn(con, app_msg->content_length, data))
+  if (!read_body(con, app_msg->content_length, data))
     return 0;
 
   *msg_size = app_msg->content_length;
@@ -1355,22 +2699,30 @@ fail:
 
 int html_encode_omsg_mime_map(void *data, size_t size,
                               const html_mime_map *mimes) {
-  cJSON *obj = cJSON_CreateObject();
-  if (!obj)
-    return -1;
-
-  if (!cJSON_AddNumberToObject(obj, "type", HTML_OMSG_MIME_MAP))
-    return -1;
+  // map: [[extname, mime], ...]
+
+  struct html_json_writer w;
+  html_json_init(&w, data, size);
+  html_json_begin_object(&w);
+  html_json_add_uint(&w, "type", HTML_OMSG_MIME_MAP);
+  html_json_key(&w, "map");
+  html_json_begin_array(&w);
+
+  size_t n = html_mime_map_size(mimes);
+  for (size_t i = 0; i < n; ++i) {
+    const char *ext, *mime;
+    if (!html_mime_map_entry_at(mimes, i, &ext, &mime))
+      return -1;
 
-  if (!cJSON_AddItemReferenceToObject(obj, "map", mimes->array)) {
-    return -1;
+    html_json_begin_array(&w);
+    html_json_string(&w, ext);
+    html_json_string(&w, mime);
+    html_json_end_array(&w);
   }
 
-  if (!cJSON_PrintPreallocated(obj, data, size, 0))
-    return -1;
-
-  cJSON_Delete(obj);
-  return strlen(data);
+  html_json_end_array(&w);
+  html_json_end_object(&w);
+  return html_json_finish(&w);
 }
 
 int html_mime_map_apply(html_connection *con, const html_mime_map *mimes) {
@@ -1382,8 +2734,11 @@ int html_mime_map_apply(html_connection *con, const html_mime_map *mimes) {
     return 0;
   }
 
+  struct html_out_msg msg = {.type = HTML_OMSG_MIME_MAP};
+  msg.msg.mime = (html_mime_map *)mimes;
+
   char buf[HTML_MSG_SIZE];
-  int n = html_encode_omsg_mime_map(buf, sizeof(buf), mimes);
+  int n = encode_out_msg(con, buf, sizeof(buf), &msg);
   if (n < 0) {
     printf_err(con, "Failed to encode mime map message (usually "
                     "memory constraint)");
@@ -0,0 +1,610 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#include "html_forms/private/json.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Writer */
+
+void html_json_init(struct html_json_writer *w, void *data, size_t size) {
+  w->data = data;
+  w->size = size;
+  w->n = 0;
+  w->ok = data && size > 0;
+  w->need_comma = 0;
+}
+
+static void put(struct html_json_writer *w, const char *str, size_t n) {
+  // leave room for the null terminator
+  if (!w->ok || w->size - w->n <= n) {
+    w->ok = 0;
+    return;
+  }
+
+  memcpy(w->data + w->n, str, n);
+  w->n += n;
+}
+
+static void put_char(struct html_json_writer *w, char c) { put(w, &c, 1); }
+
+// Separate a value from the one before it in the same array or object
+static void begin_value(struct html_json_writer *w) {
+  if (w->need_comma)
+    put_char(w, ',');
+
+  w->need_comma = 0;
+}
+
+static void end_value(struct html_json_writer *w) { w->need_comma = 1; }
+
+void html_json_begin_object(struct html_json_writer *w) {
+  begin_value(w);
+  put_char(w, '{');
+}
+
+void html_json_end_object(struct html_json_writer *w) {
+  put_char(w, '}');
+  end_value(w);
+}
+
+void html_json_begin_array(struct html_json_writer *w) {
+  begin_value(w);
+  put_char(w, '[');
+}
+
+void html_json_end_array(struct html_json_writer *w) {
+  put_char(w, ']');
+  end_value(w);
+}
+
+static void put_string(struct html_json_writer *w, const char *str) {
+  static const char hex[] = "0123456789abcdef";
+
+  put_char(w, '"');
+  for (const unsigned char *p = (const unsigned char *)str; *p; ++p) {
+    // runs of plain characters are copied at once
+    size_t run = 0;
+    while (p[run] >= 32 && p[run] != '"' && p[run] != '\\')
+      ++run;
+
+    if (run) {
+      put(w, (const char *)p, run);
+      p += run - 1;
+      continue;
+    }
+
+    char esc[6] = {'\\', 0};
+    switch (*p) {
+    case '"':
+    case '\\':
+      esc[1] = *p;
+      break;
+    case '\b':
+      esc[1] = 'b';
+      break;
+    case '\f':
+      esc[1] = 'f';
+      break;
+    case '\n':
+      esc[1] = 'n';
+      break;
+    case '\r':
+      esc[1] = 'r';
+      break;
+    case '\t':
+      esc[1] = 't';
+      break;
+    default:
+      memcpy(esc + 1, "u00", 3);
+      esc[4] = hex[*p >> 4];
+      esc[5] = hex[*p & 0xf];
+      put(w, esc, 6);
+      continue;
+    }
+
+    put(w, esc, 2);
+  }
+  put_char(w, '"');
+}
+
+void html_json_key(struct html_json_writer *w, const char *key) {
+  begin_value(w);
+  put_string(w, key);
+  put_char(w, ':');
+}
+
+void html_json_uint(struct html_json_writer *w, uint64_t val) {
+  char buf[20];
+  size_t i = sizeof(buf);
+  do {
+    buf[--i] = '0' + val % 10;
+    val /= 10;
+  } while (val);
+
+  begin_value(w);
+  put(w, buf + i, sizeof(buf) - i);
+  end_value(w);
+}
+
+void html_json_bool(struct html_json_writer *w, int val) {
+  begin_value(w);
+  if (val)
+    put(w, "true", 4);
+  else
+    put(w, "false", 5);
+  end_value(w);
+}
+
+void html_json_string(struct html_json_writer *w, const char *str) {
+  begin_value(w);
+  if (str)
+    put_string(w, str);
+  else
+    w->ok = 0;
+  end_value(w);
+}
+
+void html_json_add_uint(struct html_json_writer *w, const char *key,
+                        uint64_t val) {
+  html_json_key(w, key);
+  html_json_uint(w, val);
+}
+
+void html_json_add_bool(struct html_json_writer *w, const char *key,
+                        int val) {
+  html_json_key(w, key);
+  html_json_bool(w, val);
+}
+
+void html_json_add_string(struct html_json_writer *w, const char *key,
+                          const char *str) {
+  html_json_key(w, key);
+  html_json_string(w, str);
+}
+
+int html_json_finish(struct html_json_writer *w) {
+  if (!w->ok || w->n > INT32_MAX)
+    return -1;
+
+  w->data[w->n] = '\0';
+  return (int)w->n;
+}
+
+/* Reader. Accepts what cJSON_ParseWithLength accepts. */
+
+// cJSON's CJSON_NESTING_LIMIT
+#define NESTING_LIMIT 1000
+
+// Long enough for any key that's looked up
+#define KEY_SIZE 32
+
+struct reader {
+  const char *p;
+  const char *end;
+};
+
+// cJSON treats every byte up to and including space as whitespace. At the
+// end of the input it steps back onto the last byte, which lets a closing
+// bracket end both the value it closes and the one containing it.
+static void skip_ws(struct reader *r) {
+  while (r->p < r->end && (unsigned char)*r->p <= 32)
+    ++r->p;
+
+  if (r->p == r->end)
+    --r->p;
+}
+
+static int take(struct reader *r, char c) {
+  if (r->p < r->end && *r->p == c) {
+    ++r->p;
+    return 1;
+  }
+
+  return 0;
+}
+
+static int take_literal(struct reader *r, const char *lit, size_t n) {
+  if ((size_t)(r->end - r->p) < n || memcmp(r->p, lit, n) != 0)
+    return 0;
+
+  r->p += n;
+  return 1;
+}
+
+// Find the end of a string starting at its opening quote, like cJSON does
+// before it looks at escapes
+static int scan_string(struct reader *r) {
+  if (!take(r, '"'))
+    return 0;
+
+  while (r->p < r->end && *r->p != '"') {
+    if (*r->p == '\\') {
+      if (r->end - r->p < 2)
+        return 0;
+
+      ++r->p;
+    }
+
+    ++r->p;
+  }
+
+  return take(r, '"');
+}
+
+// Invalid digits make the whole sequence 0, like cJSON's parse_hex4
+static unsigned int hex4(const char *s) {
+  unsigned int val = 0;
+  for (int i = 0; i < 4; ++i) {
+    char c = s[i];
+    val <<= 4;
+    if (c >= '0' && c <= '9')
+      val |= c - '0';
+    else if (c >= 'a' && c <= 'f')
+      val |= c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F')
+      val |= c - 'A' + 10;
+    else
+      return 0;
+  }
+
+  return val;
+}
+
+// Writes decoded bytes up to the first null character
+struct string_out {
+  char *data;
+  size_t size;
+  size_t n;
+  int terminated;
+  int overflow;
+};
+
+static void out_byte(struct string_out *out, unsigned char c) {
+  if (out->terminated)
+    return;
+
+  if (c == '\0') {
+    out->terminated = 1;
+    return;
+  }
+
+  if (out->n + 1 >= out->size) {
+    out->overflow = 1;
+    return;
+  }
+
+  out->data[out->n++] = (char)c;
+}
+
+static void out_codepoint(struct string_out *out, unsigned long cp) {
+  if (cp < 0x80) {
+    out_byte(out, cp);
+  } else if (cp < 0x800) {
+    out_byte(out, 0xc0 | (cp >> 6));
+    out_byte(out, 0x80 | (cp & 0x3f));
+  } else if (cp < 0x10000) {
+    out_byte(out, 0xe0 | (cp >> 12));
+    out_byte(out, 0x80 | ((cp >> 6) & 0x3f));
+    out_byte(out, 0x80 | (cp & 0x3f));
+  } else {
+    out_byte(out, 0xf0 | (cp >> 18));
+    out_byte(out, 0x80 | ((cp >> 12) & 0x3f));
+    out_byte(out, 0x80 | ((cp >> 6) & 0x3f));
+    out_byte(out, 0x80 | (cp & 0x3f));
+  }
+}
+
+// Decode a string spanning [begin, end) including its quotes. A null out
+// only validates the escapes.
+static int decode_string(const char *begin, const char *end,
+                         struct string_out *out) {
+  const char *p = begin + 1;
+  const char *last = end - 1; // closing quote
+
+  while (p < last) {
+    if (*p != '\\') {
+      if (out)
+        out_byte(out, *p);
+      ++p;
+      continue;
+    }
+
+    unsigned long cp;
+    switch (p[1]) {
+    case 'b':
+      cp = '\b';
+      break;
+    case 'f':
+      cp = '\f';
+      break;
+    case 'n':
+      cp = '\n';
+      break;
+    case 'r':
+      cp = '\r';
+      break;
+    case 't':
+      cp = '\t';
+      break;
+    case '"':
+    case '\\':
+    case '/':
+      cp = p[1];
+      break;
+    case 'u': {
+      if (last - p < 6)
+        return 0;
+
+      unsigned int first = hex4(p + 2);
+      if (first >= 0xdc00 && first <= 0xdfff)
+        return 0;
+
+      if (first >= 0xd800 && first <= 0xdbff) {
+        const char *second = p + 6;
+        if (last - second < 6 || second[0] != '\\' || second[1] != 'u')
+          return 0;
+
+        unsigned int low = hex4(second + 2);
+        if (low < 0xdc00 || low > 0xdfff)
+          return 0;
+
+        cp = 0x10000 + (((first & 0x3ff) << 10) | (low & 0x3ff));
+        p += 12;
+      } else {
+        cp = first;
+        p += 6;
+      }
+
+      if (out)
+        out_codepoint(out, cp);
+      continue;
+    }
+    default:
+      return 0;
+    }
+
+    if (out)
+      out_byte(out, cp);
+    p += 2;
+  }
+
+  return 1;
+}
+
+static int parse_string(struct reader *r, struct html_json_value *val) {
+  const char *begin = r->p;
+  if (!scan_string(r) || !decode_string(begin, r->p, NULL))
+    return 0;
+
+  val->kind = HTML_JSON_STRING;
+  val->begin = begin;
+  val->end = r->p;
+  return 1;
+}
+
+// Like cJSON, take what looks like a number and let strtod decide
+static int parse_number(struct reader *r, struct html_json_value *val) {
+  char buf[64];
+  size_t n = 0;
+  while (n < sizeof(buf) - 1 && r->p + n < r->end &&
+         strchr("0123456789+-eE.", r->p[n]) && r->p[n] != '\0') {
+    buf[n] = r->p[n];
+    ++n;
+  }
+  buf[n] = '\0';
+
+  char *after;
+  double num = strtod(buf, &after);
+  if (after == buf)
+    return 0;
+
+  r->p += after - buf;
+  val->kind = HTML_JSON_NUMBER;
+  val->number = num;
+  return 1;
+}
+
+static int parse_value(struct reader *r, struct html_json_value *val,
+                       int depth);
+
+static int parse_array(struct reader *r, struct html_json_value *val,
+                       int depth) {
+  if (depth >= NESTING_LIMIT)
+    return 0;
+
+  const char *begin = r->p;
+  take(r, '[');
+  skip_ws(r);
+
+  if (!take(r, ']')) {
+    do {
+      struct html_json_value item;
+      skip_ws(r);
+      if (!parse_value(r, &item, depth + 1))
+        return 0;
+
+      skip_ws(r);
+    } while (take(r, ','));
+
+    if (!take(r, ']'))
+      return 0;
+  }
+
+  val->kind = HTML_JSON_ARRAY;
+  val->begin = begin;
+  val->end = r->p;
+  return 1;
+}
+
+// Whether a decoded key equals name, ignoring case unless asked not to
+static int key_matches(const struct string_out *key,
+                       const struct html_json_key *spec) {
+  if (key->overflow)
+    return 0;
+
+  size_t n = strlen(spec->name);
+  if (key->n != n)
+    return 0;
+
+  if (spec->case_sensitive)
+    return memcmp(key->data, spec->name, n) == 0;
+
+  for (size_t i = 0; i < n; ++i) {
+    if (tolower((unsigned char)key->data[i]) !=
+        tolower((unsigned char)spec->name[i]))
+      return 0;
+  }
+
+  return 1;
+}
+
+static int parse_object(struct reader *r, struct html_json_value *val,
+                        int depth, const struct html_json_key *keys,
+                        size_t nkeys, struct html_json_value *values) {
+  if (depth >= NESTING_LIMIT)
+    return 0;
+
+  const char *begin = r->p;
+  take(r, '{');
+  skip_ws(r);
+
+  if (!take(r, '}')) {
+    do {
+      skip_ws(r);
+
+      struct html_json_value key;
+      if (!parse_string(r, &key))
+        return 0;
+
+      skip_ws(r);
+      if (!take(r, ':'))
+        return 0;
+
+      skip_ws(r);
+      struct html_json_value member;
+      if (!parse_value(r, &member, depth + 1))
+        return 0;
+
+      skip_ws(r);
+
+      if (nkeys == 0)
+        continue;
+
+      char key_buf[KEY_SIZE];
+      struct string_out key_out = {key_buf, sizeof(key_buf), 0, 0, 0};
+      decode_string(key.begin, key.end, &key_out);
+
+      // only the first member with a key counts
+      for (size_t i = 0; i < nkeys; ++i) {
+        if (values[i].kind == HTML_JSON_MISSING &&
+            key_matches(&key_out, &keys[i])) {
+          values[i] = member;
+        }
+      }
+    } while (take(r, ','));
+
+    if (!take(r, '}'))
+      return 0;
+  }
+
+  val->kind = HTML_JSON_OBJECT;
+  val->begin = begin;
+  val->end = r->p;
+  return 1;
+}
+
+static int parse_value(struct reader *r, struct html_json_value *val,
+                       int depth) {
+  if (r->p >= r->end)
+    return 0;
+
+  switch (*r->p) {
+  case 'n':
+    val->kind = HTML_JSON_NULL;
+    return take_literal(r, "null", 4);
+  case 'f':
+    val->kind = HTML_JSON_FALSE;
+    return take_literal(r, "false", 5);
+  case 't':
+    val->kind = HTML_JSON_TRUE;
+    return take_literal(r, "true", 4);
+  case '"':
+    return parse_string(r, val);
+  case '[':
+    return parse_array(r, val, depth);
+  case '{':
+    return parse_object(r, val, depth, NULL, 0, NULL);
+  default:
+    if (*r->p == '-' || (*r->p >= '0' && *r->p <= '9'))
+      return parse_number(r, val);
+
+    return 0;
+  }
+}
+
+int html_json_scan_object(const void *data, size_t size,
+                          const struct html_json_key *keys, size_t nkeys,
+                          struct html_json_value *values) {
+  for (size_t i = 0; i < nkeys; ++i)
+    values[i].kind = HTML_JSON_MISSING;
+
+  if (!data || size == 0)
+    return 0;
+
+  struct reader r = {data, (const char *)data + size};
+
+  // a UTF-8 byte order mark is skipped
+  if (size > 4 && memcmp(r.p, "\xef\xbb\xbf", 3) == 0)
+    r.p += 3;
+
+  skip_ws(&r);
+  if (!(r.p < r.end && *r.p == '{'))
+    return 0;
+
+  // bytes after the object are ignored
+  struct html_json_value obj;
+  return parse_object(&r, &obj, 0, keys, nkeys, values);
+}
+
+int html_json_copy_string(const struct html_json_value *val, char *out,
+                          size_t out_size) {
+  if (val->kind != HTML_JSON_STRING || out_size == 0)
+    return 0;
+
+  struct string_out str = {out, out_size, 0, 0, 0};
+  if (!decode_string(val->begin, val->end, &str) || str.overflow)
+    return 0;
+
+  out[str.n] = '\0';
+  return 1;
+}
+
+void html_json_iter_init(struct html_json_iter *it,
+                         const struct html_json_value *array) {
+  it->p = array->begin + 1;
+  it->end = array->end;
+}
+
+int html_json_iter_next(struct html_json_iter *it,
+                        struct html_json_value *item) {
+  struct reader r = {it->p, it->end};
+  skip_ws(&r);
+  if (*r.p == ']')
+    return 0;
+
+  // the array was already validated, so this can't fail
+  if (!parse_value(&r, item, 0))
+    return 0;
+
+  skip_ws(&r);
+  take(&r, ',');
+  it->p = r.p;
+  return 1;
+}
@@ -51,7 +51,12 @@ function makeClient(make) {
 
 	const htmlLib = d.addLibrary({
 		name: 'html_forms',
-		src: ['client/src/html_forms.c'],
+		src: [
+			'client/src/html_forms.c',
+			'client/src/sha256.c',
+			'client/src/binary_msg.c',
+			'client/src/json.c',
+		],
 		includeDirs: ['client/include'],
 		linkTo: [cjson, catui],
 	});
@@ -172,7 +177,31 @@ function makeClient(make) {
 		linkTo: [htmlLib, gtest],
 	});
 
-	make.add('test', [parseFormTest.run, escapeStringTest.run]);
+	const sha256Test = d.addTest({
+		name: 'sha256_test',
+		src: ['test/sha256_test.cpp'],
+		linkTo: [htmlLib, gtest],
+	});
+
+	const msgEncodingTest = d.addTest({
+		name: 'msg_encoding_test',
+		src: ['test/msg_encoding_test.cpp'],
+		linkTo: [htmlLib, cjson, gtest],
+	});
+
+	const jsonTest = d.addTest({
+		name: 'json_test',
+		src: ['test/json_test.cpp'],
+		linkTo: [htmlLib, cjson, gtest],
+	});
+
+	make.add('test', [
+		parseFormTest.run,
+		escapeStringTest.run,
+		sha256Test.run,
+		msgEncodingTest.run,
+		jsonTest.run,
+	]);
 
 	return { htmlLib, distClient: d, example };
 }
@@ -244,7 +273,19 @@ function makeServer(make, htmlLib) {
 			'server/src/my-beast.cpp',
 			'server/src/browser.cpp',
 			'server/src/parse_target.cpp',
+			'server/src/http_range.cpp',
+			'server/src/http_conditional.cpp',
 			'server/src/evt_util.cpp',
+			'server/src/sendfile.cpp',
+			'server/src/compression.cpp',
+			'server/src/content_cache.cpp',
+			'server/src/session_table.cpp',
+			'server/src/log.cpp',
+			'server/src/metrics.cpp',
+			'server/src/archive_pipe.cpp',
+			'server/src/tar_index.cpp',
+			'server/src/blob_store.cpp',
+			'server/src/file_clone.cpp',
 			session_lock,
 			formsJsCpp,
 			loadingHtmlCpp,
@@ -276,6 +317,78 @@ function makeServer(make, htmlLib) {
 		linkTo: [serverLib, gtest],
 	});
 
+	const rangeTest = d.addTest({
+		name: 'range_test',
+		src: ['test/range_test.cpp'],
+		linkTo: [serverLib, gtest],
+	});
+
+	const conditionalTest = d.addTest({
+		name: 'conditional_test',
+		src: ['test/conditional_test.cpp'],
+		linkTo: [serverLib, gtest],
+	});
+
+	const compressionTest = d.addTest({
+		name: 'compression_test',
+		src: ['test/compression_test.cpp'],
+		linkTo: [serverLib, zlib, gtest],
+	});
+
+	const contentCacheTest = d.addTest({
+		name: 'content_cache_test',
+		src: ['test/content_cache_test.cpp'],
+		linkTo: [serverLib, gtest],
+	});
+
+	const sessionTableTest = d.addTest({
+		name: 'session_table_test',
+		src: ['test/session_table_test.cpp'],
+		linkTo: [serverLib, gtest],
+	});
+
+	const mimeTypeTest = d.addTest({
+		name: 'mime_type_test',
+		src: ['test/mime_type_test.cpp'],
+		linkTo: [serverLib, gtest],
+	});
+
+	const logTest = d.addTest({
+		name: 'log_test',
+		src: ['test/log_test.cpp'],
+		linkTo: [serverLib, gtest],
+	});
+
+	const metricsTest = d.addTest({
+		name: 'metrics_test',
+		src: ['test/metrics_test.cpp'],
+		linkTo: [serverLib, gtest],
+	});
+
+	const archivePipeTest = d.addTest({
+		name: 'archive_pipe_test',
+		src: ['test/archive_pipe_test.cpp'],
+		linkTo: [serverLib, libarchive, gtest],
+	});
+
+	const tarIndexTest = d.addTest({
+		name: 'tar_index_test',
+		src: ['test/tar_index_test.cpp'],
+		linkTo: [serverLib, libarchive, gtest],
+	});
+
+	const blobStoreTest = d.addTest({
+		name: 'blob_store_test',
+		src: ['test/blob_store_test.cpp'],
+		linkTo: [serverLib, gtest],
+	});
+
+	const fileCloneTest = d.addTest({
+		name: 'file_clone_test',
+		src: ['test/file_clone_test.cpp'],
+		linkTo: [serverLib, gtest],
+	});
+
 	const formsTestConfig = makeConfig(make, 'test/forms_test_config.cpp', {
 		test_scratch_dir: Path.build('.scratch'),
 		content_dir: Path.src('test/content'),
@@ -287,7 +400,26 @@ function makeServer(make, htmlLib) {
 		linkTo: [htmlLib, serverLib, gtest, boost],
 	});
 
-	make.add('test', [urlTest.run, formsTest.run], () => {});
+	make.add(
+		'test',
+		[
+			urlTest.run,
+			rangeTest.run,
+			conditionalTest.run,
+			compressionTest.run,
+			contentCacheTest.run,
+			sessionTableTest.run,
+			mimeTypeTest.run,
+			logTest.run,
+			metricsTest.run,
+			archivePipeTest.run,
+			tarIndexTest.run,
+			blobStoreTest.run,
+			fileCloneTest.run,
+			formsTest.run,
+		],
+		() => {},
+	);
 
 	return { serverLib, distServer: d, testServer };
 }
@@ -63,16 +63,168 @@ typedef void html_forms_server_event_callback(const html_forms_server_event *ev,
 int HTML_API html_forms_server_set_event_callback(
     html_forms_server *server, html_forms_server_event_callback *cb, void *ctx);
 
+/**
+ * Configure compression of uploaded text resources. May be called while
+ * the server runs, in which case uploads compressed afterwards use the new
+ * settings.
+ * @param[in] server The server object
+ * @param[in] gzip_level The zlib compression level (1-9). 0 disables
+ * compression
+ * @param[in] min_size Files smaller than this many bytes are sent as is
+ * @return 1 on success, 0 on failure
+ */
+int HTML_API html_forms_server_set_compression(html_forms_server *server,
+                                               int gzip_level,
+                                               size_t min_size);
+
+/**
+ * Set the memory budget of the server-wide cache of uploaded files.
+ * Files larger than a quarter of the budget are always read from disk.
+ * @param[in] server The server object
+ * @param[in] budget The maximum number of bytes to cache. 0 disables
+ * caching
+ * @return 1 on success, 0 on failure
+ */
+int HTML_API html_forms_server_set_cache_budget(html_forms_server *server,
+                                                size_t budget);
+
+typedef struct {
+  unsigned long long hits;
+  unsigned long long misses;
+  unsigned long long bytes;
+  unsigned long long entries;
+} html_forms_server_cache_stats;
+
+/**
+ * Read the counters of the server-wide cache of uploaded files
+ * @param[in] server The server object
+ * @param[out] stats The current counters
+ * @return 1 on success, 0 on failure
+ */
+int HTML_API html_forms_server_get_cache_stats(
+    html_forms_server *server, html_forms_server_cache_stats *stats);
+
+/** Summary of a distribution. Quantiles are accurate to within 12.5% */
+typedef struct {
+  unsigned long long count;
+  unsigned long long sum;
+  unsigned long long p50;
+  unsigned long long p90;
+  unsigned long long p99;
+  unsigned long long max;
+} html_forms_server_histogram;
+
+typedef struct {
+  unsigned long long sessions_started;
+  long long sessions_active;
+  unsigned long long http_connections;
+  unsigned long long http_requests;
+  unsigned long long http_not_found;
+  /** Microseconds from reading a request to writing its response */
+  html_forms_server_histogram http_request_us;
+  unsigned long long uploads;
+  unsigned long long upload_bytes;
+  /** Bytes per second at which each upload was received */
+  html_forms_server_histogram upload_bytes_per_sec;
+  unsigned long long ws_connections;
+  unsigned long long ws_messages_in;
+  unsigned long long ws_bytes_in;
+  unsigned long long ws_messages_out;
+  unsigned long long ws_bytes_out;
+  /** Size in bytes of websocket messages in either direction */
+  html_forms_server_histogram ws_message_bytes;
+  unsigned long long form_submits;
+  /**
+   * Microseconds from a form submission to the application's next message
+   */
+  html_forms_server_histogram form_round_trip_us;
+  unsigned long long browser_events;
+  html_forms_server_cache_stats cache;
+} html_forms_server_stats;
+
+/**
+ * Read the server's counters and latency distributions. The same values
+ * are served in the Prometheus text format at /html/metrics.
+ * @param[in] server The server object
+ * @param[out] stats The current values
+ * @return 1 on success, 0 on failure
+ */
+int HTML_API html_forms_server_get_stats(html_forms_server *server,
+                                         html_forms_server_stats *stats);
+
+#define HTML_FORMS_SERVER_LOG_DEBUG 0
+#define HTML_FORMS_SERVER_LOG_INFO 1
+#define HTML_FORMS_SERVER_LOG_WARN 2
+#define HTML_FORMS_SERVER_LOG_ERROR 3
+
+/**
+ * Receive a log record
+ * @param[in] level One of the HTML_FORMS_SERVER_LOG_* levels
+ * @param[in] session_id The null terminated session ID, or an empty string
+ * for messages about the server as a whole
+ * @param[in] msg The null terminated message
+ * @param[in] ctx The context given to html_forms_server_set_log_callback
+ */
+typedef void html_forms_server_log_callback(int level, const char *session_id,
+                                            const char *msg, void *ctx);
+
+/**
+ * Install a sink for log records. Records are delivered one at a time on a
+ * background thread. Logging is shared by all servers in the process.
+ * @param[in] server The server object
+ * @param[in] cb The callback, or NULL to log to stderr (the default)
+ * @param[in] ctx Context passed to cb
+ * @return 1 on success, 0 on failure
+ * @remark Once this returns, the previous callback won't be invoked again
+ */
+int HTML_API html_forms_server_set_log_callback(
+    html_forms_server *server, html_forms_server_log_callback *cb, void *ctx);
+
+/**
+ * Set the minimum level of records to log. Defaults to
+ * HTML_FORMS_SERVER_LOG_INFO
+ * @param[in] server The server object
+ * @param[in] level One of the HTML_FORMS_SERVER_LOG_* levels
+ * @return 1 on success, 0 on failure
+ */
+int HTML_API html_forms_server_set_log_level(html_forms_server *server,
+                                             int level);
+
+/**
+ * Log the contents of requests and messages at debug level instead of only
+ * their sizes. Off by default since bodies may contain user data.
+ * @param[in] server The server object
+ * @param[in] enabled 1 to log bodies, 0 otherwise
+ * @return 1 on success, 0 on failure
+ */
+int HTML_API html_forms_server_set_log_bodies(html_forms_server *server,
+                                              int enabled);
+
 int HTML_API html_forms_server_run(html_forms_server *server);
+
+/**
+ * Like html_forms_server_run, but handle requests on multiple threads.
+ * The calling thread is one of them. The event callback is never invoked
+ * concurrently.
+ * @param[in] server The server object
+ * @param[in] nthreads The number of threads to run the server on
+ * @return 1 on success, 0 on failure
+ */
+int HTML_API html_forms_server_run_threads(html_forms_server *server,
+                                           unsigned int nthreads);
+
 int HTML_API html_forms_server_stop(html_forms_server *server);
 
 /**
  * Begin a new session with a consumer-provided session ID on connected fd
  * @param[in] server The server object
- * @param[in] session_id The null terminated session ID in UUID format. Should
- * not be easily guessable
+ * @param[in] session_id The null terminated session ID in 8-4-4-4-12 hex UUID
+ * format. Should not be easily guessable
  * @param[in] fd The connected fd (stream) that governs the session
  * @return 1 on success, 0 on failure
+ * @remark The server owns @a fd even on failure, when it's closed
+ * @remark Hex digits may be either case. URLs and events spell the session
+ * ID in lowercase.
  */
 int HTML_API html_forms_server_start_session(html_forms_server *server,
                                              const char *session_id, int fd);
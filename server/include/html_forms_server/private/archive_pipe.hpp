@@ -0,0 +1,109 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#ifndef ARCHIVE_PIPE_HPP
+#define ARCHIVE_PIPE_HPP
+
+#include <boost/asio/thread_pool.hpp>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct archive;
+
+/**
+ * Bounded queue of chunks from an upload being read on an io thread to
+ * libarchive reading on another thread. The writer never blocks. When the
+ * queue is full, it's told to wait until the reader makes room.
+ */
+class archive_pipe {
+public:
+  static constexpr std::size_t default_capacity = 4;
+
+  explicit archive_pipe(std::size_t capacity = default_capacity);
+
+  /**
+   * Queue a chunk for the reader. Dropped if the reader stopped reading
+   * @param[in] chunk The bytes
+   * @param[in] on_room Invoked on the reader's thread once there's room,
+   * only if this returns false
+   * @return true if another chunk may be pushed right away
+   */
+  bool push(std::vector<std::uint8_t> &&chunk, std::function<void()> on_room);
+
+  /** Signal the end of the data once the queued chunks are read */
+  void close();
+
+  /** Make pending and future reads fail */
+  void abort();
+
+  /**
+   * Wait for the next chunk. Valid until the next call
+   * @param[out] buf The start of the chunk
+   * @return The size of the chunk, 0 at the end of the data, or -1 if the
+   * pipe was aborted
+   */
+  std::ptrdiff_t read(const void **buf);
+
+  /** The reader is done. Queued and later chunks are dropped */
+  void stop_reading();
+
+private:
+  std::function<void()> take_on_room();
+
+  std::mutex mtx_;
+  std::condition_variable has_data_;
+  std::size_t capacity_;
+  std::deque<std::vector<std::uint8_t>> chunks_;
+  std::vector<std::uint8_t> current_;
+  std::function<void()> on_room_;
+  bool closed_ = false;
+  bool aborted_ = false;
+  bool reading_ = true;
+};
+
+/**
+ * Open an archive for reading from a pipe
+ * @param[in] a The archive from archive_read_new()
+ * @param[in] pipe The pipe to read. Must outlive the archive
+ * @return The result of archive_read_open()
+ */
+int archive_read_open_pipe(struct archive *a, archive_pipe &pipe);
+
+/**
+ * Runs archive extractions on their own bounded pool, since they block
+ * waiting for upload data and would otherwise starve other disk work
+ */
+class archive_extractor {
+public:
+  static constexpr std::size_t default_threads = 2;
+
+  explicit archive_extractor(std::size_t nthreads = default_threads);
+
+  /**
+   * Run an extraction reading from a pipe
+   * @param[in] pipe The pipe, aborted by shutdown() if still open
+   * @param[in] fn The extraction
+   */
+  void run(const std::shared_ptr<archive_pipe> &pipe,
+           std::function<void()> fn);
+
+  /** Abort all pipes and wait for their extractions to return */
+  void shutdown();
+
+private:
+  boost::asio::thread_pool pool_;
+  std::mutex mtx_;
+  std::vector<std::weak_ptr<archive_pipe>> pipes_;
+};
+
+#endif
@@ -0,0 +1,73 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#ifndef BLOB_STORE_HPP
+#define BLOB_STORE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+
+/**
+ * Content addressed store of uploaded files shared by all sessions.
+ * Sessions' files are hard links to a blob named by the SHA-256 of its
+ * contents, so identical uploads share one inode on disk and in the page
+ * cache. A blob's link count is its reference count, which holds across
+ * server restarts.
+ */
+class blob_store {
+public:
+  /** The name of the store's directory in the sessions directory */
+  static constexpr const char *dir_name = ".blobs";
+
+  /** @param[in] dir The directory holding the blobs */
+  explicit blob_store(std::filesystem::path dir);
+
+  const std::filesystem::path &dir() const { return dir_; }
+
+  /**
+   * Share a file with identical uploads. Either the file becomes the blob
+   * for its contents, or it's replaced by a link to the existing blob. The
+   * file must not be written in place afterwards.
+   * @param[in] file A completely written upload
+   * @param[in] digest The hex SHA-256 of the file's contents
+   * @return true if the file is now in the store
+   */
+  bool add(const std::filesystem::path &file, std::string_view digest);
+
+  /**
+   * Make a file a link to an existing blob, so contents other sessions
+   * uploaded don't have to be uploaded again. The blob is hashed first, so
+   * a blob whose contents don't match its name is never linked.
+   * @param[in] digest The lowercase hex SHA-256 of the wanted contents
+   * @param[in] file The path to create or replace
+   * @param[in] size The expected size of the contents
+   * @return true if the file now has the contents, false if there's no
+   * such blob or its contents don't match
+   */
+  bool link(std::string_view digest, const std::filesystem::path &file,
+            std::uint64_t size);
+
+  /**
+   * Remove a blob if no file links to it anymore
+   * @param[in] digest The hex SHA-256 passed to add()
+   */
+  void release(std::string_view digest);
+
+  /**
+   * Remove every blob no file links to, like those left by sessions that
+   * ended without releasing theirs
+   * @return The number of blobs removed
+   */
+  std::size_t collect();
+
+private:
+  std::filesystem::path dir_;
+};
+
+#endif
@@ -10,9 +10,11 @@
 
 #include "html_forms_server.h"
 #include "html_forms_server/private/asio-pch.hpp"
+#include "html_forms_server/private/metrics.hpp"
 
 #include <msgstream.h>
 
+#include <mutex>
 #include <string>
 
 class browser {
@@ -22,7 +24,7 @@ public:
     virtual void window_close_requested() = 0;
   };
 
-  browser();
+  explicit browser(server_metrics &metrics);
 
   void run();
   void add_session(const std::string &session,
@@ -40,8 +42,14 @@ public:
   void request_close(const std::string &session);
 
 private:
+  server_metrics &metrics_;
+
+  std::mutex watchers_mtx_;
   std::map<std::string, std::weak_ptr<window_watcher>> watchers_;
 
+  // held while invoking the callback so it is never called concurrently.
+  // recursive because the callback may call back into the server.
+  std::recursive_mutex event_mtx_;
   void *event_ctx_;
   std::function<html_forms_server_event_callback> event_cb_;
   void notify_event(const html_forms_server_event &ev);
@@ -0,0 +1,65 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#ifndef COMPRESSION_HPP
+#define COMPRESSION_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <string>
+#include <string_view>
+
+// Set by the app while disk pool threads compress uploads, so each setting
+// is read atomically
+struct compression_config {
+  /** zlib compression level. 0 disables compression of uploads */
+  std::atomic<int> gzip_level = 6;
+
+  /** Files smaller than this are not worth compressing */
+  std::atomic<std::uint64_t> min_size = 1024;
+};
+
+/**
+ * Check whether a content coding is acceptable to the client
+ * @param[in] accept_encoding The Accept-Encoding header value
+ * @param[in] coding The content coding, like "gzip"
+ * @return true if the coding is listed (or matched by "*") with q > 0
+ */
+bool accepts_encoding(std::string_view accept_encoding,
+                      std::string_view coding);
+
+/**
+ * Check whether a MIME type is text-like and benefits from compression
+ * @param[in] mime The MIME type
+ */
+bool is_compressible(std::string_view mime);
+
+/**
+ * Write a gzip compressed copy of a file, or of a range of it
+ * @param[in] src The file to compress
+ * @param[in] dst The path of the compressed file
+ * @param[in] level The zlib compression level
+ * @param[in] offset Where the range to compress starts in src
+ * @param[in] length The size of the range. Stops early at the end of src
+ * @return true on success, false otherwise
+ */
+bool gzip_file(const std::filesystem::path &src,
+               const std::filesystem::path &dst, int level,
+               std::uint64_t offset = 0,
+               std::uint64_t length = UINT64_MAX);
+
+/**
+ * Compress a buffer with gzip
+ * @param[in] data The buffer to compress
+ * @param[in] level The zlib compression level
+ * @return The compressed contents, or an empty string on failure
+ */
+std::string gzip_bytes(std::span<const std::uint8_t> data, int level);
+
+#endif
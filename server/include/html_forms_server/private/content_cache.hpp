@@ -0,0 +1,89 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#ifndef CONTENT_CACHE_HPP
+#define CONTENT_CACHE_HPP
+
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Contents of an uploaded file, ready to be sent
+struct cached_content {
+  std::string bytes;
+  std::string mime;
+  std::string etag;
+  std::time_t last_modified;
+};
+
+struct content_cache_stats {
+  std::uint64_t hits;
+  std::uint64_t misses;
+  std::uint64_t bytes;
+  std::uint64_t entries;
+};
+
+// Bounded LRU cache of file contents shared by all sessions
+class content_cache {
+public:
+  using entry_ptr = std::shared_ptr<const cached_content>;
+
+  static constexpr std::size_t default_budget = 16 * 1024 * 1024;
+
+  explicit content_cache(std::size_t budget = default_budget);
+
+  /**
+   * Look up a file's contents and mark it most recently used
+   * @param[in] path The path of the file on disk
+   * @return The cached contents, or nullptr on a miss
+   */
+  entry_ptr find(const std::filesystem::path &path);
+
+  /**
+   * Cache a file's contents, evicting least recently used entries
+   * @param[in] path The path of the file on disk
+   * @param[in] entry The contents. Ignored if larger than max_entry_size()
+   */
+  void insert(const std::filesystem::path &path, entry_ptr entry);
+
+  /** Drop the entry for a file that was rewritten or removed */
+  void erase(const std::filesystem::path &path);
+
+  /** Drop the entries for all files in a directory tree */
+  void erase_under(const std::filesystem::path &dir);
+
+  /** Change the memory budget, evicting entries that no longer fit */
+  void set_budget(std::size_t budget);
+
+  /** The largest file worth caching under the current budget */
+  std::size_t max_entry_size() const;
+
+  content_cache_stats stats() const;
+
+private:
+  using lru_list = std::list<std::pair<std::string, entry_ptr>>;
+
+  void evict(std::size_t budget);
+  void erase(lru_list::iterator it);
+
+  mutable std::mutex mtx_;
+  std::size_t budget_;
+  std::size_t bytes_ = 0;
+  std::uint64_t hits_ = 0;
+  std::uint64_t misses_ = 0;
+
+  // front is most recently used
+  lru_list lru_;
+  std::unordered_map<std::string, lru_list::iterator> index_;
+};
+
+#endif
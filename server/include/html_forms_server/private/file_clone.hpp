@@ -0,0 +1,29 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#ifndef FILE_CLONE_HPP
+#define FILE_CLONE_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <system_error>
+
+/**
+ * Copy the whole contents of an open regular file to a new file, letting
+ * the kernel do as much of the work as the platform allows. A clone
+ * (reflink) shares the source's blocks, so it's nearly instant regardless
+ * of size. Otherwise the copy stays in the kernel with copy_file_range(2),
+ * and only falls back to read(2)/write(2) if neither is supported.
+ * @param[in] src_fd The file to copy. Its file offset is not used or changed
+ * @param[in] dst The path of the copy. An existing file is replaced
+ * @param[out] size The number of bytes copied
+ * @return An error if src_fd isn't a regular file or the copy failed
+ */
+std::error_code clone_file(int src_fd, const std::filesystem::path &dst,
+                           std::uint64_t &size);
+
+#endif
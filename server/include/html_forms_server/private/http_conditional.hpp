@@ -0,0 +1,52 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#ifndef HTTP_CONDITIONAL_HPP
+#define HTTP_CONDITIONAL_HPP
+
+#include <ctime>
+#include <string>
+#include <string_view>
+
+/**
+ * Format a time as an HTTP date
+ * @param[in] t The time to format
+ * @return An IMF-fixdate like "Sun, 06 Nov 1994 08:49:37 GMT"
+ */
+std::string http_date(std::time_t t);
+
+/**
+ * Parse an HTTP date in any of the formats recipients must accept
+ * (IMF-fixdate, RFC 850, asctime)
+ * @param[in] str The date string
+ * @param[out] t The parsed time
+ * @return true if the date was parsed, false otherwise
+ */
+bool parse_http_date(std::string_view str, std::time_t &t);
+
+/**
+ * Check an If-None-Match or If-Match list against an entity tag
+ * @param[in] list The header value, like `"a", W/"b"` or `*`
+ * @param[in] etag The current entity tag, including quotes
+ * @param[in] weak Use weak comparison (If-None-Match) instead of strong
+ * comparison (If-Match)
+ * @return true if any listed tag matches
+ */
+bool etag_list_matches(std::string_view list, std::string_view etag,
+                       bool weak);
+
+/**
+ * Evaluate an If-Range validator against the current representation
+ * @param[in] if_range The If-Range header value
+ * @param[in] etag The current strong entity tag, including quotes
+ * @param[in] last_modified The current modification time
+ * @return true if the Range header should be honored
+ */
+bool if_range_matches(std::string_view if_range, std::string_view etag,
+                      std::time_t last_modified);
+
+#endif
@@ -9,13 +9,26 @@
 #define HTTP_LISTENER_HPP
 
 #include "asio-pch.hpp"
+#include "content_cache.hpp"
+#include "metrics.hpp"
 #include "my-beast.hpp"
+#include "session_table.hpp"
+#include <functional>
 #include <memory>
+#include <variant>
+
+using http_response =
+    std::variant<boost::beast::http::message_generator, my::file_response>;
+
+using http_response_handler = std::function<void(http_response)>;
 
 struct http_session {
   virtual ~http_session() {}
-  virtual my::string_response respond(const std::string_view &target,
-                                      my::string_request &&req) = 0;
+
+  // cb may be invoked on another thread than the caller
+  virtual void async_respond(const std::string_view &target,
+                             my::string_request &&req,
+                             const http_response_handler &cb) = 0;
 
   virtual void connect_ws(boost::asio::ip::tcp::socket &&sock,
                           my::string_request &&req) = 0;
@@ -25,20 +38,30 @@ struct http_session {
 class http_listener : public std::enable_shared_from_this<http_listener> {
   boost::asio::io_context &ioc_;
   boost::asio::ip::tcp::acceptor acceptor_;
-  std::map<std::string, std::weak_ptr<http_session>> sessions_;
+  session_table<std::weak_ptr<http_session>> sessions_;
+  server_metrics &metrics_;
+  const content_cache &cache_;
 
 public:
   http_listener(boost::asio::io_context &ioc,
-                boost::asio::ip::tcp::endpoint endpoint);
+                boost::asio::ip::tcp::endpoint endpoint,
+                server_metrics &metrics, const content_cache &cache);
 
   // Start accepting incoming connections
   void run();
 
   std::uint16_t port() const { return acceptor_.local_endpoint().port(); }
 
-  bool add_session(const std::string &session_id,
+  bool add_session(const std::string_view &session_id,
                    std::weak_ptr<http_session> session);
-  void remove_session(const std::string &session_id);
+  void remove_session(const std::string_view &session_id);
+  std::shared_ptr<http_session>
+  find_session(const std::string_view &session_id) const;
+
+  server_metrics &metrics() const { return metrics_; }
+
+  // The body of the /html/metrics route
+  std::string metrics_text() const;
 
 private:
   void do_accept();
@@ -0,0 +1,47 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#ifndef HTTP_RANGE_HPP
+#define HTTP_RANGE_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct byte_range {
+  std::uint64_t offset;
+  std::uint64_t length;
+
+  bool operator==(const byte_range &other) const = default;
+};
+
+enum class range_status {
+  ignore,       /**< Header is malformed or absent. Send full representation */
+  satisfiable,  /**< At least one range overlaps the representation */
+  unsatisfiable /**< No range overlaps the representation (416) */
+};
+
+/**
+ * Parse a Range header value for a representation of a given size
+ * @param[in] header The value of the Range header
+ * @param[in] size The size in bytes of the full representation
+ * @param[out] ranges The satisfiable ranges, sorted and coalesced
+ * @return How the server should respond to the header
+ */
+range_status parse_range(std::string_view header, std::uint64_t size,
+                         std::vector<byte_range> &ranges);
+
+/**
+ * Format a Content-Range header value
+ * @param[in] range The range being sent
+ * @param[in] size The size in bytes of the full representation
+ * @return A value like "bytes 0-499/1234"
+ */
+std::string content_range(const byte_range &range, std::uint64_t size);
+
+#endif
@@ -0,0 +1,175 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#ifndef LOG_HPP
+#define LOG_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string_view>
+#include <thread>
+
+enum class log_level : int { debug = 0, info = 1, warn = 2, error = 3 };
+
+// Levels below this are compiled out of HTML_LOG
+#ifndef HTML_FORMS_SERVER_LOG_LEVEL
+#ifdef NDEBUG
+#define HTML_FORMS_SERVER_LOG_LEVEL 1
+#else
+#define HTML_FORMS_SERVER_LOG_LEVEL 0
+#endif
+#endif
+
+constexpr log_level compiled_log_level =
+    static_cast<log_level>(HTML_FORMS_SERVER_LOG_LEVEL);
+
+/** Longest message recorded. Longer messages are truncated */
+constexpr std::size_t log_msg_size = 480;
+
+/** Longest session ID recorded (a UUID) */
+constexpr std::size_t log_session_id_size = 36;
+
+// Both views are null terminated
+using log_sink = std::function<void(log_level, std::string_view session_id,
+                                    std::string_view msg)>;
+
+/**
+ * Process-wide logger. Records are pushed to a bounded lock-free ring buffer
+ * and handed to the sink on a background thread, so logging never blocks
+ * on I/O. Records are dropped if the ring is full.
+ */
+class logger {
+public:
+  static logger &instance();
+
+  ~logger();
+
+  bool enabled(log_level level) const {
+    return level >= level_.load(std::memory_order_relaxed);
+  }
+
+  void set_level(log_level level) { level_ = level; }
+
+  /** Whether request and message bodies should be logged */
+  bool log_bodies() const { return bodies_.load(std::memory_order_relaxed); }
+
+  void set_log_bodies(bool enabled) { bodies_ = enabled; }
+
+  /**
+   * Replace the sink. Once this returns, the old sink won't be called.
+   * @param[in] sink The new sink, or an empty function to log to stderr
+   */
+  void set_sink(log_sink sink);
+
+  /**
+   * Queue a record
+   * @param[in] level The severity
+   * @param[in] session_id The session, or empty for the server as a whole
+   * @param[in] msg The message
+   */
+  void write(log_level level, std::string_view session_id,
+             std::string_view msg);
+
+  /** Wait until every record queued so far has been handed to the sink */
+  void flush();
+
+  /** Number of records dropped because the ring was full */
+  std::uint64_t dropped() const { return dropped_; }
+
+private:
+  logger();
+
+  struct record {
+    log_level level;
+    std::uint8_t session_id_n;
+    std::uint16_t msg_n;
+    char session_id[log_session_id_size + 1];
+    char msg[log_msg_size + 1];
+  };
+
+  struct cell {
+    std::atomic<std::size_t> seq;
+    record rec;
+  };
+
+  static constexpr std::size_t ring_size = 1024;
+
+  bool try_pop(record &rec);
+  void drain_thread();
+  void wake_drainer();
+
+  std::atomic<log_level> level_{log_level::info};
+  std::atomic<bool> bodies_{false};
+  std::atomic<std::uint64_t> dropped_{0};
+
+  std::array<cell, ring_size> ring_;
+  alignas(64) std::atomic<std::size_t> enqueue_pos_{0};
+  alignas(64) std::size_t dequeue_pos_ = 0;
+
+  // number of records popped and handed to the sink
+  std::atomic<std::size_t> drained_{0};
+
+  std::atomic<bool> drainer_sleeping_{false};
+  std::atomic<bool> stop_{false};
+
+  std::mutex sink_mtx_;
+  log_sink sink_;
+
+  std::thread drainer_;
+};
+
+// Formats a record into a fixed buffer without allocating
+class log_stream : private std::streambuf, public std::ostream {
+  char buf_[log_msg_size];
+
+public:
+  log_stream() : std::ostream{this} { setp(buf_, buf_ + sizeof(buf_)); }
+
+  std::string_view view() const {
+    auto n = static_cast<std::size_t>(pptr() - pbase());
+    return std::string_view{pbase(), n};
+  }
+};
+
+/**
+ * Log a message built with operator<<, like
+ * HTML_LOG(info, session_id, "UPLOAD " << url);
+ * Nothing is evaluated if the level is disabled.
+ */
+#define HTML_LOG(LEVEL, SESSION_ID, EXPR)                                      \
+  do {                                                                         \
+    if constexpr (log_level::LEVEL >= compiled_log_level) {                    \
+      auto &html_logger_ = logger::instance();                                 \
+      if (html_logger_.enabled(log_level::LEVEL)) {                            \
+        log_stream html_log_os_;                                               \
+        html_log_os_ << EXPR;                                                  \
+        html_logger_.write(log_level::LEVEL, SESSION_ID,                       \
+                           html_log_os_.view());                               \
+      }                                                                        \
+    }                                                                          \
+  } while (0)
+
+/**
+ * Log a request or message body at debug level. Only its size is logged
+ * unless body logging is enabled.
+ */
+#define HTML_LOG_BODY(SESSION_ID, WHAT, BODY)                                  \
+  do {                                                                         \
+    if constexpr (log_level::debug >= compiled_log_level) {                    \
+      if (logger::instance().log_bodies())                                     \
+        HTML_LOG(debug, SESSION_ID, WHAT << ": " << BODY);                     \
+      else                                                                     \
+        HTML_LOG(debug, SESSION_ID, WHAT << ": " << (BODY).size() << " bytes");\
+    }                                                                          \
+  } while (0)
+
+#endif
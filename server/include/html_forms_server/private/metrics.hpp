@@ -0,0 +1,136 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include "content_cache.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Monotonically increasing count, safe to bump from any thread
+class counter {
+public:
+  void add(std::uint64_t n = 1) { n_.fetch_add(n, std::memory_order_relaxed); }
+  std::uint64_t value() const { return n_.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<std::uint64_t> n_ = 0;
+  static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+};
+
+// Current level of something that comes and goes, like open sessions
+class gauge {
+public:
+  void add(std::int64_t n) { n_.fetch_add(n, std::memory_order_relaxed); }
+  std::int64_t value() const { return n_.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<std::int64_t> n_ = 0;
+};
+
+struct histogram_snapshot;
+
+/**
+ * Distribution of unsigned samples in log-linear buckets, like an HDR
+ * histogram. Values below sub_count are exact. Above that, each power of
+ * two is split into sub_count equal buckets, bounding the relative error by
+ * 1/sub_count. Recording is a few relaxed atomic adds.
+ */
+class histogram {
+public:
+  static constexpr unsigned sub_bits = 3;
+  static constexpr std::size_t sub_count = std::size_t{1} << sub_bits;
+  static constexpr std::size_t bucket_count = (64 - sub_bits + 1) * sub_count;
+
+  void record(std::uint64_t value);
+
+  /** Record the time elapsed since start in microseconds */
+  void record_since(std::chrono::steady_clock::time_point start);
+
+  histogram_snapshot snapshot() const;
+
+  static std::size_t bucket_index(std::uint64_t value);
+
+  /** The smallest value that falls in a bucket */
+  static std::uint64_t bucket_lower(std::size_t i);
+
+  /** The largest value that falls in a bucket */
+  static std::uint64_t bucket_upper(std::size_t i);
+
+private:
+  std::array<std::atomic<std::uint64_t>, bucket_count> buckets_{};
+  std::atomic<std::uint64_t> count_ = 0;
+  std::atomic<std::uint64_t> sum_ = 0;
+  std::atomic<std::uint64_t> max_ = 0;
+};
+
+// Copy of a histogram that can be inspected without racing recorders
+struct histogram_snapshot {
+  std::array<std::uint64_t, histogram::bucket_count> buckets;
+  std::uint64_t count;
+  std::uint64_t sum;
+  std::uint64_t max;
+
+  /**
+   * Estimate a quantile
+   * @param[in] q The quantile in [0, 1]
+   * @return The upper bound of the bucket holding the quantile, or 0 if no
+   * samples were recorded
+   */
+  std::uint64_t quantile(double q) const;
+};
+
+// Everything the server counts. One instance is shared by all sessions.
+struct server_metrics {
+  // catui sessions
+  counter sessions_started;
+  gauge sessions_active;
+
+  // HTTP connections and requests
+  counter http_connections;
+  gauge http_connections_active;
+  counter http_requests;
+  counter http_not_found;
+  histogram http_request_us;
+
+  // resources uploaded by applications
+  counter uploads;
+  counter upload_bytes;
+  histogram upload_bytes_per_sec;
+
+  // websocket traffic
+  counter ws_connections;
+  counter ws_messages_in;
+  counter ws_bytes_in;
+  counter ws_messages_out;
+  counter ws_bytes_out;
+  histogram ws_message_bytes;
+
+  // forms, from the POST until the application sends its next message
+  counter form_submits;
+  histogram form_round_trip_us;
+
+  // events delivered to the browser callback
+  counter browser_events;
+};
+
+/**
+ * Render metrics in the Prometheus text exposition format. Histograms only
+ * list their non-empty buckets.
+ * @param[in] metrics The server's metrics
+ * @param[in] cache The counters of the server's content cache
+ * @return The text of the exposition
+ */
+std::string prometheus_text(const server_metrics &metrics,
+                            const content_cache_stats &cache);
+
+#endif
@@ -8,8 +8,52 @@
 #ifndef MIME_TYPE_HPP
 #define MIME_TYPE_HPP
 
-#include "asio-pch.hpp"
+#include <string>
+#include <string_view>
+#include <vector>
 
+/** Longest file extension a mime map can override (see html_mime_map_add) */
+constexpr std::size_t max_mime_ext_size = 16;
+
+/**
+ * Look up the built-in MIME type for a lowercase file extension
+ * @param[in] ext The extension without the '.'
+ * @return The MIME type, or "text/plain" if not known
+ */
 std::string_view mime_type(const std::string_view &ext);
 
+// Small open-addressing map of a session's MIME type overrides
+class mime_overlay {
+public:
+  /** Map an extension to a MIME type, replacing any existing mapping */
+  void set(std::string_view ext, std::string_view mime);
+
+  /** @return The overriding MIME type, or an empty view if none */
+  std::string_view find(std::string_view ext) const;
+
+  std::size_t size() const { return size_; }
+
+private:
+  struct slot {
+    bool full = false;
+    std::string ext;
+    std::string mime;
+  };
+
+  std::size_t probe(std::string_view ext) const;
+
+  std::vector<slot> slots_;
+  std::size_t size_ = 0;
+};
+
+/**
+ * Find the MIME type for a URL by its (case insensitive) extension.
+ * Overrides take precedence over built-in types. Doesn't allocate.
+ * @param[in] url The URL
+ * @param[in] overrides The session's overrides
+ * @return The MIME type, or an empty view if the URL has no extension
+ */
+std::string_view mime_type_for_url(std::string_view url,
+                                   const mime_overlay &overrides);
+
 #endif
@@ -29,6 +29,16 @@ void async_msgstream_recv(stream_descriptor &stream,
                           const boost::asio::mutable_buffer &buf,
                           const std::function<msgstream_handler> &handler);
 
+/**
+ * Receive a file descriptor sent over a Unix socket with SCM_RIGHTS. The
+ * sender attaches it to a single byte, which is consumed.
+ * @param[in] stream The Unix socket
+ * @param[in] cb Called with the error (if any) and the received descriptor,
+ * which the callback owns
+ */
+void async_recv_fd(stream_descriptor &stream,
+                   const std::function<void(std::error_code, int)> &cb);
+
 } // namespace my
 
 #endif
@@ -19,6 +19,56 @@ namespace ws = beast::websocket;
 
 using string_response = http::response<boost::beast::http::string_body>;
 using string_request = http::request<boost::beast::http::string_body>;
+using empty_response = http::response<boost::beast::http::empty_body>;
+
+// Part of a file response body. The preamble is written before the range
+// of the file.
+struct file_segment {
+  std::string preamble;
+  std::uint64_t offset = 0;
+  std::uint64_t length = 0;
+};
+
+// Response whose body is written directly from an open file
+struct file_response {
+  empty_response header;
+  beast::file body;
+  std::vector<file_segment> segments;
+  std::string trailer;
+};
+
+// Body that shares ownership of an immutable string, like a cache entry
+struct shared_string_body {
+  using value_type = std::shared_ptr<const std::string>;
+
+  static std::uint64_t size(const value_type &body) {
+    return body ? body->size() : 0;
+  }
+
+  class writer {
+    const value_type &body_;
+
+  public:
+    using const_buffers_type = asio::const_buffer;
+
+    template <bool isRequest, class Fields>
+    writer(const http::header<isRequest, Fields> &, const value_type &body)
+        : body_{body} {}
+
+    void init(beast::error_code &ec) { ec = {}; }
+
+    boost::optional<std::pair<const_buffers_type, bool>>
+    get(beast::error_code &ec) {
+      ec = {};
+      if (!body_)
+        return boost::none;
+
+      return {{const_buffers_type{body_->data(), body_->size()}, false}};
+    }
+  };
+};
+
+using shared_string_response = http::response<shared_string_body>;
 
 using ws_stream = ws::stream<beast::tcp_stream>;
 
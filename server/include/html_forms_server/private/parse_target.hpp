@@ -9,9 +9,24 @@
 #define PARSE_TARGET_HPP
 
 #include <cstdlib>
+#include <string_view>
 
 int parse_target(const char *target, char *session_id,
                  std::size_t session_id_len, char *normalized_path,
                  std::size_t norm_path_len);
 
+/**
+ * Same as above, but the target doesn't need a null terminator and the
+ * session ID isn't copied. The path is normalized in a single pass.
+ * @param[in] target The request target
+ * @param[out] session_id The session ID. Points into target
+ * @param[out] normalized_path Null terminated normalized path
+ * @param[in] norm_path_len The size of normalized_path
+ * @param[out] norm_path_n The length of the normalized path
+ * @return 1 on success, 0 on failure
+ */
+int parse_target(std::string_view target, std::string_view &session_id,
+                 char *normalized_path, std::size_t norm_path_len,
+                 std::size_t &norm_path_n);
+
 #endif
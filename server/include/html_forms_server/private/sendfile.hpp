@@ -0,0 +1,33 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#ifndef SENDFILE_HPP
+#define SENDFILE_HPP
+
+#include "asio-pch.hpp"
+
+namespace my {
+namespace asio = boost::asio;
+namespace beast = boost::beast;
+using tcp = asio::ip::tcp;
+
+/**
+ * Write a range of a file to a socket. Uses sendfile(2) where available so
+ * that the contents never pass through a userspace buffer.
+ * @param[in] sock The connected socket to write to
+ * @param[in] fd The open file to read from
+ * @param[in] offset The position in the file to begin reading
+ * @param[in] length The number of bytes to write
+ * @param[in] cb Called with the error (if any) and number of bytes written
+ */
+void async_sendfile(
+    tcp::socket &sock, int fd, std::uint64_t offset, std::uint64_t length,
+    const std::function<void(beast::error_code, std::size_t)> &cb);
+
+} // namespace my
+
+#endif
@@ -0,0 +1,217 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#ifndef SESSION_TABLE_HPP
+#define SESSION_TABLE_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Binary form of a session's UUID
+using session_uuid = std::array<std::uint8_t, 16>;
+
+/**
+ * Parse a UUID in 8-4-4-4-12 hex format. Hex digits may be either case.
+ * @param[in] str The UUID string
+ * @param[out] uuid The parsed bytes
+ * @return true if str is a valid UUID, false otherwise
+ */
+bool parse_session_uuid(std::string_view str, session_uuid &uuid);
+
+/**
+ * Spell a session id with lowercase hex digits, as it appears in URLs and
+ * events, so that every spelling of a UUID names the same session
+ * @param[in] str The session id
+ * @return The lowercase session id
+ */
+std::string lowercase_session_id(std::string_view str);
+
+/**
+ * Hash table keyed by session UUID. It is split into shards that are locked
+ * independently so that lookups from many threads rarely contend. Each
+ * shard is an open-addressing table with linear probing, so lookups don't
+ * allocate.
+ */
+template <typename Value> class session_table {
+public:
+  static constexpr std::size_t shard_count = 16;
+
+  /**
+   * Add an entry
+   * @param[in] key The session UUID
+   * @param[in] value The value to associate with key
+   * @return true if added, false if key already exists
+   */
+  bool insert(const session_uuid &key, const Value &value) {
+    auto h = hash(key);
+    return shard_for(h).insert(h, key, value);
+  }
+
+  /**
+   * Remove an entry
+   * @param[in] key The session UUID
+   * @return true if an entry was removed
+   */
+  bool erase(const session_uuid &key) {
+    auto h = hash(key);
+    return shard_for(h).erase(h, key);
+  }
+
+  /**
+   * Look up an entry
+   * @param[in] key The session UUID
+   * @param[out] value The value associated with key
+   * @return true if found, false otherwise
+   */
+  bool find(const session_uuid &key, Value &value) const {
+    auto h = hash(key);
+    return shard_for(h).find(h, key, value);
+  }
+
+  std::size_t size() const {
+    std::size_t n = 0;
+    for (const auto &s : shards_)
+      n += s.size();
+
+    return n;
+  }
+
+  bool empty() const { return size() == 0; }
+
+private:
+  static std::uint64_t hash(const session_uuid &key) {
+    std::uint64_t a, b;
+    std::memcpy(&a, key.data(), sizeof(a));
+    std::memcpy(&b, key.data() + sizeof(a), sizeof(b));
+
+    // UUIDs are not guaranteed random (e.g. time-based), so mix all bits
+    std::uint64_t h = a ^ (b * 0x9e3779b97f4a7c15ull);
+    h ^= h >> 32;
+    h *= 0xd6e8feb86659fd93ull;
+    h ^= h >> 32;
+    return h;
+  }
+
+  class shard {
+    enum class slot_state : std::uint8_t { empty, full, deleted };
+
+    struct slot {
+      session_uuid key;
+      slot_state state = slot_state::empty;
+      Value value;
+    };
+
+    static constexpr std::size_t initial_capacity = 16;
+
+    mutable std::shared_mutex mtx_;
+    std::vector<slot> slots_;
+    std::size_t size_ = 0;
+    std::size_t used_ = 0; // full or deleted
+
+    // index of key's slot, or of the empty slot that ends its probe
+    std::size_t probe(std::uint64_t h, const session_uuid &key) const {
+      auto mask = slots_.size() - 1;
+      for (auto i = h & mask;; i = (i + 1) & mask) {
+        const auto &s = slots_[i];
+        if (s.state == slot_state::empty ||
+            (s.state == slot_state::full && s.key == key))
+          return i;
+      }
+    }
+
+    void rehash(std::size_t capacity) {
+      auto old = std::move(slots_);
+      slots_.clear();
+      slots_.resize(capacity);
+      used_ = size_;
+
+      for (auto &s : old) {
+        if (s.state != slot_state::full)
+          continue;
+
+        auto &dst = slots_[probe(hash(s.key), s.key)];
+        dst.key = s.key;
+        dst.state = slot_state::full;
+        dst.value = std::move(s.value);
+      }
+    }
+
+  public:
+    bool insert(std::uint64_t h, const session_uuid &key, const Value &value) {
+      std::unique_lock lock{mtx_};
+
+      // keep load (including tombstones) at or below 1/2
+      if ((used_ + 1) * 2 > slots_.size()) {
+        auto capacity = std::max(slots_.size(), initial_capacity);
+        if ((size_ + 1) * 4 > capacity)
+          capacity *= 2;
+
+        rehash(capacity);
+      }
+
+      auto i = probe(h, key);
+      auto &s = slots_[i];
+      if (s.state == slot_state::full)
+        return false;
+
+      s.key = key;
+      s.state = slot_state::full;
+      s.value = value;
+      ++size_;
+      ++used_;
+      return true;
+    }
+
+    bool erase(std::uint64_t h, const session_uuid &key) {
+      std::unique_lock lock{mtx_};
+      if (slots_.empty())
+        return false;
+
+      auto &s = slots_[probe(h, key)];
+      if (s.state != slot_state::full)
+        return false;
+
+      s.state = slot_state::deleted;
+      s.value = Value{};
+      --size_;
+      return true;
+    }
+
+    bool find(std::uint64_t h, const session_uuid &key, Value &value) const {
+      std::shared_lock lock{mtx_};
+      if (slots_.empty())
+        return false;
+
+      const auto &s = slots_[probe(h, key)];
+      if (s.state != slot_state::full)
+        return false;
+
+      value = s.value;
+      return true;
+    }
+
+    std::size_t size() const {
+      std::shared_lock lock{mtx_};
+      return size_;
+    }
+  };
+
+  shard &shard_for(std::uint64_t h) { return shards_[h >> 60]; }
+  const shard &shard_for(std::uint64_t h) const { return shards_[h >> 60]; }
+
+  static_assert(shard_count == 16, "shard_for uses the top 4 bits");
+  std::array<shard, shard_count> shards_;
+};
+
+#endif
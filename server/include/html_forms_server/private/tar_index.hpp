@@ -0,0 +1,87 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#ifndef TAR_INDEX_HPP
+#define TAR_INDEX_HPP
+
+#include <html_forms/private/sha256.h>
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+constexpr std::size_t tar_block_size = 512;
+
+// A regular file stored in an uncompressed tar archive
+struct tar_entry {
+  std::string pathname;
+
+  /** Where the contents start in the archive */
+  std::uint64_t offset;
+  std::uint64_t size;
+  std::array<std::uint8_t, HTML_SHA256_SIZE> sha256;
+};
+
+/**
+ * Check whether a block is a valid ustar or GNU tar header, like the first
+ * block of an uncompressed tar archive
+ * @param[in] block The first bytes of the data. Fewer than tar_block_size
+ * bytes is never a header
+ */
+bool is_tar_header(std::span<const std::uint8_t> block);
+
+/**
+ * Parses an uncompressed tar archive as it arrives, finding where each
+ * regular file's contents are and hashing them. Understands ustar, GNU
+ * long names and pax path and size records.
+ */
+class tar_indexer {
+public:
+  /**
+   * Parse the next bytes of the archive
+   * @param[in] data The bytes following those previously fed
+   * @param[out] completed Files whose contents ended in data are appended
+   * @return false if the archive is malformed
+   */
+  bool feed(std::span<const std::uint8_t> data,
+            std::vector<tar_entry> &completed);
+
+  /** Whether the end of archive marker was seen */
+  bool done() const { return state_ == state::end; }
+
+private:
+  enum class state { header, contents, extension, skip, end, error };
+
+  bool parse_header(std::vector<tar_entry> &completed);
+  void finish_extension();
+  void start_padding(std::uint64_t size);
+
+  state state_ = state::header;
+  std::uint64_t offset_ = 0;
+
+  std::array<std::uint8_t, tar_block_size> block_;
+  std::size_t block_n_ = 0;
+
+  // bytes left in the current state
+  std::uint64_t left_ = 0;
+  std::uint64_t padding_ = 0;
+
+  // the file whose contents are being read
+  tar_entry entry_;
+  html_sha256_ctx hash_;
+
+  // GNU long name or pax records applying to the next header
+  char extension_type_ = 0;
+  std::string extension_;
+  std::string next_path_;
+  std::uint64_t next_size_ = 0;
+  bool has_next_size_ = false;
+};
+
+#endif
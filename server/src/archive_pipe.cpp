@@ -0,0 +1,136 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#include "html_forms_server/private/archive_pipe.hpp"
+
+#include <archive.h>
+#include <boost/asio/post.hpp>
+#include <cerrno>
+#include <utility>
+
+archive_pipe::archive_pipe(std::size_t capacity) : capacity_{capacity} {}
+
+bool archive_pipe::push(std::vector<std::uint8_t> &&chunk,
+                        std::function<void()> on_room) {
+  // an empty chunk would read as the end of the data
+  if (chunk.empty())
+    return true;
+
+  std::lock_guard lock{mtx_};
+  if (!reading_ || aborted_)
+    return true;
+
+  chunks_.push_back(std::move(chunk));
+  has_data_.notify_one();
+
+  if (chunks_.size() < capacity_)
+    return true;
+
+  on_room_ = std::move(on_room);
+  return false;
+}
+
+void archive_pipe::close() {
+  std::lock_guard lock{mtx_};
+  closed_ = true;
+  has_data_.notify_one();
+}
+
+void archive_pipe::abort() {
+  std::function<void()> on_room;
+  {
+    std::lock_guard lock{mtx_};
+    aborted_ = true;
+    on_room = std::move(on_room_);
+    has_data_.notify_one();
+  }
+
+  // dropped outside the lock since it may own the writer's state
+}
+
+std::ptrdiff_t archive_pipe::read(const void **buf) {
+  std::function<void()> on_room;
+  {
+    std::unique_lock lock{mtx_};
+    has_data_.wait(lock,
+                   [this] { return !chunks_.empty() || closed_ || aborted_; });
+
+    if (aborted_)
+      return -1;
+
+    if (chunks_.empty())
+      return 0;
+
+    current_ = std::move(chunks_.front());
+    chunks_.pop_front();
+    on_room = take_on_room();
+  }
+
+  if (on_room)
+    on_room();
+
+  *buf = current_.data();
+  return static_cast<std::ptrdiff_t>(current_.size());
+}
+
+void archive_pipe::stop_reading() {
+  std::function<void()> on_room;
+  {
+    std::lock_guard lock{mtx_};
+    reading_ = false;
+    chunks_.clear();
+    on_room = take_on_room();
+  }
+
+  // the writer keeps going so the rest of the upload is consumed
+  if (on_room)
+    on_room();
+}
+
+std::function<void()> archive_pipe::take_on_room() {
+  if (chunks_.size() >= capacity_ && reading_)
+    return {};
+
+  return std::exchange(on_room_, nullptr);
+}
+
+static la_ssize_t read_pipe(struct archive *a, void *ctx, const void **buf) {
+  auto n = static_cast<archive_pipe *>(ctx)->read(buf);
+  if (n < 0)
+    archive_set_error(a, ECANCELED, "Upload was aborted");
+
+  return n;
+}
+
+int archive_read_open_pipe(struct archive *a, archive_pipe &pipe) {
+  return archive_read_open(a, &pipe, nullptr, &read_pipe, nullptr);
+}
+
+archive_extractor::archive_extractor(std::size_t nthreads) : pool_{nthreads} {}
+
+void archive_extractor::run(const std::shared_ptr<archive_pipe> &pipe,
+                            std::function<void()> fn) {
+  {
+    std::lock_guard lock{mtx_};
+    std::erase_if(pipes_, [](const auto &p) { return p.expired(); });
+    pipes_.push_back(pipe);
+  }
+
+  boost::asio::post(pool_, std::move(fn));
+}
+
+void archive_extractor::shutdown() {
+  {
+    std::lock_guard lock{mtx_};
+    for (const auto &p : pipes_) {
+      if (auto pipe = p.lock())
+        pipe->abort();
+    }
+  }
+
+  pool_.join();
+}
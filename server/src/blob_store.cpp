@@ -0,0 +1,136 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#include "html_forms_server/private/blob_store.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <html_forms/private/sha256.h>
+
+namespace fs = std::filesystem;
+
+// Digests name files, so nothing else is accepted
+static bool is_digest(std::string_view digest) {
+  return digest.size() == 64 &&
+         std::all_of(digest.begin(), digest.end(),
+                     [](char c) { return std::isxdigit(c); });
+}
+
+// Atomically make a file another link to a blob, so it's always servable
+static std::error_code link_over(const fs::path &blob, const fs::path &file) {
+  auto tmp = file;
+  tmp += ".link";
+
+  std::error_code ec;
+  fs::create_hard_link(blob, tmp, ec);
+  if (ec)
+    return ec;
+
+  fs::rename(tmp, file, ec);
+  if (ec) {
+    std::error_code rm_ec;
+    fs::remove(tmp, rm_ec);
+  }
+
+  return ec;
+}
+
+// Whether a file's contents hash to digest
+static bool has_digest(const fs::path &path, std::string_view digest) {
+  std::ifstream in{path, std::ios::binary};
+  if (!in)
+    return false;
+
+  html_sha256_ctx hash;
+  html_sha256_init(&hash);
+
+  char buf[64 * 1024];
+  while (in.read(buf, sizeof(buf)) || in.gcount() > 0)
+    html_sha256_update(&hash, buf, in.gcount());
+
+  if (in.bad())
+    return false;
+
+  std::uint8_t bytes[HTML_SHA256_SIZE];
+  char hex[HTML_SHA256_HEX_SIZE];
+  html_sha256_final(&hash, bytes);
+  html_sha256_hex(bytes, hex);
+  return digest == hex;
+}
+
+blob_store::blob_store(fs::path dir) : dir_{std::move(dir)} {}
+
+bool blob_store::add(const fs::path &file, std::string_view digest) {
+  if (!is_digest(digest))
+    return false;
+
+  auto blob = dir_ / digest;
+
+  // another session may release the blob between the two attempts
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    std::error_code ec;
+    fs::create_hard_link(file, blob, ec);
+    if (!ec)
+      return true;
+
+    if (ec != std::errc::file_exists)
+      return false;
+
+    if (fs::equivalent(file, blob, ec))
+      return true;
+
+    ec = link_over(blob, file);
+    if (ec != std::errc::no_such_file_or_directory)
+      return !ec;
+  }
+
+  return false;
+}
+
+bool blob_store::link(std::string_view digest, const fs::path &file,
+                      std::uint64_t size) {
+  if (!is_digest(digest))
+    return false;
+
+  auto blob = dir_ / digest;
+  std::error_code ec;
+  if (fs::file_size(blob, ec) != size || ec)
+    return false;
+
+  // The digest comes from the client, and the store is shared, so the
+  // blob is only handed out if it really has those contents
+  if (!has_digest(blob, digest))
+    return false;
+
+  return !link_over(blob, file);
+}
+
+void blob_store::release(std::string_view digest) {
+  if (!is_digest(digest))
+    return;
+
+  auto blob = dir_ / digest;
+  std::error_code ec;
+  if (fs::hard_link_count(blob, ec) == 1 && !ec)
+    fs::remove(blob, ec);
+}
+
+std::size_t blob_store::collect() {
+  std::size_t n = 0;
+  std::error_code ec;
+  for (const auto &entry : fs::directory_iterator{dir_, ec}) {
+    std::error_code link_ec;
+    if (entry.hard_link_count(link_ec) != 1 || link_ec)
+      continue;
+
+    if (fs::remove(entry.path(), link_ec))
+      ++n;
+  }
+
+  return n;
+}
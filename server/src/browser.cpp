@@ -8,34 +8,45 @@
 #include "html_forms_server/private/browser.hpp"
 #include "html_forms_server.h"
 #include "html_forms_server/private/evt_util.hpp"
+#include "html_forms_server/private/log.hpp"
 #include <iterator>
 
 using window_watcher = browser::window_watcher;
 
-browser::browser() {}
+browser::browser(server_metrics &metrics) : metrics_{metrics} {}
 
 void browser::request_close(const std::string &session) {
-  auto it = watchers_.find(session);
-  if (it == watchers_.end()) {
-    std::cerr << "Attempting to close session that has no watcher: " << session
-              << std::endl;
-    return;
+  std::shared_ptr<window_watcher> win_ptr;
+
+  {
+    std::lock_guard lock{watchers_mtx_};
+    auto it = watchers_.find(session);
+    if (it == watchers_.end()) {
+      HTML_LOG(warn, session, "Attempting to close session with no watcher");
+      return;
+    }
+
+    win_ptr = it->second.lock();
+    if (!win_ptr)
+      watchers_.erase(it);
   }
 
-  if (auto win_ptr = it->second.lock()) {
+  if (win_ptr)
     win_ptr->window_close_requested();
-  } else {
-    watchers_.erase(it);
-  }
 }
 
 void browser::add_session(const std::string &session,
                           const std::weak_ptr<window_watcher> &watcher) {
+  std::lock_guard lock{watchers_mtx_};
   watchers_[session] = watcher;
 }
 
 void browser::remove_session(const std::string &session) {
-  watchers_.erase(session);
+  {
+    std::lock_guard lock{watchers_mtx_};
+    watchers_.erase(session);
+  }
+
   html_forms_server_event ev;
   ev.type = HTML_FORMS_SERVER_EVENT_CLOSE_WINDOW;
   copy_session_id(session, ev.data.close_win.session_id);
@@ -74,11 +85,15 @@ browser::window_watcher::~window_watcher() {}
 
 void browser::set_event_callback(html_forms_server_event_callback *cb,
                                  void *ctx) {
+  std::lock_guard lock{event_mtx_};
   event_cb_ = cb;
   event_ctx_ = ctx;
 }
 
 void browser::notify_event(const html_forms_server_event &ev) {
+  metrics_.browser_events.add();
+
+  std::lock_guard lock{event_mtx_};
   if (event_cb_) {
     event_cb_(&ev, event_ctx_);
   }
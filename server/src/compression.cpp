@@ -0,0 +1,187 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#include "html_forms_server/private/compression.hpp"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <fstream>
+#include <zlib.h>
+
+static std::string_view trim(std::string_view sv) {
+  while (!sv.empty() && (sv.front() == ' ' || sv.front() == '\t'))
+    sv.remove_prefix(1);
+
+  while (!sv.empty() && (sv.back() == ' ' || sv.back() == '\t'))
+    sv.remove_suffix(1);
+
+  return sv;
+}
+
+static bool iequals(std::string_view a, std::string_view b) {
+  if (a.size() != b.size())
+    return false;
+
+  for (std::size_t i = 0; i < a.size(); ++i) {
+    if (std::tolower(a[i]) != std::tolower(b[i]))
+      return false;
+  }
+
+  return true;
+}
+
+// q=0, q=0.0, q=0.000 mean "not acceptable"
+static bool is_zero_qvalue(std::string_view params) {
+  while (!params.empty()) {
+    auto semi = params.find(';');
+    auto param = trim(params.substr(0, semi));
+    params = semi == std::string_view::npos ? std::string_view{}
+                                            : params.substr(semi + 1);
+
+    if (param.size() < 2 || std::tolower(param[0]) != 'q' || param[1] != '=')
+      continue;
+
+    auto q = param.substr(2);
+    return q.find_first_not_of("0.") == std::string_view::npos;
+  }
+
+  return false;
+}
+
+bool accepts_encoding(std::string_view accept_encoding,
+                      std::string_view coding) {
+  int wildcard = -1; // -1 absent, 0 rejected, 1 accepted
+
+  while (!accept_encoding.empty()) {
+    auto comma = accept_encoding.find(',');
+    auto item = accept_encoding.substr(0, comma);
+    accept_encoding = comma == std::string_view::npos
+                          ? std::string_view{}
+                          : accept_encoding.substr(comma + 1);
+
+    auto semi = item.find(';');
+    auto name = trim(item.substr(0, semi));
+    auto params = semi == std::string_view::npos ? std::string_view{}
+                                                 : item.substr(semi + 1);
+
+    bool accepted = !is_zero_qvalue(params);
+
+    if (iequals(name, coding))
+      return accepted;
+
+    if (name == "*")
+      wildcard = accepted;
+  }
+
+  return wildcard == 1;
+}
+
+bool is_compressible(std::string_view mime) {
+  if (mime.starts_with("text/"))
+    return true;
+
+  constexpr std::array<std::string_view, 4> types = {
+      "application/json", "application/xml", "application/javascript",
+      "image/svg+xml"};
+
+  for (const auto &t : types) {
+    if (mime == t)
+      return true;
+  }
+
+  return false;
+}
+
+// windowBits for deflateInit2 that selects a gzip wrapper
+static constexpr int gzip_window_bits = 15 + 16;
+
+bool gzip_file(const std::filesystem::path &src,
+               const std::filesystem::path &dst, int level,
+               std::uint64_t offset, std::uint64_t length) {
+  std::ifstream in{src, std::ios::binary};
+  if (!in)
+    return false;
+
+  if (offset > 0 && !in.seekg(offset))
+    return false;
+
+  // write to a temporary so a partial file is never served
+  auto tmp = dst;
+  tmp += ".tmp";
+  std::ofstream out{tmp, std::ios::binary};
+  if (!out)
+    return false;
+
+  z_stream zs{};
+  if (deflateInit2(&zs, level, Z_DEFLATED, gzip_window_bits, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK)
+    return false;
+
+  std::array<char, 64 * 1024> ibuf, obuf;
+  int flush = Z_NO_FLUSH;
+  int ret = Z_OK;
+
+  while (ret != Z_STREAM_END) {
+    if (zs.avail_in == 0 && flush != Z_FINISH) {
+      in.read(ibuf.data(), std::min<std::uint64_t>(ibuf.size(), length));
+      if (in.bad())
+        break;
+
+      zs.next_in = reinterpret_cast<Bytef *>(ibuf.data());
+      zs.avail_in = in.gcount();
+      length -= zs.avail_in;
+      if (in.eof() || length == 0)
+        flush = Z_FINISH;
+    }
+
+    zs.next_out = reinterpret_cast<Bytef *>(obuf.data());
+    zs.avail_out = obuf.size();
+
+    ret = deflate(&zs, flush);
+    if (ret == Z_STREAM_ERROR)
+      break;
+
+    out.write(obuf.data(), obuf.size() - zs.avail_out);
+  }
+
+  deflateEnd(&zs);
+  out.close();
+
+  std::error_code ec;
+  if (ret != Z_STREAM_END || !out) {
+    std::filesystem::remove(tmp, ec);
+    return false;
+  }
+
+  std::filesystem::rename(tmp, dst, ec);
+  return !ec;
+}
+
+std::string gzip_bytes(std::span<const std::uint8_t> data, int level) {
+  z_stream zs{};
+  if (deflateInit2(&zs, level, Z_DEFLATED, gzip_window_bits, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK)
+    return {};
+
+  std::string out;
+  out.resize(deflateBound(&zs, data.size()));
+
+  zs.next_in = const_cast<Bytef *>(data.data());
+  zs.avail_in = data.size();
+  zs.next_out = reinterpret_cast<Bytef *>(out.data());
+  zs.avail_out = out.size();
+
+  int ret = deflate(&zs, Z_FINISH);
+  out.resize(out.size() - zs.avail_out);
+  deflateEnd(&zs);
+
+  if (ret != Z_STREAM_END)
+    return {};
+
+  return out;
+}
@@ -0,0 +1,99 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#include "html_forms_server/private/content_cache.hpp"
+
+content_cache::content_cache(std::size_t budget) : budget_{budget} {}
+
+content_cache::entry_ptr
+content_cache::find(const std::filesystem::path &path) {
+  std::lock_guard lock{mtx_};
+
+  auto it = index_.find(path.native());
+  if (it == index_.end()) {
+    ++misses_;
+    return nullptr;
+  }
+
+  ++hits_;
+  lru_.splice(lru_.begin(), lru_, it->second);
+  return it->second->second;
+}
+
+void content_cache::insert(const std::filesystem::path &path,
+                           entry_ptr entry) {
+  std::lock_guard lock{mtx_};
+
+  // a single file shouldn't flush out everything else
+  auto size = entry->bytes.size();
+  if (size > budget_ / 4)
+    return;
+
+  auto it = index_.find(path.native());
+  if (it != index_.end())
+    erase(it->second);
+
+  evict(budget_ - size);
+
+  lru_.emplace_front(path.native(), std::move(entry));
+  index_[path.native()] = lru_.begin();
+  bytes_ += size;
+}
+
+void content_cache::erase(const std::filesystem::path &path) {
+  std::lock_guard lock{mtx_};
+
+  auto it = index_.find(path.native());
+  if (it != index_.end())
+    erase(it->second);
+}
+
+void content_cache::erase_under(const std::filesystem::path &dir) {
+  std::lock_guard lock{mtx_};
+
+  auto prefix = (dir / "").native();
+  for (auto it = lru_.begin(); it != lru_.end();) {
+    auto next = std::next(it);
+    if (it->first.starts_with(prefix))
+      erase(it);
+
+    it = next;
+  }
+}
+
+void content_cache::set_budget(std::size_t budget) {
+  std::lock_guard lock{mtx_};
+  budget_ = budget;
+  evict(budget_);
+}
+
+std::size_t content_cache::max_entry_size() const {
+  std::lock_guard lock{mtx_};
+  return budget_ / 4;
+}
+
+content_cache_stats content_cache::stats() const {
+  std::lock_guard lock{mtx_};
+
+  content_cache_stats s;
+  s.hits = hits_;
+  s.misses = misses_;
+  s.bytes = bytes_;
+  s.entries = lru_.size();
+  return s;
+}
+
+void content_cache::evict(std::size_t budget) {
+  while (bytes_ > budget && !lru_.empty())
+    erase(std::prev(lru_.end()));
+}
+
+void content_cache::erase(lru_list::iterator it) {
+  bytes_ -= it->second->bytes.size();
+  index_.erase(it->first);
+  lru_.erase(it);
+}
@@ -0,0 +1,151 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#include "html_forms_server/private/file_clone.hpp"
+
+#include <cerrno>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#elif defined(__APPLE__)
+#include <sys/clonefile.h>
+#endif
+
+namespace fs = std::filesystem;
+
+static std::error_code errno_code(int err = errno) {
+  return {err, std::generic_category()};
+}
+
+// Whether a clone or in-kernel copy failed only because the files don't
+// support it, like when they're on different file systems
+static bool is_unsupported(int err) {
+  return err == EXDEV || err == EINVAL || err == ENOSYS || err == ENOTSUP ||
+         err == EOPNOTSUPP || err == ENOTTY || err == EBADF;
+}
+
+#if defined(__APPLE__)
+// APFS clones a file by path, so there's no descriptor to copy into
+static std::error_code try_clonefile(int src_fd, const fs::path &dst,
+                                     bool &cloned) {
+  cloned = ::fclonefileat(src_fd, AT_FDCWD, dst.c_str(), 0) == 0;
+  if (cloned || is_unsupported(errno))
+    return {};
+
+  return errno_code();
+}
+#endif
+
+// Copy [offset, size) with read(2)/write(2)
+static std::error_code copy_rest(int src_fd, int dst_fd, std::uint64_t offset,
+                                 std::uint64_t size) {
+  std::vector<char> buf(256 * 1024);
+  while (offset < size) {
+    auto n = std::min<std::uint64_t>(buf.size(), size - offset);
+    ssize_t nread = ::pread(src_fd, buf.data(), n, offset);
+    if (nread < 0 && errno == EINTR)
+      continue;
+
+    if (nread < 0)
+      return errno_code();
+
+    // the file shrank since it was measured
+    if (nread == 0)
+      return errno_code(EIO);
+
+    for (ssize_t i = 0; i < nread;) {
+      ssize_t nwritten = ::pwrite(dst_fd, buf.data() + i, nread - i, offset);
+      if (nwritten < 0 && errno == EINTR)
+        continue;
+
+      if (nwritten < 0)
+        return errno_code();
+
+      i += nwritten;
+      offset += nwritten;
+    }
+  }
+
+  return {};
+}
+
+// Copy as much as the kernel can without passing through userspace,
+// advancing offset past what was copied
+static std::error_code copy_in_kernel(int src_fd, int dst_fd,
+                                      std::uint64_t &offset,
+                                      std::uint64_t size) {
+#if defined(__linux__)
+  // a clone shares the source's blocks, like cp --reflink
+  if (offset == 0 && ::ioctl(dst_fd, FICLONE, src_fd) == 0) {
+    offset = size;
+    return {};
+  }
+
+  while (offset < size) {
+    loff_t off_in = offset, off_out = offset;
+    ssize_t n = ::copy_file_range(src_fd, &off_in, dst_fd, &off_out,
+                                  size - offset, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+
+    if (n < 0)
+      return is_unsupported(errno) ? std::error_code{} : errno_code();
+
+    // the file shrank since it was measured
+    if (n == 0)
+      return errno_code(EIO);
+
+    offset += n;
+  }
+#endif
+
+  return {};
+}
+
+std::error_code clone_file(int src_fd, const fs::path &dst,
+                           std::uint64_t &size) {
+  struct stat st;
+  if (::fstat(src_fd, &st) == -1)
+    return errno_code();
+
+  // other kinds of files could block or never end
+  if (!S_ISREG(st.st_mode))
+    return errno_code(EINVAL);
+
+  size = st.st_size;
+
+  // the old file may be linked from other sessions' uploads
+  std::error_code rm_ec;
+  fs::remove(dst, rm_ec);
+
+#if defined(__APPLE__)
+  bool cloned = false;
+  if (auto ec = try_clonefile(src_fd, dst, cloned); ec || cloned)
+    return ec;
+#endif
+
+  int dst_fd = ::open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                      0644);
+  if (dst_fd == -1)
+    return errno_code();
+
+  std::uint64_t offset = 0;
+  auto ec = copy_in_kernel(src_fd, dst_fd, offset, size);
+  if (!ec)
+    ec = copy_rest(src_fd, dst_fd, offset, size);
+
+  if (::close(dst_fd) == -1 && !ec)
+    ec = errno_code();
+
+  return ec;
+}
@@ -0,0 +1,151 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#include "html_forms_server/private/http_conditional.hpp"
+
+#include <array>
+#include <cstdio>
+
+static constexpr std::array<const char *, 7> day_names = {
+    "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+
+static constexpr std::array<const char *, 12> month_names = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+std::string http_date(std::time_t t) {
+  std::tm tm;
+  ::gmtime_r(&t, &tm);
+
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%s, %02d %s %04d %02d:%02d:%02d GMT",
+                day_names[tm.tm_wday], tm.tm_mday, month_names[tm.tm_mon],
+                tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
+
+  return buf;
+}
+
+static int month_index(std::string_view mon) {
+  for (std::size_t i = 0; i < month_names.size(); ++i) {
+    if (mon == month_names[i])
+      return i;
+  }
+
+  return -1;
+}
+
+bool parse_http_date(std::string_view str, std::time_t &t) {
+  // sscanf needs null terminated input
+  char buf[64];
+  if (str.size() >= sizeof(buf))
+    return false;
+
+  str.copy(buf, str.size());
+  buf[str.size()] = '\0';
+
+  std::tm tm{};
+  char mon[4];
+  int n = 0;
+
+  if (std::sscanf(buf, "%*3s, %2d %3s %4d %2d:%2d:%2d GMT%n", &tm.tm_mday, mon,
+                  &tm.tm_year, &tm.tm_hour, &tm.tm_min, &tm.tm_sec,
+                  &n) == 6 &&
+      static_cast<std::size_t>(n) == str.size()) {
+    // IMF-fixdate: Sun, 06 Nov 1994 08:49:37 GMT
+  } else if (std::sscanf(buf, "%*[A-Za-z], %2d-%3s-%2d %2d:%2d:%2d GMT%n",
+                         &tm.tm_mday, mon, &tm.tm_year, &tm.tm_hour,
+                         &tm.tm_min, &tm.tm_sec, &n) == 6 &&
+             static_cast<std::size_t>(n) == str.size()) {
+    // RFC 850: Sunday, 06-Nov-94 08:49:37 GMT
+    tm.tm_year += tm.tm_year < 70 ? 2000 : 1900;
+  } else if (std::sscanf(buf, "%*3s %3s %2d %2d:%2d:%2d %4d%n", mon,
+                         &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec,
+                         &tm.tm_year, &n) == 6 &&
+             static_cast<std::size_t>(n) == str.size()) {
+    // asctime: Sun Nov  6 08:49:37 1994
+  } else {
+    return false;
+  }
+
+  tm.tm_mon = month_index(mon);
+  if (tm.tm_mon < 0)
+    return false;
+
+  tm.tm_year -= 1900;
+  t = ::timegm(&tm);
+  return t != -1;
+}
+
+static bool is_weak(std::string_view etag) { return etag.starts_with("W/"); }
+
+static std::string_view opaque_tag(std::string_view etag) {
+  if (is_weak(etag))
+    etag.remove_prefix(2);
+
+  return etag;
+}
+
+bool etag_list_matches(std::string_view list, std::string_view etag,
+                       bool weak) {
+  if (!weak && is_weak(etag))
+    return false;
+
+  std::size_t i = 0;
+  while (i < list.size()) {
+    // skip separators
+    while (i < list.size() &&
+           (list[i] == ' ' || list[i] == '\t' || list[i] == ','))
+      ++i;
+
+    if (i == list.size())
+      break;
+
+    if (list[i] == '*')
+      return true;
+
+    std::size_t start = i;
+    if (list.substr(i).starts_with("W/"))
+      i += 2;
+
+    if (i == list.size() || list[i] != '"')
+      return false; // malformed
+
+    auto close = list.find('"', i + 1);
+    if (close == std::string_view::npos)
+      return false; // malformed
+
+    i = close + 1;
+    auto tag = list.substr(start, i - start);
+
+    if (weak) {
+      if (opaque_tag(tag) == opaque_tag(etag))
+        return true;
+    } else if (!is_weak(tag) && tag == etag) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool if_range_matches(std::string_view if_range, std::string_view etag,
+                      std::time_t last_modified) {
+  while (!if_range.empty() && if_range.front() == ' ')
+    if_range.remove_prefix(1);
+
+  while (!if_range.empty() && if_range.back() == ' ')
+    if_range.remove_suffix(1);
+
+  if (if_range.starts_with('"'))
+    return !is_weak(etag) && if_range == etag;
+
+  if (is_weak(if_range))
+    return false; // weak tags never satisfy If-Range
+
+  std::time_t t;
+  return parse_http_date(if_range, t) && t == last_modified;
+}
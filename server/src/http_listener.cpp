@@ -5,9 +5,12 @@
  * license that can be found in the LICENSE file or at
  * https://opensource.org/licenses/MIT.
  */
+#include "html_forms_server/private/compression.hpp"
 #include "html_forms_server/private/http_listener.hpp"
+#include "html_forms_server/private/log.hpp"
 #include "html_forms_server/private/mime_type.hpp"
 #include "html_forms_server/private/parse_target.hpp"
+#include "html_forms_server/private/sendfile.hpp"
 #include <complex>
 #include <html_forms.h>
 #include <span>
@@ -23,11 +26,20 @@ using tcp = boost::asio::ip::tcp;
 std::span<const std::uint8_t> forms_js();
 std::span<const std::uint8_t> loading_html();
 
-using session_map = std::map<std::string, std::weak_ptr<http_session>>;
+// Embedded assets never change, so they are compressed once at max level
+static const std::string &forms_js_gz() {
+  static const std::string gz = gzip_bytes(forms_js(), 9);
+  return gz;
+}
+
+static const std::string &loading_html_gz() {
+  static const std::string gz = gzip_bytes(loading_html(), 9);
+  return gz;
+}
 
 // Report a failure
 void fail(beast::error_code ec, char const *what) {
-  std::cerr << what << ": " << ec.message() << "\n";
+  HTML_LOG(warn, "", what << ": " << ec.message());
 }
 
 // Handles an HTTP server connection
@@ -35,12 +47,20 @@ class session : public std::enable_shared_from_this<session> {
   beast::tcp_stream stream_;
   beast::flat_buffer buffer_;
   http::request<http::string_body> req_;
-  const session_map &sessions_;
+  std::shared_ptr<http_listener> listener_;
+  server_metrics &metrics_;
+  std::chrono::steady_clock::time_point req_start_;
 
 public:
   // Take ownership of the stream
-  session(tcp::socket &&socket, const session_map &sessions)
-      : stream_(std::move(socket)), sessions_{sessions} {}
+  session(tcp::socket &&socket, const std::shared_ptr<http_listener> &listener)
+      : stream_(std::move(socket)), listener_{listener},
+        metrics_{listener->metrics()} {
+    metrics_.http_connections.add();
+    metrics_.http_connections_active.add(1);
+  }
+
+  ~session() { metrics_.http_connections_active.add(-1); }
 
   // Start the asynchronous operation
   void run() {
@@ -77,28 +97,28 @@ public:
     if (ec)
       return fail(ec, "read");
 
-    std::string target{req_.target()};
-    char session_id[128], normalized_target[256];
-    int parse_success =
-        parse_target(target.c_str(), session_id, sizeof(session_id),
-                     normalized_target, sizeof(normalized_target));
+    req_start_ = std::chrono::steady_clock::now();
+    metrics_.http_requests.add();
+
+    auto target = req_.target();
+    char normalized_target[256];
+    std::size_t normalized_n;
+    std::string_view session_sv;
+    int parse_success = parse_target(
+        std::string_view{target.data(), target.size()}, session_sv,
+        normalized_target, sizeof(normalized_target), normalized_n);
 
     if (!parse_success)
       return respond404("Target path not parsed");
 
-    std::string_view session_sv{session_id}, target_sv{normalized_target};
+    std::string_view target_sv{normalized_target, normalized_n};
 
-    std::cerr << '[' << session_sv << "] " << req_.method_string() << ' '
-              << normalized_target << std::endl;
+    HTML_LOG(debug, session_sv, req_.method_string() << ' ' << target_sv);
 
     if (session_sv == "html")
       return respond(normalized_target);
 
-    auto it = sessions_.find(session_id);
-    if (it == sessions_.end())
-      return respond404("No session");
-
-    if (auto session_ptr = it->second.lock()) {
+    if (auto session_ptr = listener_->find_session(session_sv)) {
       if (ws::is_upgrade(req_)) {
         if (target_sv != "/ws") {
           return respond404("Not found");
@@ -107,39 +127,79 @@ public:
         session_ptr->connect_ws(stream_.release_socket(), std::move(req_));
 
       } else {
-        send_response(session_ptr->respond(normalized_target, std::move(req_)));
+        session_ptr->async_respond(
+            normalized_target, std::move(req_),
+            beast::bind_front_handler(&session::on_respond,
+                                      shared_from_this()));
       }
     } else {
-      return respond404("Session expired");
+      return respond404("No session");
     }
   }
 
+  // Called on the http_session's executor
+  void on_respond(http_response res) {
+    net::dispatch(stream_.get_executor(),
+                  [self = shared_from_this(), res = std::move(res)]() mutable {
+                    self->send_response(std::move(res));
+                  });
+  }
+
   void respond(const std::string_view &target) {
     if (target == "/forms.js")
-      return respond_span("text/javascript", forms_js());
+      return respond_span("text/javascript", forms_js(), forms_js_gz());
 
     if (target == "/loading.html")
-      return respond_span("text/html", loading_html());
+      return respond_span("text/html", loading_html(), loading_html_gz());
+
+    if (target == "/metrics")
+      return respond_metrics();
 
     return respond404("Not found");
   }
 
   void respond_span(const std::string_view &mime,
-                    const std::span<const std::uint8_t> &contents) {
+                    const std::span<const std::uint8_t> &contents,
+                    const std::string &gz_contents) {
     http::response<http::span_body<const std::uint8_t>> res{http::status::ok,
                                                             req_.version()};
     res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
     res.set(http::field::content_type, mime);
+    res.set(http::field::vary, "Accept-Encoding");
     res.keep_alive(req_.keep_alive());
-    res.body() =
-        boost::span<const std::uint8_t>{contents.data(), contents.size()};
+
+    auto accept = req_[http::field::accept_encoding];
+    if (!gz_contents.empty() && accepts_encoding(accept, "gzip")) {
+      res.set(http::field::content_encoding, "gzip");
+      auto data = reinterpret_cast<const std::uint8_t *>(gz_contents.data());
+      res.body() = boost::span<const std::uint8_t>{data, gz_contents.size()};
+    } else {
+      res.body() =
+          boost::span<const std::uint8_t>{contents.data(), contents.size()};
+    }
+
     res.prepare_payload();
 
     // Send the response
-    send_response(std::move(res));
+    send_message(std::move(res));
+  }
+
+  void respond_metrics() {
+    http::response<http::string_body> res{http::status::ok, req_.version()};
+    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(http::field::content_type, "text/plain; version=0.0.4");
+    res.set(http::field::cache_control, "no-store");
+    res.keep_alive(req_.keep_alive());
+    if (req_.method() != http::verb::head)
+      res.body() = listener_->metrics_text();
+
+    res.prepare_payload();
+    send_message(std::move(res));
   }
 
   void respond404(const char *msg) {
+    metrics_.http_not_found.add();
+
     http::response<http::string_body> res{http::status::not_found,
                                           req_.version()};
     res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
@@ -149,10 +209,83 @@ public:
     res.prepare_payload();
 
     // Send the response
-    send_response(std::move(res));
+    send_message(std::move(res));
+  }
+
+  void send_response(http_response &&res) {
+    if (auto *file = std::get_if<my::file_response>(&res))
+      return send_file(std::move(*file));
+
+    send_message(std::get<http::message_generator>(std::move(res)));
+  }
+
+  void send_file(my::file_response &&res) {
+    auto file = std::make_shared<my::file_response>(std::move(res));
+    auto sr = std::make_shared<http::response_serializer<http::empty_body>>(
+        file->header);
+
+    // Write the header, then the body straight from the file
+    http::async_write(stream_, *sr,
+                      beast::bind_front_handler(&session::on_write_file_header,
+                                                shared_from_this(), file, sr));
   }
 
-  void send_response(http::message_generator &&msg) {
+  void on_write_file_header(
+      std::shared_ptr<my::file_response> file,
+      std::shared_ptr<http::response_serializer<http::empty_body>> sr,
+      beast::error_code ec, std::size_t bytes_transferred) {
+    if (ec)
+      return fail(ec, "write");
+
+    do_write_file_segment(file, 0);
+  }
+
+  void do_write_file_segment(std::shared_ptr<my::file_response> file,
+                             std::size_t i) {
+    if (i == file->segments.size()) {
+      if (file->trailer.empty())
+        return on_write(file->header.keep_alive(), {}, 0);
+
+      return net::async_write(
+          stream_, net::buffer(file->trailer),
+          [self = shared_from_this(), file](beast::error_code ec,
+                                            std::size_t n) {
+            self->on_write(file->header.keep_alive(), ec, n);
+          });
+    }
+
+    const auto &seg = file->segments[i];
+    if (seg.preamble.empty())
+      return on_write_file_preamble(file, i, {}, 0);
+
+    net::async_write(stream_, net::buffer(seg.preamble),
+                     beast::bind_front_handler(&session::on_write_file_preamble,
+                                               shared_from_this(), file, i));
+  }
+
+  void on_write_file_preamble(std::shared_ptr<my::file_response> file,
+                              std::size_t i, beast::error_code ec,
+                              std::size_t bytes_transferred) {
+    if (ec)
+      return fail(ec, "write");
+
+    const auto &seg = file->segments[i];
+    my::async_sendfile(stream_.socket(), file->body.native_handle(),
+                       seg.offset, seg.length,
+                       beast::bind_front_handler(&session::on_write_file_range,
+                                                 shared_from_this(), file, i));
+  }
+
+  void on_write_file_range(std::shared_ptr<my::file_response> file,
+                           std::size_t i, beast::error_code ec,
+                           std::size_t bytes_transferred) {
+    if (ec)
+      return fail(ec, "write");
+
+    do_write_file_segment(file, i + 1);
+  }
+
+  void send_message(http::message_generator &&msg) {
     bool keep_alive = msg.keep_alive();
 
     // Write the response
@@ -168,6 +301,8 @@ public:
     if (ec)
       return fail(ec, "write");
 
+    metrics_.http_request_us.record_since(req_start_);
+
     if (!keep_alive) {
       // This means we should close the connection, usually because
       // the response indicated the "Connection: close" semantic.
@@ -187,8 +322,11 @@ public:
   }
 };
 
-http_listener::http_listener(asio::io_context &ioc, tcp::endpoint endpoint)
-    : ioc_(ioc), acceptor_(asio::make_strand(ioc)) {
+http_listener::http_listener(asio::io_context &ioc, tcp::endpoint endpoint,
+                             server_metrics &metrics,
+                             const content_cache &cache)
+    : ioc_(ioc), acceptor_(asio::make_strand(ioc)), metrics_{metrics},
+      cache_{cache} {
   beast::error_code ec;
 
   // Open the acceptor
@@ -223,19 +361,42 @@ http_listener::http_listener(asio::io_context &ioc, tcp::endpoint endpoint)
 // Start accepting incoming connections
 void http_listener::run() { do_accept(); }
 
-bool http_listener::add_session(const std::string &session_id,
+bool http_listener::add_session(const std::string_view &session_id,
                                 std::weak_ptr<http_session> session) {
-  auto it = sessions_.emplace(std::make_pair(session_id, session));
-  return true; // TODO double check session id not already in use
+  session_uuid uuid;
+  if (!parse_session_uuid(session_id, uuid))
+    return false;
+
+  return sessions_.insert(uuid, session);
 }
 
-void http_listener::remove_session(const std::string &session_id) {
-  sessions_.erase(session_id);
+void http_listener::remove_session(const std::string_view &session_id) {
+  session_uuid uuid;
+  if (!parse_session_uuid(session_id, uuid))
+    return;
+
+  sessions_.erase(uuid);
   if (sessions_.empty()) {
-    acceptor_.cancel();
+    // the acceptor is only touched on its own strand
+    net::post(acceptor_.get_executor(),
+              [self = shared_from_this()] { self->acceptor_.cancel(); });
   }
 }
 
+std::shared_ptr<http_session>
+http_listener::find_session(const std::string_view &session_id) const {
+  session_uuid uuid;
+  std::weak_ptr<http_session> session;
+  if (!parse_session_uuid(session_id, uuid) || !sessions_.find(uuid, session))
+    return nullptr;
+
+  return session.lock();
+}
+
+std::string http_listener::metrics_text() const {
+  return prometheus_text(metrics_, cache_.stats());
+}
+
 void http_listener::do_accept() {
   // The new connection gets its own strand
   acceptor_.async_accept(
@@ -249,7 +410,7 @@ void http_listener::on_accept(beast::error_code ec, tcp::socket socket) {
     return; // To avoid infinite loop
   } else {
     // Create the session and run it
-    std::make_shared<session>(std::move(socket), sessions_)->run();
+    std::make_shared<session>(std::move(socket), shared_from_this())->run();
   }
 
   // Accept another connection
@@ -0,0 +1,155 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#include "html_forms_server/private/http_range.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <limits>
+
+// Don't let a client make us write many tiny overlapping parts
+static constexpr std::size_t max_ranges = 32;
+
+static void trim(std::string_view &sv) {
+  while (!sv.empty() && (sv.front() == ' ' || sv.front() == '\t'))
+    sv.remove_prefix(1);
+
+  while (!sv.empty() && (sv.back() == ' ' || sv.back() == '\t'))
+    sv.remove_suffix(1);
+}
+
+static bool parse_uint(std::string_view sv, std::uint64_t &n) {
+  if (sv.empty())
+    return false;
+
+  auto end = sv.data() + sv.size();
+  auto [ptr, ec] = std::from_chars(sv.data(), end, n);
+  return ec == std::errc{} && ptr == end;
+}
+
+// Parse "first-last", "first-", or "-suffix". Returns false on bad syntax.
+// Sets satisfiable to whether the spec overlaps the representation.
+static bool parse_spec(std::string_view spec, std::uint64_t size,
+                       byte_range &range, bool &satisfiable) {
+  auto dash = spec.find('-');
+  if (dash == std::string_view::npos)
+    return false;
+
+  auto first_sv = spec.substr(0, dash);
+  auto last_sv = spec.substr(dash + 1);
+
+  std::uint64_t first, last;
+
+  if (first_sv.empty()) {
+    // suffix range
+    std::uint64_t suffix;
+    if (!parse_uint(last_sv, suffix))
+      return false;
+
+    satisfiable = suffix > 0 && size > 0;
+    if (satisfiable) {
+      range.length = std::min(suffix, size);
+      range.offset = size - range.length;
+    }
+
+    return true;
+  }
+
+  if (!parse_uint(first_sv, first))
+    return false;
+
+  if (last_sv.empty()) {
+    last = std::numeric_limits<std::uint64_t>::max();
+  } else if (!parse_uint(last_sv, last) || last < first) {
+    return false;
+  }
+
+  satisfiable = first < size;
+  if (satisfiable) {
+    range.offset = first;
+    range.length = std::min(last, size - 1) - first + 1;
+  }
+
+  return true;
+}
+
+range_status parse_range(std::string_view header, std::uint64_t size,
+                         std::vector<byte_range> &ranges) {
+  ranges.clear();
+
+  trim(header);
+
+  constexpr std::string_view unit = "bytes=";
+  if (!header.starts_with(unit))
+    return range_status::ignore;
+
+  header.remove_prefix(unit.size());
+
+  bool any_spec = false;
+  while (!header.empty()) {
+    auto comma = header.find(',');
+    auto spec = header.substr(0, comma);
+    header = comma == std::string_view::npos ? std::string_view{}
+                                             : header.substr(comma + 1);
+
+    trim(spec);
+    if (spec.empty())
+      continue; // tolerate empty list elements
+
+    any_spec = true;
+
+    byte_range range;
+    bool satisfiable;
+    if (!parse_spec(spec, size, range, satisfiable))
+      return range_status::ignore;
+
+    if (satisfiable) {
+      if (ranges.size() >= max_ranges)
+        return range_status::ignore;
+
+      ranges.push_back(range);
+    }
+  }
+
+  if (!any_spec)
+    return range_status::ignore;
+
+  if (ranges.empty())
+    return range_status::unsatisfiable;
+
+  // coalesce overlapping or adjacent ranges
+  std::sort(ranges.begin(), ranges.end(),
+            [](const byte_range &a, const byte_range &b) {
+              return a.offset < b.offset;
+            });
+
+  std::size_t n = 0;
+  for (std::size_t i = 1; i < ranges.size(); ++i) {
+    auto &prev = ranges[n];
+    const auto &next = ranges[i];
+    auto prev_end = prev.offset + prev.length;
+    if (next.offset <= prev_end) {
+      auto next_end = next.offset + next.length;
+      prev.length = std::max(prev_end, next_end) - prev.offset;
+    } else {
+      ranges[++n] = next;
+    }
+  }
+
+  ranges.resize(n + 1);
+  return range_status::satisfiable;
+}
+
+std::string content_range(const byte_range &range, std::uint64_t size) {
+  std::string out = "bytes ";
+  out += std::to_string(range.offset);
+  out += '-';
+  out += std::to_string(range.offset + range.length - 1);
+  out += '/';
+  out += std::to_string(size);
+  return out;
+}
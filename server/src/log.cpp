@@ -0,0 +1,180 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#include "html_forms_server/private/log.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+static const char *level_name(log_level level) {
+  switch (level) {
+  case log_level::debug:
+    return "debug";
+  case log_level::info:
+    return "info";
+  case log_level::warn:
+    return "warn";
+  case log_level::error:
+    return "error";
+  }
+
+  return "?";
+}
+
+static void stderr_sink(log_level level, std::string_view session_id,
+                        std::string_view msg) {
+  if (session_id.empty())
+    session_id = "server";
+
+  std::cerr << '[' << session_id << "] " << level_name(level) << ": " << msg
+            << '\n';
+}
+
+logger &logger::instance() {
+  static logger inst;
+  return inst;
+}
+
+logger::logger() {
+  for (std::size_t i = 0; i < ring_size; ++i)
+    ring_[i].seq.store(i, std::memory_order_relaxed);
+
+  drainer_ = std::thread{&logger::drain_thread, this};
+}
+
+logger::~logger() {
+  stop_ = true;
+  drainer_sleeping_ = false;
+  drainer_sleeping_.notify_one();
+  drainer_.join();
+}
+
+void logger::set_sink(log_sink sink) {
+  std::lock_guard lock{sink_mtx_};
+  sink_ = std::move(sink);
+}
+
+// Bounded MPMC queue (Vyukov). Each cell's seq says whether it is free for
+// the producer at position pos (seq == pos) or holds a record for the
+// consumer at position pos (seq == pos + 1).
+void logger::write(log_level level, std::string_view session_id,
+                   std::string_view msg) {
+  auto pos = enqueue_pos_.load(std::memory_order_relaxed);
+  cell *c;
+
+  while (true) {
+    c = &ring_[pos % ring_size];
+    auto seq = c->seq.load(std::memory_order_acquire);
+    auto diff =
+        static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+
+    if (diff == 0) {
+      if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      ++dropped_;
+      return;
+    } else {
+      pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+
+  auto &rec = c->rec;
+  rec.level = level;
+  rec.session_id_n = std::min(session_id.size(), log_session_id_size);
+  std::memcpy(rec.session_id, session_id.data(), rec.session_id_n);
+  rec.session_id[rec.session_id_n] = '\0';
+  rec.msg_n = std::min(msg.size(), log_msg_size);
+  std::memcpy(rec.msg, msg.data(), rec.msg_n);
+  rec.msg[rec.msg_n] = '\0';
+
+  c->seq.store(pos + 1, std::memory_order_release);
+  wake_drainer();
+}
+
+void logger::wake_drainer() {
+  // pairs with the fence in drain_thread so that either the drainer sees
+  // the new record or we see that it is sleeping
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (drainer_sleeping_.load(std::memory_order_relaxed)) {
+    drainer_sleeping_ = false;
+    drainer_sleeping_.notify_one();
+  }
+}
+
+bool logger::try_pop(record &rec) {
+  auto &c = ring_[dequeue_pos_ % ring_size];
+  auto seq = c.seq.load(std::memory_order_acquire);
+  if (seq != dequeue_pos_ + 1)
+    return false;
+
+  rec = c.rec;
+  c.seq.store(dequeue_pos_ + ring_size, std::memory_order_release);
+  ++dequeue_pos_;
+  return true;
+}
+
+void logger::drain_thread() {
+  record rec;
+
+  while (true) {
+    bool any = false;
+    {
+      std::lock_guard lock{sink_mtx_};
+      while (try_pop(rec)) {
+        any = true;
+        std::string_view session_id{rec.session_id, rec.session_id_n};
+        std::string_view msg{rec.msg, rec.msg_n};
+
+        if (sink_)
+          sink_(rec.level, session_id, msg);
+        else
+          stderr_sink(rec.level, session_id, msg);
+
+        ++drained_;
+      }
+    }
+
+    if (any) {
+      drained_.notify_all();
+      continue;
+    }
+
+    if (stop_)
+      return;
+
+    drainer_sleeping_ = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    // a record may have been pushed before we announced sleeping
+    auto &next = ring_[dequeue_pos_ % ring_size];
+    if (next.seq.load(std::memory_order_acquire) == dequeue_pos_ + 1 ||
+        stop_) {
+      drainer_sleeping_ = false;
+      continue;
+    }
+
+    drainer_sleeping_.wait(true);
+  }
+}
+
+void logger::flush() {
+  auto target = enqueue_pos_.load(std::memory_order_acquire);
+
+  // wake the drainer in case it sleeps on a record that isn't published
+  // yet when it checked
+  drainer_sleeping_ = false;
+  drainer_sleeping_.notify_one();
+
+  auto n = drained_.load();
+  while (n < target) {
+    drained_.wait(n);
+    n = drained_.load();
+  }
+}
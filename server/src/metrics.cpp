@@ -0,0 +1,199 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#include "html_forms_server/private/metrics.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <sstream>
+
+std::size_t histogram::bucket_index(std::uint64_t value) {
+  if (value < sub_count)
+    return value;
+
+  unsigned shift = std::bit_width(value) - 1 - sub_bits;
+  return (shift + 1) * sub_count + (value >> shift) - sub_count;
+}
+
+std::uint64_t histogram::bucket_lower(std::size_t i) {
+  if (i < sub_count)
+    return i;
+
+  unsigned shift = i / sub_count - 1;
+  return (sub_count + i % sub_count) << shift;
+}
+
+std::uint64_t histogram::bucket_upper(std::size_t i) {
+  if (i < sub_count)
+    return i;
+
+  unsigned shift = i / sub_count - 1;
+  return bucket_lower(i) + ((std::uint64_t{1} << shift) - 1);
+}
+
+void histogram::record(std::uint64_t value) {
+  buckets_[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+
+  auto max = max_.load(std::memory_order_relaxed);
+  while (value > max &&
+         !max_.compare_exchange_weak(max, value, std::memory_order_relaxed))
+    ;
+}
+
+void histogram::record_since(std::chrono::steady_clock::time_point start) {
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed);
+  record(us.count() < 0 ? 0 : us.count());
+}
+
+histogram_snapshot histogram::snapshot() const {
+  histogram_snapshot snap;
+  for (std::size_t i = 0; i < bucket_count; ++i)
+    snap.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+
+  snap.count = count_.load(std::memory_order_relaxed);
+  snap.sum = sum_.load(std::memory_order_relaxed);
+  snap.max = max_.load(std::memory_order_relaxed);
+  return snap;
+}
+
+std::uint64_t histogram_snapshot::quantile(double q) const {
+  // buckets and count are read separately, so trust the buckets
+  std::uint64_t total = 0;
+  for (auto n : buckets)
+    total += n;
+
+  if (total == 0)
+    return 0;
+
+  q = std::clamp(q, 0.0, 1.0);
+  auto rank = static_cast<std::uint64_t>(std::ceil(q * total));
+  if (rank == 0)
+    rank = 1;
+
+  std::uint64_t seen = 0;
+  for (std::size_t i = 0; i < buckets.size(); ++i) {
+    seen += buckets[i];
+    if (seen >= rank)
+      return std::min(histogram::bucket_upper(i), max);
+  }
+
+  return max;
+}
+
+namespace {
+constexpr const char *prefix = "html_forms_";
+
+void write_counter(std::ostream &os, const char *name, const char *help,
+                   std::uint64_t value) {
+  os << "# HELP " << prefix << name << ' ' << help << '\n'
+     << "# TYPE " << prefix << name << " counter\n"
+     << prefix << name << ' ' << value << '\n';
+}
+
+void write_gauge(std::ostream &os, const char *name, const char *help,
+                 std::int64_t value) {
+  os << "# HELP " << prefix << name << ' ' << help << '\n'
+     << "# TYPE " << prefix << name << " gauge\n"
+     << prefix << name << ' ' << value << '\n';
+}
+
+// scale converts recorded units to the unit in the metric's name
+void write_histogram(std::ostream &os, const char *name, const char *help,
+                     const histogram &h, double scale = 1.0) {
+  auto snap = h.snapshot();
+
+  os << "# HELP " << prefix << name << ' ' << help << '\n'
+     << "# TYPE " << prefix << name << " histogram\n";
+
+  std::uint64_t cumulative = 0;
+  for (std::size_t i = 0; i < snap.buckets.size(); ++i) {
+    if (snap.buckets[i] == 0)
+      continue;
+
+    cumulative += snap.buckets[i];
+    os << prefix << name << "_bucket{le=\""
+       << histogram::bucket_upper(i) * scale << "\"} " << cumulative << '\n';
+  }
+
+  os << prefix << name << "_bucket{le=\"+Inf\"} " << cumulative << '\n'
+     << prefix << name << "_sum " << snap.sum * scale << '\n'
+     << prefix << name << "_count " << cumulative << '\n';
+}
+} // namespace
+
+std::string prometheus_text(const server_metrics &m,
+                            const content_cache_stats &cache) {
+  std::ostringstream os;
+  os.precision(12);
+
+  write_counter(os, "sessions_started_total", "catui sessions started",
+                m.sessions_started.value());
+  write_gauge(os, "sessions_active", "catui sessions currently open",
+              m.sessions_active.value());
+
+  write_counter(os, "http_connections_total", "HTTP connections accepted",
+                m.http_connections.value());
+  write_gauge(os, "http_connections_active", "HTTP connections currently open",
+              m.http_connections_active.value());
+  write_counter(os, "http_requests_total", "HTTP requests read",
+                m.http_requests.value());
+  write_counter(os, "http_not_found_total", "HTTP requests answered with 404",
+                m.http_not_found.value());
+  write_histogram(os, "http_request_duration_seconds",
+                  "Time from reading a request to writing its response",
+                  m.http_request_us, 1e-6);
+
+  write_counter(os, "uploads_total", "Resources uploaded by applications",
+                m.uploads.value());
+  write_counter(os, "upload_bytes_total", "Bytes uploaded by applications",
+                m.upload_bytes.value());
+  write_histogram(os, "upload_throughput_bytes_per_second",
+                  "Rate at which each upload was received",
+                  m.upload_bytes_per_sec);
+
+  write_counter(os, "ws_connections_total", "Websocket connections accepted",
+                m.ws_connections.value());
+  write_counter(os, "ws_messages_received_total",
+                "Websocket messages received from the browser",
+                m.ws_messages_in.value());
+  write_counter(os, "ws_received_bytes_total",
+                "Websocket bytes received from the browser",
+                m.ws_bytes_in.value());
+  write_counter(os, "ws_messages_sent_total",
+                "Websocket messages sent to the browser",
+                m.ws_messages_out.value());
+  write_counter(os, "ws_sent_bytes_total",
+                "Websocket bytes sent to the browser", m.ws_bytes_out.value());
+  write_histogram(os, "ws_message_size_bytes",
+                  "Size of websocket messages in either direction",
+                  m.ws_message_bytes);
+
+  write_counter(os, "form_submits_total", "Forms submitted by the browser",
+                m.form_submits.value());
+  write_histogram(os, "form_round_trip_seconds",
+                  "Time from a form submission to the application's next "
+                  "message",
+                  m.form_round_trip_us, 1e-6);
+
+  write_counter(os, "browser_events_total",
+                "Events delivered to the browser callback",
+                m.browser_events.value());
+
+  write_counter(os, "cache_hits_total", "Content cache hits", cache.hits);
+  write_counter(os, "cache_misses_total", "Content cache misses",
+                cache.misses);
+  write_gauge(os, "cache_bytes", "Bytes held by the content cache",
+              cache.bytes);
+  write_gauge(os, "cache_entries", "Files held by the content cache",
+              cache.entries);
+
+  return os.str();
+}
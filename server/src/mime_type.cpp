@@ -7,65 +7,193 @@
  */
 #include "html_forms_server/private/mime_type.hpp"
 
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdint>
+#include <stdexcept>
+
+namespace {
+
+struct mime_entry {
+  std::string_view ext;
+  std::string_view mime;
+};
+
+constexpr mime_entry builtin_mimes[] = {
+    // text
+    {"htm", "text/html"},
+    {"html", "text/html"},
+    {"css", "text/css"},
+    {"txt", "text/plain"},
+    {"js", "text/javascript"},
+    {"mjs", "text/javascript"},
+    {"json", "application/json"},
+    {"xml", "application/xml"},
+
+    // image
+    {"png", "image/png"},
+    {"jpe", "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"jpg", "image/jpeg"},
+    {"jif", "image/jpeg"},
+    {"jfif", "image/jpeg"},
+    {"jfi", "image/jpeg"},
+    {"gif", "image/gif"},
+    {"bmp", "image/bmp"},
+    {"dib", "image/bmp"},
+    {"ico", "image/vnd.microsoft.icon"},
+    {"tiff", "image/tiff"},
+    {"tif", "image/tiff"},
+    {"svg", "image/svg+xml"},
+    {"svgz", "image/svg+xml"},
+    {"webp", "image/webp"},
+    {"avif", "image/avif"},
+    // TODO - heif/heic
+
+    // font
+    {"otf", "font/otf"},
+    {"ttf", "font/ttf"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"eot", "application/vnd.ms-fontobject"},
+
+    // audio
+    {"mp3", "audio/mpeg"},
+    {"wav", "audio/wav"},
+    {"weba", "audio/webm"},
+    {"mid", "audio/midi"},
+    {"midi", "audio/midi"},
+    {"oga", "audio/ogg"},
+    {"opus", "audio/opus"},
+
+    // video
+    {"mp4", "video/mp4"},
+    {"mpeg", "video/mpeg"},
+    {"webm", "video/webm"},
+    {"avi", "video/x-msvideo"},
+};
+
+constexpr std::uint32_t ext_hash(std::string_view ext, std::uint32_t seed) {
+  // FNV-1a with a seeded offset basis
+  std::uint32_t h = 2166136261u ^ seed;
+  for (char c : ext) {
+    h ^= static_cast<unsigned char>(c);
+    h *= 16777619u;
+  }
+
+  return h ^ (h >> 15);
+}
+
+constexpr std::size_t table_size = 256;
+static_assert(std::size(builtin_mimes) < table_size);
+
+struct perfect_table {
+  std::uint32_t seed;
+
+  // index into builtin_mimes + 1, or 0 if empty
+  std::array<std::uint8_t, table_size> slots;
+};
+
+// Search for a seed that hashes every built-in extension to its own slot
+constexpr perfect_table make_perfect_table() {
+  for (std::uint32_t seed = 0; seed < 4096; ++seed) {
+    perfect_table t{seed, {}};
+    bool collision = false;
+
+    for (std::size_t i = 0; i < std::size(builtin_mimes) && !collision; ++i) {
+      auto &slot = t.slots[ext_hash(builtin_mimes[i].ext, seed) % table_size];
+      if (slot)
+        collision = true;
+      else
+        slot = static_cast<std::uint8_t>(i + 1);
+    }
+
+    if (!collision)
+      return t;
+  }
+
+  throw std::logic_error{"no perfect hash seed for built-in MIME types"};
+}
+
+constexpr perfect_table builtin_table = make_perfect_table();
+
+} // namespace
+
 std::string_view mime_type(const std::string_view &ext) {
-#define MAP(EXT, MIME)                                                         \
-  if (ext == EXT)                                                              \
-    return MIME;
-
-  // text
-  MAP("htm", "text/html")
-  MAP("html", "text/html")
-  MAP("html", "text/html")
-  MAP("css", "text/css")
-  MAP("txt", "text/plain")
-  MAP("js", "text/javascript")
-  MAP("mjs", "text/javascript")
-  MAP("json", "application/json")
-  MAP("xml", "application/xml")
-
-  // image
-  MAP("png", "image/png")
-  MAP("jpe", "image/jpeg")
-  MAP("jpeg", "image/jpeg")
-  MAP("jpg", "image/jpeg")
-  MAP("jif", "image/jpeg")
-  MAP("jfif", "image/jpeg")
-  MAP("jfi", "image/jpeg")
-  MAP("gif", "image/gif")
-  MAP("bmp", "image/bmp")
-  MAP("dib", "image/bmp")
-  MAP("ico", "image/vnd.microsoft.icon")
-  MAP("tiff", "image/tiff")
-  MAP("tif", "image/tiff")
-  MAP("svg", "image/svg+xml")
-  MAP("svgz", "image/svg+xml")
-  MAP("webp", "image/webp")
-  MAP("avif", "image/avif")
-  // TODO - heif/heic
-
-  // font
-  MAP("otf", "font/otf")
-  MAP("ttf", "font/ttf")
-  MAP("woff", "font/woff")
-  MAP("woff2", "font/woff2")
-  MAP("eot", "application/vnd.ms-fontobject")
-
-  // audio
-  MAP("mp3", "audio/mpeg")
-  MAP("wav", "audio/wav")
-  MAP("weba", "audio/webm")
-  MAP("mid", "audio/midi")
-  MAP("midi", "audio/midi")
-  MAP("oga", "audio/ogg")
-  MAP("opus", "audio/opus")
-
-  // video
-  MAP("mp4", "video/mp4")
-  MAP("mpeg", "video/mpeg")
-  MAP("webm", "video/webm")
-  MAP("avi", "video/x-msvideo")
-
-#undef MAP
+  auto slot = builtin_table.slots[ext_hash(ext, builtin_table.seed) %
+                                  table_size];
+  if (slot) {
+    const auto &entry = builtin_mimes[slot - 1];
+    if (entry.ext == ext)
+      return entry.mime;
+  }
 
   return "text/plain";
 }
+
+std::size_t mime_overlay::probe(std::string_view ext) const {
+  auto mask = slots_.size() - 1;
+  for (auto i = ext_hash(ext, 0) & mask;; i = (i + 1) & mask) {
+    const auto &s = slots_[i];
+    if (!s.full || s.ext == ext)
+      return i;
+  }
+}
+
+void mime_overlay::set(std::string_view ext, std::string_view mime) {
+  // keep load at or below 1/2
+  if ((size_ + 1) * 2 > slots_.size()) {
+    auto old = std::move(slots_);
+    slots_.clear();
+    slots_.resize(std::max<std::size_t>(8, old.size() * 2));
+
+    for (auto &s : old) {
+      if (s.full)
+        slots_[probe(s.ext)] = std::move(s);
+    }
+  }
+
+  auto &s = slots_[probe(ext)];
+  if (!s.full) {
+    s.full = true;
+    s.ext = ext;
+    ++size_;
+  }
+
+  s.mime = mime;
+}
+
+std::string_view mime_overlay::find(std::string_view ext) const {
+  if (slots_.empty())
+    return {};
+
+  const auto &s = slots_[probe(ext)];
+  return s.full ? std::string_view{s.mime} : std::string_view{};
+}
+
+std::string_view mime_type_for_url(std::string_view url,
+                                   const mime_overlay &overrides) {
+  auto start = url.rfind('.');
+  if (start == std::string_view::npos)
+    return {};
+
+  // don't wastefully compare the dot
+  auto ext = url.substr(start + 1);
+
+  // nothing longer can be overridden, and built-in extensions are shorter
+  if (ext.size() > max_mime_ext_size)
+    return "text/plain";
+
+  char buf[max_mime_ext_size];
+  for (std::size_t i = 0; i < ext.size(); ++i)
+    buf[i] = std::tolower(static_cast<unsigned char>(ext[i]));
+
+  std::string_view lower{buf, ext.size()};
+
+  auto mime = overrides.find(lower);
+  if (!mime.empty())
+    return mime;
+
+  return mime_type(lower);
+}
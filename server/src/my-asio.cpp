@@ -8,6 +8,13 @@
 #include "html_forms_server/private/my-asio.hpp"
 #include "html_forms_server/private/async_msgstream.hpp"
 
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
 namespace my {
 
 void async_readn(stream_descriptor &stream,
@@ -29,4 +36,63 @@ void async_msgstream_recv(stream_descriptor &stream,
   return ::async_msgstream_recv(stream, buf, handler);
 }
 
+// Returns errno value (0 on success) and the received descriptor in fd
+static int recv_fd_some(int sock, int &fd) {
+  char byte;
+  iovec iov{&byte, 1};
+
+  union {
+    cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } control;
+
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  ssize_t n = ::recvmsg(sock, &msg, MSG_DONTWAIT);
+  if (n < 0)
+    return errno;
+
+  if (n == 0)
+    return EPIPE;
+
+  fd = -1;
+  for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+      std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+  }
+
+  // only one descriptor fits, so any others were dropped by the kernel
+  if (fd != -1 && (msg.msg_flags & MSG_CTRUNC)) {
+    ::close(fd);
+    return EBADMSG;
+  }
+
+  if (fd == -1)
+    return EBADMSG;
+
+  ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+  return 0;
+}
+
+void async_recv_fd(stream_descriptor &stream,
+                   const std::function<void(std::error_code, int)> &cb) {
+  stream.async_wait(
+      stream_descriptor::wait_read,
+      [&stream, cb](boost::system::error_code ec) {
+        if (ec)
+          return cb(ec, -1);
+
+        int fd = -1;
+        int err = recv_fd_some(stream.native_handle(), fd);
+        if (err == EAGAIN || err == EWOULDBLOCK || err == EINTR)
+          return async_recv_fd(stream, cb);
+
+        cb(std::error_code{err, std::generic_category()}, fd);
+      });
+}
+
 } // namespace my
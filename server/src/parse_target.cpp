@@ -6,6 +6,7 @@
  * https://opensource.org/licenses/MIT.
  */
 #include "html_forms_server/private/parse_target.hpp"
+#include <array>
 #include <cstring>
 
 using std::size_t;
@@ -132,7 +133,7 @@ int parse_target(const char *target, char *session_id, size_t session_id_len,
     size_t remaining = norm_path_len - norm_path_n;
     size_t index_n =
         strlcpy(normalized_path + norm_path_n, "index.html", remaining);
-    if (index_n > remaining)
+    if (index_n >= remaining)
       return 0; // couldn't fit
 
     norm_path_n += index_n;
@@ -141,3 +142,125 @@ int parse_target(const char *target, char *session_id, size_t session_id_len,
   normalized_path[norm_path_n] = '\0';
   return 1;
 }
+
+// characters that make a path segment unservable. '~' is only allowed as a
+// segment by itself.
+static constexpr std::array<bool, 256> reserved_chars = [] {
+  std::array<bool, 256> table{};
+  for (unsigned char c : {'@', '%', '+', '~'})
+    table[c] = true;
+
+  return table;
+}();
+
+static bool has_reserved_char(std::string_view segment) {
+  for (unsigned char c : segment) {
+    if (reserved_chars[c])
+      return true;
+  }
+
+  return false;
+}
+
+int parse_target(std::string_view target, std::string_view &session_id,
+                 char *normalized_path, size_t norm_path_len,
+                 size_t &norm_path_n) {
+  if (norm_path_len < 1)
+    return 0;
+
+  // room for path characters, leaving space for the null terminator
+  const size_t cap = norm_path_len - 1;
+  const char *p = target.data();
+  const char *end = p + target.size();
+
+  // session id is the first non-empty piece of target
+  while (p < end && *p == '/')
+    ++p;
+
+  auto sid_end = static_cast<const char *>(std::memchr(p, '/', end - p));
+  if (!sid_end)
+    sid_end = end;
+
+  if (sid_end == p)
+    return 0;
+
+  session_id = std::string_view{p, static_cast<size_t>(sid_end - p)};
+  p = sid_end;
+
+  // Each iteration handles a run of '/' followed by one segment. After the
+  // run, the normalized path always ends with '/'.
+  size_t n = 0;
+  while (p < end) {
+    size_t slashes = 0;
+    while (p < end && *p == '/') {
+      ++p;
+      ++slashes;
+    }
+
+    if (slashes > 0) {
+      if (n >= cap)
+        return 0;
+
+      if (n == 0 || normalized_path[n - 1] != '/')
+        normalized_path[n++] = '/';
+
+      if (slashes > 1 && n >= cap)
+        return 0;
+    }
+
+    if (p == end)
+      break;
+
+    auto seg_end = static_cast<const char *>(std::memchr(p, '/', end - p));
+    if (!seg_end)
+      seg_end = end;
+
+    std::string_view segment{p, static_cast<size_t>(seg_end - p)};
+    p = seg_end;
+
+    if (segment == "~") {
+      // virtual abs path
+      n = 1;
+    } else if (segment[0] == '.') {
+      if (segment.find_first_not_of('.') != std::string_view::npos)
+        return 0; // hidden files not found
+
+      if (segment.size() == 2) {
+        // drop the last directory. n - 1 is the trailing '/'. The scan
+        // only covers characters being discarded, so it's amortized O(1).
+        for (size_t i = n - 1; i > 0; --i) {
+          if (normalized_path[i - 1] == '/') {
+            n = i;
+            break;
+          }
+        }
+      } else if (segment.size() > 2) {
+        return 0; // not handled
+      }
+    } else {
+      if (has_reserved_char(segment) || n + segment.size() > cap)
+        return 0;
+
+      std::memcpy(normalized_path + n, segment.data(), segment.size());
+      n += segment.size();
+    }
+  }
+
+  if (n < 1) {
+    normalized_path[0] = '/';
+    n = 1;
+  }
+
+  if (normalized_path[n - 1] == '/') {
+    constexpr std::string_view index = "index.html";
+    if (n + index.size() > cap)
+      return 0; // couldn't fit
+
+    std::memcpy(normalized_path + n, index.data(), index.size());
+    n += index.size();
+  }
+
+  normalized_path[n] = '\0';
+  norm_path_n = n;
+  return 1;
+}
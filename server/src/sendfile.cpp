@@ -0,0 +1,134 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#include "html_forms_server/private/sendfile.hpp"
+
+#include <cerrno>
+#include <sys/types.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#elif defined(__APPLE__)
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+namespace my {
+
+namespace {
+
+using sendfile_handler = std::function<void(beast::error_code, std::size_t)>;
+
+class sendfile_op : public std::enable_shared_from_this<sendfile_op> {
+  tcp::socket &sock_;
+  int fd_;
+  off_t offset_;
+  std::uint64_t remaining_;
+  std::size_t total_ = 0;
+  sendfile_handler cb_;
+
+#if !defined(__linux__) && !defined(__APPLE__)
+  std::vector<char> buf_;
+#endif
+
+public:
+  sendfile_op(tcp::socket &sock, int fd, std::uint64_t offset,
+              std::uint64_t length, const sendfile_handler &cb)
+      : sock_{sock}, fd_{fd}, offset_{static_cast<off_t>(offset)},
+        remaining_{length}, cb_{cb} {}
+
+  void run() {
+    beast::error_code ec;
+    sock_.native_non_blocking(true, ec);
+    if (ec)
+      return cb_(ec, total_);
+
+    do_send();
+  }
+
+private:
+  // write as much as the socket accepts without blocking
+  void do_send() {
+    while (remaining_ > 0) {
+      std::size_t n = 0;
+      int err = send_some(n);
+
+      offset_ += n;
+      remaining_ -= n;
+      total_ += n;
+
+      if (err == EAGAIN || err == EWOULDBLOCK) {
+        return sock_.async_wait(
+            tcp::socket::wait_write,
+            std::bind_front(&sendfile_op::on_wait, shared_from_this()));
+      } else if (err == EINTR) {
+        continue;
+      } else if (err) {
+        return cb_(beast::error_code{err, boost::system::system_category()},
+                   total_);
+      } else if (n == 0) {
+        // file is shorter than expected
+        return cb_(asio::error::eof, total_);
+      }
+    }
+
+    cb_(beast::error_code{}, total_);
+  }
+
+  void on_wait(beast::error_code ec) {
+    if (ec)
+      return cb_(ec, total_);
+
+    do_send();
+  }
+
+  // returns errno value (0 on success) and bytes written in n
+  int send_some(std::size_t &n) {
+    constexpr std::uint64_t max_chunk = 1 << 30;
+    std::uint64_t count = std::min(remaining_, max_chunk);
+
+#if defined(__linux__)
+    off_t off = offset_;
+    ssize_t ret = ::sendfile(sock_.native_handle(), fd_, &off, count);
+    if (ret < 0)
+      return errno;
+
+    n = ret;
+    return 0;
+#elif defined(__APPLE__)
+    off_t len = count;
+    int ret = ::sendfile(fd_, sock_.native_handle(), offset_, &len, nullptr, 0);
+    // partial writes are reported through len even on EAGAIN
+    n = len;
+    return ret < 0 ? errno : 0;
+#else
+    buf_.resize(64 * 1024);
+    count = std::min<std::uint64_t>(count, buf_.size());
+    ssize_t nread = ::pread(fd_, buf_.data(), count, offset_);
+    if (nread < 0)
+      return errno;
+
+    // unwritten bytes are read again from offset_ on the next attempt
+    ssize_t ret = ::write(sock_.native_handle(), buf_.data(), nread);
+    if (ret < 0)
+      return errno;
+
+    n = ret;
+    return 0;
+#endif
+  }
+};
+
+} // namespace
+
+void async_sendfile(tcp::socket &sock, int fd, std::uint64_t offset,
+                    std::uint64_t length, const sendfile_handler &cb) {
+  std::make_shared<sendfile_op>(sock, fd, offset, length, cb)->run();
+}
+
+} // namespace my
@@ -6,23 +6,41 @@
  * https://opensource.org/licenses/MIT.
  */
 #include "html_forms_server.h"
+#include "html_forms_server/private/archive_pipe.hpp"
 #include "html_forms_server/private/asio-pch.hpp"
+#include "html_forms_server/private/blob_store.hpp"
 #include "html_forms_server/private/browser.hpp"
+#include "html_forms_server/private/compression.hpp"
+#include "html_forms_server/private/content_cache.hpp"
+#include "html_forms_server/private/file_clone.hpp"
+#include "html_forms_server/private/http_conditional.hpp"
 #include "html_forms_server/private/http_listener.hpp"
+#include "html_forms_server/private/http_range.hpp"
+#include "html_forms_server/private/log.hpp"
+#include "html_forms_server/private/metrics.hpp"
 #include "html_forms_server/private/mime_type.hpp"
 #include "html_forms_server/private/my-asio.hpp"
 #include "html_forms_server/private/my-beast.hpp"
 #include "html_forms_server/private/session_lock.hpp"
+#include "html_forms_server/private/session_table.hpp"
+#include "html_forms_server/private/tar_index.hpp"
 #include <boost/system/detail/errc.hpp>
 #include <html_forms.h>
 #include <html_forms/encoding.h>
+#include <html_forms/private/sha256.h>
 
 #include <algorithm>
 #include <archive.h>
 #include <archive_entry.h>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/endian/arithmetic.hpp>
+#include <cerrno>
+#include <deque>
 #include <filesystem>
+#include <optional>
 #include <pwd.h>
+#include <set>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <uuid/uuid.h>
 
@@ -39,18 +57,284 @@ concept member_fn_of =
     std::is_member_function_pointer_v<Fn> &&
     requires(Fn fp, Class *inst) { std::bind_front(fp, inst); };
 
+// Uploads are read and written in pieces of this size
+constexpr std::size_t upload_buffer_size = 64 * 1024;
+
+// How long a GET for a lazy URL waits for the app to upload it
+constexpr auto fetch_timeout = std::chrono::seconds{30};
+
+// Limits on GETs waiting for lazy URLs, per URL and per session
+constexpr std::size_t max_fetch_waiters = 64;
+constexpr std::size_t max_session_fetch_waiters = 1024;
+
+// An uploaded tar kept on disk so its entries can be served in place.
+// Removed once no upload refers to it.
+class archive_file {
+public:
+  using disk_executor = asio::strand<asio::thread_pool::executor_type>;
+
+  archive_file(std::filesystem::path path, const disk_executor &disk)
+      : path_{std::move(path)}, disk_{disk} {}
+
+  archive_file(const archive_file &) = delete;
+  archive_file &operator=(const archive_file &) = delete;
+
+  ~archive_file() {
+    asio::post(disk_, [path = path_] {
+      std::error_code ec;
+      std::filesystem::remove(path, ec);
+    });
+  }
+
+  const std::filesystem::path &path() const { return path_; }
+
+private:
+  std::filesystem::path path_;
+  disk_executor disk_;
+};
+
 struct read_upload_state {
   std::filesystem::path path;
   std::string url;
   std::ofstream of;
   html_resource_type rtype;
   bool is_stream;
+  std::size_t chunk_header_size;
   boost::endian::little_uint32_at chunk_size;
   std::size_t chunk_bytes_left;
+  html_sha256_ctx hash;
+  std::chrono::steady_clock::time_point start;
+  std::uint64_t bytes = 0;
+  std::vector<std::uint8_t> buf;
+
+  // the start of an archive, until it's known whether it's a plain tar
+  std::vector<std::uint8_t> head;
+
+  // plain tars are kept whole and indexed as they arrive
+  std::optional<tar_indexer> indexer;
+  std::shared_ptr<const archive_file> archive;
+
+  // other archives are extracted as they arrive
+  std::shared_ptr<archive_pipe> pipe;
+  bool read_done = false;
+  bool extract_done = false;
+  bool extract_ok = false;
 
   bool has_more_chunks() const { return is_stream && chunk_size > 0; }
+  bool is_last_chunk() const {
+    return chunk_bytes_left == 0 && !has_more_chunks();
+  }
+};
+
+// The result of writing and indexing part of a plain tar upload
+struct indexed_chunk {
+  std::string err;
+  std::vector<tar_entry> entries;
+};
+
+// Whether a compressed variant of an upload exists on disk. pending means
+// an earlier request is creating it.
+enum class variant_state { unknown, pending, available, unavailable };
+
+// Validators for an uploaded file
+struct upload_meta {
+  std::string etag;
+  std::time_t last_modified;
+  variant_state gzip = variant_state::unknown;
+
+  // distinguishes reuploads of identical content
+  std::uint64_t generation = 0;
+
+  // entries of indexed archives are a range of the archive
+  std::shared_ptr<const archive_file> archive;
+  std::uint64_t offset = 0;
+  std::uint64_t size = 0;
+
+  // the etag is the SHA-256 of the contents, so it can name a blob
+  bool hashed = true;
+};
+
+// A file copied from a descriptor the client passed
+struct cloned_upload {
+  std::error_code ec;
+  std::uint64_t size = 0;
+  upload_meta meta;
+};
+
+// Largest upload manifest or batch index accepted, enough for tens of
+// thousands of files
+constexpr std::size_t max_manifest_size = 16 * 1024 * 1024;
+
+// A file offered in an upload manifest that the session doesn't have
+struct manifest_link {
+  std::size_t index;
+  std::filesystem::path path;
+  std::string digest;
+  std::uint64_t size;
+  bool linked = false;
 };
 
+// A file in an upload batch
+struct batch_file {
+  std::filesystem::path path;
+  std::uint64_t size;
+};
+
+// Many files uploaded in one message, with their contents back to back.
+// Each read can span several files, which are written in one pass.
+struct batch_upload_state {
+  std::vector<batch_file> files;
+  std::size_t next = 0; // the file being written
+  std::uint64_t file_bytes_left = 0;
+  std::ofstream of;
+  html_sha256_ctx hash;
+  std::uint64_t bytes_left = 0; // not yet read from the stream
+  std::uint64_t bytes = 0;
+  std::chrono::steady_clock::time_point start;
+  std::vector<std::uint8_t> buf;
+};
+
+// The files completed by writing part of an upload batch
+struct batch_chunk {
+  std::string err;
+  std::vector<std::pair<std::filesystem::path, upload_meta>> completed;
+};
+
+// A file extracted from an uploaded archive, not yet moved into place
+struct extracted_entry {
+  std::filesystem::path path;
+  upload_meta meta;
+};
+
+// What a GET decided on the session strand, for the disk work to finish
+struct get_plan {
+  std::filesystem::path path;
+  std::string mime;
+  upload_meta meta;
+  bool vary = false;
+  bool gzip = false;     // serve the gzip variant
+  bool compress = false; // create the gzip variant first
+};
+
+// A URL prefix whose uploads the app provides when they're requested
+struct lazy_prefix {
+  std::string url;
+  bool cache;
+};
+
+// GET requests waiting for the app to upload a lazy URL
+struct pending_fetch {
+  std::string url;
+  bool cache = true;
+  std::uint64_t id = 0; // tells a timeout for this fetch from an earlier one
+  std::unique_ptr<asio::steady_timer> deadline;
+  std::vector<std::pair<my::string_request, http_response_handler>> waiters;
+};
+
+// A message for the app and the body that follows it
+struct imsg_out {
+  std::string header = std::string(HTML_MSG_SIZE, '\0');
+  std::size_t size = 0;
+  std::string body;
+  std::function<void()> sent; // called once the whole message is written
+};
+
+// Where the bytes of a response body are on disk
+struct body_source {
+  std::filesystem::path path;
+  std::uint64_t offset = 0;
+  std::uint64_t size = 0;
+};
+
+// Copy a string into a message field, cutting it short if it doesn't fit
+template <std::size_t N>
+static void copy_field(char (&field)[N], std::string_view str) {
+  auto n = str.copy(field, N - 1);
+  field[n] = '\0';
+}
+
+static std::filesystem::path gzip_path(const std::filesystem::path &path) {
+  auto gz = path;
+  gz += ".gz";
+  return gz;
+}
+
+static std::filesystem::path part_path(const std::filesystem::path &path) {
+  auto part = path;
+  part += ".part";
+  return part;
+}
+
+// The hex SHA-256 an upload's etag quotes
+static std::string_view etag_digest(std::string_view etag) {
+  return etag.substr(1, etag.size() - 2);
+}
+
+// A distinct strong validator for the gzip content coding
+static std::string gzip_etag(const std::string &etag) {
+  auto gz = etag;
+  gz.insert(gz.size() - 1, "-gzip");
+  return gz;
+}
+
+static upload_meta make_upload_meta(std::string_view hex) {
+  upload_meta meta;
+  meta.etag = '"';
+  meta.etag += hex;
+  meta.etag += '"';
+  meta.last_modified = std::time(nullptr);
+  return meta;
+}
+
+static upload_meta make_upload_meta(const std::uint8_t *digest) {
+  char hex[HTML_SHA256_HEX_SIZE];
+  html_sha256_hex(digest, hex);
+  return make_upload_meta(std::string_view{hex});
+}
+
+static upload_meta make_upload_meta(html_sha256_ctx &hash) {
+  std::uint8_t digest[HTML_SHA256_SIZE];
+  html_sha256_final(&hash, digest);
+  return make_upload_meta(digest);
+}
+
+// Hashing a file passed by descriptor would mean reading all of it, which
+// is what passing it avoids. The copy's identity is the validator instead,
+// and add_upload makes it unique to the upload.
+static upload_meta make_clone_meta(const std::filesystem::path &path,
+                                   std::error_code &ec) {
+  struct stat st {};
+  if (::stat(path.c_str(), &st) != 0) {
+    ec = std::error_code{errno, std::generic_category()};
+    return {};
+  }
+
+  auto mtime = std::filesystem::last_write_time(path, ec);
+  if (ec)
+    return {};
+
+  std::ostringstream os;
+  os << "\"fd-" << std::hex << st.st_ino << '-' << st.st_size << '-'
+     << mtime.time_since_epoch().count() << '"';
+
+  upload_meta meta;
+  meta.etag = os.str();
+  meta.last_modified = std::time(nullptr);
+  meta.hashed = false;
+  return meta;
+}
+
+// The URL of a file in an archive uploaded to url
+static std::string entry_url(std::string_view url,
+                             std::string_view entry_pathname) {
+  std::string cat_url{url};
+  if (!(url.ends_with('/') || entry_pathname.starts_with('/')))
+    cat_url += '/';
+
+  cat_url += entry_pathname;
+  return cat_url;
+}
+
 class catui_connection : public std::enable_shared_from_this<catui_connection>,
                          public http_session,
                          public browser::window_watcher {
@@ -60,38 +344,93 @@ class catui_connection : public std::enable_shared_from_this<catui_connection>,
   std::vector<std::uint8_t> output_msg_buf_;
   std::shared_ptr<http_listener> http_;
   std::string session_id_;
-  std::vector<std::uint8_t> submit_buf_;
   beast::flat_buffer ws_buf_;
   std::string ws_send_buf_;
   browser &browser_;
   bool gracefully_closed_ = false;
 
-  std::map<std::string, std::string> mime_overrides_;
+  mime_overlay mime_overrides_;
   boost::uuids::name_generator_sha1 name_gen_{boost::uuids::ns::url()};
   const std::filesystem::path &all_sessions_dir_;
+  const compression_config &compression_;
+  content_cache &cache_;
+  server_metrics &metrics_;
   session_lock session_mtx_;
   std::filesystem::path docroot_;
   std::filesystem::path archives_dir_;
   std::filesystem::path files_dir_;
+  std::map<std::filesystem::path, upload_meta> uploads_;
+  std::uint64_t next_generation_ = 0;
+  std::uint64_t next_archive_ = 0;
+
+  // Serializes this session's disk work on the blocking I/O pool
+  asio::strand<asio::thread_pool::executor_type> disk_;
+  archive_extractor &extractor_;
+
+  // Uploads are shared with other sessions through the blob store
+  blob_store &blobs_;
+  std::set<std::string> blob_digests_;
 
   std::shared_ptr<my::ws_stream> ws_;
 
+  std::vector<lazy_prefix> lazy_;
+  std::map<std::filesystem::path, pending_fetch> fetches_;
+  std::uint64_t next_fetch_ = 0;
+  std::size_t fetch_waiters_ = 0;
+
+  // the app asked to be told when each upload is servable
+  bool ack_uploads_ = false;
+
+  // Messages to the app are written one at a time so they don't interleave
+  std::deque<imsg_out> imsg_queue_;
+
+  // Messages to the app are encoded like its last message, so apps that
+  // only know JSON never get binary messages
+  html_msg_encoding app_encoding_ = HTML_ENC_JSON;
+
+  // when the last form was posted, until the app responds
+  std::optional<std::chrono::steady_clock::time_point> form_submitted_;
+
   template <member_fn_of<self> Fn, typename... FnArgs>
   auto bind(Fn &&fn, FnArgs &&...args) {
     return std::bind_front(fn, shared_from_this(),
                            std::forward<FnArgs>(args)...);
   }
 
-  std::ostream &log() { return std::cerr << '[' << session_id_ << "] "; }
+  // Run work on the blocking I/O pool and pass its result to done on the
+  // session strand
+  template <typename Work, typename Done>
+  void async_disk(Work &&work, Done &&done) {
+    asio::post(disk_, [self = shared_from_this(),
+                       work = std::forward<Work>(work),
+                       done = std::forward<Done>(done)]() mutable {
+      auto result = work();
+      asio::post(self->get_executor(), [done = std::move(done),
+                                        result = std::move(result)]() mutable {
+        done(std::move(result));
+      });
+    });
+  }
 
 public:
   catui_connection(my::stream_descriptor &&stream, const char *session_id,
                    const std::shared_ptr<http_listener> &http, browser &browsr,
-                   const std::filesystem::path &all_sessions_dir)
+                   const std::filesystem::path &all_sessions_dir,
+                   const compression_config &compression,
+                   content_cache &cache, server_metrics &metrics,
+                   asio::thread_pool &io_pool, archive_extractor &extractor,
+                   blob_store &blobs)
       : stream_{std::move(stream)}, session_id_{session_id}, http_{http},
-        browser_{browsr}, all_sessions_dir_{all_sessions_dir} {}
+        browser_{browsr}, all_sessions_dir_{all_sessions_dir},
+        compression_{compression}, cache_{cache}, metrics_{metrics},
+        disk_{asio::make_strand(io_pool)}, extractor_{extractor},
+        blobs_{blobs} {
+    metrics_.sessions_started.add();
+    metrics_.sessions_active.add(1);
+  }
 
   ~catui_connection() {
+    metrics_.sessions_active.add(-1);
     http_->remove_session(session_id_);
 
     if (!gracefully_closed_) {
@@ -101,13 +440,23 @@ public:
                        "bug.");
     }
 
-    std::filesystem::remove_all(docroot_);
+    // Pending disk work holds a reference, so none of it is left to race
+    cache_.erase_under(docroot_);
+    asio::post(disk_, [docroot = docroot_, &blobs = blobs_,
+                       digests = std::move(blob_digests_)] {
+      std::error_code ec;
+      std::filesystem::remove_all(docroot, ec);
+
+      // blobs only this session used go with it
+      for (const auto &digest : digests)
+        blobs.release(digest);
+    });
   }
 
-  // Start the asynchronous operation
-  void run() {
+  auto get_executor() { return stream_.get_executor(); }
 
-    // TODO - thread safety on http_ ptr
+  // Start the asynchronous operation. Must be called on get_executor()
+  void run() {
     http_->add_session(session_id_, weak_from_this());
     browser_.add_session(session_id_, weak_from_this());
 
@@ -118,13 +467,13 @@ public:
 
     // TODO nack or fatal_error
     if (!session_mtx_.open(docroot_)) {
-      std::cerr << "Failed to open session lock" << std::endl;
+      HTML_LOG(error, session_id_, "Failed to open session lock");
       return;
     }
 
     if (!session_mtx_.try_lock()) {
       ::perror("sem_wait");
-      std::cerr << "Failed to obtain session lock" << std::endl;
+      HTML_LOG(error, session_id_, "Failed to obtain session lock");
       return;
     }
 
@@ -141,15 +490,53 @@ public:
     asio::dispatch(stream_.get_executor(), bind(&self::do_recv));
   }
 
-  my::string_response respond(const std::string_view &target,
-                              my::string_request &&req) override {
+  void async_respond(const std::string_view &target, my::string_request &&req,
+                     const http_response_handler &cb) override {
+    // session state is only touched on the catui strand
+    asio::dispatch(stream_.get_executor(),
+                   [self = shared_from_this(), target = std::string{target},
+                    req = std::move(req), cb]() mutable {
+                     self->respond(target, std::move(req), cb);
+                   });
+  }
+
+  void connect_ws(boost::asio::ip::tcp::socket &&sock,
+                  my::string_request &&req) override {
+    // rebind the socket to the catui strand so websocket handlers don't
+    // race with catui handlers
+    beast::error_code ec;
+    auto protocol = sock.local_endpoint(ec).protocol();
+    tcp::socket strand_sock{stream_.get_executor()};
+    if (!ec)
+      strand_sock.assign(protocol, sock.release(ec), ec);
+
+    if (ec) {
+      HTML_LOG(error, session_id_,
+               "Failed to move websocket: " << ec.message());
+      return;
+    }
+
+    asio::dispatch(stream_.get_executor(),
+                   [self = shared_from_this(), sock = std::move(strand_sock),
+                    req = std::move(req)]() mutable {
+                     self->do_connect_ws(std::move(sock), std::move(req));
+                   });
+  }
+
+  void window_close_requested() override {
+    asio::post(stream_.get_executor(), bind(&self::request_close));
+  }
+
+private:
+  void respond(const std::string_view &target, my::string_request &&req,
+               const http_response_handler &cb) {
 
     switch (req.method()) {
     case http::verb::post:
-      return respond_post(target, std::move(req));
+      return cb(respond_post(target, std::move(req)));
     case http::verb::head:
     case http::verb::get:
-      return respond_get(target, std::move(req));
+      return respond_get(target, std::move(req), cb);
     default:
       break;
     }
@@ -164,15 +551,14 @@ public:
     res.set(http::field::content_type, "text/plain");
     res.body() = os.str();
     res.prepare_payload();
-    return res;
+    cb(std::move(res));
   }
 
-  void connect_ws(boost::asio::ip::tcp::socket &&sock,
-                  my::string_request &&req) override {
+  void do_connect_ws(tcp::socket &&sock, my::string_request &&req) {
     if (ws_) {
-      log() << "Aborting websocket connection because one already exists "
-               "for the session"
-            << std::endl;
+      HTML_LOG(warn, session_id_,
+               "Aborting websocket connection because one already exists "
+               "for the session");
       sock.close();
       return;
     }
@@ -181,13 +567,8 @@ public:
     my::async_ws_accept(*ws_, req, bind(&self::on_ws_accept));
   }
 
-  void window_close_requested() override {
-    asio::post(stream_.get_executor(), bind(&self::request_close));
-  }
-
-private:
   void do_recv() {
-    log() << "Waiting to receive html message" << std::endl;
+    HTML_LOG(debug, session_id_, "Waiting to receive html message");
 
     output_msg_buf_.resize(HTML_MSG_SIZE);
     asio::dispatch([this] {
@@ -199,15 +580,23 @@ private:
 
   void on_recv(std::error_condition ec, std::size_t n) {
     if (ec) {
-      log() << "Error receiving html message: " << ec.message() << std::endl;
+      HTML_LOG(warn, session_id_,
+               "Error receiving html message: " << ec.message());
       return end_catui();
     }
 
+    app_encoding_ = html_msg_encoding_of(output_msg_buf_.data(), n);
+
     struct html_out_msg msg;
     if (!html_decode_out_msg(output_msg_buf_.data(), n, &msg)) {
       return fatal_error("Invalid output message");
     }
 
+    if (form_submitted_) {
+      metrics_.form_round_trip_us.record_since(*form_submitted_);
+      form_submitted_.reset();
+    }
+
     switch (msg.type) {
     case HTML_OMSG_UPLOAD:
       do_read_upload(msg.msg.upload);
@@ -227,14 +616,32 @@ private:
     case HTML_OMSG_ACCEPT_IO_TRANSFER:
       do_accept_io_transfer(msg.msg.accept_io_transfer);
       break;
+    case HTML_OMSG_UPLOAD_FD:
+      do_recv_upload_fd(msg.msg.upload_fd);
+      break;
+    case HTML_OMSG_UPLOAD_BATCH:
+      do_read_batch(msg.msg.upload_batch);
+      break;
+    case HTML_OMSG_UPLOAD_MANIFEST:
+      do_read_manifest(msg.msg.upload_manifest);
+      break;
+    case HTML_OMSG_LAZY:
+      do_lazy(msg.msg.lazy);
+      break;
+    case HTML_OMSG_FETCH_FAILED:
+      do_fetch_failed(msg.msg.fetch_failed);
+      break;
+    case HTML_OMSG_ACK_UPLOADS:
+      do_ack_uploads();
+      break;
     default:
-      log() << "Invalid message type: " << msg.type << std::endl;
+      HTML_LOG(warn, session_id_, "Invalid message type: " << msg.type);
       break;
     }
   }
 
   void do_close() {
-    log() << "CLOSE" << std::endl;
+    HTML_LOG(info, session_id_, "CLOSE");
     gracefully_closed_ = true;
     end_catui();
     browser_.remove_session(session_id_);
@@ -245,12 +652,12 @@ private:
     for (std::size_t i = 0; i < n; ++i) {
       const char *ext_c, *mime_c;
       if (!html_mime_map_entry_at(mimes, i, &ext_c, &mime_c)) {
-        std::cerr << "failed to read mime entry" << std::endl;
+        HTML_LOG(warn, session_id_, "failed to read mime entry");
         break;
       }
 
-      log() << "MIME ." << ext_c << " -> " << mime_c << std::endl;
-      mime_overrides_[ext_c] = mime_c;
+      HTML_LOG(debug, session_id_, "MIME ." << ext_c << " -> " << mime_c);
+      mime_overrides_.set(ext_c, mime_c);
     }
 
     html_mime_map_free(mimes);
@@ -258,32 +665,25 @@ private:
   }
 
   void request_close() {
-    log() << "CLOSE-REQ" << std::endl;
-    submit_buf_.resize(HTML_MSG_SIZE);
-    int msg_size =
-        html_encode_imsg_close_req(submit_buf_.data(), submit_buf_.size());
-    if (msg_size < 0) {
+    HTML_LOG(info, session_id_, "CLOSE-REQ");
+    html_in_msg msg{.type = HTML_IMSG_CLOSE_REQ};
+    imsg_out close_req;
+    if (!encode_imsg(msg, close_req)) {
       return fatal_error("Failed to encode close message");
     }
 
-    my::async_msgstream_send(stream_, asio::buffer(submit_buf_), msg_size,
-                             bind(&self::on_request_close));
-  }
-
-  void on_request_close(std::error_condition ec, std::size_t n) {
-    if (ec) {
-      log() << "Failed to send close request: " << ec.message() << std::endl;
-      return end_catui();
-    }
+    send_imsg(std::move(close_req));
   }
 
   void on_ws_accept(beast::error_code ec) {
     if (ec) {
-      log() << "Failed to accept websocket: " << ec.message() << std::endl;
+      HTML_LOG(error, session_id_,
+               "Failed to accept websocket: " << ec.message());
       return;
     }
 
-    log() << "Websocket connected" << std::endl;
+    HTML_LOG(info, session_id_, "Websocket connected");
+    metrics_.ws_connections.add();
     do_ws_read();
   }
 
@@ -294,11 +694,20 @@ private:
     ws_ = nullptr;
   }
 
-  void end_catui() { stream_.close(); }
+  void end_catui() {
+    stream_.close();
+
+    // nothing will upload the URLs they're waiting for now
+    while (!fetches_.empty()) {
+      auto path = fetches_.begin()->first;
+      fail_fetch(path);
+    }
+  }
 
   void do_ws_read() {
     if (!ws_) {
-      log() << "Invalid do_ws_read with no websocket connection" << std::endl;
+      HTML_LOG(error, session_id_,
+               "Invalid do_ws_read with no websocket connection");
       return;
     }
 
@@ -308,8 +717,8 @@ private:
   void on_ws_read(beast::error_code ec, std::size_t size) {
     if (ec) {
       if (ec == beast::websocket::error::closed) {
-        log() << "Failed to read ws message for session " << session_id_ << ": "
-              << ec.message() << std::endl;
+        HTML_LOG(warn, session_id_,
+                 "Failed to read ws message: " << ec.message());
       }
 
       return end_ws();
@@ -318,57 +727,33 @@ private:
     auto msg = beast::buffers_to_string(ws_buf_.data());
     ws_buf_.consume(size);
 
+    metrics_.ws_messages_in.add();
+    metrics_.ws_bytes_in.add(msg.size());
+    metrics_.ws_message_bytes.record(msg.size());
+
     do_send_recv_msg(msg);
   }
 
   void do_send_recv_msg(std::string &msg) {
-    log() << "RECV: " << msg << std::endl;
-
-    // TODO - need to sync w/ POST
-    submit_buf_.resize(HTML_MSG_SIZE);
-    if (html_encode_imsg_app_msg(submit_buf_.data(), submit_buf_.size(),
-                                 msg.size()) < 0) {
-      log() << "Failed to encode recv msg" << std::endl;
-      return end_ws();
-    }
-
-    asio::dispatch(stream_.get_executor(),
-                   bind(&self::submit_recv_app_msg,
-                        std::make_shared<std::string>(std::move(msg))));
-  }
-
-  void submit_recv_app_msg(std::shared_ptr<std::string> msg) {
-    auto buf = asio::buffer(submit_buf_.data(), HTML_MSG_SIZE);
-    my::async_msgstream_send(stream_, buf, submit_buf_.size(),
-                             bind(&self::on_submit_recv_app_msg, msg));
-  }
-
-  void on_submit_recv_app_msg(std::shared_ptr<std::string> msg,
-                              std::error_condition ec, std::size_t n) {
-    if (ec) {
-      log() << "Failed to send RECV msg" << std::endl;
-      return end_catui();
-    }
+    HTML_LOG_BODY(session_id_, "RECV", msg);
 
-    asio::async_write(stream_, asio::buffer(*msg),
-                      asio::transfer_exactly(msg->size()),
-                      bind(&self::on_send_recv_app_msg_content, msg));
-  }
+    html_in_msg imsg{.type = HTML_IMSG_APP_MSG};
+    imsg.msg.app_msg.content_length = msg.size();
 
-  void on_send_recv_app_msg_content(std::shared_ptr<std::string> msg,
-                                    std::error_code ec, std::size_t n) {
-    if (ec) {
-      log() << "Failed to send RECV msg content" << std::endl;
-      return end_catui();
+    imsg_out out;
+    if (!encode_imsg(imsg, out)) {
+      HTML_LOG(error, session_id_, "Failed to encode recv msg");
+      return end_ws();
     }
 
-    do_ws_read();
+    out.body = std::move(msg);
+    out.sent = bind(&self::do_ws_read);
+    send_imsg(std::move(out));
   }
 
   void on_ws_write(beast::error_code ec, std::size_t size) {
     if (ec) {
-      log() << "Failed to send ws message for session " << session_id_
-            << std::endl;
+      HTML_LOG(error, session_id_, "Failed to send ws message");
       return end_ws();
     }
 
@@ -387,16 +772,21 @@ private:
         return respond400("Form too big", std::move(req));
       }
 
-      submit_buf_.resize(HTML_MSG_SIZE);
-      if (!html_encode_imsg_form(submit_buf_.data(), submit_buf_.size(),
-                                 req.body().size(), ctype.c_str())) {
+      html_in_msg msg{.type = HTML_IMSG_FORM};
+      msg.msg.form.content_length = req.body().size();
+      copy_field(msg.msg.form.mime_type, ctype);
+
+      imsg_out form;
+      if (!encode_imsg(msg, form)) {
         return respond400("Failed to encode form submission", std::move(req));
       }
 
-      log() << "Initiating post with body: " << req.body() << std::endl;
-      asio::dispatch(stream_.get_executor(),
-                     bind(&self::submit_post, std::make_shared<std::string>(
-                                                  std::move(req.body()))));
+      HTML_LOG_BODY(session_id_, "Posting", req.body());
+      metrics_.form_submits.add();
+      form_submitted_ = std::chrono::steady_clock::now();
+
+      form.body = std::move(req.body());
+      send_imsg(std::move(form));
 
       my::string_response res{http::status::see_other, req.version()};
       res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
@@ -412,51 +802,17 @@ private:
   }
 
   void fatal_error(const std::string &msg) {
-    log() << "Fatal error: " << msg << std::endl;
+    HTML_LOG(error, session_id_, "Fatal error: " << msg);
 
-    std::shared_ptr<std::string> err_buf = std::make_shared<std::string>();
-    err_buf->resize(HTML_MSG_SIZE);
+    html_in_msg imsg{.type = HTML_IMSG_ERROR};
+    copy_field(imsg.msg.error.msg, msg);
 
-    if (html_encode_imsg_error(err_buf->data(), err_buf->size(), msg.c_str()) <
-        0)
+    imsg_out err;
+    if (!encode_imsg(imsg, err))
       return;
 
-    auto buf = asio::buffer(*err_buf);
-    my::async_msgstream_send(stream_, buf, err_buf->size(),
-                             bind(&self::on_send_err, err_buf));
-  }
-
-  void on_send_err(std::shared_ptr<std::string> err_buf,
-                   const std::error_condition &ec, std::size_t n) {
-    end_catui();
-  }
-
-  void submit_post(std::shared_ptr<std::string> body) {
-    log() << "Posting body: " << *body << std::endl;
-    auto buf = asio::buffer(submit_buf_.data(), HTML_MSG_SIZE);
-    my::async_msgstream_send(stream_, buf, submit_buf_.size(),
-                             bind(&self::on_submit_post, body));
-  }
-
-  void on_submit_post(std::shared_ptr<std::string> body,
-                      std::error_condition ec, std::size_t n) {
-    if (ec) {
-      log() << "Error sending form to app: " << ec.message() << std::endl;
-      return end_catui();
-    }
-
-    asio::async_write(stream_, asio::buffer(body->data(), body->size()),
-                      asio::transfer_exactly(body->size()),
-                      bind(&self::on_write_form, body));
-  }
-
-  void on_write_form(std::shared_ptr<std::string> body, std::error_code ec,
-                     std::size_t n) {
-    if (ec) {
-      log() << "Error sending form contents to app: " << ec.message()
-            << std::endl;
-      return end_catui();
-    }
+    err.sent = bind(&self::end_catui);
+    send_imsg(std::move(err));
   }
 
   std::filesystem::path
@@ -477,198 +833,853 @@ private:
   }
 
   std::string_view mime_type_for(const std::string_view &url) const {
-    auto start = url.rfind('.');
-    if (start == std::string_view::npos)
-      return std::string_view{};
-
-    // don't wastefully compare the dot
-    start += 1;
+    return mime_type_for_url(url, mime_overrides_);
+  }
 
-    std::string ext;
-    ext.resize(url.size() - start);
+  void respond_get(const std::string_view &target, my::string_request &&req,
+                   const http_response_handler &cb) {
+    get_plan plan;
+    plan.path = upload_path(target);
+
+    auto meta_it = uploads_.find(plan.path);
+    if (meta_it == uploads_.end())
+      return fetch_lazy(target, std::move(plan.path), std::move(req), cb);
+
+    auto &meta = meta_it->second;
+
+    plan.mime = mime_type_for(target);
+    if (plan.mime.empty())
+      return cb(respond404(std::move(req)));
+
+    // Ranges are only served from the identity coding
+    if (req[http::field::range].empty() && is_compressible(plan.mime)) {
+      plan.vary = true;
+      auto accept = req[http::field::accept_encoding];
+      if (accepts_encoding(accept, "gzip")) {
+        // Only one request compresses. The rest get identity until it's done
+        if (meta.gzip == variant_state::unknown) {
+          meta.gzip = variant_state::pending;
+          plan.compress = true;
+        }
 
-    for (auto i = 0; i < ext.size(); ++i) {
-      ext[i] = std::tolower(url[start + i]);
+        plan.gzip = meta.gzip == variant_state::available;
+      }
     }
 
-    auto mime_it = mime_overrides_.find(ext);
-    if (mime_it == mime_overrides_.end())
-      return mime_type(ext);
-    else
-      return mime_it->second;
-  }
-
-  my::string_response respond_get(const std::string_view &target,
-                                  my::string_request &&req) {
-    my::string_response res{http::status::ok, req.version()};
-    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-    res.keep_alive(req.keep_alive());
+    plan.meta = meta;
+
+    asio::post(disk_, [self = shared_from_this(), plan = std::move(plan),
+                       req = std::move(req), cb]() mutable {
+      if (plan.compress) {
+        auto gzip = self->compress_upload(plan);
+        plan.gzip = gzip == variant_state::available;
+        asio::post(self->get_executor(), [self, path = plan.path,
+                                          gen = plan.meta.generation, gzip] {
+          self->set_gzip_state(path, gen, gzip);
+        });
+      }
 
-    auto path = upload_path(target);
+      cb(self->build_get(plan, std::move(req)));
+    });
+  }
 
-    if (!std::filesystem::exists(path))
+  // Build a GET response on the blocking I/O pool
+  http_response build_get(const get_plan &plan,
+                          my::string_request &&req) const {
+    const auto &meta = plan.meta;
+    const auto &mime = plan.mime;
+    auto range_hdr = req[http::field::range];
+    auto cache_key = plan.gzip ? gzip_path(plan.path) : plan.path;
+    auto etag = plan.gzip ? gzip_etag(meta.etag) : meta.etag;
+    bool vary = plan.vary, gzip = plan.gzip;
+
+    if (is_not_modified(req, etag, meta.last_modified))
+      return respond304(etag, meta.last_modified, vary, std::move(req));
+
+    body_source source;
+    if (!find_body(plan, source))
       return respond404(std::move(req));
 
-    auto mime = mime_type_for(target);
-    if (mime.empty())
+    // Hot files are served from memory without touching the filesystem
+    if (range_hdr.empty()) {
+      if (auto content = load_cached(cache_key, source, mime, etag, meta))
+        return respond_cached(std::move(content), vary, gzip, std::move(req));
+    }
+
+    my::file_response res;
+    beast::error_code ec;
+    res.body.open(source.path.c_str(), beast::file_mode::scan, ec);
+    if (ec)
       return respond404(std::move(req));
 
-    res.set(http::field::content_type, mime);
+    auto size = source.size;
+    auto base = source.offset;
 
-    auto size = std::filesystem::file_size(path);
-    res.content_length(size);
+    auto &header = res.header;
+    set_get_headers(header, req, mime, etag, meta.last_modified, vary, gzip);
+    header.keep_alive(req.keep_alive());
+    header.content_length(size);
 
     // Respond to HEAD request
-    if (req.method() == http::verb::head) {
-      res.body() = "";
+    if (req.method() == http::verb::head)
+      return res;
+
+    // A stale If-Range validator means the full representation is sent
+    auto if_range = req[http::field::if_range];
+    if (range_hdr.empty() ||
+        !(if_range.empty() ||
+          if_range_matches(if_range, meta.etag, meta.last_modified))) {
+      res.segments.push_back({"", base, size});
       return res;
     }
 
-    if (req.method() == http::verb::get) {
-      std::ifstream upload_file{path};
-      std::string upload_content;
-      upload_content.resize(size);
-      upload_file.read(upload_content.data(), size);
-      upload_file.close();
-      res.body() = std::move(upload_content);
+    std::vector<byte_range> ranges;
+    switch (parse_range(range_hdr, size, ranges)) {
+    case range_status::ignore:
+      res.segments.push_back({"", base, size});
+      return res;
+    case range_status::unsatisfiable:
+      return respond416(size, std::move(req));
+    case range_status::satisfiable:
+      break;
     }
 
-    // Send the response
-    res.prepare_payload();
-    return res;
-  }
+    header.result(http::status::partial_content);
 
-  my::string_response respond404(my::string_request &&req) {
-    my::string_response res{http::status::not_found, req.version()};
-    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-    res.keep_alive(req.keep_alive());
+    if (ranges.size() == 1) {
+      const auto &range = ranges[0];
+      header.set(http::field::content_range, content_range(range, size));
+      header.content_length(range.length);
+      res.segments.push_back({"", base + range.offset, range.length});
+      return res;
+    }
 
-    res.set(http::field::content_type, "text/plain");
-    res.body() = std::string("Not found");
-    res.prepare_payload();
-    return res;
-  }
+    // multipart/byteranges
+    std::ostringstream boundary_os;
+    boundary_os << boost::uuids::random_generator()();
+    auto boundary = boundary_os.str();
+
+    header.set(http::field::content_type,
+               "multipart/byteranges; boundary=" + boundary);
+
+    std::uint64_t content_length = 0;
+    for (const auto &range : ranges) {
+      std::ostringstream preamble;
+      preamble << "\r\n--" << boundary << "\r\n"
+               << "Content-Type: " << mime << "\r\n"
+               << "Content-Range: " << content_range(range, size)
+               << "\r\n\r\n";
+
+      auto &seg = res.segments.emplace_back();
+      seg.preamble = preamble.str();
+      seg.offset = base + range.offset;
+      seg.length = range.length;
+      content_length += seg.preamble.size() + seg.length;
+    }
 
-  my::string_response respond400(const std::string_view &msg,
-                                 my::string_request &&req) {
-    my::string_response res{http::status::bad_request, req.version()};
-    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-    res.keep_alive(req.keep_alive());
+    res.trailer = "\r\n--" + boundary + "--\r\n";
+    content_length += res.trailer.size();
+    header.content_length(content_length);
 
-    res.set(http::field::content_type, "text/plain");
-    res.body() = std::string(msg);
-    res.prepare_payload();
     return res;
   }
 
-  void do_read_upload(const html_omsg_upload &msg) {
-    log() << "UPLOAD " << msg.url << std::endl;
+  void set_gzip_state(const std::filesystem::path &path,
+                      std::uint64_t generation, variant_state gzip) {
+    auto it = uploads_.find(path);
+    if (it != uploads_.end() && it->second.generation == generation)
+      it->second.gzip = gzip;
+  }
 
-    auto state = std::make_shared<read_upload_state>();
-    state->path = upload_path(msg.url, msg.rtype);
-    state->rtype = msg.rtype;
-    state->url = msg.url;
+  void set_get_headers(http::response_header<> &header,
+                       const my::string_request &req, std::string_view mime,
+                       const std::string &etag, std::time_t last_modified,
+                       bool vary, bool gzip) const {
+    header.result(http::status::ok);
+    header.version(req.version());
+    header.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    header.set(http::field::accept_ranges, "bytes");
+    header.set(http::field::etag, etag);
+    header.set(http::field::last_modified, http_date(last_modified));
+    header.set(http::field::content_type, mime);
+
+    if (vary)
+      header.set(http::field::vary, "Accept-Encoding");
+
+    if (gzip)
+      header.set(http::field::content_encoding, "gzip");
+  }
 
-    state->of.open(state->path);
+  // Find where the body of a planned GET is. Entries of indexed archives
+  // are served from the archive unless they're compressed.
+  bool find_body(const get_plan &plan, body_source &source) const {
+    const auto &meta = plan.meta;
+    if (meta.archive && !plan.gzip) {
+      source = {meta.archive->path(), meta.offset, meta.size};
+      return true;
+    }
 
-    if (!state->of)
-      return fatal_error("Error opening file for upload");
+    source.path = plan.gzip ? gzip_path(plan.path) : plan.path;
+    source.offset = 0;
 
-    state->chunk_bytes_left = msg.content_length;
-    state->is_stream = msg.content_length == 0;
+    std::error_code ec;
+    source.size = std::filesystem::file_size(source.path, ec);
+    return !ec;
+  }
 
-    if (state->is_stream)
-      read_upload_chunk_size(state);
-    else
-      read_upload_chunk(state);
+  // Find a file in the content cache, reading it into the cache if it's
+  // small enough. Entries with outdated validators are replaced.
+  content_cache::entry_ptr load_cached(const std::filesystem::path &key,
+                                       const body_source &source,
+                                       std::string_view mime,
+                                       const std::string &etag,
+                                       const upload_meta &meta) const {
+    auto entry = cache_.find(key);
+    if (entry && entry->etag == etag && entry->mime == mime)
+      return entry;
+
+    auto size = source.size;
+    if (size > cache_.max_entry_size())
+      return nullptr;
+
+    auto content = std::make_shared<cached_content>();
+    content->bytes.resize(size);
+
+    std::ifstream in{source.path, std::ios::binary};
+    if (!in.seekg(source.offset) || !in.read(content->bytes.data(), size))
+      return nullptr;
+
+    content->mime = mime;
+    content->etag = etag;
+    content->last_modified = meta.last_modified;
+
+    cache_.insert(key, content);
+    return content;
   }
 
-  void read_upload_chunk_size(std::shared_ptr<read_upload_state> state) {
-    my::async_readn(stream_, asio::buffer(&state->chunk_size, 2), 2,
-                    bind(&self::on_read_upload_chunk_size, state));
+  my::shared_string_response respond_cached(content_cache::entry_ptr content,
+                                            bool vary, bool gzip,
+                                            my::string_request &&req) const {
+    my::shared_string_response res;
+    set_get_headers(res, req, content->mime, content->etag,
+                    content->last_modified, vary, gzip);
+    res.keep_alive(req.keep_alive());
+    res.content_length(content->bytes.size());
+
+    // HEAD has no body but advertises the full length
+    if (req.method() != http::verb::head)
+      res.body() = {content, &content->bytes};
+
+    return res;
   }
 
-  void on_read_upload_chunk_size(std::shared_ptr<read_upload_state> state,
-                                 std::error_code ec, std::size_t n) {
-    if (ec)
-      return fatal_error(ec.message());
+  // Compress an upload the first time a client accepts gzip for it. Runs
+  // on the blocking I/O pool.
+  variant_state compress_upload(const get_plan &plan) const {
+    int level = compression_.gzip_level.load(std::memory_order_relaxed);
+    if (level <= 0)
+      return variant_state::unavailable;
+
+    auto min_size = compression_.min_size.load(std::memory_order_relaxed);
+    body_source source;
+    if (!find_body(plan, source) || source.size < min_size)
+      return variant_state::unavailable;
+
+    auto gz = gzip_path(plan.path);
+    if (!gzip_file(source.path, gz, level, source.offset, source.size)) {
+      HTML_LOG(warn, session_id_, "Failed to compress " << plan.path);
+      return variant_state::unavailable;
+    }
 
-    state->chunk_bytes_left = state->chunk_size;
-    read_upload_chunk(state);
+    // Not worth serving if it didn't shrink
+    auto size = source.size;
+    std::error_code ec;
+    auto gz_size = std::filesystem::file_size(gz, ec);
+    if (ec || gz_size >= size) {
+      std::filesystem::remove(gz, ec);
+      return variant_state::unavailable;
+    }
+
+    return variant_state::available;
   }
 
-  void read_upload_chunk(std::shared_ptr<read_upload_state> state) {
-    std::size_t n = std::min(state->chunk_bytes_left, output_msg_buf_.size());
+  // Forget an upload and any variants derived from it
+  void invalidate_upload(const std::filesystem::path &path) {
+    uploads_.erase(path);
+    cache_.erase(path);
+    cache_.erase(gzip_path(path));
 
-    my::async_readn(stream_, asio::buffer(output_msg_buf_), n,
-                    bind(&self::on_read_upload_chunk, state));
+    asio::post(disk_, [gz = gzip_path(path)] {
+      std::error_code ec;
+      std::filesystem::remove(gz, ec);
+    });
   }
 
-  void on_read_upload_chunk(std::shared_ptr<read_upload_state> state,
-                            std::error_code ec, std::size_t n) {
-    if (ec)
-      return fatal_error(ec.message());
+  void add_upload(const std::filesystem::path &path, upload_meta meta) {
+    meta.generation = ++next_generation_;
 
-    try {
-      state->of.write((const char *)output_msg_buf_.data(), n);
-    } catch (const std::exception &ex) {
-      return fatal_error(ex.what());
+    // A copy's inode can be reused after the old copy is removed, and a
+    // coarse mtime may not change, so the generation tells reuploads apart
+    if (!meta.hashed) {
+      std::ostringstream gen;
+      gen << '-' << std::hex << meta.generation;
+      meta.etag.insert(meta.etag.size() - 1, gen.str());
     }
 
-    state->chunk_bytes_left -= n;
-    if (state->chunk_bytes_left > 0) {
-      read_upload_chunk(state);
-    } else if (state->has_more_chunks()) {
+    // archive entries already share the archive's file
+    if (!meta.archive && meta.hashed) {
+      std::string digest{etag_digest(meta.etag)};
+      blob_digests_.insert(digest);
+      asio::post(disk_, [&blobs = blobs_, path, digest] {
+        if (!blobs.add(path, digest))
+          HTML_LOG(debug, "", "Not deduplicating " << path);
+      });
+    }
+
+    uploads_[path] = std::move(meta);
+    finish_fetch(path);
+  }
+
+  const lazy_prefix *find_lazy(std::string_view url) const {
+    const lazy_prefix *match = nullptr;
+    for (const auto &prefix : lazy_) {
+      if (url.starts_with(prefix.url) &&
+          (!match || prefix.url.size() > match->url.size())) {
+        match = &prefix;
+      }
+    }
+
+    return match;
+  }
+
+  // Hold a GET for a URL that wasn't uploaded until the app uploads it, if
+  // it's under a lazy prefix. Only the first request for it asks the app.
+  void fetch_lazy(const std::string_view &target, std::filesystem::path path,
+                  my::string_request &&req, const http_response_handler &cb) {
+    auto prefix = find_lazy(target);
+    if (!prefix || !stream_.is_open() || target.size() >= HTML_URL_SIZE ||
+        mime_type_for(target).empty()) {
+      return cb(respond404(std::move(req)));
+    }
+
+    auto it = fetches_.find(path);
+    if (fetch_waiters_ >= max_session_fetch_waiters ||
+        (it != fetches_.end() &&
+         it->second.waiters.size() >= max_fetch_waiters)) {
+      HTML_LOG(warn, session_id_, "Too many requests waiting for " << target);
+      return cb(respond_error(http::status::service_unavailable,
+                              "Too many requests", std::move(req)));
+    }
+
+    ++fetch_waiters_;
+    if (it != fetches_.end()) {
+      it->second.waiters.emplace_back(std::move(req), cb);
+      return;
+    }
+
+    HTML_LOG(info, session_id_, "FETCH " << target);
+    it = fetches_.try_emplace(path).first;
+    auto &fetch = it->second;
+    fetch.url = target;
+    fetch.cache = prefix->cache;
+    fetch.id = next_fetch_++;
+    fetch.waiters.emplace_back(std::move(req), cb);
+
+    fetch.deadline = std::make_unique<asio::steady_timer>(get_executor());
+    fetch.deadline->expires_after(fetch_timeout);
+    fetch.deadline->async_wait(bind(&self::on_fetch_timeout, path, fetch.id));
+
+    html_in_msg msg{.type = HTML_IMSG_FETCH};
+    copy_field(msg.msg.fetch.url, fetch.url);
+
+    imsg_out fetch_msg;
+    if (!encode_imsg(msg, fetch_msg)) {
+      HTML_LOG(error, session_id_, "Failed to encode fetch request");
+      return fail_fetch(path);
+    }
+
+    send_imsg(std::move(fetch_msg));
+  }
+
+  // Stop waiting for path, leaving its requests to the caller
+  std::optional<pending_fetch> take_fetch(const std::filesystem::path &path) {
+    auto node = fetches_.extract(path);
+    if (!node)
+      return std::nullopt;
+
+    auto &fetch = node.mapped();
+    fetch_waiters_ -= fetch.waiters.size();
+    fetch.deadline->cancel();
+    return std::move(fetch);
+  }
+
+  // Respond to the requests that were waiting for the app to upload path
+  void finish_fetch(const std::filesystem::path &path) {
+    auto fetch = take_fetch(path);
+    if (!fetch)
+      return;
+
+    for (auto &[req, cb] : fetch->waiters)
+      respond_get(fetch->url, std::move(req), cb);
+
+    if (fetch->cache)
+      return;
+
+    // responses already posted to the disk strand open the file first
+    invalidate_upload(path);
+    asio::post(disk_, [path] {
+      std::error_code ec;
+      std::filesystem::remove(path, ec);
+    });
+  }
+
+  void fail_fetch(const std::filesystem::path &path) {
+    auto fetch = take_fetch(path);
+    if (!fetch)
+      return;
+
+    for (auto &[req, cb] : fetch->waiters)
+      cb(respond404(std::move(req)));
+  }
+
+  void on_fetch_timeout(std::filesystem::path path, std::uint64_t id,
+                        beast::error_code ec) {
+    auto it = fetches_.find(path);
+    if (ec || it == fetches_.end() || it->second.id != id)
+      return;
+
+    HTML_LOG(warn, session_id_, "Timed out waiting for " << it->second.url);
+    auto fetch = take_fetch(path);
+    for (auto &[req, cb] : fetch->waiters) {
+      cb(respond_error(http::status::gateway_timeout,
+                       "Timed out waiting for the app", std::move(req)));
+    }
+  }
+
+  bool is_not_modified(const my::string_request &req, const std::string &etag,
+                       std::time_t last_modified) const {
+    auto if_none_match = req[http::field::if_none_match];
+    if (!if_none_match.empty())
+      return etag_list_matches(if_none_match, etag, true);
+
+    auto if_modified_since = req[http::field::if_modified_since];
+    std::time_t since;
+    if (!if_modified_since.empty() &&
+        parse_http_date(if_modified_since, since)) {
+      return last_modified <= since;
+    }
+
+    return false;
+  }
+
+  my::empty_response respond304(const std::string &etag,
+                                std::time_t last_modified, bool vary,
+                                my::string_request &&req) const {
+    my::empty_response res{http::status::not_modified, req.version()};
+    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.keep_alive(req.keep_alive());
+    res.set(http::field::etag, etag);
+    res.set(http::field::last_modified, http_date(last_modified));
+    if (vary)
+      res.set(http::field::vary, "Accept-Encoding");
+    return res;
+  }
+
+  my::string_response respond416(std::uint64_t size,
+                                 my::string_request &&req) const {
+    my::string_response res{http::status::range_not_satisfiable,
+                            req.version()};
+    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.keep_alive(req.keep_alive());
+    res.set(http::field::content_range, "bytes */" + std::to_string(size));
+    res.prepare_payload();
+    return res;
+  }
+
+  my::string_response respond404(my::string_request &&req) const {
+    my::string_response res{http::status::not_found, req.version()};
+    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.keep_alive(req.keep_alive());
+
+    res.set(http::field::content_type, "text/plain");
+    res.body() = std::string("Not found");
+    res.prepare_payload();
+    return res;
+  }
+
+  my::string_response respond_error(http::status status,
+                                    const std::string_view &msg,
+                                    my::string_request &&req) const {
+    my::string_response res{status, req.version()};
+    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.keep_alive(req.keep_alive());
+
+    res.set(http::field::content_type, "text/plain");
+    res.body() = std::string(msg);
+    res.prepare_payload();
+    return res;
+  }
+
+  my::string_response respond400(const std::string_view &msg,
+                                 my::string_request &&req) {
+    my::string_response res{http::status::bad_request, req.version()};
+    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.keep_alive(req.keep_alive());
+
+    res.set(http::field::content_type, "text/plain");
+    res.body() = std::string(msg);
+    res.prepare_payload();
+    return res;
+  }
+
+  void do_read_upload(const html_omsg_upload &msg) {
+    HTML_LOG(info, session_id_, "UPLOAD " << msg.url);
+
+    auto state = std::make_shared<read_upload_state>();
+    state->rtype = msg.rtype;
+    state->url = msg.url;
+    state->start = std::chrono::steady_clock::now();
+    state->buf.resize(upload_buffer_size);
+    html_sha256_init(&state->hash);
+
+    state->chunk_bytes_left = msg.content_length;
+    state->is_stream = msg.content_length == 0;
+    state->chunk_header_size = msg.chunk_header_size;
+
+    // how an archive is handled depends on its first block
+    if (state->rtype == HTML_RT_ARCHIVE)
+      return read_upload(state);
+
+    state->path = upload_path(msg.url, msg.rtype);
+
+    // not servable until the new contents are complete
+    invalidate_upload(state->path);
+
+    async_disk(
+        [state] {
+          // the old file may be linked from other sessions' uploads
+          std::error_code ec;
+          std::filesystem::remove(state->path, ec);
+
+          state->of.open(state->path);
+          return state->of.is_open();
+        },
+        bind(&self::on_open_upload, state));
+  }
+
+  void on_open_upload(std::shared_ptr<read_upload_state> state, bool ok) {
+    if (!ok)
+      return fatal_error("Error opening file for upload");
+
+    read_upload(state);
+  }
+
+  void read_upload(std::shared_ptr<read_upload_state> state) {
+    if (state->is_stream)
       read_upload_chunk_size(state);
-    } else {
-      state->of.close();
-      switch (state->rtype) {
-      case HTML_RT_ARCHIVE:
-        on_read_archive(state);
-        break;
-      case HTML_RT_FILE:
-        // nothing to do :)
-        break;
-      default:
-        break;
+    else
+      read_upload_chunk(state);
+  }
+
+  void read_upload_chunk_size(std::shared_ptr<read_upload_state> state) {
+    // older clients send 2 byte headers, read into the low bytes
+    state->chunk_size = 0;
+    auto n = state->chunk_header_size;
+    my::async_readn(stream_, asio::buffer(&state->chunk_size, n), n,
+                    bind(&self::on_read_upload_chunk_size, state));
+  }
+
+  void on_read_upload_chunk_size(std::shared_ptr<read_upload_state> state,
+                                 std::error_code ec, std::size_t n) {
+    if (ec)
+      return fail_upload(state, ec.message());
+
+    state->chunk_bytes_left = state->chunk_size;
+    read_upload_chunk(state);
+  }
+
+  void read_upload_chunk(std::shared_ptr<read_upload_state> state) {
+    std::size_t n = std::min(state->chunk_bytes_left, state->buf.size());
+
+    my::async_readn(stream_, asio::buffer(state->buf), n,
+                    bind(&self::on_read_upload_chunk, state));
+  }
+
+  void on_read_upload_chunk(std::shared_ptr<read_upload_state> state,
+                            std::error_code ec, std::size_t n) {
+    if (ec)
+      return fail_upload(state, ec.message());
+
+    state->chunk_bytes_left -= n;
+    state->bytes += n;
+
+    if (state->rtype == HTML_RT_ARCHIVE) {
+      if (state->indexer)
+        return index_archive(state, std::span{state->buf}.first(n));
+
+      if (state->pipe) {
+        auto chunk = std::exchange(state->buf, {});
+        chunk.resize(n);
+        state->buf.resize(upload_buffer_size);
+        return push_archive_chunk(state, std::move(chunk));
       }
 
-      do_recv();
+      auto &head = state->head;
+      head.insert(head.end(), state->buf.begin(), state->buf.begin() + n);
+      if (head.size() < tar_block_size && !state->is_last_chunk())
+        return next_upload_chunk(state);
+
+      return start_archive(state);
     }
+
+    async_disk([state, n] { return write_upload_chunk(*state, n); },
+               bind(&self::on_write_upload_chunk, state));
   }
 
-  void on_read_archive(const std::shared_ptr<read_upload_state> &state) {
+  // Plain tars are kept whole and served in place, which avoids a file per
+  // entry. Anything else, like a compressed tar, is extracted.
+  void start_archive(std::shared_ptr<read_upload_state> state) {
+    if (!is_tar_header(state->head)) {
+      state->pipe = std::make_shared<archive_pipe>();
+      extractor_.run(state->pipe, [self = shared_from_this(), state] {
+        self->extract_archive(state);
+      });
+
+      return push_archive_chunk(state, std::exchange(state->head, {}));
+    }
+
+    auto path = upload_path(state->url, HTML_RT_ARCHIVE);
+    path += '-' + std::to_string(++next_archive_) + ".tar";
+
+    state->indexer.emplace();
+    state->archive = std::make_shared<archive_file>(path, disk_);
+    state->path = std::move(path);
+
+    async_disk(
+        [state] {
+          state->of.open(state->path, std::ios::binary);
+          return state->of.is_open();
+        },
+        bind(&self::on_open_archive, state));
+  }
+
+  void on_open_archive(std::shared_ptr<read_upload_state> state, bool ok) {
+    if (!ok)
+      return fatal_error("Error opening file for archive upload");
+
+    index_archive(state, state->head);
+  }
+
+  // Write part of a plain tar and add the entries it completes. The bytes
+  // must outlive the disk work.
+  void index_archive(std::shared_ptr<read_upload_state> state,
+                     std::span<const std::uint8_t> bytes) {
+    async_disk([state, bytes] { return write_archive_chunk(*state, bytes); },
+               bind(&self::on_write_archive_chunk, state));
+  }
+
+  // Runs on the blocking I/O pool
+  static indexed_chunk
+  write_archive_chunk(read_upload_state &state,
+                      std::span<const std::uint8_t> bytes) {
+    indexed_chunk result;
+    state.of.write((const char *)bytes.data(), bytes.size());
+    if (!state.of) {
+      result.err = "Failed to write archive upload";
+      return result;
+    }
+
+    if (!state.indexer->feed(bytes, result.entries)) {
+      result.err = "Invalid tar archive";
+      return result;
+    }
+
+    // entries are read back from the file as soon as they're added, so they
+    // aren't published unless all of their bytes are there
+    if (!result.entries.empty()) {
+      state.of.flush();
+      if (!state.of) {
+        result.entries.clear();
+        result.err = "Failed to write archive upload";
+      }
+    }
+
+    return result;
+  }
+
+  void on_write_archive_chunk(std::shared_ptr<read_upload_state> state,
+                              indexed_chunk chunk) {
+    if (!chunk.err.empty())
+      return fatal_error(chunk.err);
+
+    // only needed until its bytes are written
+    state->head = {};
+
+    for (const auto &entry : chunk.entries) {
+      auto cat_url = entry_url(state->url, entry.pathname);
+      HTML_LOG(debug, session_id_, "UPLOAD-ENTRY " << cat_url);
+
+      auto path = upload_path(cat_url);
+      invalidate_upload(path);
+
+      auto meta = make_upload_meta(entry.sha256.data());
+      meta.archive = state->archive;
+      meta.offset = entry.offset;
+      meta.size = entry.size;
+      add_upload(path, std::move(meta));
+    }
+
+    next_upload_chunk(state);
+  }
+
+  void push_archive_chunk(std::shared_ptr<read_upload_state> state,
+                          std::vector<std::uint8_t> &&chunk) {
+    // wait for the extraction to catch up if it's behind
+    auto on_room = [self = shared_from_this(), state] {
+      asio::post(self->get_executor(),
+                 [self, state] { self->next_upload_chunk(state); });
+    };
+
+    if (state->pipe->push(std::move(chunk), std::move(on_room)))
+      next_upload_chunk(state);
+  }
+
+  // Runs on the blocking I/O pool. Returns an error message on failure
+  static std::string write_upload_chunk(read_upload_state &state,
+                                        std::size_t n) {
+    try {
+      state.of.write((const char *)state.buf.data(), n);
+      html_sha256_update(&state.hash, state.buf.data(), n);
+    } catch (const std::exception &ex) {
+      return ex.what();
+    }
+
+    return {};
+  }
+
+  void on_write_upload_chunk(std::shared_ptr<read_upload_state> state,
+                             std::string err) {
+    if (!err.empty())
+      return fatal_error(err);
+
+    next_upload_chunk(state);
+  }
+
+  void next_upload_chunk(std::shared_ptr<read_upload_state> state) {
+    if (state->chunk_bytes_left > 0)
+      return read_upload_chunk(state);
+
+    if (state->has_more_chunks())
+      return read_upload_chunk_size(state);
+
+    record_upload(*state);
+
+    if (state->pipe) {
+      state->pipe->close();
+      state->read_done = true;
+      return maybe_finish_archive(state);
+    }
+
+    async_disk(
+        [state] {
+          state->of.close();
+          return !state->of.fail();
+        },
+        bind(&self::on_close_upload, state));
+  }
+
+  void fail_upload(std::shared_ptr<read_upload_state> state,
+                   const std::string &msg) {
+    if (state->pipe)
+      state->pipe->abort();
+
+    fatal_error(msg);
+  }
+
+  void on_close_upload(std::shared_ptr<read_upload_state> state, bool ok) {
+    if (!ok)
+      return fatal_error("Error writing upload");
+
+    if (state->rtype == HTML_RT_FILE)
+      add_upload(state->path, make_upload_meta(state->hash));
+
+    // the entries that did arrive are still served
+    if (state->indexer && !state->indexer->done())
+      HTML_LOG(warn, session_id_, "Truncated tar archive " << state->url);
+
+    finish_upload();
+  }
+
+  void record_upload(const read_upload_state &state) {
+    record_uploads(1, state.bytes, state.start);
+  }
+
+  void record_uploads(std::size_t n, std::uint64_t bytes,
+                      std::chrono::steady_clock::time_point start) {
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed);
+    auto us_count = std::max<std::int64_t>(us.count(), 1);
+
+    metrics_.uploads.add(n);
+    metrics_.upload_bytes.add(bytes);
+    metrics_.upload_bytes_per_sec.record(bytes * 1000000 / us_count);
+  }
+
+  // Runs on the archive extractor's pool, reading the upload as it
+  // arrives. Each entry is written next to its final path and handed to
+  // the session strand to be moved into place, so it's servable before
+  // the rest of the archive arrives.
+  void extract_archive(std::shared_ptr<read_upload_state> state) {
+    bool ok = extract_entries(*state);
+
+    // the rest of the upload still has to be read off the stream
+    state->pipe->stop_reading();
+
+    asio::post(get_executor(), bind(&self::on_extract_archive, state, ok));
+  }
+
+  bool extract_entries(const read_upload_state &state) {
     struct archive *a;
     a = archive_read_new();
     archive_read_support_filter_all(a);
     archive_read_support_format_all(a);
-    int r = archive_read_open_filename(a, state->path.c_str(), 10240);
+    int r = archive_read_open_pipe(a, *state.pipe);
     if (r != ARCHIVE_OK) {
-      log() << "Failed to open archive " << archive_error_string(a)
-            << std::endl;
-      return end_catui(); // fatal
+      HTML_LOG(error, session_id_,
+               "Failed to open archive " << archive_error_string(a));
+      archive_read_free(a);
+      return false;
     }
 
     struct archive_entry *entry;
-    while (archive_read_next_header(a, &entry) == ARCHIVE_OK) {
+    while ((r = archive_read_next_header(a, &entry)) == ARCHIVE_OK) {
       mode_t type = archive_entry_filetype(entry);
       if (type != AE_IFREG) // only upload regular files
         continue;
 
-      std::ostringstream cat_url_ss;
-      cat_url_ss << state->url;
-
-      std::string_view entry_pathname{archive_entry_pathname(entry)};
-
-      if (!(state->url.ends_with('/') || entry_pathname.starts_with('/')))
-        cat_url_ss << '/';
-
-      cat_url_ss << entry_pathname;
-      auto cat_url = cat_url_ss.str();
-      log() << "UPLOAD-ENTRY " << cat_url << std::endl;
+      auto cat_url = entry_url(state.url, archive_entry_pathname(entry));
+      HTML_LOG(debug, session_id_, "UPLOAD-ENTRY " << cat_url);
 
       auto path = upload_path(cat_url);
-      std::ofstream of{path};
+      auto part = part_path(path);
+      std::ofstream of{part, std::ios::binary};
+
+      // a partial entry is never installed or left behind
+      auto fail_entry = [&] {
+        of.close();
+        std::error_code ec;
+        std::filesystem::remove(part, ec);
+        archive_read_free(a);
+        return false;
+      };
+
+      if (!of) {
+        HTML_LOG(error, session_id_, "Failed to open " << part);
+        return fail_entry();
+      }
+
+      html_sha256_ctx hash;
+      html_sha256_init(&hash);
 
       const void *buffer;
       std::size_t size;
@@ -680,33 +1691,462 @@ private:
           break;
         }
         if (r < ARCHIVE_OK) {
-          log() << "Error reading entry contents: " << archive_error_string(a)
-                << std::endl;
-          return end_catui();
+          HTML_LOG(error, session_id_,
+                   "Error reading entry contents: " << archive_error_string(a));
+          return fail_entry();
+        }
+
+        if (!of.write(static_cast<const char *>(buffer), size)) {
+          HTML_LOG(error, session_id_, "Failed to write " << part);
+          return fail_entry();
         }
 
-        of.write(static_cast<const char *>(buffer), size);
+        html_sha256_update(&hash, buffer, size);
       }
 
       of.close();
+      if (!of) {
+        HTML_LOG(error, session_id_, "Failed to write " << part);
+        return fail_entry();
+      }
+
+      asio::post(get_executor(),
+                 bind(&self::on_extract_entry,
+                      extracted_entry{path, make_upload_meta(hash)}));
+    }
+
+    if (r != ARCHIVE_EOF) {
+      HTML_LOG(error, session_id_,
+               "Error reading archive " << archive_error_string(a));
     }
 
     archive_read_free(a);
-    // don't need to keep archive since we wrote the contents
-    std::filesystem::remove(state->path);
+    return r == ARCHIVE_EOF;
+  }
+
+  void on_extract_entry(extracted_entry entry) {
+    // Old contents stop being served before the new ones replace them
+    invalidate_upload(entry.path);
+
+    async_disk(
+        [path = entry.path] {
+          std::error_code ec;
+          std::filesystem::rename(part_path(path), path, ec);
+          return !ec;
+        },
+        bind(&self::on_install_entry, std::move(entry)));
+  }
+
+  void on_install_entry(extracted_entry entry, bool ok) {
+    if (ok)
+      add_upload(entry.path, std::move(entry.meta));
+  }
+
+  void on_extract_archive(std::shared_ptr<read_upload_state> state, bool ok) {
+    state->extract_done = true;
+    state->extract_ok = ok;
+    maybe_finish_archive(state);
+  }
+
+  void maybe_finish_archive(std::shared_ptr<read_upload_state> state) {
+    if (!(state->read_done && state->extract_done))
+      return;
+
+    if (!state->extract_ok)
+      return end_catui(); // fatal
+
+    // entries are installed once the disk work queued before this is done
+    async_disk([] { return true; },
+               [self = shared_from_this()](bool) { self->finish_upload(); });
+  }
+
+  void do_recv_upload_fd(const html_omsg_upload_fd &msg) {
+    HTML_LOG(info, session_id_, "UPLOAD-FD " << msg.url);
+    my::async_recv_fd(stream_, bind(&self::on_recv_upload_fd,
+                                    upload_path(msg.url),
+                                    std::chrono::steady_clock::now()));
+  }
+
+  void on_recv_upload_fd(std::filesystem::path path,
+                         std::chrono::steady_clock::time_point start,
+                         std::error_code ec, int fd) {
+    if (ec) {
+      HTML_LOG(error, session_id_,
+               "Failed to receive upload descriptor: " << ec.message());
+      return end_catui();
+    }
+
+    // not servable until the new contents are complete
+    invalidate_upload(path);
+
+    async_disk(
+        [fd, path] {
+          cloned_upload result;
+          result.ec = clone_file(fd, path, result.size);
+          ::close(fd);
+
+          if (!result.ec)
+            result.meta = make_clone_meta(path, result.ec);
+
+          return result;
+        },
+        bind(&self::on_clone_upload, path, start));
+  }
+
+  void on_clone_upload(std::filesystem::path path,
+                       std::chrono::steady_clock::time_point start,
+                       cloned_upload result) {
+    if (result.ec)
+      return fatal_error("Error copying upload: " + result.ec.message());
+
+    HTML_LOG(debug, session_id_,
+             "Copied " << result.size << " byte upload to " << path);
+
+    add_upload(path, std::move(result.meta));
+    record_uploads(1, result.size, start);
+    finish_upload();
+  }
+
+  void do_read_batch(const html_omsg_upload_batch &msg) {
+    if (msg.content_length > max_manifest_size)
+      return fatal_error("Upload batch index is too big");
+
+    auto buf = std::make_shared<std::string>();
+    buf->resize(msg.content_length);
+    my::async_readn(stream_, asio::buffer(*buf), buf->size(),
+                    bind(&self::on_read_batch_index, buf));
+  }
+
+  void on_read_batch_index(std::shared_ptr<std::string> buf,
+                           std::error_code ec, std::size_t n) {
+    if (ec) {
+      HTML_LOG(error, session_id_,
+               "Failed to read upload batch: " << ec.message());
+      return end_catui();
+    }
+
+    html_batch_entry *entries;
+    std::size_t count;
+    if (!html_decode_upload_batch(buf->data(), buf->size(), &entries, &count))
+      return fatal_error("Invalid upload batch");
+
+    auto state = std::make_shared<batch_upload_state>();
+    state->start = std::chrono::steady_clock::now();
+    state->buf.resize(upload_buffer_size);
+    state->files.reserve(count);
+
+    for (std::size_t i = 0; i < count; ++i) {
+      const auto &entry = entries[i];
+      auto path = upload_path(entry.url);
+
+      // not servable until the new contents are complete
+      invalidate_upload(path);
+      state->files.push_back({std::move(path), entry.size});
+      state->bytes_left += entry.size;
+    }
+
+    std::free(entries);
+    HTML_LOG(info, session_id_,
+             "UPLOAD-BATCH " << count << " files, " << state->bytes_left
+                             << " bytes");
+
+    read_batch_chunk(state);
+  }
+
+  void read_batch_chunk(std::shared_ptr<batch_upload_state> state) {
+    auto n = std::min<std::uint64_t>(state->bytes_left, state->buf.size());
+
+    // only empty files are left
+    if (n == 0)
+      return write_batch(state, 0);
+
+    my::async_readn(stream_, asio::buffer(state->buf), n,
+                    bind(&self::on_read_batch_chunk, state));
+  }
+
+  void on_read_batch_chunk(std::shared_ptr<batch_upload_state> state,
+                           std::error_code ec, std::size_t n) {
+    if (ec)
+      return fatal_error(ec.message());
+
+    state->bytes_left -= n;
+    state->bytes += n;
+    write_batch(state, n);
+  }
+
+  void write_batch(std::shared_ptr<batch_upload_state> state, std::size_t n) {
+    async_disk([state, n] { return write_batch_chunk(*state, n); },
+               bind(&self::on_write_batch_chunk, state));
+  }
+
+  // Runs on the blocking I/O pool. Splits the first n bytes of the buffer
+  // among the files they belong to, finishing every file they complete.
+  static batch_chunk write_batch_chunk(batch_upload_state &state,
+                                       std::size_t n) {
+    batch_chunk chunk;
+    std::size_t offset = 0;
+
+    try {
+      while (state.next < state.files.size()) {
+        const auto &file = state.files[state.next];
+        if (!state.of.is_open()) {
+          // the old file may be linked from other sessions' uploads
+          std::error_code ec;
+          std::filesystem::remove(file.path, ec);
+
+          state.of.open(file.path);
+          if (!state.of.is_open()) {
+            chunk.err = "Error opening file for upload";
+            return chunk;
+          }
+
+          html_sha256_init(&state.hash);
+          state.file_bytes_left = file.size;
+        }
+
+        auto take = std::min<std::uint64_t>(state.file_bytes_left, n - offset);
+        auto data = state.buf.data() + offset;
+        state.of.write((const char *)data, take);
+        html_sha256_update(&state.hash, data, take);
+        offset += take;
+        state.file_bytes_left -= take;
+
+        // the rest of the file is in the next chunk
+        if (state.file_bytes_left > 0)
+          break;
+
+        state.of.close();
+        if (state.of.fail()) {
+          chunk.err = "Error writing upload";
+          return chunk;
+        }
+
+        chunk.completed.emplace_back(file.path, make_upload_meta(state.hash));
+        ++state.next;
+      }
+    } catch (const std::exception &ex) {
+      chunk.err = ex.what();
+    }
+
+    return chunk;
+  }
+
+  void on_write_batch_chunk(std::shared_ptr<batch_upload_state> state,
+                            batch_chunk chunk) {
+    for (auto &[path, meta] : chunk.completed)
+      add_upload(path, std::move(meta));
+
+    if (!chunk.err.empty())
+      return fatal_error(chunk.err);
+
+    if (state->bytes_left > 0)
+      return read_batch_chunk(state);
+
+    record_uploads(state->files.size(), state->bytes, state->start);
+    finish_upload();
+  }
+
+  void do_read_manifest(const html_omsg_upload_manifest &msg) {
+    if (msg.content_length > max_manifest_size)
+      return fatal_error("Upload manifest is too big");
+
+    auto buf = std::make_shared<std::string>();
+    buf->resize(msg.content_length);
+    my::async_readn(stream_, asio::buffer(*buf), buf->size(),
+                    bind(&self::on_read_manifest, buf));
+  }
+
+  void on_read_manifest(std::shared_ptr<std::string> buf, std::error_code ec,
+                        std::size_t n) {
+    if (ec) {
+      HTML_LOG(error, session_id_,
+               "Failed to read upload manifest: " << ec.message());
+      return end_catui();
+    }
+
+    html_manifest_entry *entries;
+    std::size_t count;
+    if (!html_decode_manifest(buf->data(), buf->size(), &entries, &count))
+      return fatal_error("Invalid upload manifest");
+
+    // Files this session already has are skipped. The rest may have been
+    // uploaded by another session
+    std::vector<manifest_link> links;
+    for (std::size_t i = 0; i < count; ++i) {
+      const auto &entry = entries[i];
+      auto path = upload_path(entry.url);
+
+      auto it = uploads_.find(path);
+      if (it != uploads_.end() && etag_digest(it->second.etag) == entry.sha256)
+        continue;
+
+      invalidate_upload(path);
+      links.push_back({i, path, entry.sha256, entry.size});
+    }
+
+    std::free(entries);
+    HTML_LOG(debug, session_id_,
+             "MANIFEST " << count << " files, " << links.size() << " changed");
+
+    async_disk(
+        [&blobs = blobs_, links = std::move(links)]() mutable {
+          for (auto &link : links)
+            link.linked = blobs.link(link.digest, link.path, link.size);
+
+          return std::move(links);
+        },
+        bind(&self::on_link_manifest));
+  }
+
+  void on_link_manifest(std::vector<manifest_link> links) {
+    std::vector<std::size_t> needed;
+    for (auto &link : links) {
+      if (link.linked)
+        add_upload(link.path, make_upload_meta(link.digest));
+      else
+        needed.push_back(link.index);
+    }
+
+    HTML_LOG(debug, session_id_, "NEEDED " << needed.size() << " uploads");
+
+    std::size_t list_size;
+    char *list = html_encode_upload_needed(needed.data(), needed.size(),
+                                           &list_size);
+    if (!list)
+      return fatal_error("Failed to encode needed uploads");
+
+    imsg_out reply;
+    reply.body.assign(list, list_size);
+    std::free(list);
+
+    html_in_msg msg{.type = HTML_IMSG_UPLOAD_NEEDED};
+    msg.msg.upload_needed.content_length = reply.body.size();
+    if (!encode_imsg(msg, reply))
+      return fatal_error("Failed to encode needed uploads");
+
+    reply.sent = bind(&self::do_recv);
+    send_imsg(std::move(reply));
+  }
+
+  bool encode_imsg(const html_in_msg &msg, imsg_out &out) const {
+    int n = html_encode_in_msg(out.header.data(), out.header.size(), &msg,
+                               app_encoding_);
+    if (n < 0)
+      return false;
+
+    out.size = n;
+    return true;
+  }
+
+  // Queue a message for the app. Messages are written whole in the order
+  // they're queued, even when several are ready at once.
+  void send_imsg(imsg_out msg) {
+    imsg_queue_.push_back(std::move(msg));
+    if (imsg_queue_.size() == 1)
+      send_next_imsg();
+  }
+
+  void send_next_imsg() {
+    if (imsg_queue_.empty())
+      return;
+
+    auto &msg = imsg_queue_.front();
+    my::async_msgstream_send(stream_, asio::buffer(msg.header), msg.size,
+                             bind(&self::on_send_imsg));
+  }
+
+  void on_send_imsg(std::error_condition ec, std::size_t n) {
+    if (ec) {
+      HTML_LOG(error, session_id_,
+               "Failed to send message to app: " << ec.message());
+      return fail_imsgs();
+    }
+
+    auto &body = imsg_queue_.front().body;
+    if (body.empty())
+      return on_write_imsg_body({}, 0);
+
+    asio::async_write(stream_, asio::buffer(body),
+                      asio::transfer_exactly(body.size()),
+                      bind(&self::on_write_imsg_body));
+  }
+
+  void on_write_imsg_body(std::error_code ec, std::size_t n) {
+    if (ec) {
+      HTML_LOG(error, session_id_,
+               "Failed to send message body to app: " << ec.message());
+      return fail_imsgs();
+    }
+
+    auto sent = std::move(imsg_queue_.front().sent);
+    imsg_queue_.pop_front();
+    send_next_imsg();
+
+    if (sent)
+      sent();
+  }
+
+  // Nothing more can be sent. Queued callbacks hold the session, so they
+  // are dropped with it.
+  void fail_imsgs() {
+    imsg_queue_.clear();
+    end_catui();
+  }
+
+  // Tell the app an upload is servable if it asked, and read the next
+  // message
+  void finish_upload() {
+    if (ack_uploads_) {
+      html_in_msg msg{.type = HTML_IMSG_UPLOAD_ACK};
+      imsg_out ack;
+      if (!encode_imsg(msg, ack))
+        return fatal_error("Failed to encode upload acknowledgement");
+
+      send_imsg(std::move(ack));
+    }
+
+    do_recv();
+  }
+
+  void do_ack_uploads() {
+    HTML_LOG(info, session_id_, "ACK-UPLOADS");
+    ack_uploads_ = true;
+    do_recv();
+  }
+
+  void do_lazy(const html_omsg_lazy &msg) {
+    HTML_LOG(info, session_id_,
+             "LAZY " << msg.url << (msg.cache ? "" : " (uncached)"));
+
+    std::string_view url{msg.url};
+    auto it = std::find_if(lazy_.begin(), lazy_.end(), [url](const auto &p) {
+      return p.url == url;
+    });
+    if (it == lazy_.end())
+      lazy_.push_back({std::string{url}, msg.cache != 0});
+    else
+      it->cache = msg.cache != 0;
+
+    do_recv();
+  }
+
+  void do_fetch_failed(const html_omsg_fetch_failed &msg) {
+    HTML_LOG(info, session_id_, "FETCH_FAILED " << msg.url);
+    fail_fetch(upload_path(msg.url));
+    do_recv();
   }
 
   void do_navigate(const html_omsg_navigate &msg) {
     std::ostringstream os;
     os << "http://localhost:" << http_->port() << '/' << session_id_ << msg.url;
-    log() << "Opening " << os.str() << std::endl;
+    HTML_LOG(info, session_id_, "Opening " << os.str());
 
     browser_.load_url(session_id_, os.str());
     do_recv();
   }
 
   void do_accept_io_transfer(const html_omsg_accept_io_transfer &msg) {
-    log() << "Accepting I/O transfer" << std::endl;
+    HTML_LOG(info, session_id_, "Accepting I/O transfer");
     browser_.accept_io_transfer(session_id_, msg.token);
     do_recv();
   }
@@ -723,11 +2163,14 @@ private:
     }
 
     if (!ws_) {
-      log() << "Invalid SEND with no websocket connection" << std::endl;
+      HTML_LOG(error, session_id_, "Invalid SEND with no websocket connection");
       return;
     }
 
-    log() << "SEND: " << ws_send_buf_ << std::endl;
+    HTML_LOG_BODY(session_id_, "SEND", ws_send_buf_);
+    metrics_.ws_messages_out.add();
+    metrics_.ws_bytes_out.add(ws_send_buf_.size());
+    metrics_.ws_message_bytes.record(ws_send_buf_.size());
 
     my::async_ws_write(*ws_, asio::buffer(ws_send_buf_),
                        bind(&self::on_ws_write));
@@ -736,24 +2179,49 @@ private:
 
 struct html_forms_server_ {
 private:
+  static std::size_t io_pool_threads() {
+    return std::clamp<std::size_t>(std::thread::hardware_concurrency(), 2, 4);
+  }
+
   unsigned short port_;
-  asio::io_context ioc_;
+  // Blocking filesystem work, so slow disks don't stall the io threads
+  asio::thread_pool io_pool_{io_pool_threads()};
+  archive_extractor extractor_;
+  server_metrics metrics_;
   browser browser_;
   std::filesystem::path session_dir_;
+  blob_store blobs_;
+  compression_config compression_;
+  content_cache cache_;
   std::shared_ptr<http_listener> http_;
 
+  // Destroyed first, along with the sessions owned by its pending handlers,
+  // since they refer to everything above
+  asio::io_context ioc_;
+
 public:
   html_forms_server_(unsigned short port, const char *session_dir)
-      : port_{port}, session_dir_{session_dir}, ioc_{}, browser_{} {
+      : port_{port}, browser_{metrics_}, session_dir_{session_dir},
+        blobs_{session_dir_ / blob_store::dir_name}, ioc_{} {
     auto const address = asio::ip::make_address("127.0.0.1");
-    http_ =
-        std::make_shared<http_listener>(ioc_, tcp::endpoint{address, port_});
+    http_ = std::make_shared<http_listener>(
+        ioc_, tcp::endpoint{address, port_}, metrics_, cache_);
   }
 
-  int start() {
+  ~html_forms_server_() {
+    // Let disk work finish while the sessions it reports back to are alive
+    extractor_.shutdown();
+    io_pool_.join();
+
+    // The listener must not outlive the io_context it's bound to
+    http_.reset();
+  }
+
+  int start(unsigned int nthreads) {
     std::filesystem::create_directories(session_dir_);
+    std::filesystem::create_directories(blobs_.dir());
 
-    std::cerr << "[server] Writing content to " << session_dir_ << std::endl;
+    HTML_LOG(info, "", "Writing content to " << session_dir_);
 
     // Create and launch a listening port
     http_->run();
@@ -762,6 +2230,8 @@ public:
       for (const auto &entry :
            std::filesystem::directory_iterator{session_dir_}) {
         const auto &session_path = entry.path();
+        if (session_path.filename() == blob_store::dir_name)
+          continue;
 
         session_lock mtx{session_path};
         if (!mtx.try_lock())
@@ -769,20 +2239,33 @@ public:
 
         auto session_id = session_path.filename();
         try {
-          std::cerr << "Cleaning up inactive session " << session_id
-                    << std::endl;
+          HTML_LOG(info, "", "Cleaning up inactive session " << session_id);
           std::filesystem::remove_all(session_path);
         } catch (const std::exception &ex) {
-          std::cerr << "Failed to clean up session: " << ex.what() << std::endl;
+          HTML_LOG(error, "", "Failed to clean up session: " << ex.what());
         }
 
         mtx.unlock();
       }
+
+      // blobs of the sessions just removed, or of a crashed server
+      auto n = blobs_.collect();
+      HTML_LOG(info, "", "Removed " << n << " unused upload blobs");
     }};
 
     cleanup.detach();
+
+    // this thread is one of the nthreads
+    std::vector<std::thread> workers;
+    workers.reserve(nthreads - 1);
+    for (unsigned int i = 1; i < nthreads; ++i)
+      workers.emplace_back([this] { ioc_.run(); });
+
     ioc_.run();
 
+    for (auto &th : workers)
+      th.join();
+
     return EXIT_SUCCESS;
   }
 
@@ -792,23 +2275,43 @@ public:
   }
 
   int start_session(const char *session_id, int client) {
+    session_uuid uuid;
+    if (!parse_session_uuid(session_id, uuid)) {
+      HTML_LOG(error, "", "Session ID is not a UUID: " << session_id);
+      ::close(client);
+      return 0;
+    }
+
+    auto id = lowercase_session_id(session_id);
     auto con = std::make_shared<catui_connection>(
-        my::stream_descriptor{asio::make_strand(ioc_), client}, session_id,
-        http_, browser_, session_dir_);
+        my::stream_descriptor{asio::make_strand(ioc_), client}, id.c_str(),
+        http_, browser_, session_dir_, compression_, cache_, metrics_,
+        io_pool_, extractor_, blobs_);
 
-    con->run();
+    asio::dispatch(con->get_executor(), std::bind(&catui_connection::run, con));
     return 1;
   }
 
   void close_window(const std::string &session_id) {
-    asio::dispatch(
-        ioc_.get_executor(),
-        std::bind(&browser::request_close, &browser_, std::string{session_id}));
+    asio::dispatch(ioc_.get_executor(),
+                   std::bind(&browser::request_close, &browser_,
+                             lowercase_session_id(session_id)));
   }
 
   void set_ev_callback(html_forms_server_event_callback *cb, void *ctx) {
     browser_.set_event_callback(cb, ctx);
   }
+
+  void set_compression(int gzip_level, std::uint64_t min_size) {
+    compression_.gzip_level.store(gzip_level, std::memory_order_relaxed);
+    compression_.min_size.store(min_size, std::memory_order_relaxed);
+  }
+
+  void set_cache_budget(std::size_t budget) { cache_.set_budget(budget); }
+
+  content_cache_stats cache_stats() const { return cache_.stats(); }
+
+  const server_metrics &metrics() const { return metrics_; }
 };
 
 html_forms_server *html_forms_server_init(unsigned short port,
@@ -819,6 +2322,7 @@ html_forms_server *html_forms_server_init(unsigned short port,
 void html_forms_server_free(html_forms_server *server) {
   if (server) {
     delete server;
+    logger::instance().flush();
   }
 }
 
@@ -827,7 +2331,15 @@ int html_forms_server_run(html_forms_server *server) {
     return 0;
   }
 
-  return server->start();
+  return server->start(1);
+}
+
+int html_forms_server_run_threads(html_forms_server *server,
+                                  unsigned int nthreads) {
+  if (!server || nthreads < 1)
+    return 0;
+
+  return server->start(nthreads);
 }
 
 int html_forms_server_stop(html_forms_server *server) {
@@ -853,6 +2365,111 @@ int html_forms_server_set_event_callback(html_forms_server *server,
   return 1;
 }
 
+int html_forms_server_set_compression(html_forms_server *server,
+                                     int gzip_level, size_t min_size) {
+  if (!server || gzip_level < 0 || gzip_level > 9)
+    return 0;
+
+  server->set_compression(gzip_level, min_size);
+  return 1;
+}
+
+int html_forms_server_set_cache_budget(html_forms_server *server,
+                                      size_t budget) {
+  if (!server)
+    return 0;
+
+  server->set_cache_budget(budget);
+  return 1;
+}
+
+int html_forms_server_get_cache_stats(html_forms_server *server,
+                                      html_forms_server_cache_stats *stats) {
+  if (!(server && stats))
+    return 0;
+
+  auto s = server->cache_stats();
+  stats->hits = s.hits;
+  stats->misses = s.misses;
+  stats->bytes = s.bytes;
+  stats->entries = s.entries;
+  return 1;
+}
+
+static void copy_histogram(const histogram &h,
+                           html_forms_server_histogram &out) {
+  auto snap = h.snapshot();
+  out.count = snap.count;
+  out.sum = snap.sum;
+  out.p50 = snap.quantile(0.5);
+  out.p90 = snap.quantile(0.9);
+  out.p99 = snap.quantile(0.99);
+  out.max = snap.max;
+}
+
+int html_forms_server_get_stats(html_forms_server *server,
+                                html_forms_server_stats *stats) {
+  if (!(server && stats))
+    return 0;
+
+  const auto &m = server->metrics();
+  stats->sessions_started = m.sessions_started.value();
+  stats->sessions_active = m.sessions_active.value();
+  stats->http_connections = m.http_connections.value();
+  stats->http_requests = m.http_requests.value();
+  stats->http_not_found = m.http_not_found.value();
+  copy_histogram(m.http_request_us, stats->http_request_us);
+  stats->uploads = m.uploads.value();
+  stats->upload_bytes = m.upload_bytes.value();
+  copy_histogram(m.upload_bytes_per_sec, stats->upload_bytes_per_sec);
+  stats->ws_connections = m.ws_connections.value();
+  stats->ws_messages_in = m.ws_messages_in.value();
+  stats->ws_bytes_in = m.ws_bytes_in.value();
+  stats->ws_messages_out = m.ws_messages_out.value();
+  stats->ws_bytes_out = m.ws_bytes_out.value();
+  copy_histogram(m.ws_message_bytes, stats->ws_message_bytes);
+  stats->form_submits = m.form_submits.value();
+  copy_histogram(m.form_round_trip_us, stats->form_round_trip_us);
+  stats->browser_events = m.browser_events.value();
+  return html_forms_server_get_cache_stats(server, &stats->cache);
+}
+
+int html_forms_server_set_log_callback(html_forms_server *server,
+                                       html_forms_server_log_callback *cb,
+                                       void *ctx) {
+  if (!server)
+    return 0;
+
+  if (!cb) {
+    logger::instance().set_sink({});
+    return 1;
+  }
+
+  logger::instance().set_sink([cb, ctx](log_level level,
+                                        std::string_view session_id,
+                                        std::string_view msg) {
+    cb(static_cast<int>(level), session_id.data(), msg.data(), ctx);
+  });
+  return 1;
+}
+
+int html_forms_server_set_log_level(html_forms_server *server, int level) {
+  if (!server || level < HTML_FORMS_SERVER_LOG_DEBUG ||
+      level > HTML_FORMS_SERVER_LOG_ERROR)
+    return 0;
+
+  logger::instance().set_level(static_cast<log_level>(level));
+  return 1;
+}
+
+int html_forms_server_set_log_bodies(html_forms_server *server, int enabled) {
+  if (!server)
+    return 0;
+
+  logger::instance().set_log_bodies(enabled);
+  return 1;
+}
+
 int html_forms_server_close_window(html_forms_server *server,
                                    const char *session_id) {
   if (!server)
@@ -0,0 +1,54 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#include "html_forms_server/private/session_table.hpp"
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+
+  return -1;
+}
+
+bool parse_session_uuid(std::string_view str, session_uuid &uuid) {
+  if (str.size() != 36)
+    return false;
+
+  std::size_t j = 0;
+  for (std::size_t i = 0; i < str.size();) {
+    if (i == 8 || i == 13 || i == 18 || i == 23) {
+      if (str[i] != '-')
+        return false;
+
+      ++i;
+      continue;
+    }
+
+    int hi = hex_value(str[i]), lo = hex_value(str[i + 1]);
+    if (hi < 0 || lo < 0)
+      return false;
+
+    uuid[j++] = static_cast<std::uint8_t>((hi << 4) | lo);
+    i += 2;
+  }
+
+  return true;
+}
+
+std::string lowercase_session_id(std::string_view str) {
+  std::string id{str};
+  for (auto &c : id) {
+    if (c >= 'A' && c <= 'F')
+      c += 'a' - 'A';
+  }
+
+  return id;
+}
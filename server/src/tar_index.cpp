@@ -0,0 +1,326 @@
+/**
+ * Copyright 2025 Nicholas Gulachek
+ *
+ * Use of this source code is governed by an MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT.
+ */
+#include "html_forms_server/private/tar_index.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+
+namespace {
+// offsets of ustar header fields
+constexpr std::size_t name_offset = 0, name_size = 100;
+constexpr std::size_t size_offset = 124, size_size = 12;
+constexpr std::size_t chksum_offset = 148, chksum_size = 8;
+constexpr std::size_t typeflag_offset = 156;
+constexpr std::size_t magic_offset = 257;
+constexpr std::size_t prefix_offset = 345, prefix_size = 155;
+
+// GNU long names and pax headers larger than this are rejected
+constexpr std::uint64_t max_extension_size = 1024 * 1024;
+
+std::string_view field(const std::uint8_t *block, std::size_t offset,
+                       std::size_t size) {
+  auto p = reinterpret_cast<const char *>(block + offset);
+  return {p, ::strnlen(p, size)};
+}
+
+bool parse_octal(const std::uint8_t *p, std::size_t size,
+                 std::uint64_t &value) {
+  std::size_t i = 0;
+  while (i < size && p[i] == ' ')
+    ++i;
+
+  value = 0;
+  bool any = false;
+  for (; i < size && p[i] >= '0' && p[i] <= '7'; ++i) {
+    if (value >> 61)
+      return false;
+
+    value = value * 8 + (p[i] - '0');
+    any = true;
+  }
+
+  // terminated by a space or NUL, if not full width
+  return any && (i == size || p[i] == ' ' || p[i] == '\0');
+}
+
+// Sizes too large for octal are stored as big endian base-256
+bool parse_number(const std::uint8_t *p, std::size_t size,
+                  std::uint64_t &value) {
+  if (!(p[0] & 0x80))
+    return parse_octal(p, size, value);
+
+  if (p[0] & 0x40) // negative
+    return false;
+
+  value = p[0] & 0x3f;
+  for (std::size_t i = 1; i < size; ++i) {
+    if (value >> 56)
+      return false;
+
+    value = (value << 8) | p[i];
+  }
+
+  return true;
+}
+
+bool checksum_matches(const std::uint8_t *block) {
+  std::uint64_t expected;
+  if (!parse_octal(block + chksum_offset, chksum_size, expected))
+    return false;
+
+  // the checksum field counts as spaces. Some old tars summed signed chars
+  std::uint64_t sum = 0;
+  std::int64_t signed_sum = 0;
+  for (std::size_t i = 0; i < tar_block_size; ++i) {
+    bool in_chksum = i >= chksum_offset && i < chksum_offset + chksum_size;
+    std::uint8_t c = in_chksum ? ' ' : block[i];
+    sum += c;
+    signed_sum += static_cast<std::int8_t>(c);
+  }
+
+  return sum == expected || signed_sum == static_cast<std::int64_t>(expected);
+}
+
+bool is_zero_block(const std::uint8_t *block) {
+  return std::all_of(block, block + tar_block_size,
+                     [](std::uint8_t c) { return c == 0; });
+}
+
+bool has_ustar_magic(const std::uint8_t *block) {
+  return std::memcmp(block + magic_offset, "ustar", 5) == 0;
+}
+} // namespace
+
+bool is_tar_header(std::span<const std::uint8_t> block) {
+  if (block.size() < tar_block_size)
+    return false;
+
+  return !is_zero_block(block.data()) && has_ustar_magic(block.data()) &&
+         checksum_matches(block.data());
+}
+
+bool tar_indexer::feed(std::span<const std::uint8_t> data,
+                       std::vector<tar_entry> &completed) {
+  auto consume = [&](std::size_t n) {
+    auto chunk = data.first(n);
+    data = data.subspan(n);
+    offset_ += n;
+    return chunk;
+  };
+
+  while (!data.empty()) {
+    switch (state_) {
+    case state::end:
+      // whatever follows the end marker is ignored
+      consume(data.size());
+      break;
+
+    case state::error:
+      return false;
+
+    case state::header: {
+      if (padding_ > 0) {
+        padding_ -= consume(std::min<std::uint64_t>(padding_, data.size()))
+                        .size();
+        break;
+      }
+
+      auto n = std::min(tar_block_size - block_n_, data.size());
+      auto chunk = consume(n);
+      std::copy(chunk.begin(), chunk.end(), block_.begin() + block_n_);
+      block_n_ += n;
+      if (block_n_ < tar_block_size)
+        break;
+
+      block_n_ = 0;
+      if (!parse_header(completed)) {
+        state_ = state::error;
+        return false;
+      }
+      break;
+    }
+
+    case state::contents: {
+      auto chunk = consume(std::min<std::uint64_t>(left_, data.size()));
+      html_sha256_update(&hash_, chunk.data(), chunk.size());
+      left_ -= chunk.size();
+      if (left_ == 0) {
+        auto size = entry_.size;
+        html_sha256_final(&hash_, entry_.sha256.data());
+        completed.push_back(std::move(entry_));
+        start_padding(size);
+      }
+      break;
+    }
+
+    case state::extension: {
+      auto chunk = consume(std::min<std::uint64_t>(left_, data.size()));
+      extension_.append(reinterpret_cast<const char *>(chunk.data()),
+                        chunk.size());
+      left_ -= chunk.size();
+      if (left_ == 0) {
+        finish_extension();
+        start_padding(extension_.size());
+      }
+      break;
+    }
+
+    case state::skip: {
+      auto size = left_;
+      left_ -= consume(std::min<std::uint64_t>(left_, data.size())).size();
+      if (left_ == 0)
+        start_padding(size);
+      break;
+    }
+    }
+  }
+
+  return state_ != state::error;
+}
+
+bool tar_indexer::parse_header(std::vector<tar_entry> &completed) {
+  const auto *block = block_.data();
+
+  if (is_zero_block(block)) {
+    state_ = state::end;
+    return true;
+  }
+
+  if (!checksum_matches(block))
+    return false;
+
+  std::uint64_t size;
+  if (!parse_number(block + size_offset, size_size, size))
+    return false;
+
+  char type = static_cast<char>(block[typeflag_offset]);
+  switch (type) {
+  case 'L': // GNU long name
+  case 'x': // pax extended header
+    if (size > max_extension_size)
+      return false;
+
+    extension_type_ = type;
+    extension_.clear();
+    left_ = size;
+    state_ = state::extension;
+    if (size == 0)
+      finish_extension();
+    return true;
+
+  case '0':
+  case '\0':
+  case '7': // contiguous file
+    break;
+
+  case '1': // links have no contents
+  case '2':
+    size = 0;
+    [[fallthrough]];
+  default:
+    next_path_.clear();
+    has_next_size_ = false;
+    left_ = size;
+    state_ = size > 0 ? state::skip : state::header;
+    return true;
+  }
+
+  std::string path;
+  if (!next_path_.empty()) {
+    path = std::move(next_path_);
+  } else {
+    auto name = field(block, name_offset, name_size);
+    auto prefix = field(block, prefix_offset, prefix_size);
+
+    // GNU tars use the prefix field for other things
+    bool posix = std::memcmp(block + magic_offset, "ustar\0", 6) == 0;
+    if (posix && !prefix.empty()) {
+      path = prefix;
+      path += '/';
+    }
+
+    path += name;
+  }
+
+  if (has_next_size_)
+    size = next_size_;
+
+  next_path_.clear();
+  has_next_size_ = false;
+
+  entry_ = tar_entry{std::move(path), offset_, size, {}};
+  html_sha256_init(&hash_);
+  left_ = size;
+
+  if (size > 0) {
+    state_ = state::contents;
+  } else {
+    html_sha256_final(&hash_, entry_.sha256.data());
+    completed.push_back(std::move(entry_));
+    state_ = state::header;
+  }
+
+  return true;
+}
+
+void tar_indexer::finish_extension() {
+  if (extension_type_ == 'L') {
+    next_path_ = extension_.substr(0, extension_.find('\0'));
+    return;
+  }
+
+  // pax records look like "<length> <key>=<value>\n"
+  std::string_view records{extension_};
+  while (!records.empty()) {
+    auto space = records.find(' ');
+    if (space == std::string_view::npos)
+      return;
+
+    std::size_t len = 0;
+    for (auto c : records.substr(0, space)) {
+      if (c < '0' || c > '9')
+        return;
+      len = len * 10 + (c - '0');
+    }
+
+    if (len <= space + 1 || len > records.size())
+      return;
+
+    auto record = records.substr(space + 1, len - space - 1);
+    records.remove_prefix(len);
+
+    if (record.ends_with('\n'))
+      record.remove_suffix(1);
+
+    auto eq = record.find('=');
+    if (eq == std::string_view::npos)
+      continue;
+
+    auto key = record.substr(0, eq);
+    auto value = record.substr(eq + 1);
+    if (key == "path") {
+      next_path_ = value;
+    } else if (key == "size") {
+      std::uint64_t n = 0;
+      for (auto c : value) {
+        if (c < '0' || c > '9')
+          return;
+        n = n * 10 + (c - '0');
+      }
+
+      next_size_ = n;
+      has_next_size_ = true;
+    }
+  }
+}
+
+void tar_indexer::start_padding(std::uint64_t size) {
+  padding_ = (tar_block_size - size % tar_block_size) % tar_block_size;
+  state_ = state::header;
+}
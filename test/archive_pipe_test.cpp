@@ -0,0 +1,180 @@
+#include <gtest/gtest.h>
+
+#include "html_forms_server/private/archive_pipe.hpp"
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include <atomic>
+#include <future>
+#include <map>
+#include <semaphore>
+#include <string>
+#include <thread>
+
+static std::vector<std::uint8_t> bytes(const std::string &s) {
+  return {s.begin(), s.end()};
+}
+
+static std::string read_string(archive_pipe &pipe) {
+  const void *buf;
+  auto n = pipe.read(&buf);
+  if (n <= 0)
+    return {};
+
+  return std::string{static_cast<const char *>(buf),
+                     static_cast<std::size_t>(n)};
+}
+
+TEST(ArchivePipe, ReadsChunksInOrderThenEnd) {
+  archive_pipe pipe;
+  EXPECT_TRUE(pipe.push(bytes("hello"), nullptr));
+  EXPECT_TRUE(pipe.push(bytes("world"), nullptr));
+  pipe.close();
+
+  EXPECT_EQ(read_string(pipe), "hello");
+  EXPECT_EQ(read_string(pipe), "world");
+
+  const void *buf;
+  EXPECT_EQ(pipe.read(&buf), 0);
+}
+
+TEST(ArchivePipe, EmptyChunksAreNotTheEnd) {
+  archive_pipe pipe;
+  EXPECT_TRUE(pipe.push({}, nullptr));
+  EXPECT_TRUE(pipe.push(bytes("data"), nullptr));
+  pipe.close();
+
+  EXPECT_EQ(read_string(pipe), "data");
+}
+
+TEST(ArchivePipe, FullPipeCallsOnRoomAfterRead) {
+  archive_pipe pipe{2};
+  int calls = 0;
+  EXPECT_TRUE(pipe.push(bytes("a"), [&] { ++calls; }));
+  EXPECT_FALSE(pipe.push(bytes("b"), [&] { ++calls; }));
+  EXPECT_EQ(calls, 0);
+
+  EXPECT_EQ(read_string(pipe), "a");
+  EXPECT_EQ(calls, 1);
+
+  // only invoked once per full push
+  EXPECT_EQ(read_string(pipe), "b");
+  EXPECT_EQ(calls, 1);
+}
+
+TEST(ArchivePipe, AbortFailsPendingRead) {
+  archive_pipe pipe;
+  auto result = std::async(std::launch::async, [&] {
+    const void *buf;
+    return pipe.read(&buf);
+  });
+
+  pipe.abort();
+  EXPECT_EQ(result.get(), -1);
+}
+
+TEST(ArchivePipe, StopReadingDropsChunksAndWakesWriter) {
+  archive_pipe pipe{1};
+  bool woken = false;
+  EXPECT_FALSE(pipe.push(bytes("a"), [&] { woken = true; }));
+
+  pipe.stop_reading();
+  EXPECT_TRUE(woken);
+  EXPECT_TRUE(pipe.push(bytes("b"), nullptr));
+  EXPECT_TRUE(pipe.push(bytes("c"), nullptr));
+}
+
+static std::string make_tar_gz(const std::map<std::string, std::string> &files) {
+  std::string out;
+  out.resize(1024 * 1024);
+  std::size_t used = 0;
+
+  auto a = archive_write_new();
+  archive_write_set_format_pax_restricted(a);
+  archive_write_add_filter_gzip(a);
+  archive_write_open_memory(a, out.data(), out.size(), &used);
+
+  for (const auto &[name, contents] : files) {
+    auto entry = archive_entry_new();
+    archive_entry_set_pathname(entry, name.c_str());
+    archive_entry_set_size(entry, contents.size());
+    archive_entry_set_filetype(entry, AE_IFREG);
+    archive_entry_set_perm(entry, 0644);
+    archive_write_header(a, entry);
+    archive_write_data(a, contents.data(), contents.size());
+    archive_entry_free(entry);
+  }
+
+  archive_write_close(a);
+  archive_write_free(a);
+  out.resize(used);
+  return out;
+}
+
+static std::map<std::string, std::string> extract(archive_pipe &pipe) {
+  std::map<std::string, std::string> files;
+
+  auto a = archive_read_new();
+  archive_read_support_filter_all(a);
+  archive_read_support_format_all(a);
+  if (archive_read_open_pipe(a, pipe) != ARCHIVE_OK) {
+    archive_read_free(a);
+    return files;
+  }
+
+  struct archive_entry *entry;
+  while (archive_read_next_header(a, &entry) == ARCHIVE_OK) {
+    auto &contents = files[archive_entry_pathname(entry)];
+    const void *buf;
+    std::size_t size;
+    la_int64_t offset;
+    while (archive_read_data_block(a, &buf, &size, &offset) == ARCHIVE_OK)
+      contents.append(static_cast<const char *>(buf), size);
+  }
+
+  archive_read_free(a);
+  return files;
+}
+
+TEST(ArchivePipe, ExtractsArchiveStreamedInSmallChunks) {
+  std::map<std::string, std::string> files;
+  files["index.html"] = "<h1>hello</h1>";
+  for (int i = 0; i < 2000; ++i)
+    files["style/main.css"] += "body { color: red; }\n";
+
+  auto tgz = make_tar_gz(files);
+  ASSERT_FALSE(tgz.empty());
+
+  archive_pipe pipe{2};
+  auto extracted =
+      std::async(std::launch::async, [&] { return extract(pipe); });
+
+  // push like the io thread does, waiting whenever the pipe is full
+  std::binary_semaphore room{0};
+  for (std::size_t i = 0; i < tgz.size(); i += 100) {
+    auto n = std::min<std::size_t>(100, tgz.size() - i);
+    std::vector<std::uint8_t> chunk{tgz.begin() + i, tgz.begin() + i + n};
+    if (!pipe.push(std::move(chunk), [&] { room.release(); }))
+      room.acquire();
+  }
+
+  pipe.close();
+  EXPECT_EQ(extracted.get(), files);
+}
+
+TEST(ArchiveExtractor, ShutdownAbortsWaitingExtractions) {
+  archive_extractor extractor;
+  auto pipe = std::make_shared<archive_pipe>();
+  std::atomic<bool> failed = false;
+
+  extractor.run(pipe, [&] {
+    auto a = archive_read_new();
+    archive_read_support_format_all(a);
+    failed = archive_read_open_pipe(a, *pipe) != ARCHIVE_OK;
+    archive_read_free(a);
+  });
+
+  extractor.shutdown();
+  EXPECT_TRUE(failed);
+}
@@ -0,0 +1,162 @@
+#include <gtest/gtest.h>
+
+#include "html_forms_server/private/blob_store.hpp"
+
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+class BlobStore : public testing::Test {
+protected:
+  fs::path dir_;
+
+  void SetUp() override {
+    dir_ = fs::temp_directory_path() / "html_forms_blob_store_test";
+    fs::remove_all(dir_);
+    fs::create_directories(dir_ / blob_store::dir_name);
+  }
+
+  void TearDown() override { fs::remove_all(dir_); }
+
+  fs::path write(const std::string &name, const std::string &contents) {
+    auto path = dir_ / name;
+    std::ofstream of{path, std::ios::binary};
+    of << contents;
+    return path;
+  }
+
+  static std::string read(const fs::path &path) {
+    std::ifstream in{path, std::ios::binary};
+    return {std::istreambuf_iterator<char>{in}, {}};
+  }
+};
+
+// SHA-256 of "hello" and "world"
+static const std::string digest_a =
+    "2cf24dba5fb0a30e26e83b2ac5b9e29e1b161e5c1fa7425e73043362938b9824";
+static const std::string digest_b =
+    "486ea46224d1bb4fb680f34f7c9ad96a8f24ec88be73ea8e5a6c65260e9cb8a7";
+
+TEST_F(BlobStore, IdenticalFilesShareBlob) {
+  blob_store store{dir_ / blob_store::dir_name};
+  auto one = write("one", "hello");
+  auto two = write("two", "hello");
+
+  EXPECT_TRUE(store.add(one, digest_a));
+  EXPECT_TRUE(store.add(two, digest_a));
+
+  EXPECT_TRUE(fs::equivalent(one, two));
+  EXPECT_EQ(fs::hard_link_count(store.dir() / digest_a), 3);
+  EXPECT_EQ(read(two), "hello");
+  EXPECT_FALSE(fs::exists(dir_ / "two.link"));
+}
+
+TEST_F(BlobStore, AddingTwiceIsHarmless) {
+  blob_store store{dir_ / blob_store::dir_name};
+  auto one = write("one", "hello");
+
+  EXPECT_TRUE(store.add(one, digest_a));
+  EXPECT_TRUE(store.add(one, digest_a));
+
+  EXPECT_EQ(fs::hard_link_count(one), 2);
+  EXPECT_FALSE(fs::exists(dir_ / "one.link"));
+}
+
+TEST_F(BlobStore, DifferentContentsAreSeparate) {
+  blob_store store{dir_ / blob_store::dir_name};
+  auto one = write("one", "hello");
+  auto two = write("two", "world");
+
+  EXPECT_TRUE(store.add(one, digest_a));
+  EXPECT_TRUE(store.add(two, digest_b));
+
+  EXPECT_FALSE(fs::equivalent(one, two));
+  EXPECT_EQ(read(one), "hello");
+  EXPECT_EQ(read(two), "world");
+}
+
+TEST_F(BlobStore, ReleaseKeepsBlobsInUse) {
+  blob_store store{dir_ / blob_store::dir_name};
+  auto one = write("one", "hello");
+  auto two = write("two", "hello");
+  store.add(one, digest_a);
+  store.add(two, digest_a);
+
+  fs::remove(one);
+  store.release(digest_a);
+  EXPECT_TRUE(fs::exists(store.dir() / digest_a));
+
+  fs::remove(two);
+  store.release(digest_a);
+  EXPECT_FALSE(fs::exists(store.dir() / digest_a));
+}
+
+TEST_F(BlobStore, CollectRemovesUnreferencedBlobs) {
+  blob_store store{dir_ / blob_store::dir_name};
+  auto one = write("one", "hello");
+  auto two = write("two", "world");
+  store.add(one, digest_a);
+  store.add(two, digest_b);
+
+  fs::remove(one);
+  EXPECT_EQ(store.collect(), 1);
+  EXPECT_FALSE(fs::exists(store.dir() / digest_a));
+  EXPECT_TRUE(fs::exists(store.dir() / digest_b));
+}
+
+TEST_F(BlobStore, RejectsInvalidDigest) {
+  blob_store store{dir_ / blob_store::dir_name};
+  auto one = write("one", "hello");
+
+  EXPECT_FALSE(store.add(one, "../one"));
+  EXPECT_FALSE(store.add(one, std::string(64, 'z')));
+  EXPECT_EQ(fs::hard_link_count(one), 1);
+}
+
+TEST_F(BlobStore, MissingStoreKeepsFile) {
+  blob_store store{dir_ / "missing"};
+  auto one = write("one", "hello");
+
+  EXPECT_FALSE(store.add(one, digest_a));
+  EXPECT_EQ(read(one), "hello");
+}
+
+TEST_F(BlobStore, LinkReusesExistingBlob) {
+  blob_store store{dir_ / blob_store::dir_name};
+  auto one = write("one", "hello");
+  store.add(one, digest_a);
+
+  auto two = dir_ / "two";
+  EXPECT_TRUE(store.link(digest_a, two, 5));
+  EXPECT_TRUE(fs::equivalent(one, two));
+  EXPECT_EQ(read(two), "hello");
+}
+
+TEST_F(BlobStore, LinkReplacesExistingFile) {
+  blob_store store{dir_ / blob_store::dir_name};
+  auto one = write("one", "hello");
+  auto two = write("two", "world");
+  store.add(one, digest_a);
+
+  EXPECT_TRUE(store.link(digest_a, two, 5));
+  EXPECT_EQ(read(two), "hello");
+}
+
+TEST_F(BlobStore, LinkFailsWithoutMatchingBlob) {
+  blob_store store{dir_ / blob_store::dir_name};
+  auto one = write("one", "hello");
+  store.add(one, digest_a);
+
+  EXPECT_FALSE(store.link(digest_b, dir_ / "two", 5));
+  EXPECT_FALSE(store.link(digest_a, dir_ / "two", 6));
+  EXPECT_FALSE(fs::exists(dir_ / "two"));
+}
+
+TEST_F(BlobStore, LinkRejectsBlobWithOtherContents) {
+  blob_store store{dir_ / blob_store::dir_name};
+  auto one = write("one", "world");
+  store.add(one, digest_a);
+
+  EXPECT_FALSE(store.link(digest_a, dir_ / "two", 5));
+  EXPECT_FALSE(fs::exists(dir_ / "two"));
+}
@@ -0,0 +1,123 @@
+#include <gtest/gtest.h>
+
+#include "html_forms_server/private/compression.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <zlib.h>
+
+static std::string gunzip(const std::string &gz) {
+  z_stream zs{};
+  EXPECT_EQ(inflateInit2(&zs, 15 + 16), Z_OK);
+
+  std::string out;
+  char buf[4096];
+
+  zs.next_in = (Bytef *)gz.data();
+  zs.avail_in = gz.size();
+
+  int ret;
+  do {
+    zs.next_out = (Bytef *)buf;
+    zs.avail_out = sizeof(buf);
+    ret = inflate(&zs, Z_NO_FLUSH);
+    out.append(buf, sizeof(buf) - zs.avail_out);
+  } while (ret == Z_OK);
+
+  EXPECT_EQ(ret, Z_STREAM_END);
+  inflateEnd(&zs);
+  return out;
+}
+
+TEST(AcceptEncoding, ListedCodingIsAccepted) {
+  EXPECT_TRUE(accepts_encoding("gzip", "gzip"));
+  EXPECT_TRUE(accepts_encoding("deflate, gzip, br", "gzip"));
+  EXPECT_TRUE(accepts_encoding("GZIP;q=0.5", "gzip"));
+}
+
+TEST(AcceptEncoding, ZeroQvalueIsRejected) {
+  EXPECT_FALSE(accepts_encoding("gzip;q=0", "gzip"));
+  EXPECT_FALSE(accepts_encoding("gzip; q=0.000", "gzip"));
+  EXPECT_FALSE(accepts_encoding("*, gzip;q=0", "gzip"));
+}
+
+TEST(AcceptEncoding, Wildcard) {
+  EXPECT_TRUE(accepts_encoding("*", "gzip"));
+  EXPECT_FALSE(accepts_encoding("*;q=0", "gzip"));
+}
+
+TEST(AcceptEncoding, MissingCodingIsRejected) {
+  EXPECT_FALSE(accepts_encoding("", "gzip"));
+  EXPECT_FALSE(accepts_encoding("br, deflate", "gzip"));
+  EXPECT_FALSE(accepts_encoding("gzipx", "gzip"));
+}
+
+TEST(Compressible, TextLikeTypes) {
+  EXPECT_TRUE(is_compressible("text/html"));
+  EXPECT_TRUE(is_compressible("text/css"));
+  EXPECT_TRUE(is_compressible("application/json"));
+  EXPECT_TRUE(is_compressible("image/svg+xml"));
+  EXPECT_FALSE(is_compressible("image/png"));
+  EXPECT_FALSE(is_compressible("video/mp4"));
+}
+
+TEST(Gzip, BytesRoundTrip) {
+  std::string text;
+  for (int i = 0; i < 1000; ++i)
+    text += "hello world ";
+
+  auto gz = gzip_bytes(
+      {reinterpret_cast<const std::uint8_t *>(text.data()), text.size()}, 6);
+
+  ASSERT_FALSE(gz.empty());
+  EXPECT_LT(gz.size(), text.size());
+  EXPECT_EQ(gunzip(gz), text);
+}
+
+TEST(Gzip, FileRoundTrip) {
+  auto dir = std::filesystem::temp_directory_path();
+  auto src = dir / "html_forms_gzip_test.txt";
+  auto dst = dir / "html_forms_gzip_test.txt.gz";
+
+  std::string text;
+  for (int i = 0; i < 100000; ++i)
+    text += std::to_string(i % 100);
+
+  {
+    std::ofstream of{src, std::ios::binary};
+    of << text;
+  }
+
+  ASSERT_TRUE(gzip_file(src, dst, 9));
+
+  std::ifstream in{dst, std::ios::binary};
+  std::string gz{std::istreambuf_iterator<char>{in}, {}};
+  EXPECT_EQ(gunzip(gz), text);
+
+  std::filesystem::remove(src);
+  std::filesystem::remove(dst);
+}
+
+TEST(Gzip, FileRangeRoundTrip) {
+  auto dir = std::filesystem::temp_directory_path();
+  auto src = dir / "html_forms_gzip_range_test.tar";
+  auto dst = dir / "html_forms_gzip_range_test.txt.gz";
+
+  std::string text;
+  for (int i = 0; i < 100000; ++i)
+    text += std::to_string(i % 100);
+
+  {
+    std::ofstream of{src, std::ios::binary};
+    of << text;
+  }
+
+  ASSERT_TRUE(gzip_file(src, dst, 9, 1000, 70000));
+
+  std::ifstream in{dst, std::ios::binary};
+  std::string gz{std::istreambuf_iterator<char>{in}, {}};
+  EXPECT_EQ(gunzip(gz), text.substr(1000, 70000));
+
+  std::filesystem::remove(src);
+  std::filesystem::remove(dst);
+}
@@ -0,0 +1,67 @@
+#include <gtest/gtest.h>
+
+#include "html_forms_server/private/http_conditional.hpp"
+
+// Sun, 06 Nov 1994 08:49:37 GMT
+static constexpr std::time_t rfc_example = 784111777;
+
+TEST(HttpDate, FormatsImfFixdate) {
+  EXPECT_EQ(http_date(rfc_example), "Sun, 06 Nov 1994 08:49:37 GMT");
+}
+
+TEST(HttpDate, ParsesAllRequiredFormats) {
+  std::time_t t = 0;
+  ASSERT_TRUE(parse_http_date("Sun, 06 Nov 1994 08:49:37 GMT", t));
+  EXPECT_EQ(t, rfc_example);
+
+  t = 0;
+  ASSERT_TRUE(parse_http_date("Sunday, 06-Nov-94 08:49:37 GMT", t));
+  EXPECT_EQ(t, rfc_example);
+
+  t = 0;
+  ASSERT_TRUE(parse_http_date("Sun Nov  6 08:49:37 1994", t));
+  EXPECT_EQ(t, rfc_example);
+}
+
+TEST(HttpDate, RoundTrips) {
+  std::time_t t = 0;
+  ASSERT_TRUE(parse_http_date(http_date(1700000000), t));
+  EXPECT_EQ(t, 1700000000);
+}
+
+TEST(HttpDate, RejectsGarbage) {
+  std::time_t t;
+  EXPECT_FALSE(parse_http_date("", t));
+  EXPECT_FALSE(parse_http_date("yesterday", t));
+  EXPECT_FALSE(parse_http_date("Sun, 06 Foo 1994 08:49:37 GMT", t));
+  EXPECT_FALSE(parse_http_date("Sun, 06 Nov 1994 08:49:37 GMT trailing", t));
+}
+
+TEST(EtagList, WeakComparison) {
+  EXPECT_TRUE(etag_list_matches("\"abc\"", "\"abc\"", true));
+  EXPECT_TRUE(etag_list_matches("W/\"abc\"", "\"abc\"", true));
+  EXPECT_TRUE(etag_list_matches("\"x\", W/\"abc\"", "\"abc\"", true));
+  EXPECT_TRUE(etag_list_matches("*", "\"abc\"", true));
+  EXPECT_FALSE(etag_list_matches("\"abcd\"", "\"abc\"", true));
+  EXPECT_FALSE(etag_list_matches("", "\"abc\"", true));
+}
+
+TEST(EtagList, StrongComparison) {
+  EXPECT_TRUE(etag_list_matches("\"abc\"", "\"abc\"", false));
+  EXPECT_FALSE(etag_list_matches("W/\"abc\"", "\"abc\"", false));
+}
+
+TEST(EtagList, MalformedListDoesNotMatch) {
+  EXPECT_FALSE(etag_list_matches("abc", "\"abc\"", true));
+  EXPECT_FALSE(etag_list_matches("\"abc", "\"abc\"", true));
+}
+
+TEST(IfRange, MatchesStrongEtagOrExactDate) {
+  EXPECT_TRUE(if_range_matches("\"abc\"", "\"abc\"", rfc_example));
+  EXPECT_FALSE(if_range_matches("\"xyz\"", "\"abc\"", rfc_example));
+  EXPECT_FALSE(if_range_matches("W/\"abc\"", "\"abc\"", rfc_example));
+  EXPECT_TRUE(if_range_matches("Sun, 06 Nov 1994 08:49:37 GMT", "\"abc\"",
+                               rfc_example));
+  EXPECT_FALSE(if_range_matches("Sun, 06 Nov 1994 08:49:38 GMT", "\"abc\"",
+                                rfc_example));
+}
@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+
+#include "html_forms_server/private/content_cache.hpp"
+
+static content_cache::entry_ptr make_entry(std::size_t size) {
+  auto entry = std::make_shared<cached_content>();
+  entry->bytes.resize(size, 'x');
+  entry->mime = "text/plain";
+  entry->etag = "\"abc\"";
+  entry->last_modified = 0;
+  return entry;
+}
+
+TEST(ContentCache, MissThenHit) {
+  content_cache cache{1000};
+
+  EXPECT_EQ(cache.find("/a"), nullptr);
+
+  auto entry = make_entry(10);
+  cache.insert("/a", entry);
+  EXPECT_EQ(cache.find("/a"), entry);
+
+  auto stats = cache.stats();
+  EXPECT_EQ(stats.hits, 1);
+  EXPECT_EQ(stats.misses, 1);
+  EXPECT_EQ(stats.bytes, 10);
+  EXPECT_EQ(stats.entries, 1);
+}
+
+TEST(ContentCache, EvictsLeastRecentlyUsed) {
+  content_cache cache{1000};
+
+  cache.insert("/a", make_entry(200));
+  cache.insert("/b", make_entry(200));
+  cache.insert("/c", make_entry(200));
+  cache.insert("/d", make_entry(200));
+
+  // a is now most recently used
+  EXPECT_NE(cache.find("/a"), nullptr);
+
+  cache.insert("/e", make_entry(200));
+  cache.insert("/f", make_entry(200));
+
+  EXPECT_NE(cache.find("/a"), nullptr);
+  EXPECT_EQ(cache.find("/b"), nullptr);
+  EXPECT_NE(cache.find("/f"), nullptr);
+  EXPECT_LE(cache.stats().bytes, 1000);
+}
+
+TEST(ContentCache, LargeEntriesAreNotCached) {
+  content_cache cache{1000};
+
+  cache.insert("/big", make_entry(cache.max_entry_size() + 1));
+  EXPECT_EQ(cache.find("/big"), nullptr);
+  EXPECT_EQ(cache.stats().bytes, 0);
+}
+
+TEST(ContentCache, ReplaceUpdatesSize) {
+  content_cache cache{1000};
+
+  cache.insert("/a", make_entry(100));
+  auto entry = make_entry(50);
+  cache.insert("/a", entry);
+
+  EXPECT_EQ(cache.find("/a"), entry);
+  EXPECT_EQ(cache.stats().bytes, 50);
+  EXPECT_EQ(cache.stats().entries, 1);
+}
+
+TEST(ContentCache, Erase) {
+  content_cache cache{1000};
+
+  cache.insert("/a", make_entry(10));
+  cache.erase("/a");
+  EXPECT_EQ(cache.find("/a"), nullptr);
+  EXPECT_EQ(cache.stats().bytes, 0);
+}
+
+TEST(ContentCache, EraseUnderDirectory) {
+  content_cache cache{1000};
+
+  cache.insert("/s1/uploads/a", make_entry(10));
+  cache.insert("/s1/uploads/b", make_entry(10));
+  cache.insert("/s10/uploads/a", make_entry(10));
+
+  cache.erase_under("/s1");
+  EXPECT_EQ(cache.find("/s1/uploads/a"), nullptr);
+  EXPECT_EQ(cache.find("/s1/uploads/b"), nullptr);
+  EXPECT_NE(cache.find("/s10/uploads/a"), nullptr);
+}
+
+TEST(ContentCache, ShrinkingBudgetEvicts) {
+  content_cache cache{1000};
+
+  cache.insert("/a", make_entry(200));
+  cache.insert("/b", make_entry(200));
+
+  cache.set_budget(300);
+  EXPECT_EQ(cache.find("/a"), nullptr);
+  EXPECT_LE(cache.stats().bytes, 300);
+}
@@ -0,0 +1,118 @@
+#include <gtest/gtest.h>
+
+#include "html_forms_server/private/file_clone.hpp"
+
+#include <fstream>
+#include <random>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+class FileClone : public testing::Test {
+protected:
+  fs::path dir_;
+
+  void SetUp() override {
+    dir_ = fs::temp_directory_path() / "html_forms_file_clone_test";
+    fs::remove_all(dir_);
+    fs::create_directories(dir_);
+  }
+
+  void TearDown() override { fs::remove_all(dir_); }
+
+  fs::path write(const std::string &name, const std::string &contents) {
+    auto path = dir_ / name;
+    std::ofstream of{path, std::ios::binary};
+    of << contents;
+    return path;
+  }
+
+  static std::string read(const fs::path &path) {
+    std::ifstream in{path, std::ios::binary};
+    return {std::istreambuf_iterator<char>{in}, {}};
+  }
+};
+
+static std::string random_contents(std::size_t size) {
+  std::mt19937 rng{static_cast<unsigned>(size)};
+  std::string s;
+  s.reserve(size);
+  while (s.size() < size)
+    s += static_cast<char>(rng());
+  return s;
+}
+
+TEST_F(FileClone, CopiesWholeFile) {
+  auto contents = random_contents(3 * 1024 * 1024 + 17);
+  auto src = write("src", contents);
+
+  int fd = ::open(src.c_str(), O_RDONLY);
+  ASSERT_NE(fd, -1);
+
+  std::uint64_t size = 0;
+  EXPECT_FALSE(clone_file(fd, dir_ / "dst", size));
+  ::close(fd);
+
+  EXPECT_EQ(size, contents.size());
+  EXPECT_TRUE(read(dir_ / "dst") == contents);
+}
+
+TEST_F(FileClone, IgnoresFileOffset) {
+  auto src = write("src", "hello world");
+
+  int fd = ::open(src.c_str(), O_RDONLY);
+  ASSERT_NE(fd, -1);
+  ASSERT_EQ(::lseek(fd, 6, SEEK_SET), 6);
+
+  std::uint64_t size = 0;
+  EXPECT_FALSE(clone_file(fd, dir_ / "dst", size));
+  EXPECT_EQ(::lseek(fd, 0, SEEK_CUR), 6);
+  ::close(fd);
+
+  EXPECT_EQ(read(dir_ / "dst"), "hello world");
+}
+
+TEST_F(FileClone, EmptyFile) {
+  auto src = write("src", "");
+
+  int fd = ::open(src.c_str(), O_RDONLY);
+  ASSERT_NE(fd, -1);
+
+  std::uint64_t size = 1;
+  EXPECT_FALSE(clone_file(fd, dir_ / "dst", size));
+  ::close(fd);
+
+  EXPECT_EQ(size, 0);
+  EXPECT_TRUE(fs::exists(dir_ / "dst"));
+}
+
+TEST_F(FileClone, ReplacesLinkWithoutChangingTarget) {
+  auto src = write("src", "new");
+  auto shared = write("shared", "old");
+  fs::create_hard_link(shared, dir_ / "dst");
+
+  int fd = ::open(src.c_str(), O_RDONLY);
+  ASSERT_NE(fd, -1);
+
+  std::uint64_t size = 0;
+  EXPECT_FALSE(clone_file(fd, dir_ / "dst", size));
+  ::close(fd);
+
+  EXPECT_EQ(read(dir_ / "dst"), "new");
+  EXPECT_EQ(read(shared), "old");
+}
+
+TEST_F(FileClone, RejectsPipe) {
+  int fds[2];
+  ASSERT_EQ(::pipe(fds), 0);
+
+  std::uint64_t size = 0;
+  EXPECT_EQ(clone_file(fds[0], dir_ / "dst", size),
+            std::errc::invalid_argument);
+  EXPECT_FALSE(fs::exists(dir_ / "dst"));
+
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
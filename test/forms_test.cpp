@@ -6,6 +6,7 @@
 #include <msgstream.h>
 #include <unixsocket.h>
 
+#include <fcntl.h>
 #include <unistd.h>
 
 #include <boost/asio/connect.hpp>
@@ -15,6 +16,7 @@
 #include <boost/beast/http.hpp>
 #include <boost/beast/version.hpp>
 
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
 #include <cstdio>
@@ -30,6 +32,7 @@
 #include <regex>
 #include <string>
 #include <thread>
+#include <vector>
 
 #define LOG 0
 
@@ -49,7 +52,14 @@ void log(const std::string &s) {
   }
 }
 
-http::response<http::string_body> http_get(const std::string &url);
+using header_list = std::vector<std::pair<http::field, std::string>>;
+
+http::response<http::string_body> http_get(const std::string &url,
+                                           const header_list &headers = {});
+
+http::response<http::string_body> http_post(const std::string &url,
+                                            const std::string &content_type,
+                                            const std::string &body);
 
 template <typename Duration> class timer {
   Duration d_;
@@ -104,6 +114,9 @@ class server {
 
   int client_fd_;
 
+  // acts like a server from before protocol version 0.2.0
+  bool refuse_0_2_0_ = false;
+
   std::queue<html_forms_server_event> events_;
   std::mutex evt_mtx_;
   std::condition_variable evt_has_data_;
@@ -120,7 +133,7 @@ class server {
   }
 
 public:
-  server() {
+  server(unsigned int nthreads = 1) {
     scratch_ = fs::path{test_scratch_dir};
 
     if (fs::exists(scratch_)) {
@@ -159,8 +172,9 @@ public:
     assert(ret);
 
     log("Spawning html server thread");
-    server_thread_ =
-        std::thread{[this] { html_forms_server_run(html_server_); }};
+    server_thread_ = std::thread{[this, nthreads] {
+      html_forms_server_run_threads(html_server_, nthreads);
+    }};
   }
 
   ~server() {
@@ -180,24 +194,51 @@ public:
     fs::remove_all(scratch_);
   };
 
+  html_forms_server_cache_stats cache_stats() {
+    html_forms_server_cache_stats stats;
+    int ret = html_forms_server_get_cache_stats(html_server_, &stats);
+    assert(ret);
+    return stats;
+  }
+
+  html_forms_server_stats stats() {
+    html_forms_server_stats stats;
+    int ret = html_forms_server_get_stats(html_server_, &stats);
+    assert(ret);
+    return stats;
+  }
+
+  std::string metrics_url() const {
+    return "http://localhost:" + std::to_string(port_) + "/html/metrics";
+  }
+
   std::promise<std::string> accept_client() {
     std::promise<std::string> p;
 
     std::thread t{[this, &p] {
-      log("accepting catui client");
-      client_fd_ = unix_accept(catui_server_);
-      assert(client_fd_ >= 0);
-
-      char connect_buf[CATUI_CONNECT_SIZE];
-      size_t msg_size;
-      log("receiving catui connect request");
-      int ec = msgstream_fd_recv(client_fd_, connect_buf, CATUI_CONNECT_SIZE,
-                                 &msg_size);
-      assert(ec == MSGSTREAM_OK);
-
       catui_connect_request req;
-      log("decoding catui connect request");
-      assert(catui_decode_connect(connect_buf, msg_size, &req));
+      while (true) {
+        log("accepting catui client");
+        client_fd_ = unix_accept(catui_server_);
+        assert(client_fd_ >= 0);
+
+        char connect_buf[CATUI_CONNECT_SIZE];
+        size_t msg_size;
+        log("receiving catui connect request");
+        int ec = msgstream_fd_recv(client_fd_, connect_buf,
+                                   CATUI_CONNECT_SIZE, &msg_size);
+        assert(ec == MSGSTREAM_OK);
+
+        log("decoding catui connect request");
+        assert(catui_decode_connect(connect_buf, msg_size, &req));
+
+        if (!(refuse_0_2_0_ && req.version.minor >= 2))
+          break;
+
+        log("refusing protocol version 0.2.0");
+        catui_server_nack(client_fd_, "Only 0.1.0 is supported", stderr);
+        ::close(client_fd_);
+      }
 
       std::string proto{req.protocol};
       assert(proto == "com.gulachek.html-forms");
@@ -218,6 +259,14 @@ public:
 
   short port() const { return port_; }
 
+  void refuse_0_2_0() { refuse_0_2_0_ = true; }
+
+  void close_window(const std::string &session_id) {
+    log("closing window of session " + session_id);
+    int ret = html_forms_server_close_window(html_server_, session_id.c_str());
+    assert(ret);
+  }
+
   void pop_event(html_forms_server_event &evt) {
     log("waiting for server event");
     std::unique_lock lck{evt_mtx_};
@@ -287,11 +336,76 @@ public:
   void upload_string(const char *url, std::string content) {
     log("uploading " + std::string{url});
     log(content);
+    upload_chunks(url, content, {content.size()});
+  }
+
+  void upload_chunks(const char *url, const std::string &content,
+                     const std::vector<std::size_t> &chunk_sizes) {
     assert(html_upload_stream_open(con_, url));
-    assert(html_upload_stream_write(con_, content.data(), content.size()));
+
+    std::size_t i = 0;
+    for (auto n : chunk_sizes) {
+      assert(html_upload_stream_write(con_, content.data() + i, n));
+      i += n;
+    }
+
+    assert(i == content.size());
     assert(html_upload_stream_close(con_));
   }
 
+  void upload_file(const char *url, const fs::path &path) {
+    log("uploading file " + path.string());
+    assert(html_upload_file(con_, url, path.c_str()));
+  }
+
+  void upload_fd(const char *url, int fd) {
+    log("uploading descriptor " + std::to_string(fd));
+    assert(html_upload_fd(con_, url, fd));
+  }
+
+  void set_write_buffer_size(std::size_t size) {
+    assert(html_set_write_buffer_size(con_, size));
+  }
+
+  void upload_lazy(const char *url, bool cache,
+                   html_fetch_callback *cb, void *ctx) {
+    log("uploading " + std::string{url} + " lazily");
+    assert(html_set_fetch_callback(con_, cb, ctx));
+    assert(html_upload_lazy(con_, url, cache));
+  }
+
+  void set_upload_window(std::size_t window) {
+    assert(html_set_upload_window(con_, window));
+  }
+
+  void upload_wait() { assert(html_upload_wait(con_)); }
+
+  bool has_pending() const { return html_has_pending(con_); }
+
+  std::string read_form_field(const char *name) {
+    html_form *form;
+    assert(html_form_read(con_, &form));
+    std::string value = html_form_value_of(form, name);
+    html_form_free(form);
+    return value;
+  }
+
+  // Handle messages until the user closes the window
+  void wait_for_close() {
+    log("waiting for close request");
+    char buf[64];
+    std::size_t n;
+    while (html_recv(con_, buf, sizeof(buf), &n))
+      ;
+
+    assert(html_close_requested(con_));
+  }
+
+  void upload_dir(const char *url, const fs::path &dir) {
+    log("uploading directory " + dir.string());
+    assert(html_upload_dir(con_, url, dir.c_str()));
+  }
+
   client transfer() {
     log("transferring connection");
     assert(con_);
@@ -311,6 +425,19 @@ public:
   }
 };
 
+// Waits for the session to handle what was sent before, returning the
+// contents of url
+static std::string fetch(server &s, client &c, const std::string &url) {
+  html_forms_server_event evt;
+  c.navigate(url);
+  s.pop_event(evt);
+  assert(evt.type == HTML_FORMS_SERVER_EVENT_OPEN_URL);
+
+  auto resp = http_get(evt.data.open_url.url);
+  EXPECT_EQ(resp.result_int(), 200);
+  return resp.body();
+}
+
 TEST(HtmlForms, NavigateTriggersServerEvent) {
   server s;
   client c{s};
@@ -366,6 +493,555 @@ TEST(HtmlForms, CanRequestUploadedResourceAfterSubsequentNavigate) {
   EXPECT_EQ(resp.body(), "hello");
 }
 
+TEST(HtmlForms, CanRequestLargeUploadedResource) {
+  server s;
+  client c{s};
+  html_forms_server_event evt;
+
+  std::string content;
+  content.resize(4 * 1024 * 1024);
+  for (std::size_t i = 0; i < content.size(); ++i) {
+    content[i] = 'a' + (i % 26);
+  }
+
+  c.upload_string("/large.txt", content);
+  c.navigate("/large.txt");
+  s.pop_event(evt);
+  ASSERT_EQ(evt.type, HTML_FORMS_SERVER_EVENT_OPEN_URL);
+
+  auto resp = http_get(evt.data.open_url.url);
+  EXPECT_EQ(resp.result_int(), 200);
+  EXPECT_EQ(resp.body().size(), content.size());
+  EXPECT_TRUE(resp.body() == content);
+}
+
+TEST(HtmlForms, StreamedChunksOfAnySizeAreJoined) {
+  server s;
+  client c{s};
+  html_forms_server_event evt;
+
+  // sizes around the old 16-bit chunk limit and the server's read buffer
+  std::vector<std::size_t> sizes = {1, 0xffff, 0x10000, 0x10001,
+                                    0, 3000000, 7};
+  std::string content;
+  for (auto n : sizes) {
+    for (std::size_t i = 0; i < n; ++i)
+      content += 'a' + (content.size() % 26);
+  }
+
+  c.upload_chunks("/chunks.txt", content, sizes);
+  c.navigate("/chunks.txt");
+  s.pop_event(evt);
+  ASSERT_EQ(evt.type, HTML_FORMS_SERVER_EVENT_OPEN_URL);
+
+  auto resp = http_get(evt.data.open_url.url);
+  EXPECT_EQ(resp.result_int(), 200);
+  EXPECT_TRUE(resp.body() == content);
+}
+
+TEST(HtmlForms, BufferedStreamWritesArriveInOrder) {
+  server s;
+  client c{s};
+
+  // many writes smaller than the buffer and some bigger than it
+  std::vector<std::size_t> sizes;
+  for (std::size_t i = 0; i < 2000; ++i)
+    sizes.push_back(i % 50);
+  sizes.push_back(5000);
+  sizes.push_back(1);
+  sizes.push_back(100000);
+
+  std::string content;
+  for (auto n : sizes) {
+    for (std::size_t i = 0; i < n; ++i)
+      content += 'a' + (content.size() % 26);
+  }
+
+  for (std::size_t buf_size : {0, 1, 4096, HTML_WRITE_BUFFER_SIZE}) {
+    c.set_write_buffer_size(buf_size);
+
+    auto url = "/buffered" + std::to_string(buf_size) + ".txt";
+    c.upload_chunks(url.c_str(), content, sizes);
+    EXPECT_EQ(fetch(s, c, url), content) << buf_size;
+  }
+}
+
+TEST(HtmlForms, MatchingEtagIsNotModified) {
+  server s;
+  client c{s};
+  html_forms_server_event evt;
+
+  c.upload_string("/hello.html", "hello");
+  c.navigate("/hello.html");
+  s.pop_event(evt);
+  ASSERT_EQ(evt.type, HTML_FORMS_SERVER_EVENT_OPEN_URL);
+
+  auto resp = http_get(evt.data.open_url.url);
+  ASSERT_EQ(resp.result_int(), 200);
+  std::string etag{resp[http::field::etag]};
+  ASSERT_FALSE(etag.empty());
+
+  resp = http_get(evt.data.open_url.url, {{http::field::if_none_match, etag}});
+  EXPECT_EQ(resp.result_int(), 304);
+  EXPECT_EQ(resp.body(), "");
+}
+
+TEST(HtmlForms, TextIsGzippedWhenAccepted) {
+  server s;
+  client c{s};
+  html_forms_server_event evt;
+
+  std::string content;
+  for (int i = 0; i < 1000; ++i)
+    content += "hello world\n";
+
+  c.upload_string("/hello.txt", content);
+  c.navigate("/hello.txt");
+  s.pop_event(evt);
+  ASSERT_EQ(evt.type, HTML_FORMS_SERVER_EVENT_OPEN_URL);
+
+  auto identity = http_get(evt.data.open_url.url);
+  ASSERT_EQ(identity.result_int(), 200);
+  EXPECT_EQ(identity[http::field::content_encoding], "");
+  EXPECT_EQ(identity.body(), content);
+
+  auto gz = http_get(evt.data.open_url.url,
+                     {{http::field::accept_encoding, "gzip, deflate"}});
+  ASSERT_EQ(gz.result_int(), 200);
+  EXPECT_EQ(gz[http::field::content_encoding], "gzip");
+  EXPECT_EQ(gz[http::field::vary], "Accept-Encoding");
+  EXPECT_LT(gz.body().size(), content.size());
+  EXPECT_NE(gz[http::field::etag], identity[http::field::etag]);
+}
+
+TEST(HtmlForms, RepeatedGetIsServedFromCache) {
+  server s;
+  client c{s};
+  html_forms_server_event evt;
+
+  c.upload_string("/view.html", "<h1>hello</h1>");
+  c.navigate("/view.html");
+  s.pop_event(evt);
+  ASSERT_EQ(evt.type, HTML_FORMS_SERVER_EVENT_OPEN_URL);
+
+  auto resp = http_get(evt.data.open_url.url);
+  ASSERT_EQ(resp.result_int(), 200);
+  auto before = s.cache_stats();
+
+  resp = http_get(evt.data.open_url.url);
+  ASSERT_EQ(resp.result_int(), 200);
+  EXPECT_EQ(resp.body(), "<h1>hello</h1>");
+
+  auto after = s.cache_stats();
+  EXPECT_EQ(after.hits, before.hits + 1);
+  EXPECT_EQ(after.misses, before.misses);
+}
+
+TEST(HtmlForms, ReuploadInvalidatesCache) {
+  server s;
+  client c{s};
+  html_forms_server_event evt;
+
+  c.upload_string("/view.html", "first");
+  c.navigate("/view.html");
+  s.pop_event(evt);
+  ASSERT_EQ(evt.type, HTML_FORMS_SERVER_EVENT_OPEN_URL);
+
+  auto resp = http_get(evt.data.open_url.url);
+  ASSERT_EQ(resp.body(), "first");
+
+  c.upload_string("/view.html", "second");
+  c.navigate("/view.html");
+  s.pop_event(evt);
+  ASSERT_EQ(evt.type, HTML_FORMS_SERVER_EVENT_OPEN_URL);
+
+  resp = http_get(evt.data.open_url.url);
+  EXPECT_EQ(resp.body(), "second");
+}
+
+TEST(HtmlForms, ConcurrentGetsOnMultipleThreads) {
+  server s{4};
+  client c{s};
+  html_forms_server_event evt;
+
+  c.upload_string("/hello.html", "hello");
+  c.navigate("/hello.html");
+  s.pop_event(evt);
+  ASSERT_EQ(evt.type, HTML_FORMS_SERVER_EVENT_OPEN_URL);
+
+  std::string url = evt.data.open_url.url;
+  std::atomic<int> ok = 0;
+  std::vector<std::thread> threads;
+
+  for (int i = 0; i < 8; ++i) {
+    threads.emplace_back([&] {
+      for (int j = 0; j < 16; ++j) {
+        auto resp = http_get(url);
+        if (resp.result_int() == 200 && resp.body() == "hello")
+          ++ok;
+      }
+    });
+  }
+
+  for (auto &th : threads)
+    th.join();
+
+  EXPECT_EQ(ok, 8 * 16);
+}
+
+TEST(HtmlForms, MetricsCountRequestsAndUploads) {
+  server s;
+  client c{s};
+  html_forms_server_event evt;
+
+  c.upload_string("/hello.html", "hello");
+  c.navigate("/hello.html");
+  s.pop_event(evt);
+  ASSERT_EQ(evt.type, HTML_FORMS_SERVER_EVENT_OPEN_URL);
+
+  auto before = s.stats();
+  EXPECT_EQ(before.sessions_active, 1);
+  EXPECT_EQ(before.uploads, 1);
+  EXPECT_EQ(before.upload_bytes, 5);
+  EXPECT_GE(before.browser_events, 1);
+
+  auto resp = http_get(evt.data.open_url.url);
+  ASSERT_EQ(resp.result_int(), 200);
+
+  auto after = s.stats();
+  EXPECT_EQ(after.http_requests, before.http_requests + 1);
+  EXPECT_EQ(after.http_request_us.count, before.http_request_us.count + 1);
+
+  resp = http_get(s.metrics_url());
+  ASSERT_EQ(resp.result_int(), 200);
+  EXPECT_NE(resp.body().find("html_forms_uploads_total 1\n"),
+            std::string::npos);
+  EXPECT_NE(resp.body().find("html_forms_http_request_duration_seconds_count"),
+            std::string::npos);
+}
+
+static void write_file(const fs::path &path, const std::string &content) {
+  fs::create_directories(path.parent_path());
+  std::ofstream of{path, std::ios::binary};
+  of << content;
+}
+
+TEST(HtmlForms, UploadFileSendsWholeFile) {
+  server s;
+  client c{s};
+
+  // bigger than a single sendfile(2) on a socket usually writes
+  for (std::size_t size : {1 << 20, 16 << 20}) {
+    std::string content;
+    content.reserve(size);
+    std::mt19937 rng{static_cast<unsigned>(size)};
+    while (content.size() < size)
+      content += static_cast<char>(rng());
+
+    auto path = fs::path{test_scratch_dir} / "upload_file.bin";
+    write_file(path, content);
+
+    auto url = "/file" + std::to_string(size) + ".bin";
+    c.upload_file(url.c_str(), path);
+    EXPECT_TRUE(fetch(s, c, url) == content) << size;
+  }
+}
+
+TEST(HtmlForms, UploadFdServesSnapshotOfFile) {
+  server s;
+  client c{s};
+
+  auto path = fs::path{test_scratch_dir} / "upload_fd.txt";
+  write_file(path, "hello world");
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  ASSERT_NE(fd, -1);
+
+  // the whole file is uploaded no matter where the descriptor is
+  ASSERT_EQ(::lseek(fd, 6, SEEK_SET), 6);
+  c.upload_fd("/fd.txt", fd);
+  ::close(fd);
+
+  EXPECT_EQ(fetch(s, c, "/fd.txt"), "hello world");
+
+  // later changes aren't served until uploaded again
+  write_file(path, "goodbye");
+  EXPECT_EQ(fetch(s, c, "/fd.txt"), "hello world");
+
+  fd = ::open(path.c_str(), O_RDONLY);
+  ASSERT_NE(fd, -1);
+  c.upload_fd("/fd.txt", fd);
+  ::close(fd);
+
+  EXPECT_EQ(fetch(s, c, "/fd.txt"), "goodbye");
+  EXPECT_EQ(s.stats().uploads, 2);
+}
+
+TEST(HtmlForms, UploadEmptyFile) {
+  server s;
+  client c{s};
+
+  auto path = fs::path{test_scratch_dir} / "empty.txt";
+  write_file(path, "");
+
+  c.upload_file("/empty.txt", path);
+  EXPECT_EQ(fetch(s, c, "/empty.txt"), "");
+}
+
+TEST(HtmlForms, UploadDirSkipsContentServerHas) {
+  server s;
+
+  auto src = fs::path{test_scratch_dir} / "upload_dir_src";
+  write_file(src / "index.html", "<h1>hello</h1>");
+  write_file(src / "style" / "main.css", "body { color: red; }");
+
+  client c1{s};
+  c1.upload_dir("/", src);
+  EXPECT_EQ(fetch(s, c1, "/index.html"), "<h1>hello</h1>");
+  EXPECT_EQ(s.stats().uploads, 2);
+
+  // Nothing changed, so nothing is sent
+  c1.upload_dir("/", src);
+  EXPECT_EQ(fetch(s, c1, "/index.html"), "<h1>hello</h1>");
+  EXPECT_EQ(s.stats().uploads, 2);
+
+  write_file(src / "index.html", "<h1>changed</h1>");
+  c1.upload_dir("/", src);
+  EXPECT_EQ(fetch(s, c1, "/index.html"), "<h1>changed</h1>");
+  EXPECT_EQ(s.stats().uploads, 3);
+
+  // Another session links to what the first uploaded
+  client c2{s};
+  c2.upload_dir("/", src);
+  EXPECT_EQ(fetch(s, c2, "/style/main.css"), "body { color: red; }");
+  EXPECT_EQ(s.stats().uploads, 3);
+}
+
+TEST(HtmlForms, KeptFormsSurviveWaitingForOtherReplies) {
+  server s;
+  client c{s};
+  c.set_upload_window(1);
+
+  auto src = fs::path{test_scratch_dir} / "upload_kept_src";
+  write_file(src / "index.html", "<h1>hello</h1>");
+
+  auto resp = http_post(c.expected_navigation_url("/submit"),
+                        "application/x-www-form-urlencoded", "name=value");
+  EXPECT_EQ(resp.result_int(), 303);
+
+  // waiting for a's acknowledgement keeps the form, which the manifest's
+  // reply doesn't disturb
+  c.upload_string("/a.txt", "a");
+  c.upload_string("/b.txt", "b");
+  c.upload_dir("/", src);
+  c.upload_wait();
+
+  EXPECT_EQ(c.read_form_field("name"), "value");
+  EXPECT_FALSE(c.has_pending());
+  EXPECT_EQ(http_get(c.expected_navigation_url("/index.html")).body(),
+            "<h1>hello</h1>");
+}
+
+TEST(HtmlForms, FormsArrivingWhileNegotiatingUploadsAreKept) {
+  server s;
+  client c{s};
+
+  auto src = fs::path{test_scratch_dir} / "upload_negotiate_src";
+  write_file(src / "index.html", "<h1>hello</h1>");
+
+  // the form is sent to the app before the manifest's reply
+  auto resp = http_post(c.expected_navigation_url("/submit"),
+                        "application/x-www-form-urlencoded", "name=value");
+  EXPECT_EQ(resp.result_int(), 303);
+
+  c.upload_dir("/", src);
+  EXPECT_TRUE(c.has_pending());
+
+  EXPECT_EQ(c.read_form_field("name"), "value");
+  EXPECT_EQ(fetch(s, c, "/index.html"), "<h1>hello</h1>");
+}
+
+TEST(HtmlForms, UploadsToOldServersUseOnlyProtocol010) {
+  server s;
+  s.refuse_0_2_0();
+  client c{s};
+
+  auto src = fs::path{test_scratch_dir} / "upload_010_src";
+  write_file(src / "index.html", "<h1>hello</h1>");
+  write_file(src / "style" / "main.css", "body { color: red; }");
+  c.upload_dir("/", src);
+
+  // 2 byte chunk headers can't size this in one chunk
+  std::string big(100000, 'b');
+  c.upload_chunks("/big.txt", big, {big.size()});
+
+  auto path = fs::path{test_scratch_dir} / "fd_010.txt";
+  write_file(path, "by descriptor");
+  int fd = ::open(path.c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0);
+  c.upload_fd("/fd.txt", fd);
+  ::close(fd);
+
+  EXPECT_EQ(fetch(s, c, "/index.html"), "<h1>hello</h1>");
+  EXPECT_EQ(fetch(s, c, "/style/main.css"), "body { color: red; }");
+  EXPECT_EQ(fetch(s, c, "/big.txt"), big);
+  EXPECT_EQ(fetch(s, c, "/fd.txt"), "by descriptor");
+}
+
+TEST(HtmlForms, UploadDirSendsManyFilesInOneBatch) {
+  server s;
+  client c{s};
+
+  auto src = fs::path{test_scratch_dir} / "upload_batch_src";
+  for (int i = 0; i < 200; ++i)
+    write_file(src / ("file" + std::to_string(i) + ".txt"),
+               std::string(i * 37, 'a' + i % 26));
+
+  // empty files and files bigger than a read buffer are split correctly
+  write_file(src / "empty.txt", "");
+  std::string big;
+  for (int i = 0; i < 20000; ++i)
+    big += std::to_string(i) + '\n';
+  write_file(src / "big.txt", big);
+
+  c.upload_dir("/", src);
+
+  EXPECT_EQ(fetch(s, c, "/big.txt"), big);
+  EXPECT_EQ(fetch(s, c, "/empty.txt"), "");
+  for (int i = 0; i < 200; i += 17) {
+    auto url = "/file" + std::to_string(i) + ".txt";
+    EXPECT_EQ(fetch(s, c, url), std::string(i * 37, 'a' + i % 26));
+  }
+
+  EXPECT_EQ(s.stats().uploads, 202);
+}
+
+// Uploads "page <url>" for lazy URLs, except ones named missing
+static int upload_page(html_connection *con, const char *url, void *ctx) {
+  static_cast<std::vector<std::string> *>(ctx)->push_back(url);
+  if (std::string_view{url}.ends_with("/missing.html"))
+    return 0;
+
+  std::string content = "page " + std::string{url};
+  return html_upload_stream_open(con, url) &&
+         html_upload_stream_write(con, content.data(), content.size()) &&
+         html_upload_stream_close(con);
+}
+
+// Requests urls while the client handles fetches, then closes the window
+static std::vector<http::response<http::string_body>>
+get_lazy(server &s, client &c, const std::vector<std::string> &urls) {
+  html_forms_server_event evt;
+  c.navigate("/");
+  s.pop_event(evt);
+  assert(evt.type == HTML_FORMS_SERVER_EVENT_OPEN_URL);
+  std::string base = evt.data.open_url.url;
+  base.pop_back();
+
+  auto gets = std::async(std::launch::async, [&] {
+    std::vector<http::response<http::string_body>> responses;
+    for (const auto &url : urls)
+      responses.push_back(http_get(base + url));
+
+    s.close_window(c.session_id());
+    return responses;
+  });
+
+  c.wait_for_close();
+  return gets.get();
+}
+
+TEST(HtmlForms, LazyUrlsAreUploadedWhenRequested) {
+  server s;
+  client c{s};
+
+  std::vector<std::string> fetched;
+  c.upload_lazy("/docs/", true, &upload_page, &fetched);
+  c.upload_string("/docs/eager.html", "eager");
+
+  auto resps = get_lazy(s, c,
+                        {"/docs/a.html", "/docs/a.html", "/docs/missing.html",
+                         "/docs/eager.html", "/other.html"});
+
+  EXPECT_EQ(resps[0].result_int(), 200);
+  EXPECT_EQ(resps[0].body(), "page /docs/a.html");
+  EXPECT_EQ(resps[1].body(), "page /docs/a.html");
+  EXPECT_EQ(resps[2].result_int(), 404);
+  EXPECT_EQ(resps[3].body(), "eager");
+  EXPECT_EQ(resps[4].result_int(), 404);
+
+  // cached after the first request, and nothing else is fetched
+  std::vector<std::string> expected = {"/docs/a.html", "/docs/missing.html"};
+  EXPECT_EQ(fetched, expected);
+}
+
+TEST(HtmlForms, UncachedLazyUrlsAreFetchedEveryTime) {
+  server s;
+  client c{s};
+
+  std::vector<std::string> fetched;
+  c.upload_lazy("/", true, &upload_page, &fetched);
+  c.upload_lazy("/live/", false, &upload_page, &fetched);
+
+  auto resps = get_lazy(s, c,
+                        {"/live/a.txt", "/live/a.txt", "/a.txt", "/a.txt"});
+
+  for (const auto &resp : resps)
+    EXPECT_EQ(resp.result_int(), 200);
+
+  EXPECT_EQ(resps[1].body(), "page /live/a.txt");
+  EXPECT_EQ(resps[3].body(), "page /a.txt");
+
+  // the longest prefix decides
+  std::vector<std::string> expected = {"/live/a.txt", "/live/a.txt",
+                                       "/a.txt"};
+  EXPECT_EQ(fetched, expected);
+}
+
+TEST(HtmlForms, UploadWaitReturnsOnceUploadsAreServable) {
+  server s;
+  client c{s};
+
+  // more uploads than the window pipelines past it
+  c.set_upload_window(4);
+  for (int i = 0; i < 10; ++i) {
+    auto url = "/file" + std::to_string(i) + ".txt";
+    c.upload_string(url.c_str(), "contents " + std::to_string(i));
+  }
+
+  c.upload_wait();
+
+  // no navigation is needed to know the server has them
+  for (int i = 0; i < 10; ++i) {
+    auto url = "/file" + std::to_string(i) + ".txt";
+    auto resp = http_get(c.expected_navigation_url(url));
+    EXPECT_EQ(resp.result_int(), 200);
+    EXPECT_EQ(resp.body(), "contents " + std::to_string(i));
+  }
+
+  EXPECT_EQ(s.stats().uploads, 10);
+}
+
+TEST(HtmlForms, FormsArrivingWhileWaitingForUploadsAreKept) {
+  server s;
+  client c{s};
+  c.set_upload_window(1);
+
+  // the form is sent to the app before the upload's acknowledgement
+  auto resp = http_post(c.expected_navigation_url("/submit"),
+                        "application/x-www-form-urlencoded", "name=value");
+  EXPECT_EQ(resp.result_int(), 303);
+
+  c.upload_string("/a.txt", "a");
+  c.upload_string("/b.txt", "b");
+  c.upload_wait();
+  EXPECT_TRUE(c.has_pending());
+
+  EXPECT_EQ(c.read_form_field("name"), "value");
+  EXPECT_FALSE(c.has_pending());
+  EXPECT_EQ(http_get(c.expected_navigation_url("/b.txt")).body(), "b");
+}
+
 bool parse_url(const std::string &url, std::string &hostname, std::string &port,
                std::string &path) {
   std::smatch match;
@@ -383,8 +1059,26 @@ bool parse_url(const std::string &url, std::string &hostname, std::string &port,
   return false;
 }
 
-http::response<http::string_body> http_get(const std::string &url) {
-  log("HTTP GET " + url);
+static http::response<http::string_body>
+http_request(http::verb method, const std::string &url,
+             const header_list &headers, const std::string &body = {});
+
+http::response<http::string_body> http_get(const std::string &url,
+                                           const header_list &headers) {
+  return http_request(http::verb::get, url, headers);
+}
+
+http::response<http::string_body> http_post(const std::string &url,
+                                            const std::string &content_type,
+                                            const std::string &body) {
+  return http_request(http::verb::post, url,
+                      {{http::field::content_type, content_type}}, body);
+}
+
+static http::response<http::string_body>
+http_request(http::verb method, const std::string &url,
+             const header_list &headers, const std::string &body) {
+  log("HTTP " + std::string{http::to_string(method)} + " " + url);
   std::string hostname;
   std::string port;
   std::string path;
@@ -403,9 +1097,17 @@ http::response<http::string_body> http_get(const std::string &url) {
   log("connecting to host");
   stream.connect(results);
 
-  http::request<http::string_body> req{http::verb::get, path, 11};
+  http::request<http::string_body> req{method, path, 11};
   req.set(http::field::host, hostname);
   req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+  for (const auto &[field, value] : headers) {
+    req.set(field, value);
+  }
+
+  if (method == http::verb::post) {
+    req.body() = body;
+    req.prepare_payload();
+  }
 
   log("sending http request");
   http::write(stream, req);
@@ -0,0 +1,833 @@
+#include <gtest/gtest.h>
+
+#include "html_forms.h"
+#include "html_forms/encoding.h"
+#include "html_forms/private/json.h"
+#include <cjson/cJSON.h>
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+// The JSON encoding was printed and parsed with cJSON before. These tests
+// check the writer and scanner against cJSON on random input, so the wire
+// format can't drift.
+
+// Decoders built on cJSON the way html_forms.c used to be
+namespace ref {
+
+static bool copy_string(cJSON *obj, const char *key, char *out,
+                        std::size_t out_size) {
+  const char *val = cJSON_GetStringValue(cJSON_GetObjectItem(obj, key));
+  if (!val || std::strlen(val) >= out_size)
+    return false;
+
+  std::strcpy(out, val);
+  return true;
+}
+
+static bool uintval(cJSON *item, unsigned int *val) {
+  if (!cJSON_IsNumber(item))
+    return false;
+
+  double dval = cJSON_GetNumberValue(item);
+  if (!(dval >= 0 && dval <= INT_MAX))
+    return false;
+
+  *val = (unsigned int)dval;
+  return *val == dval;
+}
+
+static bool sizeval(cJSON *item, std::size_t *val) {
+  if (!cJSON_IsNumber(item))
+    return false;
+
+  double dval = cJSON_GetNumberValue(item);
+  if (!(dval >= 0 && dval < (double)SIZE_MAX))
+    return false;
+
+  *val = (std::size_t)dval;
+  return *val == dval;
+}
+
+static bool size_of(cJSON *obj, std::size_t *val) {
+  return sizeval(cJSON_GetObjectItem(obj, "size"), val);
+}
+
+static bool decode_upload(cJSON *obj, html_omsg_upload *msg) {
+  if (!copy_string(obj, "url", msg->url, sizeof(msg->url)))
+    return false;
+
+  unsigned int size = 0;
+  if (cJSON_HasObjectItem(obj, "size") &&
+      !uintval(cJSON_GetObjectItem(obj, "size"), &size))
+    return false;
+  msg->content_length = size;
+
+  unsigned int chunk_header = 2;
+  if (cJSON_HasObjectItem(obj, "chunkHeader")) {
+    if (!uintval(cJSON_GetObjectItem(obj, "chunkHeader"), &chunk_header))
+      return false;
+
+    if (!(chunk_header == 2 || chunk_header == 4))
+      return false;
+  }
+  msg->chunk_header_size = chunk_header;
+
+  unsigned int rtype;
+  if (!uintval(cJSON_GetObjectItem(obj, "resType"), &rtype))
+    return false;
+
+  if (rtype > HTML_RT_ARCHIVE)
+    return false;
+
+  msg->rtype = (html_resource_type)rtype;
+  return true;
+}
+
+static html_mime_map *decode_mime(cJSON *obj) {
+  cJSON *map = cJSON_GetObjectItemCaseSensitive(obj, "map");
+  if (!cJSON_IsArray(map))
+    return nullptr;
+
+  html_mime_map *mimes = html_mime_map_create();
+  cJSON *item;
+  cJSON_ArrayForEach(item, map) {
+    char ext[HTML_MIME_SIZE], mime[HTML_MIME_SIZE + 1];
+    const char *e = cJSON_GetStringValue(cJSON_GetArrayItem(item, 0));
+    const char *m = cJSON_GetStringValue(cJSON_GetArrayItem(item, 1));
+    if (!(cJSON_IsArray(item) && cJSON_GetArraySize(item) == 2 && e && m &&
+          std::strlen(e) < sizeof(ext) && std::strlen(m) < sizeof(mime))) {
+      html_mime_map_free(mimes);
+      return nullptr;
+    }
+
+    std::strcpy(ext, e);
+    std::strcpy(mime, m);
+    if (!html_mime_map_add(mimes, ext, mime)) {
+      html_mime_map_free(mimes);
+      return nullptr;
+    }
+  }
+
+  return mimes;
+}
+
+static bool decode_out(cJSON *obj, html_out_msg *msg) {
+  cJSON *type = cJSON_GetObjectItem(obj, "type");
+  if (!cJSON_IsNumber(type))
+    return false;
+
+  // every type is a small whole number
+  double t = cJSON_GetNumberValue(type);
+  if (!(t >= 0 && t <= INT_MAX && t == (int)t))
+    return false;
+
+  int type_val = (int)t;
+  auto &m = msg->msg;
+  if (type_val == HTML_OMSG_UPLOAD) {
+    msg->type = HTML_OMSG_UPLOAD;
+    return decode_upload(obj, &m.upload);
+  } else if (type_val == HTML_OMSG_NAVIGATE) {
+    msg->type = HTML_OMSG_NAVIGATE;
+    return copy_string(obj, "url", m.navigate.url, sizeof(m.navigate.url));
+  } else if (type_val == HTML_OMSG_APP_MSG) {
+    msg->type = HTML_OMSG_APP_MSG;
+    return size_of(obj, &m.app_msg.content_length);
+  } else if (type_val == HTML_OMSG_MIME_MAP) {
+    msg->type = HTML_OMSG_MIME_MAP;
+    return (m.mime = decode_mime(obj)) != nullptr;
+  } else if (type_val == HTML_OMSG_CLOSE) {
+    msg->type = HTML_OMSG_CLOSE;
+    return true;
+  } else if (type_val == HTML_OMSG_ACCEPT_IO_TRANSFER) {
+    msg->type = HTML_OMSG_ACCEPT_IO_TRANSFER;
+    return copy_string(obj, "token", m.accept_io_transfer.token,
+                       sizeof(m.accept_io_transfer.token));
+  } else if (type_val == HTML_OMSG_UPLOAD_MANIFEST) {
+    msg->type = HTML_OMSG_UPLOAD_MANIFEST;
+    return size_of(obj, &m.upload_manifest.content_length);
+  } else if (type_val == HTML_OMSG_UPLOAD_BATCH) {
+    msg->type = HTML_OMSG_UPLOAD_BATCH;
+    return size_of(obj, &m.upload_batch.content_length);
+  } else if (type_val == HTML_OMSG_UPLOAD_FD) {
+    msg->type = HTML_OMSG_UPLOAD_FD;
+    return copy_string(obj, "url", m.upload_fd.url, sizeof(m.upload_fd.url));
+  } else if (type_val == HTML_OMSG_LAZY) {
+    msg->type = HTML_OMSG_LAZY;
+    cJSON *cache = cJSON_GetObjectItem(obj, "cache");
+    if (!cJSON_IsBool(cache))
+      return false;
+
+    m.lazy.cache = cJSON_IsTrue(cache);
+    return copy_string(obj, "url", m.lazy.url, sizeof(m.lazy.url));
+  } else if (type_val == HTML_OMSG_FETCH_FAILED) {
+    msg->type = HTML_OMSG_FETCH_FAILED;
+    return copy_string(obj, "url", m.fetch_failed.url,
+                       sizeof(m.fetch_failed.url));
+  } else if (type_val == HTML_OMSG_ACK_UPLOADS) {
+    msg->type = HTML_OMSG_ACK_UPLOADS;
+    return true;
+  }
+
+  return false;
+}
+
+static bool decode_in(cJSON *obj, html_in_msg *msg) {
+  cJSON *type = cJSON_GetObjectItem(obj, "type");
+  if (!cJSON_IsNumber(type))
+    return false;
+
+  // every type is a small whole number
+  double t = cJSON_GetNumberValue(type);
+  if (!(t >= 0 && t <= INT_MAX && t == (int)t))
+    return false;
+
+  int type_val = (int)t;
+  auto &m = msg->msg;
+  if (type_val == HTML_IMSG_FORM) {
+    msg->type = HTML_IMSG_FORM;
+    return copy_string(obj, "mime", m.form.mime_type,
+                       sizeof(m.form.mime_type)) &&
+           size_of(obj, &m.form.content_length);
+  } else if (type_val == HTML_IMSG_APP_MSG) {
+    msg->type = HTML_IMSG_APP_MSG;
+    return size_of(obj, &m.app_msg.content_length);
+  } else if (type_val == HTML_IMSG_CLOSE_REQ) {
+    msg->type = HTML_IMSG_CLOSE_REQ;
+    return true;
+  } else if (type_val == HTML_IMSG_ERROR) {
+    msg->type = HTML_IMSG_ERROR;
+    return copy_string(obj, "msg", m.error.msg, sizeof(m.error.msg));
+  } else if (type_val == HTML_IMSG_UPLOAD_NEEDED) {
+    msg->type = HTML_IMSG_UPLOAD_NEEDED;
+    return size_of(obj, &m.upload_needed.content_length);
+  } else if (type_val == HTML_IMSG_FETCH) {
+    msg->type = HTML_IMSG_FETCH;
+    return copy_string(obj, "url", m.fetch.url, sizeof(m.fetch.url));
+  } else if (type_val == HTML_IMSG_UPLOAD_ACK) {
+    msg->type = HTML_IMSG_UPLOAD_ACK;
+    return true;
+  }
+
+  return false;
+}
+
+template <typename Msg, typename Decode>
+static bool decode(const std::string &data, Msg *msg, Decode decode_obj) {
+  cJSON *obj = cJSON_ParseWithLength(data.data(), data.size());
+  bool ok = obj && decode_obj(obj, msg);
+  cJSON_Delete(obj);
+  return ok;
+}
+
+} // namespace ref
+
+static void expect_same_mimes(const html_mime_map *a, const html_mime_map *b) {
+  ASSERT_EQ(html_mime_map_size(a), html_mime_map_size(b));
+  for (std::size_t i = 0; i < html_mime_map_size(a); ++i) {
+    const char *ext_a, *mime_a, *ext_b, *mime_b;
+    ASSERT_TRUE(html_mime_map_entry_at(a, i, &ext_a, &mime_a));
+    ASSERT_TRUE(html_mime_map_entry_at(b, i, &ext_b, &mime_b));
+    EXPECT_STREQ(ext_a, ext_b);
+    EXPECT_STREQ(mime_a, mime_b);
+  }
+}
+
+static void expect_same(const html_out_msg &a, const html_out_msg &b) {
+  ASSERT_EQ(a.type, b.type);
+  auto &x = a.msg;
+  auto &y = b.msg;
+  switch (a.type) {
+  case HTML_OMSG_UPLOAD:
+    EXPECT_STREQ(x.upload.url, y.upload.url);
+    EXPECT_EQ(x.upload.content_length, y.upload.content_length);
+    EXPECT_EQ(x.upload.chunk_header_size, y.upload.chunk_header_size);
+    EXPECT_EQ(x.upload.rtype, y.upload.rtype);
+    break;
+  case HTML_OMSG_NAVIGATE:
+    EXPECT_STREQ(x.navigate.url, y.navigate.url);
+    break;
+  case HTML_OMSG_APP_MSG:
+    EXPECT_EQ(x.app_msg.content_length, y.app_msg.content_length);
+    break;
+  case HTML_OMSG_MIME_MAP:
+    expect_same_mimes(x.mime, y.mime);
+    break;
+  case HTML_OMSG_ACCEPT_IO_TRANSFER:
+    EXPECT_STREQ(x.accept_io_transfer.token, y.accept_io_transfer.token);
+    break;
+  case HTML_OMSG_UPLOAD_MANIFEST:
+    EXPECT_EQ(x.upload_manifest.content_length,
+              y.upload_manifest.content_length);
+    break;
+  case HTML_OMSG_UPLOAD_BATCH:
+    EXPECT_EQ(x.upload_batch.content_length, y.upload_batch.content_length);
+    break;
+  case HTML_OMSG_UPLOAD_FD:
+    EXPECT_STREQ(x.upload_fd.url, y.upload_fd.url);
+    break;
+  case HTML_OMSG_LAZY:
+    EXPECT_STREQ(x.lazy.url, y.lazy.url);
+    EXPECT_EQ(x.lazy.cache, y.lazy.cache);
+    break;
+  case HTML_OMSG_FETCH_FAILED:
+    EXPECT_STREQ(x.fetch_failed.url, y.fetch_failed.url);
+    break;
+  default:
+    break;
+  }
+}
+
+static void expect_same(const html_in_msg &a, const html_in_msg &b) {
+  ASSERT_EQ(a.type, b.type);
+  auto &x = a.msg;
+  auto &y = b.msg;
+  switch (a.type) {
+  case HTML_IMSG_FORM:
+    EXPECT_STREQ(x.form.mime_type, y.form.mime_type);
+    EXPECT_EQ(x.form.content_length, y.form.content_length);
+    break;
+  case HTML_IMSG_APP_MSG:
+    EXPECT_EQ(x.app_msg.content_length, y.app_msg.content_length);
+    break;
+  case HTML_IMSG_ERROR:
+    EXPECT_STREQ(x.error.msg, y.error.msg);
+    break;
+  case HTML_IMSG_UPLOAD_NEEDED:
+    EXPECT_EQ(x.upload_needed.content_length,
+              y.upload_needed.content_length);
+    break;
+  case HTML_IMSG_FETCH:
+    EXPECT_STREQ(x.fetch.url, y.fetch.url);
+    break;
+  default:
+    break;
+  }
+}
+
+// Random JSON text that leans toward what the decoders look for
+class JsonGen {
+public:
+  explicit JsonGen(unsigned seed) : rng_(seed) {}
+
+  bool chance(int percent) { return pick(100) < percent; }
+
+  std::size_t pick(std::size_t n) {
+    return std::uniform_int_distribution<std::size_t>(0, n - 1)(rng_);
+  }
+
+  std::string ws() {
+    static const char chars[] = {' ', '\t', '\n', '\r', '\x01', '\x1f'};
+    std::string out;
+    while (chance(15))
+      out += chars[pick(sizeof(chars))];
+    return out;
+  }
+
+  // A string literal whose characters are escaped at random
+  std::string string(std::size_t max_len) {
+    std::string out = "\"";
+    std::size_t len = pick(max_len + 1);
+    for (std::size_t i = 0; i < len; ++i)
+      codepoint(out, random_codepoint());
+    return out + "\"";
+  }
+
+  std::string string_of(const std::string &str) {
+    std::string out = "\"";
+    for (unsigned char c : str)
+      codepoint(out, c < 0x80 ? c : '?');
+    return out + "\"";
+  }
+
+  std::string number() {
+    static const char *const numbers[] = {
+        "0",
+        "-0",
+        "1.0",
+        "1e0",
+        "10E-1",
+        "0.5",
+        "-1",
+        "01",
+        "1.",
+        "1e",
+        "-",
+        "2147483647",
+        "2147483648",
+        "4294967296",
+        "9007199254740993",
+        "18446744073709549568",
+        "18446744073709551616",
+        "1e400",
+        "-1e400",
+    };
+
+    if (chance(50))
+      return std::to_string(pick(16));
+
+    return numbers[pick(std::size(numbers))];
+  }
+
+  // Any value, nested at most depth deep
+  std::string value(int depth) {
+    switch (pick(depth > 0 ? 8 : 6)) {
+    case 0:
+      return "null";
+    case 1:
+      return chance(50) ? "true" : "false";
+    case 2:
+    case 3:
+      return number();
+    case 4:
+    case 5:
+      return string(8);
+    case 6: {
+      std::string out = "[" + ws();
+      for (std::size_t i = 0, n = pick(4); i < n; ++i)
+        out += (i ? "," : "") + ws() + value(depth - 1) + ws();
+      return out + "]";
+    }
+    default: {
+      std::string out = "{" + ws();
+      for (std::size_t i = 0, n = pick(4); i < n; ++i) {
+        out += (i ? "," : "") + ws() + key() + ws() + ":" + ws() +
+               value(depth - 1) + ws();
+      }
+      return out + "}";
+    }
+    }
+  }
+
+  std::string key() {
+    static const char *const keys[] = {
+        "type",    "url",  "size",  "chunkHeader", "resType", "cache",
+        "token",   "mime", "msg",   "map",         "TYPE",    "Url",
+        "SIZE",    "Map",  "extra", "",            "types",   "ur",
+    };
+
+    if (chance(10))
+      return string(4);
+
+    std::string k = keys[pick(std::size(keys))];
+    if (chance(10) && !k.empty())
+      k[pick(k.size())] ^= 0x20;
+
+    return string_of(k);
+  }
+
+  // [[ext, mime], ...] with the occasional malformed entry
+  std::string mime_map() {
+    static const char *const exts[] = {"txt", ".md", "", "a.b", "html"};
+    std::string out = "[" + ws();
+    for (std::size_t i = 0, n = pick(4); i < n; ++i) {
+      out += i ? "," : "";
+      if (chance(5)) {
+        out += value(1);
+        continue;
+      }
+
+      out += "[" + ws() + string_of(exts[pick(std::size(exts))]) + ws() +
+             "," + ws() + (chance(90) ? string(20) : number()) + ws();
+      if (chance(5))
+        out += "," + string(2);
+
+      out += "]" + ws();
+    }
+    return out + "]";
+  }
+
+  // An object with the members of a message of some type, shuffled and
+  // padded out with others
+  std::string message(int min_type, int max_type) {
+    std::vector<std::string> members;
+    auto add = [&](const std::string &k, const std::string &v) {
+      members.push_back(ws() + string_of(k) + ws() + ":" + ws() + v + ws());
+    };
+
+    int type = min_type + (int)pick(max_type - min_type + 2);
+    add("type", chance(90) ? std::to_string(type) : value(1));
+
+    auto maybe = [&](const char *k, const std::string &v) {
+      if (chance(85))
+        add(k, v);
+    };
+
+    maybe("url", url());
+    maybe("size", chance(80) ? std::to_string(pick(100000)) : number());
+    if (chance(30))
+      add("chunkHeader", chance(80) ? std::to_string(2 + 2 * pick(2))
+                                    : number());
+    maybe("resType", chance(80) ? std::to_string(pick(3)) : number());
+    maybe("cache", chance(80) ? (chance(50) ? "true" : "false") : value(0));
+    maybe("token", chance(80) ? string_of(uuid()) : string(40));
+    maybe("mime", chance(80) ? string(40) : value(0));
+    maybe("msg", chance(80) ? string(80) : value(0));
+    maybe("map", chance(90) ? mime_map() : value(1));
+
+    for (std::size_t i = 0, n = pick(3); i < n; ++i)
+      members.push_back(ws() + key() + ws() + ":" + ws() + value(3) + ws());
+
+    std::shuffle(members.begin(), members.end(), rng_);
+
+    std::string out = ws() + "{";
+    for (std::size_t i = 0; i < members.size(); ++i)
+      out += (i ? "," : "") + members[i];
+    return out + "}" + (chance(10) ? ws() + value(1) : "");
+  }
+
+  // Truncate, overwrite, insert or remove bytes
+  void mutate(std::string &doc) {
+    static const char bytes[] = "{}[]\",:\\ 0123456789.eE+-tfnu\x00\x01\xff";
+    int n = (int)pick(3);
+    for (int i = 0; i < n && !doc.empty(); ++i) {
+      std::size_t at = pick(doc.size());
+      char b = bytes[pick(sizeof(bytes) - 1)];
+      switch (pick(4)) {
+      case 0:
+        doc.resize(at);
+        break;
+      case 1:
+        doc[at] = b;
+        break;
+      case 2:
+        doc.insert(doc.begin() + at, b);
+        break;
+      default:
+        doc.erase(at, 1);
+        break;
+      }
+    }
+  }
+
+private:
+  std::mt19937 rng_;
+
+  std::string url() {
+    // straddle the size of the url fields
+    if (chance(5)) {
+      std::size_t n = HTML_URL_SIZE - 2 + pick(4);
+      return string_of("/" + std::string(n - 1, 'a'));
+    }
+
+    return string(24);
+  }
+
+  std::string uuid() {
+    std::string out;
+    std::size_t len = HTML_UUID_SIZE - 2 + pick(3);
+    for (std::size_t i = 0; i < len; ++i)
+      out += "0123456789abcdef-"[pick(17)];
+    return out;
+  }
+
+  unsigned long random_codepoint() {
+    switch (pick(10)) {
+    case 0:
+      return pick(0x20);
+    case 1:
+      return 0x80 + pick(0x780);
+    case 2:
+      return 0x800 + pick(0xf800);
+    case 3:
+      return 0x10000 + pick(0x100000);
+    case 4:
+      return "\"\\/"[pick(3)];
+    default:
+      return 0x20 + pick(0x5f);
+    }
+  }
+
+  // Append a code point raw or escaped, with some invalid escapes mixed in
+  void codepoint(std::string &out, unsigned long cp) {
+    static const char hex[] = "0123456789abcdefABCDEF";
+    auto hex4 = [&](unsigned long v) {
+      char buf[8];
+      std::snprintf(buf, sizeof(buf), chance(50) ? "%04lx" : "%04lX", v);
+      out += "\\u";
+      out += buf;
+    };
+
+    if (chance(2)) {
+      static const char *const bad[] = {"\\x", "\\u12", "\\ud800",
+                                        "\\udc00", "\\ud800\\u0041", "\\"};
+      out += bad[pick(std::size(bad))];
+      return;
+    }
+
+    if (chance(1)) {
+      out += "\\u";
+      for (int i = 0; i < 4; ++i)
+        out += hex[pick(sizeof(hex) - 1)];
+      return;
+    }
+
+    bool escape = chance(30) || cp == '"' || cp == '\\';
+    if (cp >= 0x10000) {
+      if (escape) {
+        cp -= 0x10000;
+        hex4(0xd800 | (cp >> 10));
+        hex4(0xdc00 | (cp & 0x3ff));
+      } else {
+        out += (char)(0xf0 | (cp >> 18));
+        out += (char)(0x80 | ((cp >> 12) & 0x3f));
+        out += (char)(0x80 | ((cp >> 6) & 0x3f));
+        out += (char)(0x80 | (cp & 0x3f));
+      }
+    } else if (escape) {
+      if (cp >= 0xd800 && cp <= 0xdfff)
+        cp = 0xfffd;
+
+      static const char shorts[] = "\"\\/\b\f\n\r\t";
+      static const char names[] = "\"\\/bfnrt";
+      const char *s = cp ? std::strchr(shorts, (int)cp) : nullptr;
+      if (s && chance(70)) {
+        out += '\\';
+        out += names[s - shorts];
+      } else {
+        hex4(cp);
+      }
+    } else if (cp < 0x80) {
+      out += (char)(cp ? cp : ' ');
+    } else if (cp < 0x800) {
+      out += (char)(0xc0 | (cp >> 6));
+      out += (char)(0x80 | (cp & 0x3f));
+    } else {
+      out += (char)(0xe0 | (cp >> 12));
+      out += (char)(0x80 | ((cp >> 6) & 0x3f));
+      out += (char)(0x80 | (cp & 0x3f));
+    }
+  }
+};
+
+static void expect_out_matches_cjson(const std::string &doc) {
+  html_out_msg ours, theirs;
+  std::memset(&ours, 0, sizeof(ours));
+  std::memset(&theirs, 0, sizeof(theirs));
+
+  bool ok = html_decode_out_msg(doc.data(), doc.size(), &ours);
+  bool ref_ok = ref::decode(doc, &theirs, ref::decode_out);
+  EXPECT_EQ(ok, ref_ok) << doc;
+  if (ok && ref_ok)
+    expect_same(ours, theirs);
+
+  if (ok && ours.type == HTML_OMSG_MIME_MAP)
+    html_mime_map_free(ours.msg.mime);
+  if (ref_ok && theirs.type == HTML_OMSG_MIME_MAP)
+    html_mime_map_free(theirs.msg.mime);
+}
+
+static void expect_in_matches_cjson(const std::string &doc) {
+  html_in_msg ours, theirs;
+  std::memset(&ours, 0, sizeof(ours));
+  std::memset(&theirs, 0, sizeof(theirs));
+
+  bool ok = html_decode_in_msg(doc.data(), doc.size(), &ours);
+  bool ref_ok = ref::decode(doc, &theirs, ref::decode_in);
+  EXPECT_EQ(ok, ref_ok) << doc;
+  if (ok && ref_ok)
+    expect_same(ours, theirs);
+}
+
+TEST(JsonDecode, OutputMessagesMatchCjson) {
+  JsonGen gen(1);
+  for (int i = 0; i < 20000; ++i) {
+    auto doc = gen.message(HTML_OMSG_UPLOAD, HTML_OMSG_ACK_UPLOADS);
+    if (gen.chance(30))
+      gen.mutate(doc);
+
+    expect_out_matches_cjson(doc);
+    if (HasFailure())
+      return;
+  }
+}
+
+TEST(JsonDecode, InputMessagesMatchCjson) {
+  JsonGen gen(2);
+  for (int i = 0; i < 20000; ++i) {
+    auto doc = gen.message(HTML_IMSG_FORM, HTML_IMSG_UPLOAD_ACK);
+    if (gen.chance(30))
+      gen.mutate(doc);
+
+    expect_in_matches_cjson(doc);
+    if (HasFailure())
+      return;
+  }
+}
+
+TEST(JsonDecode, ArbitraryValuesMatchCjson) {
+  JsonGen gen(3);
+  for (int i = 0; i < 20000; ++i) {
+    auto doc = gen.value(4);
+    if (gen.chance(50))
+      gen.mutate(doc);
+
+    expect_out_matches_cjson(doc);
+    if (HasFailure())
+      return;
+  }
+}
+
+TEST(JsonDecode, NestingLimitMatchesCjson) {
+  for (int depth : {997, 998, 999, 1000, 1001}) {
+    std::string doc = "{\"type\":" + std::to_string(HTML_OMSG_CLOSE) +
+                      ",\"x\":" + std::string(depth, '[') +
+                      std::string(depth, ']') + "}";
+    expect_out_matches_cjson(doc);
+  }
+}
+
+TEST(JsonDecode, QuirksMatchCjson) {
+  const char *docs[] = {
+      "\xef\xbb\xbf{\"type\":4}",
+      "\xef\xbb\xbf{}",
+      "{\"type\":4}trailing",
+      "{\"type\":4,\"x\":{}",
+      "{\"type\":4,\"x\":[]",
+      "{\"type\":4",
+      "{\"TYPE\":4,\"type\":\"x\"}",
+      "{\"type\":\"4\"}",
+      "{\"type\":4.0}",
+      "{\"ty\\u0000x\":4}",
+      "{\"type\":1,\"url\":\"/a\\u0000b\"}",
+      "{\"type\":1,\"url\":\"\\ud83d\\ude00\"}",
+      "{\"type\":1,\"url\":\"\\uzzzz\"}",
+      "\x01{\x01\"type\"\x01:\x01" "4\x01}",
+  };
+
+  for (auto doc : docs)
+    expect_out_matches_cjson(doc);
+}
+
+// Walk a cJSON tree with the writer
+static void write_tree(html_json_writer *w, const cJSON *item) {
+  if (item->string)
+    html_json_key(w, item->string);
+
+  if (cJSON_IsObject(item) || cJSON_IsArray(item)) {
+    bool obj = cJSON_IsObject(item);
+    obj ? html_json_begin_object(w) : html_json_begin_array(w);
+
+    const cJSON *child;
+    cJSON_ArrayForEach(child, item) { write_tree(w, child); }
+
+    obj ? html_json_end_object(w) : html_json_end_array(w);
+  } else if (cJSON_IsString(item)) {
+    html_json_string(w, cJSON_GetStringValue(item));
+  } else if (cJSON_IsBool(item)) {
+    html_json_bool(w, cJSON_IsTrue(item));
+  } else {
+    html_json_uint(w, (std::uint64_t)cJSON_GetNumberValue(item));
+  }
+}
+
+// Random trees of the kinds of values messages hold. Numbers stay below
+// 1e15, past which cJSON switches to exponents.
+static cJSON *random_tree(JsonGen &gen, int depth, bool object) {
+  cJSON *item = object ? cJSON_CreateObject() : cJSON_CreateArray();
+  for (std::size_t i = 0, n = gen.pick(5); i < n; ++i) {
+    std::string str;
+    for (std::size_t j = 0, len = gen.pick(12); j < len; ++j)
+      str += (char)(1 + gen.pick(255));
+
+    cJSON *child;
+    switch (gen.pick(depth > 0 ? 5 : 3)) {
+    case 0:
+      child = cJSON_CreateString(str.c_str());
+      break;
+    case 1:
+      child = cJSON_CreateNumber((double)gen.pick(1000000000000000));
+      break;
+    case 2:
+      child = cJSON_CreateBool(gen.chance(50));
+      break;
+    default:
+      child = random_tree(gen, depth - 1, gen.chance(50));
+      break;
+    }
+
+    if (object)
+      cJSON_AddItemToObject(item, str.c_str(), child);
+    else
+      cJSON_AddItemToArray(item, child);
+  }
+
+  return item;
+}
+
+TEST(JsonWrite, MatchesCjsonPrintUnformatted) {
+  JsonGen gen(4);
+  for (int i = 0; i < 5000; ++i) {
+    cJSON *tree = random_tree(gen, 3, true);
+    char *expected = cJSON_PrintUnformatted(tree);
+    std::string want = expected;
+    cJSON_free(expected);
+
+    std::vector<char> buf(want.size() + 1);
+    html_json_writer w;
+    html_json_init(&w, buf.data(), buf.size());
+    write_tree(&w, tree);
+    int n = html_json_finish(&w);
+
+    ASSERT_EQ(n, (int)want.size());
+    ASSERT_EQ(std::string(buf.data(), n), want);
+
+    // one byte short of the null terminator doesn't fit
+    html_json_init(&w, buf.data(), buf.size() - 1);
+    write_tree(&w, tree);
+    EXPECT_EQ(html_json_finish(&w), -1);
+
+    cJSON_Delete(tree);
+  }
+}
+
+TEST(JsonWrite, NullStringFails) {
+  char buf[32];
+  html_json_writer w;
+  html_json_init(&w, buf, sizeof(buf));
+  html_json_begin_object(&w);
+  html_json_add_string(&w, "url", nullptr);
+  html_json_end_object(&w);
+  EXPECT_EQ(html_json_finish(&w), -1);
+}
+
+// Every encoded message reads back the same through cJSON
+TEST(JsonWrite, EncodedMessagesParseWithCjson) {
+  JsonGen gen(5);
+  for (int i = 0; i < 2000; ++i) {
+    std::string url;
+    for (std::size_t j = 0, len = gen.pick(HTML_URL_SIZE); j < len; ++j)
+      url += (char)(1 + gen.pick(255));
+
+    html_out_msg msg{.type = HTML_OMSG_LAZY};
+    std::strcpy(msg.msg.lazy.url, url.c_str());
+    msg.msg.lazy.cache = gen.chance(50);
+
+    char buf[HTML_MSG_SIZE];
+    int n = html_encode_out_msg(buf, sizeof(buf), &msg, HTML_ENC_JSON);
+    if (n < 0)
+      continue; // escapes can push long urls past the message size
+
+    html_out_msg out;
+    ASSERT_TRUE(ref::decode(std::string(buf, n), &out, ref::decode_out));
+    expect_same(msg, out);
+
+    html_in_msg imsg{.type = HTML_IMSG_FORM};
+    imsg.msg.form.content_length = gen.pick(1000000000000000);
+    auto mime = url.substr(0, HTML_MIME_SIZE - 1);
+    std::strcpy(imsg.msg.form.mime_type, mime.c_str());
+    n = html_encode_in_msg(buf, sizeof(buf), &imsg, HTML_ENC_JSON);
+    ASSERT_GT(n, 0);
+
+    html_in_msg iout;
+    ASSERT_TRUE(ref::decode(std::string(buf, n), &iout, ref::decode_in));
+    expect_same(imsg, iout);
+  }
+}
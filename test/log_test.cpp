@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+
+#include "html_forms_server/private/log.hpp"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+struct captured_record {
+  log_level level;
+  std::string session_id;
+  std::string msg;
+};
+
+class Log : public testing::Test {
+protected:
+  std::mutex mtx_;
+  std::vector<captured_record> records_;
+
+  void SetUp() override {
+    auto &log = logger::instance();
+    log.set_level(log_level::debug);
+    log.set_sink([this](log_level level, std::string_view session_id,
+                        std::string_view msg) {
+      std::lock_guard lock{mtx_};
+      records_.push_back({level, std::string{session_id}, std::string{msg}});
+    });
+  }
+
+  void TearDown() override {
+    auto &log = logger::instance();
+    log.flush();
+    log.set_sink({});
+    log.set_level(log_level::info);
+    log.set_log_bodies(false);
+  }
+
+  std::vector<captured_record> records() {
+    logger::instance().flush();
+    std::lock_guard lock{mtx_};
+    return records_;
+  }
+};
+
+TEST_F(Log, RecordsReachSink) {
+  HTML_LOG(info, "sid", "hello " << 42);
+
+  auto recs = records();
+  ASSERT_EQ(recs.size(), 1);
+  EXPECT_EQ(recs[0].level, log_level::info);
+  EXPECT_EQ(recs[0].session_id, "sid");
+  EXPECT_EQ(recs[0].msg, "hello 42");
+}
+
+TEST_F(Log, DisabledLevelIsNotEvaluated) {
+  logger::instance().set_level(log_level::warn);
+
+  int evaluated = 0;
+  auto count = [&] { return ++evaluated; };
+  HTML_LOG(info, "", "skipped " << count());
+  HTML_LOG(error, "", "kept " << count());
+
+  auto recs = records();
+  ASSERT_EQ(recs.size(), 1);
+  EXPECT_EQ(recs[0].msg, "kept 1");
+  EXPECT_EQ(evaluated, 1);
+}
+
+TEST_F(Log, LongMessagesAreTruncated) {
+  std::string big(2 * log_msg_size, 'x');
+  HTML_LOG(info, "", big);
+
+  auto recs = records();
+  ASSERT_EQ(recs.size(), 1);
+  EXPECT_EQ(recs[0].msg, std::string(log_msg_size, 'x'));
+}
+
+TEST_F(Log, BodiesAreOptIn) {
+  EXPECT_FALSE(logger::instance().log_bodies());
+  logger::instance().set_log_bodies(true);
+  EXPECT_TRUE(logger::instance().log_bodies());
+}
+
+TEST_F(Log, ConcurrentWritersKeepPerThreadOrder) {
+  constexpr int nthreads = 4, n = 200;
+  std::vector<std::thread> threads;
+  auto dropped_before = logger::instance().dropped();
+
+  for (int t = 0; t < nthreads; ++t) {
+    threads.emplace_back([t] {
+      for (int i = 0; i < n; ++i) {
+        HTML_LOG(debug, std::to_string(t), i);
+        // don't outrun the drainer, which would drop records
+        if (i % 64 == 0)
+          logger::instance().flush();
+      }
+    });
+  }
+
+  for (auto &th : threads)
+    th.join();
+
+  auto dropped = logger::instance().dropped() - dropped_before;
+  auto recs = records();
+  EXPECT_EQ(recs.size() + dropped, nthreads * n);
+
+  std::vector<int> last(nthreads, -1);
+  for (const auto &rec : recs) {
+    int t = std::stoi(rec.session_id);
+    int i = std::stoi(rec.msg);
+    EXPECT_GT(i, last[t]);
+    last[t] = i;
+  }
+}
@@ -0,0 +1,120 @@
+#include <gtest/gtest.h>
+
+#include "html_forms_server/private/metrics.hpp"
+
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+TEST(Metrics, SmallValuesHaveExactBuckets) {
+  for (std::uint64_t v = 0; v < histogram::sub_count; ++v) {
+    auto i = histogram::bucket_index(v);
+    EXPECT_EQ(histogram::bucket_lower(i), v);
+    EXPECT_EQ(histogram::bucket_upper(i), v);
+  }
+}
+
+TEST(Metrics, BucketsAreContiguous) {
+  EXPECT_EQ(histogram::bucket_lower(0), 0);
+  for (std::size_t i = 1; i < histogram::bucket_count; ++i) {
+    EXPECT_EQ(histogram::bucket_lower(i), histogram::bucket_upper(i - 1) + 1)
+        << "bucket " << i;
+  }
+
+  EXPECT_EQ(histogram::bucket_upper(histogram::bucket_count - 1), UINT64_MAX);
+}
+
+TEST(Metrics, ValuesFallInTheirBucket) {
+  std::mt19937_64 rng{1234};
+  for (int n = 0; n < 100000; ++n) {
+    // spread over all magnitudes
+    std::uint64_t v = rng() >> (rng() % 64);
+    auto i = histogram::bucket_index(v);
+    ASSERT_LT(i, histogram::bucket_count);
+    ASSERT_LE(histogram::bucket_lower(i), v);
+    ASSERT_GE(histogram::bucket_upper(i), v);
+
+    // relative error is bounded by the number of sub-buckets
+    auto width = histogram::bucket_upper(i) - histogram::bucket_lower(i);
+    ASSERT_LE(width, v / histogram::sub_count);
+  }
+}
+
+TEST(Metrics, QuantilesAreWithinBucketError) {
+  histogram h;
+  for (std::uint64_t v = 1; v <= 1000; ++v)
+    h.record(v);
+
+  auto snap = h.snapshot();
+  EXPECT_EQ(snap.count, 1000);
+  EXPECT_EQ(snap.sum, 500500);
+  EXPECT_EQ(snap.max, 1000);
+
+  auto p50 = snap.quantile(0.5);
+  EXPECT_GE(p50, 500);
+  EXPECT_LE(p50, 500 + 500 / histogram::sub_count);
+
+  auto p99 = snap.quantile(0.99);
+  EXPECT_GE(p99, 990);
+  EXPECT_LE(p99, 1000);
+
+  EXPECT_EQ(snap.quantile(1.0), 1000);
+}
+
+TEST(Metrics, EmptyHistogramHasZeroQuantiles) {
+  histogram h;
+  EXPECT_EQ(h.snapshot().quantile(0.5), 0);
+}
+
+TEST(Metrics, ConcurrentRecordingLosesNothing) {
+  histogram h;
+  counter c;
+  std::vector<std::thread> threads;
+
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&, t] {
+      for (std::uint64_t v = 0; v < 10000; ++v) {
+        h.record(v * (t + 1));
+        c.add();
+      }
+    });
+  }
+
+  for (auto &th : threads)
+    th.join();
+
+  auto snap = h.snapshot();
+  EXPECT_EQ(snap.count, 80000);
+  EXPECT_EQ(c.value(), 80000);
+  EXPECT_EQ(snap.max, 9999 * 8);
+}
+
+TEST(Metrics, PrometheusTextListsCountersAndHistograms) {
+  server_metrics m;
+  m.http_requests.add(3);
+  m.sessions_active.add(2);
+  m.http_request_us.record(1500);
+  m.http_request_us.record(1500);
+
+  content_cache_stats cache{7, 1, 100, 2};
+  auto text = prometheus_text(m, cache);
+
+  EXPECT_NE(text.find("# TYPE html_forms_http_requests_total counter\n"
+                      "html_forms_http_requests_total 3\n"),
+            std::string::npos);
+  EXPECT_NE(text.find("html_forms_sessions_active 2\n"), std::string::npos);
+  EXPECT_NE(text.find("html_forms_cache_hits_total 7\n"), std::string::npos);
+
+  auto i = histogram::bucket_index(1500);
+  std::ostringstream bucket;
+  bucket.precision(12);
+  bucket << "html_forms_http_request_duration_seconds_bucket{le=\""
+         << histogram::bucket_upper(i) * 1e-6 << "\"} 2\n";
+  EXPECT_NE(text.find(bucket.str()), std::string::npos);
+  EXPECT_NE(text.find("html_forms_http_request_duration_seconds_bucket"
+                      "{le=\"+Inf\"} 2\n"),
+            std::string::npos);
+  EXPECT_NE(text.find("html_forms_http_request_duration_seconds_count 2\n"),
+            std::string::npos);
+}
@@ -0,0 +1,94 @@
+#include <gtest/gtest.h>
+
+#include "html_forms_server/private/mime_type.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// count allocations to show that lookups don't allocate
+static std::atomic<std::size_t> allocations = 0;
+
+void *operator new(std::size_t n) {
+  ++allocations;
+  if (void *p = std::malloc(n ? n : 1))
+    return p;
+
+  throw std::bad_alloc{};
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+TEST(MimeType, BuiltInTypes) {
+  EXPECT_EQ(mime_type("html"), "text/html");
+  EXPECT_EQ(mime_type("htm"), "text/html");
+  EXPECT_EQ(mime_type("js"), "text/javascript");
+  EXPECT_EQ(mime_type("json"), "application/json");
+  EXPECT_EQ(mime_type("jpg"), "image/jpeg");
+  EXPECT_EQ(mime_type("woff2"), "font/woff2");
+  EXPECT_EQ(mime_type("avi"), "video/x-msvideo");
+}
+
+TEST(MimeType, UnknownIsTextPlain) {
+  EXPECT_EQ(mime_type(""), "text/plain");
+  EXPECT_EQ(mime_type("foo"), "text/plain");
+  EXPECT_EQ(mime_type("htmlx"), "text/plain");
+  EXPECT_EQ(mime_type("HTML"), "text/plain");
+}
+
+TEST(MimeType, UrlExtensionIsCaseInsensitive) {
+  mime_overlay none;
+  EXPECT_EQ(mime_type_for_url("/index.HTML", none), "text/html");
+  EXPECT_EQ(mime_type_for_url("/a.b/photo.JpG", none), "image/jpeg");
+  EXPECT_EQ(mime_type_for_url("/no-extension", none), "");
+  EXPECT_EQ(mime_type_for_url("/trailing.", none), "text/plain");
+  EXPECT_EQ(mime_type_for_url("/file.averyveryverylongextension", none),
+            "text/plain");
+}
+
+TEST(MimeType, OverridesTakePrecedence) {
+  mime_overlay overrides;
+  overrides.set("html5", "text/html");
+  overrides.set("txt", "text/markdown");
+
+  EXPECT_EQ(mime_type_for_url("/index.html5", overrides), "text/html");
+  EXPECT_EQ(mime_type_for_url("/README.TXT", overrides), "text/markdown");
+  EXPECT_EQ(mime_type_for_url("/style.css", overrides), "text/css");
+
+  overrides.set("txt", "text/plain");
+  EXPECT_EQ(mime_type_for_url("/README.txt", overrides), "text/plain");
+  EXPECT_EQ(overrides.size(), 2);
+}
+
+TEST(MimeType, OverlayGrows) {
+  mime_overlay overrides;
+  for (int i = 0; i < 100; ++i)
+    overrides.set("ext" + std::to_string(i), "type/" + std::to_string(i));
+
+  EXPECT_EQ(overrides.size(), 100);
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(overrides.find("ext" + std::to_string(i)),
+              "type/" + std::to_string(i));
+  }
+
+  EXPECT_EQ(overrides.find("ext100"), "");
+}
+
+TEST(MimeType, LookupsDoNotAllocate) {
+  mime_overlay overrides;
+  overrides.set("html5", "text/html");
+
+  const char *urls[] = {"/index.html", "/a/b/c.CSS", "/x.html5",
+                        "/unknown.xyz", "/none"};
+
+  std::size_t before = allocations;
+  std::size_t found = 0;
+  for (int i = 0; i < 100000; ++i) {
+    for (const char *url : urls)
+      found += mime_type_for_url(url, overrides).size();
+  }
+
+  EXPECT_EQ(allocations, before);
+  EXPECT_GT(found, 0);
+}
@@ -0,0 +1,288 @@
+#include <gtest/gtest.h>
+
+#include "html_forms.h"
+#include "html_forms/encoding.h"
+#include <cjson/cJSON.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+// Counts what cJSON allocates, since that's where message encoding and
+// decoding allocate
+static std::size_t n_allocs = 0;
+
+static void *counting_malloc(std::size_t size) {
+  ++n_allocs;
+  return std::malloc(size);
+}
+
+class MsgEncoding : public testing::TestWithParam<html_msg_encoding> {
+protected:
+  char buf_[HTML_MSG_SIZE];
+  int size_ = -1;
+
+  html_out_msg round_trip(const html_out_msg &msg) {
+    size_ = html_encode_out_msg(buf_, sizeof(buf_), &msg, GetParam());
+    EXPECT_GT(size_, 0);
+    EXPECT_EQ(html_msg_encoding_of(buf_, size_), GetParam());
+
+    html_out_msg out;
+    std::memset(&out, 0xff, sizeof(out));
+    EXPECT_TRUE(html_decode_out_msg(buf_, size_, &out));
+    EXPECT_EQ(out.type, msg.type);
+    return out;
+  }
+
+  html_in_msg round_trip(const html_in_msg &msg) {
+    size_ = html_encode_in_msg(buf_, sizeof(buf_), &msg, GetParam());
+    EXPECT_GT(size_, 0);
+    EXPECT_EQ(html_msg_encoding_of(buf_, size_), GetParam());
+
+    html_in_msg out;
+    std::memset(&out, 0xff, sizeof(out));
+    EXPECT_TRUE(html_decode_in_msg(buf_, size_, &out));
+    EXPECT_EQ(out.type, msg.type);
+    return out;
+  }
+};
+
+INSTANTIATE_TEST_SUITE_P(Encodings, MsgEncoding,
+                         testing::Values(HTML_ENC_JSON, HTML_ENC_BINARY));
+
+TEST_P(MsgEncoding, Upload) {
+  html_out_msg msg{.type = HTML_OMSG_UPLOAD};
+  msg.msg.upload.content_length = 1234;
+  msg.msg.upload.rtype = HTML_RT_ARCHIVE;
+  msg.msg.upload.chunk_header_size = HTML_STREAM_CHUNK_HEADER_SIZE;
+  std::strcpy(msg.msg.upload.url, "/style/main.css");
+
+  auto out = round_trip(msg);
+  EXPECT_EQ(out.msg.upload.content_length, 1234);
+  EXPECT_EQ(out.msg.upload.rtype, HTML_RT_ARCHIVE);
+  EXPECT_STREQ(out.msg.upload.url, "/style/main.css");
+}
+
+TEST_P(MsgEncoding, UploadStream) {
+  html_out_msg msg{.type = HTML_OMSG_UPLOAD};
+  msg.msg.upload.content_length = 0;
+  msg.msg.upload.rtype = HTML_RT_FILE;
+  msg.msg.upload.chunk_header_size = HTML_STREAM_CHUNK_HEADER_SIZE;
+  std::strcpy(msg.msg.upload.url, "/stream.txt");
+
+  auto out = round_trip(msg);
+  EXPECT_EQ(out.msg.upload.content_length, 0);
+  EXPECT_EQ(out.msg.upload.chunk_header_size, HTML_STREAM_CHUNK_HEADER_SIZE);
+}
+
+TEST_P(MsgEncoding, Navigate) {
+  html_out_msg msg{.type = HTML_OMSG_NAVIGATE};
+  std::strcpy(msg.msg.navigate.url, "/index.html?q=1");
+
+  auto out = round_trip(msg);
+  EXPECT_STREQ(out.msg.navigate.url, "/index.html?q=1");
+}
+
+TEST_P(MsgEncoding, OutputAppMsg) {
+  html_out_msg msg{.type = HTML_OMSG_APP_MSG};
+  msg.msg.app_msg.content_length = 42;
+
+  auto out = round_trip(msg);
+  EXPECT_EQ(out.msg.app_msg.content_length, 42);
+}
+
+TEST_P(MsgEncoding, MimeMap) {
+  html_out_msg msg{.type = HTML_OMSG_MIME_MAP};
+  msg.msg.mime = html_mime_map_create();
+  ASSERT_TRUE(html_mime_map_add(msg.msg.mime, ".foo", "text/plain"));
+  ASSERT_TRUE(html_mime_map_add(msg.msg.mime, "bar", "image/png"));
+
+  auto out = round_trip(msg);
+  html_mime_map_free(msg.msg.mime);
+
+  ASSERT_EQ(html_mime_map_size(out.msg.mime), 2);
+  const char *ext, *mime;
+  ASSERT_TRUE(html_mime_map_entry_at(out.msg.mime, 1, &ext, &mime));
+  EXPECT_STREQ(ext, "bar");
+  EXPECT_STREQ(mime, "image/png");
+  html_mime_map_free(out.msg.mime);
+}
+
+TEST_P(MsgEncoding, PayloadlessOutputMessages) {
+  round_trip(html_out_msg{.type = HTML_OMSG_CLOSE});
+  round_trip(html_out_msg{.type = HTML_OMSG_ACK_UPLOADS});
+}
+
+TEST_P(MsgEncoding, AcceptIoTransfer) {
+  html_out_msg msg{.type = HTML_OMSG_ACCEPT_IO_TRANSFER};
+  std::strcpy(msg.msg.accept_io_transfer.token,
+              "0b5c5b2e-8d4f-4c2a-9a44-6f4c1d6d1d2e");
+
+  auto out = round_trip(msg);
+  EXPECT_STREQ(out.msg.accept_io_transfer.token,
+               "0b5c5b2e-8d4f-4c2a-9a44-6f4c1d6d1d2e");
+}
+
+TEST_P(MsgEncoding, UploadManifestAndBatch) {
+  html_out_msg msg{.type = HTML_OMSG_UPLOAD_MANIFEST};
+  msg.msg.upload_manifest.content_length = 300;
+  EXPECT_EQ(round_trip(msg).msg.upload_manifest.content_length, 300);
+
+  msg = html_out_msg{.type = HTML_OMSG_UPLOAD_BATCH};
+  msg.msg.upload_batch.content_length = 500;
+  EXPECT_EQ(round_trip(msg).msg.upload_batch.content_length, 500);
+}
+
+TEST_P(MsgEncoding, UploadFdLazyAndFetchFailed) {
+  html_out_msg msg{.type = HTML_OMSG_UPLOAD_FD};
+  std::strcpy(msg.msg.upload_fd.url, "/big.bin");
+  EXPECT_STREQ(round_trip(msg).msg.upload_fd.url, "/big.bin");
+
+  msg = html_out_msg{.type = HTML_OMSG_LAZY};
+  std::strcpy(msg.msg.lazy.url, "/pages/");
+  msg.msg.lazy.cache = 1;
+  auto out = round_trip(msg);
+  EXPECT_STREQ(out.msg.lazy.url, "/pages/");
+  EXPECT_EQ(out.msg.lazy.cache, 1);
+
+  msg = html_out_msg{.type = HTML_OMSG_FETCH_FAILED};
+  std::strcpy(msg.msg.fetch_failed.url, "/pages/missing.html");
+  EXPECT_STREQ(round_trip(msg).msg.fetch_failed.url, "/pages/missing.html");
+}
+
+TEST_P(MsgEncoding, Form) {
+  html_in_msg msg{.type = HTML_IMSG_FORM};
+  msg.msg.form.content_length = 17;
+  std::strcpy(msg.msg.form.mime_type, "application/x-www-form-urlencoded");
+
+  EXPECT_EQ(round_trip(msg).msg.form.content_length, 17);
+}
+
+TEST_P(MsgEncoding, InputMessages) {
+  html_in_msg msg{.type = HTML_IMSG_APP_MSG};
+  msg.msg.app_msg.content_length = 9;
+  EXPECT_EQ(round_trip(msg).msg.app_msg.content_length, 9);
+
+  msg = html_in_msg{.type = HTML_IMSG_UPLOAD_NEEDED};
+  msg.msg.upload_needed.content_length = 11;
+  EXPECT_EQ(round_trip(msg).msg.upload_needed.content_length, 11);
+
+  msg = html_in_msg{.type = HTML_IMSG_FETCH};
+  std::strcpy(msg.msg.fetch.url, "/pages/a.html");
+  EXPECT_STREQ(round_trip(msg).msg.fetch.url, "/pages/a.html");
+
+  msg = html_in_msg{.type = HTML_IMSG_ERROR};
+  std::strcpy(msg.msg.error.msg, "Invalid output message");
+  EXPECT_STREQ(round_trip(msg).msg.error.msg, "Invalid output message");
+
+  round_trip(html_in_msg{.type = HTML_IMSG_CLOSE_REQ});
+  round_trip(html_in_msg{.type = HTML_IMSG_UPLOAD_ACK});
+}
+
+TEST_P(MsgEncoding, TooSmallBufferFails) {
+  html_out_msg msg{.type = HTML_OMSG_NAVIGATE};
+  std::strcpy(msg.msg.navigate.url, "/index.html");
+
+  EXPECT_EQ(html_encode_out_msg(buf_, 8, &msg, GetParam()), -1);
+}
+
+// Binary messages are smaller. Neither encoding allocates to encode or
+// decode.
+class BinaryEncoding : public testing::Test {
+protected:
+  char buf_[HTML_MSG_SIZE];
+  html_out_msg msg_{.type = HTML_OMSG_UPLOAD};
+
+  void SetUp() override {
+    cJSON_Hooks hooks = {counting_malloc, std::free};
+    cJSON_InitHooks(&hooks);
+
+    msg_.msg.upload.content_length = 65536;
+    msg_.msg.upload.rtype = HTML_RT_FILE;
+    msg_.msg.upload.chunk_header_size = HTML_STREAM_CHUNK_HEADER_SIZE;
+    std::strcpy(msg_.msg.upload.url, "/images/logo.png");
+  }
+
+  void TearDown() override { cJSON_InitHooks(nullptr); }
+};
+
+TEST_F(BinaryEncoding, IsSmallerThanJson) {
+  int json = html_encode_out_msg(buf_, sizeof(buf_), &msg_, HTML_ENC_JSON);
+  int bin = html_encode_out_msg(buf_, sizeof(buf_), &msg_, HTML_ENC_BINARY);
+
+  ASSERT_GT(json, 0);
+  ASSERT_GT(bin, 0);
+  EXPECT_LT(bin, json / 2);
+}
+
+TEST_F(BinaryEncoding, DoesNotAllocate) {
+  for (auto enc : {HTML_ENC_JSON, HTML_ENC_BINARY}) {
+    html_out_msg out;
+    n_allocs = 0;
+    int n = html_encode_out_msg(buf_, sizeof(buf_), &msg_, enc);
+    ASSERT_TRUE(html_decode_out_msg(buf_, n, &out));
+    EXPECT_EQ(n_allocs, 0) << "encoding " << enc;
+  }
+}
+
+class BinaryDecoding : public testing::Test {
+protected:
+  std::string encode_navigate(const char *url) {
+    html_out_msg msg{.type = HTML_OMSG_NAVIGATE};
+    std::strcpy(msg.msg.navigate.url, url);
+
+    char buf[HTML_MSG_SIZE];
+    int n = html_encode_out_msg(buf, sizeof(buf), &msg, HTML_ENC_BINARY);
+    EXPECT_GT(n, 0);
+    return std::string(buf, n > 0 ? n : 0);
+  }
+
+  static bool decodes(const std::string &data) {
+    html_out_msg msg;
+    return html_decode_out_msg(data.data(), data.size(), &msg);
+  }
+};
+
+TEST_F(BinaryDecoding, RejectsTruncatedMessages) {
+  auto data = encode_navigate("/index.html");
+  for (std::size_t n = 1; n < data.size(); ++n)
+    EXPECT_FALSE(decodes(data.substr(0, n))) << n;
+}
+
+TEST_F(BinaryDecoding, RejectsTrailingBytes) {
+  EXPECT_FALSE(decodes(encode_navigate("/index.html") + '\0'));
+}
+
+TEST_F(BinaryDecoding, RejectsUnknownType) {
+  auto data = encode_navigate("/index.html");
+  data[1] = (char)200;
+  EXPECT_FALSE(decodes(data));
+}
+
+TEST_F(BinaryDecoding, RejectsEmbeddedNull) {
+  auto data = encode_navigate("/index.html");
+  data[4] = '\0';
+  EXPECT_FALSE(decodes(data));
+}
+
+TEST_F(BinaryDecoding, RejectsStringsTooLongForTheirField) {
+  std::string data{(char)HTML_BINARY_MAGIC, (char)HTML_OMSG_NAVIGATE};
+  data += (char)(HTML_URL_SIZE & 0xff);
+  data += (char)(HTML_URL_SIZE >> 8);
+  data += std::string(HTML_URL_SIZE, 'a');
+  EXPECT_FALSE(decodes(data));
+}
+
+TEST_F(BinaryDecoding, RejectsInvalidFlags) {
+  html_out_msg msg{.type = HTML_OMSG_LAZY};
+  std::strcpy(msg.msg.lazy.url, "/pages/");
+  msg.msg.lazy.cache = 1;
+
+  char buf[HTML_MSG_SIZE];
+  int n = html_encode_out_msg(buf, sizeof(buf), &msg, HTML_ENC_BINARY);
+  ASSERT_GT(n, 0);
+
+  buf[n - 1] = 2;
+  html_out_msg out;
+  EXPECT_FALSE(html_decode_out_msg(buf, n, &out));
+}
@@ -0,0 +1,76 @@
+#include <gtest/gtest.h>
+
+#include "html_forms_server/private/http_range.hpp"
+
+struct ParseRange : public testing::Test {
+protected:
+  std::vector<byte_range> ranges_;
+
+  range_status parse(const char *header, std::uint64_t size) {
+    return parse_range(header, size, ranges_);
+  }
+
+  void test(const char *header, std::uint64_t size,
+            const std::vector<byte_range> &expected) {
+    ASSERT_EQ(parse(header, size), range_status::satisfiable);
+    EXPECT_EQ(ranges_, expected);
+  }
+};
+
+TEST_F(ParseRange, SingleClosedRange) {
+  test("bytes=0-499", 1000, {{0, 500}});
+  test("bytes=500-999", 1000, {{500, 500}});
+}
+
+TEST_F(ParseRange, OpenEndedRange) { test("bytes=900-", 1000, {{900, 100}}); }
+
+TEST_F(ParseRange, SuffixRange) {
+  test("bytes=-100", 1000, {{900, 100}});
+  test("bytes=-5000", 1000, {{0, 1000}});
+}
+
+TEST_F(ParseRange, LastPositionClampedToSize) {
+  test("bytes=990-2000", 1000, {{990, 10}});
+}
+
+TEST_F(ParseRange, MultipleRangesSorted) {
+  test("bytes=500-599, 0-99", 1000, {{0, 100}, {500, 100}});
+}
+
+TEST_F(ParseRange, OverlappingRangesCoalesced) {
+  test("bytes=0-99,50-199,200-299", 1000, {{0, 300}});
+}
+
+TEST_F(ParseRange, UnsatisfiableRangesDropped) {
+  test("bytes=2000-3000,0-9", 1000, {{0, 10}});
+}
+
+TEST_F(ParseRange, NoSatisfiableRange) {
+  EXPECT_EQ(parse("bytes=1000-", 1000), range_status::unsatisfiable);
+  EXPECT_EQ(parse("bytes=-0", 1000), range_status::unsatisfiable);
+  EXPECT_EQ(parse("bytes=0-", 0), range_status::unsatisfiable);
+}
+
+TEST_F(ParseRange, MalformedHeaderIgnored) {
+  EXPECT_EQ(parse("", 1000), range_status::ignore);
+  EXPECT_EQ(parse("items=0-1", 1000), range_status::ignore);
+  EXPECT_EQ(parse("bytes=", 1000), range_status::ignore);
+  EXPECT_EQ(parse("bytes=a-b", 1000), range_status::ignore);
+  EXPECT_EQ(parse("bytes=5-1", 1000), range_status::ignore);
+  EXPECT_EQ(parse("bytes=0-1,x", 1000), range_status::ignore);
+  EXPECT_EQ(parse("bytes=10", 1000), range_status::ignore);
+}
+
+TEST_F(ParseRange, TooManyRangesIgnored) {
+  std::string header = "bytes=0-0";
+  for (int i = 1; i < 100; ++i) {
+    header += ',' + std::to_string(2 * i) + '-' + std::to_string(2 * i);
+  }
+
+  EXPECT_EQ(parse(header.c_str(), 1000), range_status::ignore);
+}
+
+TEST(ContentRange, FormatsInclusiveRange) {
+  EXPECT_EQ(content_range({0, 500}, 1234), "bytes 0-499/1234");
+  EXPECT_EQ(content_range({1233, 1}, 1234), "bytes 1233-1233/1234");
+}
@@ -0,0 +1,142 @@
+#include <gtest/gtest.h>
+
+#include "html_forms_server/private/session_table.hpp"
+
+#include <random>
+#include <thread>
+
+static session_uuid make_uuid(std::uint64_t n) {
+  session_uuid uuid{};
+  std::memcpy(uuid.data(), &n, sizeof(n));
+  return uuid;
+}
+
+TEST(SessionUuid, ParsesCanonicalForm) {
+  session_uuid uuid;
+  ASSERT_TRUE(parse_session_uuid("00112233-4455-6677-8899-aabbccddeeff", uuid));
+
+  session_uuid expected = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+                           0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff};
+  EXPECT_EQ(uuid, expected);
+}
+
+TEST(SessionUuid, CaseInsensitive) {
+  session_uuid lower, upper;
+  ASSERT_TRUE(parse_session_uuid("0a1b2c3d-4e5f-6a7b-8c9d-aebfcadbecfd", lower));
+  ASSERT_TRUE(parse_session_uuid("0A1B2C3D-4E5F-6A7B-8C9D-AEBFCADBECFD", upper));
+  EXPECT_EQ(lower, upper);
+}
+
+TEST(SessionUuid, LowercasesIds) {
+  EXPECT_EQ(lowercase_session_id("0A1B2C3D-4E5F-6A7B-8C9D-AEBFCADBECFD"),
+            "0a1b2c3d-4e5f-6a7b-8c9d-aebfcadbecfd");
+}
+
+TEST(SessionUuid, RejectsInvalid) {
+  session_uuid uuid;
+  EXPECT_FALSE(parse_session_uuid("", uuid));
+  EXPECT_FALSE(parse_session_uuid("html", uuid));
+  EXPECT_FALSE(parse_session_uuid("00112233-4455-6677-8899-aabbccddeef", uuid));
+  EXPECT_FALSE(
+      parse_session_uuid("00112233-4455-6677-8899-aabbccddeeff0", uuid));
+  EXPECT_FALSE(parse_session_uuid("00112233_4455-6677-8899-aabbccddeeff", uuid));
+  EXPECT_FALSE(parse_session_uuid("0011223g-4455-6677-8899-aabbccddeeff", uuid));
+}
+
+TEST(SessionTable, InsertFindErase) {
+  session_table<int> table;
+  int v;
+
+  EXPECT_FALSE(table.find(make_uuid(1), v));
+  EXPECT_FALSE(table.erase(make_uuid(1)));
+
+  EXPECT_TRUE(table.insert(make_uuid(1), 10));
+  EXPECT_FALSE(table.insert(make_uuid(1), 20));
+  ASSERT_TRUE(table.find(make_uuid(1), v));
+  EXPECT_EQ(v, 10);
+  EXPECT_EQ(table.size(), 1);
+
+  EXPECT_TRUE(table.erase(make_uuid(1)));
+  EXPECT_FALSE(table.find(make_uuid(1), v));
+  EXPECT_TRUE(table.empty());
+
+  EXPECT_TRUE(table.insert(make_uuid(1), 30));
+  ASSERT_TRUE(table.find(make_uuid(1), v));
+  EXPECT_EQ(v, 30);
+}
+
+// Scale check standing in for a benchmark: 10, 1k, and 100k sessions
+class SessionTableScale : public testing::TestWithParam<int> {};
+
+TEST_P(SessionTableScale, ManySessions) {
+  int n = GetParam();
+  session_table<int> table;
+
+  std::mt19937_64 rng{1234};
+  std::vector<session_uuid> keys;
+  for (int i = 0; i < n; ++i) {
+    session_uuid uuid;
+    for (auto &b : uuid)
+      b = static_cast<std::uint8_t>(rng());
+
+    keys.push_back(uuid);
+    ASSERT_TRUE(table.insert(uuid, i));
+  }
+
+  EXPECT_EQ(table.size(), n);
+
+  // erase every other key, leaving tombstones along probe chains
+  for (int i = 0; i < n; i += 2)
+    ASSERT_TRUE(table.erase(keys[i]));
+
+  for (int i = 0; i < n; ++i) {
+    int v;
+    if (i % 2 == 0) {
+      EXPECT_FALSE(table.find(keys[i], v));
+    } else {
+      ASSERT_TRUE(table.find(keys[i], v));
+      EXPECT_EQ(v, i);
+    }
+  }
+
+  // reinsert, reusing tombstones
+  for (int i = 0; i < n; i += 2)
+    ASSERT_TRUE(table.insert(keys[i], -i));
+
+  EXPECT_EQ(table.size(), n);
+}
+
+INSTANTIATE_TEST_SUITE_P(Sizes, SessionTableScale,
+                         testing::Values(10, 1000, 100000));
+
+TEST(SessionTable, ChurnDoesNotFillWithTombstones) {
+  session_table<int> table;
+  for (std::uint64_t i = 0; i < 100000; ++i) {
+    ASSERT_TRUE(table.insert(make_uuid(i), 0));
+    ASSERT_TRUE(table.erase(make_uuid(i)));
+  }
+
+  EXPECT_TRUE(table.empty());
+}
+
+TEST(SessionTable, ConcurrentAccess) {
+  session_table<int> table;
+  std::vector<std::thread> threads;
+
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&table, t] {
+      for (int i = 0; i < 10000; ++i) {
+        auto key = make_uuid((std::uint64_t(t) << 32) | i);
+        table.insert(key, i);
+        int v;
+        EXPECT_TRUE(table.find(key, v));
+        EXPECT_EQ(v, i);
+      }
+    });
+  }
+
+  for (auto &th : threads)
+    th.join();
+
+  EXPECT_EQ(table.size(), 40000);
+}
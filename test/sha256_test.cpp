@@ -0,0 +1,53 @@
+#include <gtest/gtest.h>
+
+#include "html_forms/private/sha256.h"
+#include <string>
+#include <string_view>
+
+static std::string sha256_hex(const std::string_view &data,
+                              std::size_t chunk_size = 0) {
+  html_sha256_ctx ctx;
+  html_sha256_init(&ctx);
+
+  if (chunk_size == 0)
+    chunk_size = data.size() ? data.size() : 1;
+
+  for (std::size_t i = 0; i < data.size(); i += chunk_size) {
+    auto n = std::min(chunk_size, data.size() - i);
+    html_sha256_update(&ctx, data.data() + i, n);
+  }
+
+  std::uint8_t digest[HTML_SHA256_SIZE];
+  html_sha256_final(&ctx, digest);
+
+  char hex[HTML_SHA256_HEX_SIZE];
+  html_sha256_hex(digest, hex);
+  return hex;
+}
+
+TEST(Sha256, EmptyString) {
+  EXPECT_EQ(sha256_hex(""),
+            "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+}
+
+TEST(Sha256, Abc) {
+  EXPECT_EQ(sha256_hex("abc"),
+            "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+}
+
+TEST(Sha256, TwoBlockMessage) {
+  EXPECT_EQ(
+      sha256_hex("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"),
+      "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+}
+
+TEST(Sha256, MillionAsInUnevenChunks) {
+  std::string data(1000000, 'a');
+  auto expected =
+      "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0";
+
+  EXPECT_EQ(sha256_hex(data), expected);
+  EXPECT_EQ(sha256_hex(data, 7), expected);
+  EXPECT_EQ(sha256_hex(data, 64), expected);
+  EXPECT_EQ(sha256_hex(data, 1000), expected);
+}
@@ -0,0 +1,173 @@
+#include <gtest/gtest.h>
+
+#include "html_forms_server/private/tar_index.hpp"
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include <map>
+#include <random>
+#include <string>
+
+using file_map = std::map<std::string, std::string>;
+
+static std::string make_tar(int format, const file_map &files) {
+  std::string out;
+  out.resize(4 * 1024 * 1024);
+  std::size_t used = 0;
+
+  auto a = archive_write_new();
+  archive_write_set_format(a, format);
+  archive_write_open_memory(a, out.data(), out.size(), &used);
+
+  // a directory and symlink among the files have no indexed contents
+  auto dir = archive_entry_new();
+  archive_entry_set_pathname(dir, "dir/");
+  archive_entry_set_filetype(dir, AE_IFDIR);
+  archive_entry_set_perm(dir, 0755);
+  archive_write_header(a, dir);
+  archive_entry_free(dir);
+
+  auto link = archive_entry_new();
+  archive_entry_set_pathname(link, "link");
+  archive_entry_set_filetype(link, AE_IFLNK);
+  archive_entry_set_symlink(link, "index.html");
+  archive_entry_set_perm(link, 0777);
+  archive_write_header(a, link);
+  archive_entry_free(link);
+
+  for (const auto &[name, contents] : files) {
+    auto entry = archive_entry_new();
+    archive_entry_set_pathname(entry, name.c_str());
+    archive_entry_set_size(entry, contents.size());
+    archive_entry_set_filetype(entry, AE_IFREG);
+    archive_entry_set_perm(entry, 0644);
+    archive_write_header(a, entry);
+    archive_write_data(a, contents.data(), contents.size());
+    archive_entry_free(entry);
+  }
+
+  archive_write_close(a);
+  archive_write_free(a);
+  out.resize(used);
+  return out;
+}
+
+static std::span<const std::uint8_t> bytes(std::string_view s) {
+  return {reinterpret_cast<const std::uint8_t *>(s.data()), s.size()};
+}
+
+static std::array<std::uint8_t, HTML_SHA256_SIZE> sha256(std::string_view s) {
+  std::array<std::uint8_t, HTML_SHA256_SIZE> digest;
+  html_sha256_ctx ctx;
+  html_sha256_init(&ctx);
+  html_sha256_update(&ctx, s.data(), s.size());
+  html_sha256_final(&ctx, digest.data());
+  return digest;
+}
+
+static file_map test_files() {
+  file_map files;
+  files["index.html"] = "<h1>hello</h1>";
+  files["empty.txt"] = "";
+  files["exact.bin"] = std::string(512, 'x');
+
+  // too long for the ustar name field, but fits with the prefix
+  files[std::string(120, 'p') + "/style.css"] = "body { color: red; }";
+
+  for (int i = 0; i < 5000; ++i)
+    files["docs/big.txt"] += std::to_string(i) + '\n';
+
+  return files;
+}
+
+// Feed a tar in random sized chunks, checking each entry against the
+// archive itself
+static void expect_indexed(const std::string &tar, const file_map &files,
+                           unsigned seed) {
+  std::mt19937 rng{seed};
+  std::uniform_int_distribution<std::size_t> chunk_size{1, 2000};
+
+  tar_indexer indexer;
+  std::vector<tar_entry> entries;
+  std::size_t i = 0;
+  while (i < tar.size()) {
+    auto n = std::min(chunk_size(rng), tar.size() - i);
+    ASSERT_TRUE(indexer.feed(bytes(tar).subspan(i, n), entries));
+    i += n;
+  }
+
+  EXPECT_TRUE(indexer.done());
+
+  file_map indexed;
+  for (const auto &entry : entries) {
+    ASSERT_LE(entry.offset + entry.size, tar.size());
+    auto contents = tar.substr(entry.offset, entry.size);
+    EXPECT_EQ(entry.sha256, sha256(contents)) << entry.pathname;
+    indexed[entry.pathname] = contents;
+  }
+
+  EXPECT_EQ(indexed, files);
+}
+
+TEST(TarIndex, IndexesUstar) {
+  auto files = test_files();
+  auto tar = make_tar(ARCHIVE_FORMAT_TAR_USTAR, files);
+  ASSERT_TRUE(is_tar_header(bytes(tar)));
+
+  for (unsigned seed = 0; seed < 10; ++seed)
+    expect_indexed(tar, files, seed);
+}
+
+TEST(TarIndex, IndexesGnuLongNames) {
+  auto files = test_files();
+  files[std::string(300, 'g') + ".txt"] = "long gnu name";
+
+  auto tar = make_tar(ARCHIVE_FORMAT_TAR_GNUTAR, files);
+  ASSERT_TRUE(is_tar_header(bytes(tar)));
+
+  for (unsigned seed = 0; seed < 10; ++seed)
+    expect_indexed(tar, files, seed);
+}
+
+TEST(TarIndex, IndexesPaxPaths) {
+  auto files = test_files();
+  files[std::string(300, 'x') + ".txt"] = "long pax name";
+
+  auto tar = make_tar(ARCHIVE_FORMAT_TAR_PAX_RESTRICTED, files);
+  ASSERT_TRUE(is_tar_header(bytes(tar)));
+
+  for (unsigned seed = 0; seed < 10; ++seed)
+    expect_indexed(tar, files, seed);
+}
+
+TEST(TarIndex, CompressedArchiveIsNotTar) {
+  std::string gz = "\x1f\x8b\x08";
+  gz.resize(tar_block_size);
+  EXPECT_FALSE(is_tar_header(bytes(gz)));
+}
+
+TEST(TarIndex, ShortDataIsNotTar) {
+  auto tar = make_tar(ARCHIVE_FORMAT_TAR_USTAR, test_files());
+  EXPECT_FALSE(is_tar_header(bytes(tar).first(tar_block_size - 1)));
+}
+
+TEST(TarIndex, BadChecksumFails) {
+  auto tar = make_tar(ARCHIVE_FORMAT_TAR_USTAR, test_files());
+  tar[0] ^= 1;
+  EXPECT_FALSE(is_tar_header(bytes(tar)));
+
+  tar_indexer indexer;
+  std::vector<tar_entry> entries;
+  EXPECT_FALSE(indexer.feed(bytes(tar), entries));
+  EXPECT_FALSE(indexer.done());
+}
+
+TEST(TarIndex, TruncatedArchiveIsNotDone) {
+  auto tar = make_tar(ARCHIVE_FORMAT_TAR_USTAR, test_files());
+
+  tar_indexer indexer;
+  std::vector<tar_entry> entries;
+  EXPECT_TRUE(indexer.feed(bytes(tar).first(4 * tar_block_size), entries));
+  EXPECT_FALSE(indexer.done());
+}
@@ -240,9 +240,10 @@ int main(int argc, char **argv) {
       NOPE("Only com.gulachek.html-forms is a supported protocol")
     }
 
-    if (!(req.version.major == 0 && req.version.minor == 1 &&
-          req.version.patch >= 0)) {
-      NOPE("Version is not compatible with com.gulachek.html-forms 0.1.0")
+    // 0.2.0 added binary encoded messages
+    if (!(req.version.major == 0 &&
+          (req.version.minor == 1 || req.version.minor == 2))) {
+      NOPE("Version is not compatible with com.gulachek.html-forms 0.2.0")
     }
 
     catui_server_ack(con, stderr);
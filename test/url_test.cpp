@@ -2,14 +2,32 @@
 
 #include "html_forms_server/private/parse_target.hpp"
 
+#include <random>
+
 struct ParseTargetUrl : public testing::Test {
 protected:
   char session_id_[128];
   char target_path_[256];
 
+  // the string_view overload must agree with the original
   int parse(const char *target) {
-    return parse_target(target, session_id_, sizeof(session_id_), target_path_,
-                        sizeof(target_path_));
+    int ret = parse_target(target, session_id_, sizeof(session_id_),
+                           target_path_, sizeof(target_path_));
+
+    char sv_path[sizeof(target_path_)];
+    std::string_view sv_session_id;
+    std::size_t sv_path_n;
+    int sv_ret = parse_target(std::string_view{target}, sv_session_id,
+                              sv_path, sizeof(sv_path), sv_path_n);
+
+    EXPECT_EQ(ret, sv_ret) << target;
+    if (ret && sv_ret) {
+      EXPECT_EQ(sv_session_id, session_id_);
+      EXPECT_EQ(std::string_view(sv_path, sv_path_n), target_path_);
+      EXPECT_EQ(sv_path[sv_path_n], '\0');
+    }
+
+    return ret;
   }
 
   void test(const char *target, const std::string_view &session_id,
@@ -96,3 +114,47 @@ TEST_F(ParseTargetUrl, ReservedCharsNotFound) {
   EXPECT_FALSE(parse("/sid/bar+.txt"));   // TODO support escape
   EXPECT_FALSE(parse("/sid/bar/hello@ampersand/bar.txt"));
 }
+
+TEST_F(ParseTargetUrl, StringViewNeedsNoNullTerminator) {
+  std::string_view target{"/sid/foo/bar.txtGARBAGE", 16};
+  std::string_view session_id;
+  std::size_t n;
+  ASSERT_TRUE(parse_target(target, session_id, target_path_,
+                           sizeof(target_path_), n));
+  EXPECT_EQ(session_id, "sid");
+  EXPECT_EQ(std::string_view(target_path_, n), "/foo/bar.txt");
+}
+
+// Differential test of both overloads on random targets built from the
+// characters that matter to normalization, including small path buffers
+TEST(ParseTargetFuzz, StringViewMatchesOriginal) {
+  constexpr std::string_view alphabet = "//////....~~ab@%+x";
+  std::mt19937 rng{42};
+  std::uniform_int_distribution<std::size_t> pick{0, alphabet.size() - 1};
+  std::uniform_int_distribution<std::size_t> length{0, 40};
+  std::uniform_int_distribution<std::size_t> path_len{1, 48};
+
+  char session_id[64];
+  char path[64], sv_path[64];
+
+  for (int i = 0; i < 200000; ++i) {
+    std::string target;
+    auto n = length(rng);
+    for (std::size_t j = 0; j < n; ++j)
+      target += alphabet[pick(rng)];
+
+    auto len = path_len(rng);
+    int ret = parse_target(target.c_str(), session_id, sizeof(session_id),
+                           path, len);
+
+    std::string_view sv_session_id;
+    std::size_t sv_n;
+    int sv_ret = parse_target(target, sv_session_id, sv_path, len, sv_n);
+
+    ASSERT_EQ(ret, sv_ret) << target << " (buffer " << len << ")";
+    if (ret) {
+      ASSERT_EQ(sv_session_id, session_id) << target;
+      ASSERT_EQ(std::string_view(sv_path, sv_n), path) << target;
+    }
+  }
+}